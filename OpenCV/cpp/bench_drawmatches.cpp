@@ -0,0 +1,138 @@
+// drawMatches against drawMatchesParallel for growing numbers of matches
+// Author: Paul Foster
+// Copyright: Public domain, or CC0 if that is not possible
+//
+// build and run with:
+//   g++ -O2 -o bench_drawmatches bench_drawmatches.cpp ocvdebugutils.cpp `pkg-config --cflags --libs opencv4`
+//       && ./bench_drawmatches drawmatches.json
+// The JSON argument is optional, it gets the times in the format of c/bench.c, with the match
+// and thread counts added. Every run is one draw, so iters is 1, and no run is dropped as an outlier.
+//
+// Both draw on two 1920x1080 gray images, as debugDisplayMatches() does, with as many keypoints
+// on each side as there are matches and a quarter of the matches masked out. The canvas is kept
+// between runs, so only the drawing is timed. Each time is the median of REPS runs after one to
+// warm up, and drawMatches is skipped once a run of it takes more than SLOW_MS.
+
+#include "opencv2/core.hpp"
+#include "opencv2/features2d.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "ocvdebugutils.h"
+
+using namespace cv;
+
+static const int matchCounts[] = { 1000, 4000, 16000, 64000, 256000, 1024000 };
+static const int REPS = 7;
+static const double SLOW_MS = 2000;
+
+struct Result
+{
+    std::string name;
+    int matches;
+    double median, mad, min, max;   // ns
+    int reps;
+};
+
+struct Scene
+{
+    Mat img1, img2;
+    std::vector<KeyPoint> keypoints1, keypoints2;
+    std::vector<DMatch> matches;
+    std::vector<char> mask;
+};
+
+static void makeScene( Scene& s, int n )
+{
+    RNG rng( 12345 );
+    s.img1.create( 1080, 1920, CV_8UC1 );
+    s.img2.create( 1080, 1920, CV_8UC1 );
+    rng.fill( s.img1, RNG::UNIFORM, 0, 256 );
+    rng.fill( s.img2, RNG::UNIFORM, 0, 256 );
+    s.keypoints1.resize( n );
+    s.keypoints2.resize( n );
+    s.matches.resize( n );
+    s.mask.resize( n );
+    for( int i = 0; i < n; i++ )
+    {
+        s.keypoints1[i] = KeyPoint( Point2f(rng.uniform(0.f, 1920.f), rng.uniform(0.f, 1080.f)), 7 );
+        // roughly where it was, like a real pair of frames
+        Point2f p = s.keypoints1[i].pt + Point2f( rng.uniform(-60.f, 60.f), rng.uniform(-40.f, 40.f) );
+        s.keypoints2[i] = KeyPoint( Point2f(std::min(std::max(p.x, 0.f), 1919.f), std::min(std::max(p.y, 0.f), 1079.f)), 7 );
+        s.matches[i] = DMatch( i, i, rng.uniform(0.f, 256.f) );
+        s.mask[i] = rng.uniform( 0, 4 ) != 0;
+    }
+}
+
+template<class Draw> static Result timeIt( const char* name, int n, Draw draw )
+{
+    std::vector<double> t;
+    draw();
+    for( int r = 0; r < REPS; r++ )
+    {
+        int64 start = getTickCount();
+        draw();
+        t.push_back( (getTickCount() - start) * 1e9 / getTickFrequency() );
+        if( t.back() > SLOW_MS * 1e6 )
+            break;
+    }
+    std::sort( t.begin(), t.end() );
+    std::vector<double> dev;
+    for( size_t i = 0; i < t.size(); i++ )
+        dev.push_back( std::abs(t[i] - t[t.size() / 2]) );
+    std::sort( dev.begin(), dev.end() );
+    Result res = { name, n, t[t.size() / 2], dev[dev.size() / 2], t.front(), t.back(), (int)t.size() };
+    printf( "%-22s %8d matches %10.2f ms  [%.2f, %.2f]  %d reps\n", name, n,
+            res.median / 1e6, res.min / 1e6, res.max / 1e6, (int)t.size() );
+    return res;
+}
+
+int main( int argc, char** argv )
+{
+    std::vector<Result> results;
+    bool slow = false;
+    Mat out;
+    printf( "%d threads\n", getNumThreads() );
+    for( size_t c = 0; c < sizeof(matchCounts) / sizeof(matchCounts[0]); c++ )
+    {
+        Scene s;
+        const int n = matchCounts[c];
+        makeScene( s, n );
+        if( !slow )
+        {
+            results.push_back( timeIt("drawMatches", n, [&]{
+                drawMatches( s.img1, s.keypoints1, s.img2, s.keypoints2, s.matches, out,
+                             Scalar::all(-1), Scalar::all(-1), s.mask );
+            }) );
+            slow = results.back().max > SLOW_MS * 1e6;
+        }
+        results.push_back( timeIt("drawMatchesParallel", n, [&]{
+            drawMatchesParallel( s.img1, s.keypoints1, s.img2, s.keypoints2, s.matches, out,
+                                 Scalar::all(-1), Scalar::all(-1), s.mask );
+        }) );
+        if( results.size() >= 2 && results[results.size() - 2].matches == n )
+            printf( "%-22s %8d matches %10.1fx\n", "speedup", n,
+                    results[results.size() - 2].median / results.back().median );
+    }
+
+    if( argc > 1 )
+    {
+        FILE* f = fopen( argv[1], "w" );
+        if( !f )
+        {
+            perror( argv[1] );
+            return 1;
+        }
+        fprintf( f, "[\n" );
+        for( size_t i = 0; i < results.size(); i++ )
+            fprintf( f, "  {\"name\":\"%s %d\",\"median_ns\":%.4f,\"mad_ns\":%.4f,\"min_ns\":%.4f,\"max_ns\":%.4f,"
+                        "\"iters\":1,\"reps\":%d,\"outliers\":0,\"matches\":%d,\"threads\":%d}%s\n",
+                     results[i].name.c_str(), results[i].matches, results[i].median, results[i].mad, results[i].min,
+                     results[i].max, results[i].reps, results[i].matches, getNumThreads(), i + 1 < results.size() ? "," : "" );
+        fprintf( f, "]\n" );
+        fclose( f );
+    }
+    return 0;
+}
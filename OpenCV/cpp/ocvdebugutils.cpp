@@ -1,8 +1,1140 @@
 #include "opencv2/features2d.hpp" //drawMatches
 #include "opencv2/highgui.hpp" //imshow
 #include "opencv2/imgproc.hpp" //cvtColor
+#include "opencv2/videoio.hpp" //VideoWriter
 #include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic> //the frame queue
+#include <memory>
+#include <thread> //the viewer and the recorder
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map> //the LOD view's thinning
+#include <unordered_set>
+#include "ocvdebugutils.h"
 namespace cv{
+namespace{
+
+// Everything debugDisplayMatches() draws from, copied so the caller can reuse its buffers
+struct DebugMatchFrame
+{
+    Mat img1, img2;
+    std::vector<KeyPoint> keypoints1, keypoints2;
+    std::vector<DMatch> matches1to2;
+    Scalar matchColor, singlePointColor;
+    std::vector<char> matchesMask;
+    int flags;
+};
+
+// Bounded multi-producer multi-consumer queue of pointers, lock-free: every cell has a sequence
+// number that says whether it is free for the push at that position or full for the pop at it.
+// Whatever is left in it when it goes away is deleted.
+template<class T> class DebugQueue
+{
+public:
+    explicit DebugQueue( size_t size )
+    {
+        size_t n = 1;
+        while( n < size )
+            n *= 2;
+        mask = n - 1;
+        cells.reset( new Cell[n] );
+        for( size_t i = 0; i < n; i++ )
+        {
+            cells[i].seq.store( i, std::memory_order_relaxed );
+            cells[i].frame = NULL;
+        }
+        head.store( 0, std::memory_order_relaxed );
+        tail.store( 0, std::memory_order_relaxed );
+    }
+
+    ~DebugQueue()
+    {
+        while( T* f = pop() )
+            delete f;
+    }
+
+    // false if the queue is full
+    bool push( T* f )
+    {
+        size_t pos = tail.load( std::memory_order_relaxed );
+        for(;;)
+        {
+            Cell& c = cells[pos & mask];
+            size_t seq = c.seq.load( std::memory_order_acquire );
+            if( seq == pos )
+            {
+                if( tail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                {
+                    c.frame = f;
+                    c.seq.store( pos + 1, std::memory_order_release );
+                    return true;
+                }
+            }
+            else if( (ptrdiff_t)(seq - pos) < 0 )
+                return false;
+            else
+                pos = tail.load( std::memory_order_relaxed );
+        }
+    }
+
+    // NULL if the queue is empty
+    T* pop()
+    {
+        size_t pos = head.load( std::memory_order_relaxed );
+        for(;;)
+        {
+            Cell& c = cells[pos & mask];
+            size_t seq = c.seq.load( std::memory_order_acquire );
+            if( seq == pos + 1 )
+            {
+                if( head.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                {
+                    T* f = c.frame;
+                    c.seq.store( pos + mask + 1, std::memory_order_release );
+                    return f;
+                }
+            }
+            else if( (ptrdiff_t)(seq - (pos + 1)) < 0 )
+                return NULL;
+            else
+                pos = head.load( std::memory_order_relaxed );
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T*                  frame;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    std::atomic<size_t> head, tail;
+};
+
+// Rows per band of drawMatchesParallel(). The lines mostly run across from one image to the
+// other, so few of them cross more than a band or two.
+const int MATCH_BAND_ROWS = 32;
+
+// The circles drawMatches puts around the keypoints, radius 3: for dy = -3..3, the pixels with
+// ringInner[dy+3] <= |dx| <= ringOuter[dy+3]
+const int RING_RADIUS = 3;
+const int ringInner[2*RING_RADIUS + 1] = { 0, 2, 3, 3, 3, 2, 0 };
+const int ringOuter[2*RING_RADIUS + 1] = { 1, 2, 3, 3, 3, 2, 1 };
+
+// BGR for a distance scaled to 0..255, blue through green to red
+struct DistanceColormap
+{
+    uchar bgr[256][3];
+
+    DistanceColormap()
+    {
+        for( int i = 0; i < 256; i++ )
+        {
+            bgr[i][0] = saturate_cast<uchar>( 255 - 2*i );
+            bgr[i][1] = saturate_cast<uchar>( 255 - std::abs(2*i - 255) );
+            bgr[i][2] = saturate_cast<uchar>( 2*i - 255 );
+        }
+    }
+};
+
+// The colors of the first n distances, by where they are between the smallest and the largest.
+// convertTo does the scaling to 0..255, which saturates and is vectorized.
+void distanceColors( std::vector<float>& distances, int n, std::vector<Vec3b>& colors )
+{
+    static const DistanceColormap colormap;
+    if( n <= 0 )
+        return;
+    Mat d( 1, n, CV_32F, &distances[0] ), levels;
+    double dmin, dmax;
+    minMaxLoc( d, &dmin, &dmax );
+    const double scale = dmax > dmin ? 255. / (dmax - dmin) : 0.;
+    d.convertTo( levels, CV_8U, scale, -dmin * scale );
+    const uchar* level = levels.ptr();
+    for( int k = 0; k < n; k++ )
+        colors[k] = Vec3b( colormap.bgr[level[k]][0], colormap.bgr[level[k]][1], colormap.bgr[level[k]][2] );
+}
+
+// drawMatches picks random colors for the keypoints, these are scattered but stay put between frames
+Vec3b keypointColor( int i, const Scalar& singlePointColor )
+{
+    if( !(singlePointColor == Scalar::all(-1)) )
+        return Vec3b( (uchar)singlePointColor[0], (uchar)singlePointColor[1], (uchar)singlePointColor[2] );
+    unsigned h = (unsigned)i * 2654435761u;
+    return Vec3b( (uchar)(h >> 8), (uchar)(h >> 16), (uchar)(h >> 24) );
+}
+
+// The items touching each band, band b's in items[offsets[b]] .. items[offsets[b+1]-1] in the
+// order they were given. An item spanning several bands is in each of them.
+struct BandBins
+{
+    std::vector<int> offsets, items;
+
+    // top and bottom are the first and last rows of every item, not necessarily on the canvas
+    void build( const std::vector<int>& top, const std::vector<int>& bottom, int nbands )
+    {
+        const int n = (int)top.size();
+        std::vector<int> first( n ), last( n );
+        offsets.assign( nbands + 1, 0 );
+        for( int i = 0; i < n; i++ )
+        {
+            first[i] = std::min( std::max( top[i], 0 ) / MATCH_BAND_ROWS, nbands - 1 );
+            last[i] = std::min( std::max( bottom[i], 0 ) / MATCH_BAND_ROWS, nbands - 1 );
+            for( int b = first[i]; b <= last[i]; b++ )
+                offsets[b + 1]++;
+        }
+        for( int b = 0; b < nbands; b++ )
+            offsets[b + 1] += offsets[b];
+        items.resize( offsets[nbands] );
+        std::vector<int> fill( offsets.begin(), offsets.end() - 1 );
+        for( int i = 0; i < n; i++ )
+            for( int b = first[i]; b <= last[i]; b++ )
+                items[fill[b]++] = i;
+    }
+};
+
+// The rows y0..y1-1 of a 1 pixel line from a to b: each row gets the run of pixels the line
+// covers between its upper and lower edge, so the line stays connected however steep it is, and
+// a row comes out the same whichever band draws it.
+void drawSegmentRows( Mat& canvas, int y0, int y1, Point2f a, Point2f b, const uchar* color )
+{
+    if( a.y > b.y )
+        std::swap( a, b );
+    const float dy = b.y - a.y;
+    const bool flat = dy < 1e-6f;
+    const float dxdy = flat ? 0.f : (b.x - a.x) / dy;
+    const int r0 = std::max( y0, cvRound(a.y) ), r1 = std::min( y1 - 1, cvRound(b.y) );
+    for( int r = r0; r <= r1; r++ )
+    {
+        float ya = std::max( a.y, r - 0.5f ), yb = std::min( b.y, r + 0.5f );
+        float xa = flat ? a.x : a.x + (ya - a.y) * dxdy, xb = flat ? b.x : a.x + (yb - a.y) * dxdy;
+        if( xa > xb )
+            std::swap( xa, xb );
+        // clamped before rounding, the keypoints can be anywhere
+        int x0 = cvRound( std::max(xa, -1.f) ), x1 = cvRound( std::min(xb, (float)canvas.cols) );
+        x0 = std::max( x0, 0 );
+        x1 = std::min( x1, canvas.cols - 1 );
+        uchar* p = canvas.ptr(r) + 3*x0;
+        for( int x = x0; x <= x1; x++, p += 3 )
+        {
+            p[0] = color[0];
+            p[1] = color[1];
+            p[2] = color[2];
+        }
+    }
+}
+
+// The rows y0..y1-1 of a keypoint circle
+void drawRingRows( Mat& canvas, int y0, int y1, Point2f c, const uchar* color )
+{
+    const int cx = cvRound( c.x ), cy = cvRound( c.y );
+    if( cx < -RING_RADIUS || cx >= canvas.cols + RING_RADIUS )
+        return;
+    const int r0 = std::max( y0, cy - RING_RADIUS ), r1 = std::min( y1 - 1, cy + RING_RADIUS );
+    for( int r = r0; r <= r1; r++ )
+    {
+        const int inner = ringInner[r - cy + RING_RADIUS], outer = ringOuter[r - cy + RING_RADIUS];
+        uchar* row = canvas.ptr(r);
+        for( int dx = -outer; dx <= outer; dx++ )
+        {
+            const int x = cx + dx;
+            if( std::abs(dx) >= inner && x >= 0 && x < canvas.cols )
+            {
+                row[3*x] = color[0];
+                row[3*x + 1] = color[1];
+                row[3*x + 2] = color[2];
+            }
+        }
+    }
+}
+
+// One parallel_for_ range of bands of drawMatchesParallel(). Every band is drawn by one call,
+// single points first and then the matches in order, so the picture doesn't depend on how the
+// bands are split between threads.
+class MatchBandRenderer : public ParallelLoopBody
+{
+public:
+    MatchBandRenderer( const Mat& canvas, const std::vector<Point2f>& points, const std::vector<Vec3b>& pointColors,
+                       const BandBins& pointBins, const std::vector<Point2f>& from, const std::vector<Point2f>& to,
+                       const std::vector<Vec3b>& lineColors, const BandBins& lineBins )
+        : canvas( canvas ), points( points ), pointColors( pointColors ), pointBins( pointBins ),
+          from( from ), to( to ), lineColors( lineColors ), lineBins( lineBins )
+    {
+    }
+
+    void operator()( const Range& bands ) const
+    {
+        Mat img = canvas;
+        for( int b = bands.start; b < bands.end; b++ )
+        {
+            const int y0 = b * MATCH_BAND_ROWS, y1 = std::min( img.rows, y0 + MATCH_BAND_ROWS );
+            for( int k = pointBins.offsets[b]; k < pointBins.offsets[b + 1]; k++ )
+            {
+                const int i = pointBins.items[k];
+                drawRingRows( img, y0, y1, points[i], &pointColors[i][0] );
+            }
+            for( int k = lineBins.offsets[b]; k < lineBins.offsets[b + 1]; k++ )
+            {
+                const int i = lineBins.items[k];
+                const uchar* color = &lineColors[i][0];
+                drawRingRows( img, y0, y1, from[i], color );
+                drawRingRows( img, y0, y1, to[i], color );
+                drawSegmentRows( img, y0, y1, from[i], to[i], color );
+            }
+        }
+    }
+
+private:
+    Mat canvas;
+    const std::vector<Point2f>& points;
+    const std::vector<Vec3b>& pointColors;
+    const BandBins& pointBins;
+    const std::vector<Point2f>& from;
+    const std::vector<Point2f>& to;
+    const std::vector<Vec3b>& lineColors;
+    const BandBins& lineBins;
+};
+
+// One side of the canvas, in color
+void copyToBgr( const Mat& img, Mat dst )
+{
+    if( img.channels() == 1 )
+        cvtColor( img, dst, cv::COLOR_GRAY2BGR );
+    else if( img.channels() == 4 )
+        cvtColor( img, dst, cv::COLOR_BGRA2BGR );
+    else
+        img.copyTo( dst );
+}
+
+// From how many matches up renderMatches() draws with drawMatchesParallel, 0 for never
+std::atomic<size_t> parallelMatches( 0 );
+
+// drawMatches on gray copies, so the colored lines stand out, and drawMatchesParallel for the big
+// sets once that is turned on, unless rich keypoints were asked for, which it can't draw. The
+// buffers are reused when the sizes don't change.
+void renderMatches( const Mat& img1, const std::vector<KeyPoint>& keypoints1,
+                           const Mat& img2, const std::vector<KeyPoint>& keypoints2,
+                           const std::vector<DMatch>& matches1to2, Mat& i1g, Mat& i2g, Mat& matchImage,
+                           const Scalar& matchColor, const Scalar& singlePointColor,
+                           const std::vector<char>& matchesMask, int flags )
+{
+    cvtColor(img1, i1g, cv::COLOR_BGR2GRAY);
+    cvtColor(img2, i2g, cv::COLOR_BGR2GRAY);
+    size_t parallel = parallelMatches.load( std::memory_order_relaxed );
+    if( parallel && matches1to2.size() >= parallel && !(flags & DrawMatchesFlags::DRAW_RICH_KEYPOINTS) )
+        drawMatchesParallel(i1g, keypoints1, i2g, keypoints2, matches1to2, matchImage, matchColor, singlePointColor, matchesMask, flags);
+    else
+        drawMatches(i1g, keypoints1, i2g, keypoints2, matches1to2, matchImage, matchColor, singlePointColor, matchesMask, flags);
+}
+
+// An image's part of a LOD tile, gray like renderMatches' backdrop
+void toGrayBgr( const Mat& src, Mat dst )
+{
+    if( src.channels() == 1 )
+        cvtColor( src, dst, cv::COLOR_GRAY2BGR );
+    else
+    {
+        Mat gray;
+        cvtColor( src, gray, cv::COLOR_BGR2GRAY );
+        cvtColor( gray, dst, cv::COLOR_GRAY2BGR );
+    }
+}
+
+// Screen pixels per LOD tile side, and the cells the matches are thinned by: at most
+// LOD_CELL_MATCHES matches end in a cell of LOD_CELL pixels, and one keypoint is drawn per
+// LOD_POINT_CELL pixels. Lines that start and end elsewhere can still pile up in a tile, so it
+// draws the best LOD_TILE_MATCHES of the ones through it.
+const int LOD_TILE = 256;
+const int LOD_CELL = 16;
+const int LOD_CELL_MATCHES = 2;
+const int LOD_POINT_CELL = 8;
+const int LOD_TILE_MATCHES = 512;
+
+// The level of detail display. The two images are never put side by side at full resolution:
+// each gets a gray pyramid of halves down to the screen size, built once per frame, and the view
+// is put together from tiles of the screen's resolution, drawn from the nearest level that is at
+// least as sharp and kept in a small cache while the view pans. Zoom level 0 fits the whole
+// picture on the screen, and every level up doubles it until it is 1:1. Each level thins the
+// matches for itself, keeping the best ones, so a dense area stays readable and zooming in shows
+// what was left out. Level 0 of the pyramids is the frame itself, not a copy.
+class DebugLodView
+{
+public:
+    explicit DebugLodView( Size screen )
+        : screen( screen ), zoom( 0 ), maxZoom( 0 ), fit( 1 ), clock( 0 ), dirty( false )
+    {
+    }
+
+    void setFrame( const Mat& img1, const std::vector<KeyPoint>& keypoints1,
+                   const Mat& img2, const std::vector<KeyPoint>& keypoints2,
+                   const std::vector<DMatch>& matches1to2, const Scalar& matchColor, const Scalar& singlePointColor,
+                   const std::vector<char>& matchesMask, int flags )
+    {
+        CV_Assert( matchesMask.empty() || matchesMask.size() == matches1to2.size() );
+        Size size( img1.cols + img2.cols, std::max(img1.rows, img2.rows) );
+        // the same view on a new frame of the same size, so it can be followed zoomed in
+        if( size != canvas )
+        {
+            canvas = size;
+            fit = std::min( 1., std::min(screen.width / (double)canvas.width, screen.height / (double)canvas.height) );
+            for( maxZoom = 0; fit * (1 << maxZoom) < 1; maxZoom++ )
+                ;
+            zoom = 0;
+            center = Point2f( canvas.width * 0.5f, canvas.height * 0.5f );
+        }
+
+        // down to the level that fits the screen, the zooms in between are resized from the one above
+        pyr1.assign( 1, img1 );
+        pyr2.assign( 1, img2 );
+        for( int k = 1; fit * (1 << k) <= 1 + 1e-9; k++ )
+        {
+            pyr1.push_back( halfGray(pyr1.back()) );
+            pyr2.push_back( halfGray(pyr2.back()) );
+        }
+
+        // the matches to draw, best first
+        const int n1 = (int)keypoints1.size(), n2 = (int)keypoints2.size();
+        std::vector<float> distances;
+        std::vector<std::pair<float, int> > order;
+        for( size_t i = 0; i < matches1to2.size(); i++ )
+        {
+            const DMatch& m = matches1to2[i];
+            if( (matchesMask.empty() || matchesMask[i]) && (unsigned)m.queryIdx < (unsigned)n1 && (unsigned)m.trainIdx < (unsigned)n2 )
+                order.push_back( std::make_pair(m.distance, (int)i) );
+        }
+        std::stable_sort( order.begin(), order.end() );
+        from.resize( order.size() );
+        to.resize( order.size() );
+        distances.resize( order.size() );
+        lineColors.assign( order.size(), Vec3b((uchar)matchColor[0], (uchar)matchColor[1], (uchar)matchColor[2]) );
+        for( size_t k = 0; k < order.size(); k++ )
+        {
+            const DMatch& m = matches1to2[order[k].second];
+            from[k] = keypoints1[m.queryIdx].pt;
+            to[k] = keypoints2[m.trainIdx].pt + Point2f( (float)img1.cols, 0.f );
+            distances[k] = m.distance;
+        }
+        if( matchColor == Scalar::all(-1) )
+            distanceColors( distances, (int)distances.size(), lineColors );
+
+        points.clear();
+        pointColors.clear();
+        if( !(flags & DrawMatchesFlags::NOT_DRAW_SINGLE_POINTS) )
+        {
+            for( int i = 0; i < n1 + n2; i++ )
+            {
+                points.push_back( i < n1 ? keypoints1[i].pt : keypoints2[i - n1].pt + Point2f((float)img1.cols, 0.f) );
+                pointColors.push_back( keypointColor(i, singlePointColor) );
+            }
+        }
+
+        shownMatches.assign( maxZoom + 1, std::vector<int>() );
+        shownPoints.assign( maxZoom + 1, std::vector<int>() );
+        thinned.assign( maxZoom + 1, false );
+        tiles.clear();
+        dirty = true;
+    }
+
+    // Lets go of the frame, keeping where the view is for the next one
+    void release()
+    {
+        pyr1.clear();
+        pyr2.clear();
+        tiles.clear();
+    }
+
+    bool changed() const { return dirty; }
+
+    // w a s d pan by half a screen, + and - zoom around the middle, 0 shows everything.
+    // Anything else is ignored.
+    void key( int k )
+    {
+        const double s = scale();
+        switch( k )
+        {
+        case 'w': center.y -= (float)(screen.height / (2 * s)); break;
+        case 's': center.y += (float)(screen.height / (2 * s)); break;
+        case 'a': center.x -= (float)(screen.width / (2 * s)); break;
+        case 'd': center.x += (float)(screen.width / (2 * s)); break;
+        case '+': case '=': setZoom( zoom + 1 ); break;
+        case '-': setZoom( zoom - 1 ); break;
+        case '0': setZoom( 0 ); break;
+        default: return;
+        }
+        clampCenter();
+        dirty = true;
+    }
+
+    // highgui mouse callback: a click zooms in around the point, a right click zooms out
+    static void onMouse( int event, int x, int y, int, void* p )
+    {
+        DebugLodView* view = (DebugLodView*)p;
+        if( event != EVENT_LBUTTONDOWN && event != EVENT_RBUTTONDOWN )
+            return;
+        const double s = view->scale();
+        Point o = view->origin();
+        view->center = Point2f( (float)((o.x + x) / s), (float)((o.y + y) / s) );
+        view->setZoom( view->zoom + (event == EVENT_LBUTTONDOWN ? 1 : -1) );
+        view->clampCenter();
+        view->dirty = true;
+    }
+
+    // The view, at most the screen size
+    const Mat& render()
+    {
+        const double s = scale();
+        Size zoomed( cvRound(canvas.width * s), cvRound(canvas.height * s) );
+        Size size( std::min(screen.width, zoomed.width), std::min(screen.height, zoomed.height) );
+        Point o = origin();
+        view.create( size, CV_8UC3 );
+        for( int ty = o.y / LOD_TILE; ty * LOD_TILE < o.y + size.height; ty++ )
+        {
+            for( int tx = o.x / LOD_TILE; tx * LOD_TILE < o.x + size.width; tx++ )
+            {
+                const Mat& tile = getTile( tx, ty );
+                // the part of the tile in view
+                int x0 = std::max( tx * LOD_TILE, o.x ), x1 = std::min( (tx + 1) * LOD_TILE, o.x + size.width );
+                int y0 = std::max( ty * LOD_TILE, o.y ), y1 = std::min( (ty + 1) * LOD_TILE, o.y + size.height );
+                Mat dst = view( Rect(x0 - o.x, y0 - o.y, x1 - x0, y1 - y0) );
+                tile( Rect(x0 - tx * LOD_TILE, y0 - ty * LOD_TILE, x1 - x0, y1 - y0) ).copyTo( dst );
+            }
+        }
+        dirty = false;
+        return view;
+    }
+
+private:
+    struct Tile
+    {
+        int zoom, tx, ty;
+        Mat image;
+        unsigned long used;
+    };
+
+    static Mat halfGray( const Mat& src )
+    {
+        Mat half, gray;
+        pyrDown( src, half );
+        if( half.channels() == 1 )
+            return half;
+        cvtColor( half, gray, cv::COLOR_BGR2GRAY );
+        return gray;
+    }
+
+    static long long cell( Point2f p, double c )
+    {
+        return ((long long)cvFloor(p.y * c) << 32) ^ (unsigned)cvFloor( p.x * c );
+    }
+
+    double scale() const { return std::min( 1., fit * (1 << zoom) ); }
+
+    void setZoom( int z ) { zoom = std::min( std::max(z, 0), maxZoom ); }
+
+    // top left of the view in zoomed pixels
+    Point origin() const
+    {
+        const double s = scale();
+        int w = cvRound( canvas.width * s ), h = cvRound( canvas.height * s );
+        int x = cvRound( center.x * s - screen.width / 2 ), y = cvRound( center.y * s - screen.height / 2 );
+        return Point( std::max(0, std::min(x, w - screen.width)), std::max(0, std::min(y, h - screen.height)) );
+    }
+
+    // so panning can't run off the picture and leave the center somewhere far away
+    void clampCenter()
+    {
+        const double s = scale();
+        const float w = (float)(std::min(screen.width / s, (double)canvas.width) / 2);
+        const float h = (float)(std::min(screen.height / s, (double)canvas.height) / 2);
+        center.x = std::min( std::max(center.x, w), canvas.width - w );
+        center.y = std::min( std::max(center.y, h), canvas.height - h );
+    }
+
+    // What the current zoom level draws: the matches in order, each while both its ends are in
+    // cells that don't have LOD_CELL_MATCHES yet, and a keypoint per cell
+    void thin()
+    {
+        if( thinned[zoom] )
+            return;
+        const double c = scale() / LOD_CELL, pc = scale() / LOD_POINT_CELL;
+        std::unordered_map<long long, int> ends;
+        std::unordered_set<long long> occupied;
+        for( size_t k = 0; k < from.size(); k++ )
+        {
+            int& na = ends[cell( from[k], c )];
+            int& nb = ends[cell( to[k], c )];
+            if( na < LOD_CELL_MATCHES && nb < LOD_CELL_MATCHES )
+            {
+                na++;
+                nb++;
+                shownMatches[zoom].push_back( (int)k );
+            }
+        }
+        for( size_t i = 0; i < points.size(); i++ )
+            if( occupied.insert(cell( points[i], pc )).second )
+                shownPoints[zoom].push_back( (int)i );
+        thinned[zoom] = true;
+    }
+
+    // The tile from the cache, drawn if it isn't there. The least recently used one goes once
+    // there are enough for two screens.
+    const Mat& getTile( int tx, int ty )
+    {
+        const size_t maxTiles = 2 * (screen.width / LOD_TILE + 2) * (screen.height / LOD_TILE + 2);
+        Tile* lru = NULL;
+        for( size_t i = 0; i < tiles.size(); i++ )
+        {
+            if( tiles[i].zoom == zoom && tiles[i].tx == tx && tiles[i].ty == ty )
+            {
+                tiles[i].used = ++clock;
+                return tiles[i].image;
+            }
+            if( !lru || tiles[i].used < lru->used )
+                lru = &tiles[i];
+        }
+        if( tiles.size() < maxTiles || !lru )
+        {
+            tiles.push_back( Tile() );
+            lru = &tiles.back();
+        }
+        lru->zoom = zoom;
+        lru->tx = tx;
+        lru->ty = ty;
+        lru->used = ++clock;
+        drawTile( lru->image, tx, ty );
+        return lru->image;
+    }
+
+    static bool inTile( Point2f p, float margin )
+    {
+        return p.x >= -margin && p.y >= -margin && p.x <= LOD_TILE + margin && p.y <= LOD_TILE + margin;
+    }
+
+    // Whether the segment passes through the tile, clipping it to each side in turn. The matches
+    // mostly run across the whole picture, so their bounding boxes would take in most tiles.
+    static bool crossesTile( Point2f a, Point2f b, float margin )
+    {
+        const float d[4] = { a.x - b.x, b.x - a.x, a.y - b.y, b.y - a.y };
+        const float room[4] = { a.x + margin, LOD_TILE + margin - a.x, a.y + margin, LOD_TILE + margin - a.y };
+        float t0 = 0, t1 = 1;
+        for( int i = 0; i < 4; i++ )
+        {
+            if( d[i] == 0 )
+            {
+                if( room[i] < 0 )
+                    return false;
+            }
+            else if( d[i] < 0 )
+                t0 = std::max( t0, room[i] / d[i] );
+            else
+                t1 = std::min( t1, room[i] / d[i] );
+        }
+        return t0 <= t1;
+    }
+
+    void drawTile( Mat& tile, int tx, int ty )
+    {
+        const double s = scale();
+        const Point t( tx * LOD_TILE, ty * LOD_TILE );
+        tile.create( LOD_TILE, LOD_TILE, CV_8UC3 );
+        tile.setTo( Scalar::all(0) );
+
+        // each image's part of the tile, from the level just sharper than the zoom
+        int level = 0;
+        while( level + 1 < (int)pyr1.size() && s * (1 << (level + 1)) <= 1 + 1e-9 )
+            level++;
+        for( int i = 0; i < 2; i++ )
+        {
+            const Mat& full = i ? pyr2[0] : pyr1[0];
+            const Mat& src = i ? pyr2[level] : pyr1[level];
+            const int left = i ? pyr1[0].cols : 0;
+            // where the image is in zoomed pixels, and where that meets the tile
+            const int ix0 = cvRound( left * s ), ix1 = cvRound( (left + full.cols) * s ), iy1 = cvRound( full.rows * s );
+            const int x0 = std::max( ix0, t.x ), x1 = std::min( ix1, t.x + LOD_TILE );
+            const int y0 = std::max( 0, t.y ), y1 = std::min( iy1, t.y + LOD_TILE );
+            if( x0 >= x1 || y0 >= y1 )
+                continue;
+            const double fx = src.cols / (double)(ix1 - ix0), fy = src.rows / (double)iy1;
+            const int sx0 = std::min( cvFloor((x0 - ix0) * fx), src.cols - 1 ), sx1 = std::min( std::max(cvCeil((x1 - ix0) * fx), sx0 + 1), src.cols );
+            const int sy0 = std::min( cvFloor(y0 * fy), src.rows - 1 ), sy1 = std::min( std::max(cvCeil(y1 * fy), sy0 + 1), src.rows );
+            Mat part;
+            resize( src(Rect(sx0, sy0, sx1 - sx0, sy1 - sy0)), part, Size(x1 - x0, y1 - y0), 0, 0, INTER_AREA );
+            toGrayBgr( part, tile(Rect(x0 - t.x, y0 - t.y, x1 - x0, y1 - y0)) );
+        }
+
+        // then what the zoom level shows of the keypoints and matches, the best matches on top
+        thin();
+        const float margin = (float)RING_RADIUS + 1;
+        for( size_t j = 0; j < shownPoints[zoom].size(); j++ )
+        {
+            const int i = shownPoints[zoom][j];
+            Point2f p( (float)(points[i].x * s - t.x), (float)(points[i].y * s - t.y) );
+            if( !inTile(p, margin) )
+                continue;
+            const Vec3b& c = pointColors[i];
+            circle( tile, Point(cvRound(p.x * 16), cvRound(p.y * 16)), RING_RADIUS << 4, Scalar(c[0], c[1], c[2]), 1, LINE_AA, 4 );
+        }
+        std::vector<int> through;
+        for( size_t j = 0; j < shownMatches[zoom].size() && through.size() < (size_t)LOD_TILE_MATCHES; j++ )
+        {
+            const int k = shownMatches[zoom][j];
+            Point2f a( (float)(from[k].x * s - t.x), (float)(from[k].y * s - t.y) );
+            Point2f b( (float)(to[k].x * s - t.x), (float)(to[k].y * s - t.y) );
+            if( inTile(a, margin) || inTile(b, margin) || crossesTile(a, b, margin) )
+                through.push_back( k );
+        }
+        for( size_t j = through.size(); j-- > 0; )
+        {
+            const int k = through[j];
+            Point2f a( (float)(from[k].x * s - t.x), (float)(from[k].y * s - t.y) );
+            Point2f b( (float)(to[k].x * s - t.x), (float)(to[k].y * s - t.y) );
+            const bool inA = inTile( a, margin ), inB = inTile( b, margin );
+            const Vec3b& c = lineColors[k];
+            const Scalar color( c[0], c[1], c[2] );
+            const Point a16( cvRound(a.x * 16), cvRound(a.y * 16) ), b16( cvRound(b.x * 16), cvRound(b.y * 16) );
+            if( inA )
+                circle( tile, a16, RING_RADIUS << 4, color, 1, LINE_AA, 4 );
+            if( inB )
+                circle( tile, b16, RING_RADIUS << 4, color, 1, LINE_AA, 4 );
+            line( tile, a16, b16, color, 1, LINE_AA, 4 );
+        }
+    }
+
+    Size screen, canvas;
+    int zoom, maxZoom;
+    double fit;                        // the scale of zoom level 0
+    Point2f center;                    // in full resolution pixels
+    std::vector<Mat> pyr1, pyr2;
+    std::vector<Point2f> from, to;     // the drawable matches, best first
+    std::vector<Vec3b> lineColors;
+    std::vector<Point2f> points;
+    std::vector<Vec3b> pointColors;
+    std::vector<std::vector<int> > shownMatches, shownPoints;
+    std::vector<bool> thinned;
+    std::vector<Tile> tiles;
+    unsigned long clock;
+    Mat view;
+    bool dirty;
+};
+
+// The background thread of the asynchronous modes, the only one that touches highgui
+class DebugMatchViewer
+{
+public:
+    DebugMatchViewer( int mode, int queueSize, Size lodScreen )
+        : queue( queueSize > 0 ? queueSize : 1 ), keepLatest( mode == DebugDisplayMode::KEEP_LATEST ),
+          lodScreen( lodScreen ), stopping( false ), dropped( 0 )
+    {
+        thread = std::thread( &DebugMatchViewer::run, this );
+    }
+
+    ~DebugMatchViewer()
+    {
+        stopping.store( true );
+        thread.join();
+    }
+
+    // Never blocks: when the queue is full the oldest frame makes room
+    void show( DebugMatchFrame* f )
+    {
+        while( !queue.push( f ) )
+        {
+            if( DebugMatchFrame* old = queue.pop() )
+            {
+                delete old;
+                dropped.fetch_add( 1, std::memory_order_relaxed );
+            }
+        }
+    }
+
+    std::atomic<size_t>& droppedCount() { return dropped; }
+
+private:
+    void run()
+    {
+        Mat i1g, i2g, matchImage;
+        bool paused = false;
+        std::unique_ptr<DebugLodView> lod;
+
+        namedWindow("matches",CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO | CV_GUI_EXPANDED);
+        if( lodScreen.area() > 0 )
+            lod.reset( new DebugLodView(lodScreen) );
+        setMouseCallback( "matches", lod ? DebugLodView::onMouse : NULL, lod.get() );
+        while( !stopping.load() )
+        {
+            DebugMatchFrame* f = NULL;
+            if( !paused )
+            {
+                // KEEP_LATEST shows only the newest of what came in since the last frame
+                f = queue.pop();
+                while( f && keepLatest )
+                {
+                    DebugMatchFrame* next = queue.pop();
+                    if( !next )
+                        break;
+                    delete f;
+                    dropped.fetch_add( 1, std::memory_order_relaxed );
+                    f = next;
+                }
+            }
+            if( f && lod )
+            {
+                // the view keeps the images, they're only referenced
+                lod->setFrame(f->img1, f->keypoints1, f->img2, f->keypoints2, f->matches1to2,
+                              f->matchColor, f->singlePointColor, f->matchesMask, f->flags);
+                delete f;
+            }
+            else if( f )
+            {
+                renderMatches(f->img1, f->keypoints1, f->img2, f->keypoints2, f->matches1to2, i1g, i2g, matchImage,
+                              f->matchColor, f->singlePointColor, f->matchesMask, f->flags);
+                imshow("matches", matchImage);
+                delete f;
+            }
+            if( lod && lod->changed() )
+                imshow("matches", lod->render());
+            // also runs the window's events, so it stays responsive while idle
+            int key = waitKey(f ? 1 : 10);
+            if( key == ' ' )
+            {
+                paused = !paused;
+                std::cout << (paused ? "matches viewer paused, SPACE to resume" : "matches viewer resumed") << std::endl;
+            }
+            else if( lod )
+                lod->key( key );
+        }
+        setMouseCallback( "matches", NULL, NULL );
+        destroyWindow("matches");
+    }
+
+    DebugQueue<DebugMatchFrame> queue;
+    bool keepLatest;
+    Size lodScreen;
+    std::atomic<bool> stopping;
+    std::atomic<size_t> dropped;
+    std::thread thread;
+};
+
+// The headless mode: frames are drawn by the caller into one of a fixed set of buffers and a
+// worker thread writes them out, then hands the buffer back
+class DebugMatchRecorder
+{
+public:
+    DebugMatchRecorder( const std::string& path, int poolSize, double fps )
+        : path( path ), fps( fps ), raw( NULL ), spare( poolSize > 0 ? poolSize : 1 ), filled( poolSize > 0 ? poolSize : 1 ),
+          frames( 0 ), dropped( 0 ), ready( 0 ), stopping( false ), opened( true )
+    {
+        const char* ext = strrchr( path.c_str(), '.' );
+        if( path.find('%') != std::string::npos )
+            kind = IMAGES;
+        else if( ext && !strcmp(ext, ".raw") )
+            kind = RAW;
+        else
+            kind = VIDEO;
+        if( kind == RAW && !(raw = fopen(path.c_str(), "wb")) )
+            opened = false;
+        if( kind == IMAGES && !imageFormat(path, format) )
+            opened = false;
+        // the buffers get their pixels on the first frame, and keep them while the size stays
+        for( int i = 0; i < (poolSize > 0 ? poolSize : 1); i++ )
+            spare.push( new Slot );
+        thread = std::thread( &DebugMatchRecorder::run, this );
+    }
+
+    ~DebugMatchRecorder()
+    {
+        {
+            std::lock_guard<std::mutex> lock( wakeLock );
+            stopping.store( true );
+        }
+        wake.notify_one();
+        thread.join();
+        if( raw )
+            fclose( raw );
+    }
+
+    bool ok() const { return opened.load(); }
+
+    // Never blocks: if the writer has every buffer, the frame is dropped
+    void record( InputArray img1, const std::vector<KeyPoint>& keypoints1,
+                 InputArray img2, const std::vector<KeyPoint>& keypoints2,
+                 const std::vector<DMatch>& matches1to2, const Scalar& matchColor, const Scalar& singlePointColor,
+                 const std::vector<char>& matchesMask, int flags )
+    {
+        size_t n = frames.fetch_add( 1, std::memory_order_relaxed );
+        Slot* s = spare.pop();
+        if( !s )
+        {
+            dropped.fetch_add( 1, std::memory_order_relaxed );
+            return;
+        }
+        renderMatches(img1.getMat(), keypoints1, img2.getMat(), keypoints2, matches1to2, s->i1g, s->i2g, s->image,
+                      matchColor, singlePointColor, matchesMask, flags);
+        s->frame = n;
+        filled.push( s );
+        {
+            std::lock_guard<std::mutex> lock( wakeLock );
+            ready++;
+        }
+        wake.notify_one();
+    }
+
+    size_t droppedCount() const { return dropped.load( std::memory_order_relaxed ); }
+
+private:
+    enum { IMAGES, VIDEO, RAW };
+
+    struct Slot
+    {
+        Mat i1g, i2g, image;
+        size_t frame;
+    };
+
+    // An image path needs exactly one integer conversion, like %06lu, and no other %. It is
+    // rebuilt with the ll length, for the unsigned long long the frame number is passed as.
+    static bool imageFormat( const std::string& path, std::string& format )
+    {
+        size_t i = path.find('%') + 1, spec;
+        while( i < path.size() && strchr("-+ #0", path[i]) )
+            i++;
+        while( i < path.size() && path[i] >= '0' && path[i] <= '9' )
+            i++;
+        if( i < path.size() && path[i] == '.' )
+            for( i++; i < path.size() && path[i] >= '0' && path[i] <= '9'; i++ )
+                ;
+        spec = i;
+        while( i < path.size() && strchr("hljzt", path[i]) )
+            i++;
+        if( i >= path.size() || !strchr("diouxX", path[i]) || path.find('%', i + 1) != std::string::npos )
+            return false;
+        format = path.substr(0, spec) + "ll" + path[i] + path.substr(i + 1);
+        return true;
+    }
+
+    void run()
+    {
+        for(;;)
+        {
+            {
+                // what is queued is still written after a stop
+                std::unique_lock<std::mutex> lock( wakeLock );
+                wake.wait( lock, [this]{ return ready > 0 || stopping.load(); } );
+                if( !ready )
+                    break;
+                ready--;
+            }
+            Slot* s = filled.pop();
+            if( !write( *s ) )
+                dropped.fetch_add( 1, std::memory_order_relaxed );
+            spare.push( s );
+        }
+        if( video.isOpened() )
+            video.release();
+    }
+
+    bool write( const Slot& s )
+    {
+        if( kind == IMAGES )
+        {
+            char name[4096];
+            std::vector<int> params;
+            snprintf( name, sizeof(name), format.c_str(), (unsigned long long)s.frame );
+            // the encoder is most of the work, and zlib's fastest level is still lossless
+            params.push_back( IMWRITE_PNG_COMPRESSION );
+            params.push_back( 1 );
+            return imwrite( name, s.image, params );
+        }
+        if( kind == RAW )
+        {
+            // a 32 byte header per frame, then the rows without padding
+            uint32_t header[8] = { 0x31464d44, (uint32_t)s.frame, (uint32_t)(s.frame >> 32), (uint32_t)s.image.rows,
+                                   (uint32_t)s.image.cols, (uint32_t)s.image.type(), (uint32_t)s.image.elemSize(), 0 };
+            size_t row = s.image.cols * s.image.elemSize();
+            if( !raw || fwrite(header, sizeof(header), 1, raw) != 1 )
+                return false;
+            for( int y = 0; y < s.image.rows; y++ )
+                if( fwrite(s.image.ptr(y), row, 1, raw) != 1 )
+                    return false;
+            return true;
+        }
+        if( !video.isOpened() )
+        {
+            const char* ext = strrchr( path.c_str(), '.' );
+            int fourcc = ext && !strcmp(ext, ".avi") ? VideoWriter::fourcc('M','J','P','G') : VideoWriter::fourcc('m','p','4','v');
+            videoSize = s.image.size();
+            if( !video.open(path, fourcc, fps, videoSize, true) )
+            {
+                opened.store( false );
+                return false;
+            }
+        }
+        // a video can't change size, frames that do are dropped
+        if( s.image.size().width != videoSize.width || s.image.size().height != videoSize.height )
+            return false;
+        video.write( s.image );
+        return true;
+    }
+
+    std::string path, format;
+    double fps;
+    int kind;
+    FILE* raw;
+    VideoWriter video;
+    Size videoSize;
+    DebugQueue<Slot> spare, filled;
+    std::atomic<size_t> frames, dropped;
+    // the worker sleeps until a frame is filled, ready counts them
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    size_t ready;
+    std::atomic<bool> stopping, opened;
+    std::thread thread;
+};
+
+std::unique_ptr<DebugMatchViewer> viewer;
+std::unique_ptr<DebugMatchRecorder> recorder;
+Size lodScreen;
+std::unique_ptr<DebugLodView> lodView;   // the blocking mode's, kept for where it was zoomed
+
+} // anonymous
+
+CV_EXPORTS void setDebugDisplayMode( int mode, int queueSize )
+{
+    viewer.reset();
+    if( mode == DebugDisplayMode::DROP_OLDEST || mode == DebugDisplayMode::KEEP_LATEST )
+        viewer.reset( new DebugMatchViewer(mode, queueSize, lodScreen) );
+}
+
+CV_EXPORTS void setDebugParallelMatches( size_t minMatches )
+{
+    parallelMatches.store( minMatches, std::memory_order_relaxed );
+}
+
+CV_EXPORTS void setDebugDisplayLOD( bool on, Size screen )
+{
+    lodScreen = on ? screen : Size();
+    lodView.reset();
+}
+
+CV_EXPORTS size_t debugDisplayDropped()
+{
+    return viewer ? viewer->droppedCount().load( std::memory_order_relaxed ) : 0;
+}
+
+CV_EXPORTS bool setDebugRecording( const std::string& path, int poolSize, double fps )
+{
+    recorder.reset();
+    if( path.empty() )
+        return true;
+    recorder.reset( new DebugMatchRecorder(path, poolSize, fps) );
+    if( !recorder->ok() )
+    {
+        std::cerr << "debugDisplayMatches can't record to " << path << std::endl;
+        recorder.reset();
+        return false;
+    }
+    return true;
+}
+
+CV_EXPORTS size_t debugRecordingDropped()
+{
+    return recorder ? recorder->droppedCount() : 0;
+}
+
+CV_EXPORTS void drawMatchesParallel( InputArray img1, const std::vector<KeyPoint>& keypoints1,
+                            InputArray img2, const std::vector<KeyPoint>& keypoints2,
+                            const std::vector<DMatch>& matches1to2, InputOutputArray outImg,
+                            const Scalar& matchColor, const Scalar& singlePointColor,
+                            const std::vector<char>& matchesMask, int flags )
+{
+    CV_Assert( matchesMask.empty() || matchesMask.size() == matches1to2.size() );
+
+    Mat i1 = img1.getMat(), i2 = img2.getMat();
+    Size size( i1.cols + i2.cols, std::max(i1.rows, i2.rows) );
+    Mat canvas;
+    if( flags & DrawMatchesFlags::DRAW_OVER_OUTIMG )
+    {
+        canvas = outImg.getMat();
+        CV_Assert( canvas.size() == size && canvas.type() == CV_8UC3 );
+    }
+    else
+    {
+        outImg.create( size, CV_8UC3 );
+        canvas = outImg.getMat();
+        if( i1.rows != i2.rows )
+            canvas.setTo( Scalar::all(0) );
+        copyToBgr( i1, canvas(Rect(0, 0, i1.cols, i1.rows)) );
+        copyToBgr( i2, canvas(Rect(i1.cols, 0, i2.cols, i2.rows)) );
+    }
+    if( canvas.empty() )
+        return;
+    const int nbands = (canvas.rows + MATCH_BAND_ROWS - 1) / MATCH_BAND_ROWS;
+    const Point2f offset2( (float)i1.cols, 0.f );
+
+    // The matches that are drawn, with their distances. No branch on the mask: every match is
+    // written at the end, and the end only moves past it if it is kept.
+    const int n = (int)matches1to2.size(), n1 = (int)keypoints1.size(), n2 = (int)keypoints2.size();
+    // Without a mask every match reads the same 1.
+    static const char keepAll = 1;
+    const char* mask = matchesMask.empty() ? &keepAll : &matchesMask[0];
+    const int maskStep = matchesMask.empty() ? 0 : 1;
+    std::vector<int> kept( n + 1 );
+    std::vector<float> distances( n + 1 );
+    int nkept = 0;
+    for( int i = 0; i < n; i++ )
+    {
+        const DMatch& m = matches1to2[i];
+        kept[nkept] = i;
+        distances[nkept] = m.distance;
+        nkept += (int)( (mask[i * maskStep] != 0) &
+                        ((unsigned)m.queryIdx < (unsigned)n1) & ((unsigned)m.trainIdx < (unsigned)n2) );
+    }
+
+    std::vector<Point2f> from( nkept ), to( nkept );
+    std::vector<Vec3b> lineColors( nkept, Vec3b((uchar)matchColor[0], (uchar)matchColor[1], (uchar)matchColor[2]) );
+    std::vector<int> top( nkept ), bottom( nkept );
+    if( matchColor == Scalar::all(-1) )
+        distanceColors( distances, nkept, lineColors );
+    for( int k = 0; k < nkept; k++ )
+    {
+        const DMatch& m = matches1to2[kept[k]];
+        from[k] = keypoints1[m.queryIdx].pt;
+        to[k] = keypoints2[m.trainIdx].pt + offset2;
+        top[k] = cvFloor( std::min(from[k].y, to[k].y) ) - RING_RADIUS;
+        bottom[k] = cvCeil( std::max(from[k].y, to[k].y) ) + RING_RADIUS;
+    }
+    BandBins lineBins;
+    lineBins.build( top, bottom, nbands );
+
+    std::vector<Point2f> points;
+    std::vector<Vec3b> pointColors;
+    if( !(flags & DrawMatchesFlags::NOT_DRAW_SINGLE_POINTS) )
+    {
+        points.resize( n1 + n2 );
+        pointColors.resize( n1 + n2 );
+        top.resize( n1 + n2 );
+        bottom.resize( n1 + n2 );
+        for( int i = 0; i < n1 + n2; i++ )
+        {
+            points[i] = i < n1 ? keypoints1[i].pt : keypoints2[i - n1].pt + offset2;
+            top[i] = cvFloor( points[i].y ) - RING_RADIUS;
+            bottom[i] = cvCeil( points[i].y ) + RING_RADIUS;
+            pointColors[i] = keypointColor( i, singlePointColor );
+        }
+    }
+    else
+    {
+        top.clear();
+        bottom.clear();
+    }
+    BandBins pointBins;
+    pointBins.build( top, bottom, nbands );
+
+    parallel_for_( Range(0, nbands),
+                   MatchBandRenderer(canvas, points, pointColors, pointBins, from, to, lineColors, lineBins) );
+}
 
 // A wrapper around drawMatches that actually checks for color images, etc
 CV_EXPORTS void debugDisplayMatches( InputArray img1, const std::vector<KeyPoint>& keypoints1,
@@ -11,12 +1143,58 @@ CV_EXPORTS void debugDisplayMatches( InputArray img1, const std::vector<KeyPoint
                             const Scalar& matchColor, const Scalar& singlePointColor,
                             const std::vector<char>& matchesMask, int flags)
 {
+    if( recorder )
+    {
+        recorder->record(img1, keypoints1, img2, keypoints2, matches1to2, matchColor, singlePointColor, matchesMask, flags);
+        return;
+    }
+    if( viewer )
+    {
+        // copy now, render on the viewer thread
+        DebugMatchFrame* f = new DebugMatchFrame;
+        img1.getMat().copyTo(f->img1);
+        img2.getMat().copyTo(f->img2);
+        f->keypoints1 = keypoints1;
+        f->keypoints2 = keypoints2;
+        f->matches1to2 = matches1to2;
+        f->matchColor = matchColor;
+        f->singlePointColor = singlePointColor;
+        f->matchesMask = matchesMask;
+        f->flags = flags;
+        viewer->show( f );
+        return;
+    }
+
+    if( lodScreen.area() > 0 )
+    {
+        if( !lodView )
+            lodView.reset( new DebugLodView(lodScreen) );
+        lodView->setFrame(img1.getMat(), keypoints1, img2.getMat(), keypoints2, matches1to2,
+                          matchColor, singlePointColor, matchesMask, flags);
+        namedWindow("matches",CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO | CV_GUI_EXPANDED);
+        setMouseCallback("matches", DebugLodView::onMouse, lodView.get());
+        std::cout << "Press SPACE to continue, click to zoom in, right click to zoom out, wasd to pan, 0 to see all" << std::endl;
+        for(;;)
+        {
+            if( lodView->changed() )
+                imshow("matches", lodView->render());
+            int key = waitKey(20);
+            if( key == ' ' )
+                break;
+            lodView->key( key );
+        }
+        // the window outlives the view, which setDebugDisplayLOD() may delete
+        setMouseCallback("matches", NULL, NULL);
+        lodView->release();
+        return;
+    }
+
     Mat i1g,i2g,matchImage;
 
-    cvtColor(img1, i1g, cv::COLOR_BGR2GRAY);
-    cvtColor(img2, i2g, cv::COLOR_BGR2GRAY);
-    drawMatches(i1g, keypoints1, i2g, keypoints2, matches1to2, matchImage, matchColor, singlePointColor, matchesMask, flags);
+    renderMatches(img1.getMat(), keypoints1, img2.getMat(), keypoints2, matches1to2, i1g, i2g, matchImage,
+                  matchColor, singlePointColor, matchesMask, flags);
     namedWindow("matches",CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO | CV_GUI_EXPANDED);
+    setMouseCallback("matches", NULL, NULL);
     imshow("matches", matchImage);
     std::cout << "Press SPACE to continue" << std::endl;
     while(waitKey(0)!=' ');
@@ -9,7 +9,7 @@ extern "C" {
 #endif
 
 // Returns the type string for a given type code
-std::string cvtype2str(int type) {
+inline std::string cvtype2str(int type) {
     //inspired by a less than elegant SO post
     std::string bits, sign, ret;
 
@@ -36,6 +36,84 @@ CV_EXPORTS void debugDisplayMatches( InputArray img1, const std::vector<KeyPoint
                             const std::vector<DMatch>& matches1to2, InputOutputArray outImg = Mat(),
                             const Scalar& matchColor=Scalar::all(-1), const Scalar& singlePointColor=Scalar::all(-1),
                             const std::vector<char>& matchesMask=std::vector<char>(), int flags=DrawMatchesFlags::DEFAULT );
+
+// drawMatches for tens of thousands of matches: the canvas is cut into bands of rows, every line
+// and keypoint is sorted into the bands it touches, and the bands are drawn in parallel, each
+// by its own thread, so no two threads write the same pixel. With matchColor left at -1 the lines
+// are colored by distance, blue for the best of the set to red for the worst, instead of at
+// random. The lines and circles are 1 pixel wide and not antialiased, DRAW_RICH_KEYPOINTS is
+// ignored, and matches with keypoint indices out of range are skipped.
+CV_EXPORTS void drawMatchesParallel( InputArray img1, const std::vector<KeyPoint>& keypoints1,
+                            InputArray img2, const std::vector<KeyPoint>& keypoints2,
+                            const std::vector<DMatch>& matches1to2, InputOutputArray outImg,
+                            const Scalar& matchColor=Scalar::all(-1), const Scalar& singlePointColor=Scalar::all(-1),
+                            const std::vector<char>& matchesMask=std::vector<char>(), int flags=DrawMatchesFlags::DEFAULT );
+
+// debugDisplayMatches() and the recording draw with drawMatches() until this is called, then
+// with drawMatchesParallel() from minMatches matches up, except with DRAW_RICH_KEYPOINTS. Since
+// that changes what the frames look like it is left to the caller, and bench_drawmatches.cpp
+// shows from how many matches it pays off on a machine. 0 turns it off again.
+CV_EXPORTS void setDebugParallelMatches( size_t minMatches );
+
+// How debugDisplayMatches() shows its frames. BLOCKING (the default) waits for SPACE after each
+// one. The others return as soon as the frame is copied into a queue of queueSize frames, and a
+// background thread draws and shows them, so leaving the display on doesn't stall the pipeline.
+// When the queue is full the oldest frame is dropped. DROP_OLDEST shows the frames in order as
+// long as the viewer keeps up, and KEEP_LATEST always skips to the newest one. SPACE in the
+// window pauses and resumes the viewer, which keeps dropping frames meanwhile.
+// All highgui calls happen on the viewer thread, so don't use highgui elsewhere while it runs.
+// Switching modes stops the viewer and discards what is queued. Don't switch while
+// other threads are calling debugDisplayMatches().
+struct CV_EXPORTS DebugDisplayMode
+{
+    enum
+    {
+        BLOCKING    = 0,
+        DROP_OLDEST = 1,
+        KEEP_LATEST = 2
+    };
+};
+CV_EXPORTS void setDebugDisplayMode( int mode, int queueSize = 4 );
+
+// Frames dropped since the mode was set, because the viewer fell behind or was paused
+CV_EXPORTS size_t debugDisplayDropped();
+
+// Level of detail display, for images too big to draw side by side at full resolution. Each
+// frame gets a gray pyramid of halves of both images, down to what fits the screen, and the
+// window shows a view of at most the screen size put together from 256 pixel tiles. Each tile is
+// drawn from the pyramid level nearest the zoom when it comes into view, and kept while there
+// is room for two screens of them. Keypoints and matches are thinned to what the zoom level can
+// show, the best matches first: at most two end in each 16 pixel cell of the screen, and a
+// keypoint is drawn per 8 pixel cell. So the memory is the pyramid, a third of the images in gray,
+// plus a few screens, and the frame isn't copied at all in the BLOCKING mode. That bound only holds
+// there: the other modes still queue full copies of both images, up to queueSize frames, and
+// build the pyramid on the viewer thread, since building it on the caller's would cost more than
+// the copy it saves. Keep queueSize small for very large images. Click to zoom in
+// around a point, right click to zoom out, + and - zoom around the middle, w a s d pan and 0
+// shows everything. It keeps the zoom from frame to frame while the sizes don't change.
+// The display modes pick it up when they are set, so call it before setDebugDisplayMode().
+// Recording isn't affected.
+CV_EXPORTS void setDebugDisplayLOD( bool on, Size screen = Size(1600, 900) );
+
+// Headless mode, which takes precedence over the display modes: debugDisplayMatches() draws each
+// frame into one of poolSize buffers that are reused from frame to frame, and a worker thread
+// writes it out and hands the buffer back. If the worker has all of them, the frame is dropped
+// rather than waited for. Where the frames go depends on path:
+//   "matches/%06lu.png"  numbered images, by call number so drops leave gaps (any imwrite format).
+//                        Exactly one integer conversion, and no other %, not even %%.
+//   "matches.raw"        one file, each frame a 32 byte header of uint32s
+//                        { 'DMF1', frame low, frame high, rows, cols, cv type, bytes per pixel, 0 }
+//                        and then its rows, unpadded. The cheapest to write.
+//   anything else        a video at fps, MJPG for .avi and mp4v otherwise. Frames of another
+//                        size than the first are dropped.
+// Returns false if the .raw file can't be created or an image path has another % than that one.
+// Images and videos are opened by the worker, so their failures only show up as drops. An empty
+// path stops recording, and the queued frames are written before it returns. Like the modes,
+// don't switch while other threads are drawing.
+CV_EXPORTS bool setDebugRecording( const std::string& path, int poolSize = 4, double fps = 10 );
+
+// Frames dropped since recording started, because the writer fell behind or failed
+CV_EXPORTS size_t debugRecordingDropped();
 } // cv
 
 #endif //P_OCVDEBUGUTILS_H
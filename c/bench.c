@@ -0,0 +1,129 @@
+// A small microbenchmark harness built on nanotime(), see bench.h
+// Author: Paul Foster
+// Public domain
+//
+// compile with: gcc -c bench.c time.c -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "time.h"
+
+static int cmp_double(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static double median(double* v, unsigned int n)
+{
+  qsort(v, n, sizeof(double), cmp_double);
+  return n % 2 ? v[n/2] : 0.5 * (v[n/2 - 1] + v[n/2]);
+}
+
+static uint64_t time_reps(bench_fn fn, void* arg, uint64_t iters)
+{
+  uint64_t t = nanotime();
+  fn(iters, arg);
+  return nanotime() - t;
+}
+
+int bench_run(const char* name, bench_fn fn, void* arg, const struct bench_config* cfg, struct bench_result* out)
+{
+  struct bench_config c = { 50000000ull, 10000000ull, 15, 3.0 };
+  double per_iter[BENCH_MAX_REPS], dev[BENCH_MAX_REPS];
+  unsigned int i, kept;
+  uint64_t iters, t;
+
+  if(cfg)
+    c = *cfg;
+  if(c.reps == 0 || c.reps > BENCH_MAX_REPS)
+    return -1;
+
+  // warm up caches, branch predictors and the cpu clock
+  t = nanotime();
+  while(nanotime() - t < c.warmup_ns)
+    fn(1, arg);
+
+  // find an iteration count that makes one repetition long enough to time
+  for(iters = 1; ; iters *= 2){
+    uint64_t dt = time_reps(fn, arg, iters);
+    if(dt >= c.min_time_ns){
+      break;
+    }
+    if(dt > c.min_time_ns / 8){
+      iters = (uint64_t)((double)iters * c.min_time_ns / dt) + 1;
+      break;
+    }
+  }
+
+  for(i = 0; i < c.reps; i++)
+    per_iter[i] = (double)time_reps(fn, arg, iters) / iters;
+
+  memset(out, 0, sizeof(*out));
+  out->name = name;
+  out->iters = iters;
+  out->reps = c.reps;
+
+  memcpy(dev, per_iter, sizeof(double) * c.reps);
+  double med = median(dev, c.reps);
+  for(i = 0; i < c.reps; i++)
+    dev[i] = per_iter[i] > med ? per_iter[i] - med : med - per_iter[i];
+  double mad = median(dev, c.reps);
+
+  // the noise is all on the slow side, so only reject that way
+  for(i = 0, kept = 0; i < c.reps; i++){
+    if(per_iter[i] - med > c.outlier_mads * 1.4826 * mad && mad > 0)
+      continue;
+    per_iter[kept++] = per_iter[i];
+  }
+  out->outliers = c.reps - kept;
+
+  out->median_ns = median(per_iter, kept);
+  out->min_ns = per_iter[0];
+  out->max_ns = per_iter[kept-1];
+  for(i = 0; i < kept; i++)
+    dev[i] = per_iter[i] > out->median_ns ? per_iter[i] - out->median_ns : out->median_ns - per_iter[i];
+  out->mad_ns = median(dev, kept);
+  return 0;
+}
+
+void bench_print(FILE* out, const struct bench_result* r)
+{
+  fprintf(out, "%-40s %10.2f ns  +- %-8.2f [%.2f, %.2f]  %llu iters x %u reps (%u outliers)\n",
+          r->name, r->median_ns, r->mad_ns, r->min_ns, r->max_ns,
+          (unsigned long long)r->iters, r->reps, r->outliers);
+}
+
+// A JSON string, quotes included
+static void write_json_string(FILE* out, const char* s)
+{
+  fputc('"', out);
+  for(; *s; s++){
+    unsigned char c = (unsigned char)*s;
+    if(c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if(c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+void bench_write_json(FILE* out, const struct bench_result* r, int n)
+{
+  int i;
+  fprintf(out, "[\n");
+  for(i = 0; i < n; i++){
+    fprintf(out, "  {\"name\":");
+    write_json_string(out, r[i].name);
+    fprintf(out, ",\"median_ns\":%.4f,\"mad_ns\":%.4f,\"min_ns\":%.4f,\"max_ns\":%.4f,"
+                 "\"iters\":%llu,\"reps\":%u,\"outliers\":%u}%s\n",
+            r[i].median_ns, r[i].mad_ns, r[i].min_ns, r[i].max_ns,
+            (unsigned long long)r[i].iters, r[i].reps, r[i].outliers, i+1 < n ? "," : "");
+  }
+  fprintf(out, "]\n");
+}
@@ -0,0 +1,66 @@
+// A small microbenchmark harness built on nanotime()
+// Author: Paul Foster
+// Public domain
+//
+// Usage:
+//   static void bm_foo(uint64_t iters, void* arg){
+//     uint64_t i;
+//     for(i = 0; i < iters; i++)
+//       BENCH_DO_NOT_OPTIMIZE(foo(i));
+//   }
+//   struct bench_result r;
+//   bench_run("foo", bm_foo, NULL, NULL, &r);   //NULL config means the defaults below
+//   bench_print(stdout, &r);
+//
+// Each run warms up, doubles the iteration count until one repetition takes min_time_ns,
+// then times reps repetitions. Repetitions further than outlier_mads MADs above the median
+// are thrown out (those are interrupts and migrations, not the code under test) and the
+// median and MAD per iteration are reported.
+// Link with time.c and -lpthread
+
+#ifndef P_BENCH_H
+#define P_BENCH_H
+#include <stdint.h>
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Keeps the compiler from discarding a value, or from caching memory across the barrier
+#define BENCH_DO_NOT_OPTIMIZE(x) do{ __typeof__(x) bench_v_ = (x); __asm__ volatile("" : : "g"(&bench_v_) : "memory"); }while(0)
+#define BENCH_CLOBBER() __asm__ volatile("" : : : "memory")
+
+#define BENCH_MAX_REPS 256
+
+typedef void (*bench_fn)(uint64_t iters, void* arg);
+
+struct bench_config
+{
+  uint64_t     warmup_ns;      //default 50ms
+  uint64_t     min_time_ns;    //per repetition, default 10ms
+  unsigned int reps;           //default 15, at most BENCH_MAX_REPS
+  double       outlier_mads;   //default 3
+};
+
+struct bench_result
+{
+  const char*  name;
+  uint64_t     iters;          //per repetition
+  unsigned int reps;
+  unsigned int outliers;       //repetitions rejected
+  double       median_ns;      //per iteration
+  double       mad_ns;
+  double       min_ns;
+  double       max_ns;
+};
+
+int  bench_run(const char* name, bench_fn fn, void* arg, const struct bench_config* cfg, struct bench_result* out);
+void bench_print(FILE* out, const struct bench_result* r);
+
+// Writes results as a JSON array, one object per result, for diffing between runs
+void bench_write_json(FILE* out, const struct bench_result* r, int n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_BENCH_H
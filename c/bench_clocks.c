@@ -0,0 +1,186 @@
+// Measures the cost and resolution of every clock source time.c can use, so you can pick the
+// cheapest acceptable one for each call site. Also compares cached_nanotime() against nanotime().
+// Author: Paul Foster
+// Public domain
+//
+// linux, build and run with:
+//   gcc -O2 -o bench_clocks bench_clocks.c bench.c time.c -lpthread && ./bench_clocks clocks.json
+// The JSON argument is optional, it gets the per call costs for regression tracking.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "bench.h"
+#include "time.h"
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+struct clock_source
+{
+  const char* name;
+  clockid_t   id;
+};
+
+static const struct clock_source clocks[] = {
+  { "CLOCK_REALTIME",         CLOCK_REALTIME },
+  { "CLOCK_MONOTONIC",        CLOCK_MONOTONIC },
+#ifdef CLOCK_REALTIME_COARSE
+  { "CLOCK_REALTIME_COARSE",  CLOCK_REALTIME_COARSE },
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+  { "CLOCK_MONOTONIC_COARSE", CLOCK_MONOTONIC_COARSE },
+#endif
+#ifdef CLOCK_MONOTONIC_RAW
+  { "CLOCK_MONOTONIC_RAW",    CLOCK_MONOTONIC_RAW },
+#endif
+#ifdef CLOCK_BOOTTIME
+  { "CLOCK_BOOTTIME",         CLOCK_BOOTTIME },
+#endif
+};
+#define NCLOCKS (sizeof(clocks)/sizeof(clocks[0]))
+
+static void bm_clock_gettime(uint64_t iters, void* arg)
+{
+  clockid_t id = *(const clockid_t*)arg;
+  struct timespec ts;
+  uint64_t i;
+  for(i = 0; i < iters; i++){
+    clock_gettime(id, &ts);
+    BENCH_CLOBBER();
+  }
+}
+
+static void bm_nanotime(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++)
+    BENCH_DO_NOT_OPTIMIZE(nanotime());
+}
+
+static void bm_current_utc_time(uint64_t iters, void* arg)
+{
+  struct timespec ts;
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++){
+    current_utc_time(&ts);
+    BENCH_CLOBBER();
+  }
+}
+
+static void bm_cached_nanotime(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++)
+    BENCH_DO_NOT_OPTIMIZE(cached_nanotime());
+}
+
+#if defined(__x86_64__)
+static void bm_rdtsc(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++)
+    BENCH_DO_NOT_OPTIMIZE(__rdtsc());
+}
+
+static void bm_rdtscp(uint64_t iters, void* arg)
+{
+  unsigned int aux;
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++)
+    BENCH_DO_NOT_OPTIMIZE(__rdtscp(&aux));
+}
+#endif
+
+// Smallest nonzero step seen between back to back reads, in ns
+static double observed_step(clockid_t id)
+{
+  struct timespec a, b;
+  int64_t best = INT64_MAX;
+  int i;
+  for(i = 0; i < 1000; i++){
+    clock_gettime(id, &a);
+    do{
+      clock_gettime(id, &b);
+    }while(a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec);
+    int64_t d = (int64_t)(b.tv_sec - a.tv_sec) * 1000000000ll + (b.tv_nsec - a.tv_nsec);
+    if(d < best)
+      best = d;
+  }
+  return (double)best;
+}
+
+static double observed_nanotime_step()
+{
+  uint64_t best = UINT64_MAX;
+  int i;
+  for(i = 0; i < 1000; i++){
+    uint64_t a = nanotime(), b;
+    while((b = nanotime()) == a)
+      ;
+    if(b - a < best)
+      best = b - a;
+  }
+  return (double)best;
+}
+
+int main(int argc, char** argv)
+{
+  struct bench_result results[NCLOCKS + 6];
+  char names[NCLOCKS][64];
+  int n = 0;
+  unsigned int i;
+
+  nanotime_calibrate();
+  printf("nanotime() source: %s", nanotime_uses_tsc() ? "invariant TSC" : "clock_gettime(CLOCK_MONOTONIC)");
+  if(nanotime_uses_tsc())
+    printf(" @ %.3f MHz", nanotime_tsc_hz() / 1e6);
+  printf("\n\n%-32s %12s %12s\n", "resolution", "clock_getres", "observed");
+
+  for(i = 0; i < NCLOCKS; i++){
+    struct timespec res;
+    clock_getres(clocks[i].id, &res);
+    printf("%-32s %10ld ns %10.0f ns\n", clocks[i].name, res.tv_nsec + res.tv_sec * 1000000000l, observed_step(clocks[i].id));
+  }
+  printf("%-32s %13s %10.0f ns\n\ncost per call\n", "nanotime()", "", observed_nanotime_step());
+
+  for(i = 0; i < NCLOCKS; i++){
+    snprintf(names[i], sizeof(names[i]), "clock_gettime(%s)", clocks[i].name);
+    bench_run(names[i], bm_clock_gettime, (void*)&clocks[i].id, NULL, &results[n]);
+    bench_print(stdout, &results[n++]);
+  }
+  bench_run("current_utc_time()", bm_current_utc_time, NULL, NULL, &results[n]);
+  bench_print(stdout, &results[n++]);
+  bench_run("nanotime()", bm_nanotime, NULL, NULL, &results[n]);
+  bench_print(stdout, &results[n++]);
+  bench_run("cached_nanotime() coarse", bm_cached_nanotime, NULL, NULL, &results[n]);
+  bench_print(stdout, &results[n++]);
+  nanotime_cache_start(1000);
+  bench_run("cached_nanotime() ticker", bm_cached_nanotime, NULL, NULL, &results[n]);
+  bench_print(stdout, &results[n++]);
+  nanotime_cache_stop();
+#if defined(__x86_64__)
+  bench_run("rdtsc", bm_rdtsc, NULL, NULL, &results[n]);
+  bench_print(stdout, &results[n++]);
+  bench_run("rdtscp", bm_rdtscp, NULL, NULL, &results[n]);
+  bench_print(stdout, &results[n++]);
+#endif
+
+  if(argc > 1){
+    FILE* out = fopen(argv[1], "w");
+    if(!out){
+      perror(argv[1]);
+      return 1;
+    }
+    bench_write_json(out, results, n);
+    fclose(out);
+  }
+  return 0;
+}
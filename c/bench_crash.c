@@ -0,0 +1,624 @@
+// What a stack trace costs on the crash path: capture, module lookup, symbol resolution,
+// demangling and output timed separately, cold and warm, for each symbolization backend
+// Author: Paul Foster
+// Public domain
+//
+// linux, build and run with:
+//   gcc -O2 -g -rdynamic -fno-omit-frame-pointer -o bench_crash bench_crash.c stack_dump_on_assert.c elfsym.c
+//       symbolizer.c unwind.c bench.c time.c -lpthread -ldl -lstdc++ && ./bench_crash
+// and for the libbfd handler, whose own phases can't be timed apart, so only its totals are:
+//   g++ -O2 -c stack_dump_on_assert_bfd.c && gcc -O2 -g -rdynamic -fno-omit-frame-pointer -DBENCH_BFD -o bench_crash_bfd
+//       bench_crash.c stack_dump_on_assert_bfd.o elfsym.c symbolizer.c unwind.c bench.c time.c -lbfd -lpthread -ldl -lstdc++
+// An optional argument names a JSON file for the results. $CXX (default c++) builds the libraries.
+//
+// For every symbol count a synthetic C++ shared library is generated and built with -g: that
+// many functions in nested namespaces, each with an inlined helper, and for every depth a chain
+// of that many template frames, each calling the next from an inlined function, that calls back
+// into the benchmark. So the traces go through long mangled names, inlined frames and three or
+// more modules, like a real one. The libraries are built with -O0, which compiles this much code
+// several times quicker, and always_inline still inlines.
+//
+// The phases:
+//   capture    backtrace(), unwind_fp() and unwind_cfi() at the bottom of the chain
+//   module     the module of every frame, from elfsym_resolve() with no room for frames, which
+//              stops there, or with dladdr1(), which also searches the symbols and is what
+//              backtrace_symbols() uses
+//   resolve    elfsym_resolve() of every frame, the call the assert handler makes, which is the
+//              module again and then the lookup in it. Or the demangled names from symbolizerd,
+//              or the dynamic symbol names backtrace_symbols() has
+//   demangle   __cxa_demangle() of every name elfsym found
+//   output     the report lines printed to /dev/null and flushed
+//   total      stack_dump_capture() and stack_dump_print(), which is what the assert handler does,
+//              with its own lookups and with stack_dump_set_symbolizer(symbolizer_resolve)
+// Cold is a fresh process that hasn't unwound or symbolized anything: a child is forked before
+// the parent warms up anything and measures the first call, COLD_RUNS times. The files are in
+// the page cache by then, and symbolizerd keeps its tables between processes, which is its point.
+// Warm is bench_run() repeating the call in the parent. symbolizerd is skipped if it isn't running.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <execinfo.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "elfsym.h"
+#include "symbolizer.h"
+#include "unwind.h"
+#include "time.h"
+#ifdef BENCH_BFD
+#include "stack_dump_on_assert_bfd.h"
+#define HANDLER "bfd"
+#else
+#include "stack_dump_on_assert.h"
+#define HANDLER "elfsym"
+#endif
+
+char* __cxa_demangle(const char* mangled, char* buf, size_t* len, int* status);
+
+#define MAX_FRAMES   256
+#define MAX_INLINE   16
+#define MAX_ROWS     512
+#define COLD_RUNS    5
+
+static const int symbol_counts[] = { 1000, 10000, 50000 };
+static const int depths[] = { 8, 32, 128 };
+#define NSYMS   (int)(sizeof(symbol_counts) / sizeof(symbol_counts[0]))
+#define NDEPTHS (int)(sizeof(depths) / sizeof(depths[0]))
+
+struct unwinder
+{
+  const char* name;
+  int (*fn)(void** addrs, int max_frames);
+};
+
+static const struct unwinder unwinders[] = {
+  { "backtrace", backtrace },
+  { "unwind_fp", unwind_fp },
+  { "unwind_cfi", unwind_cfi },
+};
+#define NUNWINDERS (int)(sizeof(unwinders) / sizeof(unwinders[0]))
+
+// One stack on its way to the report
+struct stack
+{
+  void*               trace[MAX_FRAMES];
+  int                 n;
+  const char*         module[MAX_FRAMES];    //the module's path, NULL if it wasn't found
+  struct elfsym_frame frames[MAX_FRAMES][MAX_INLINE];
+  int                 nframes[MAX_FRAMES];
+  char*               names[MAX_FRAMES][MAX_INLINE];  //demangled, NULL if the name wasn't mangled
+};
+
+struct row
+{
+  char                name[96];
+  const char*         phase;
+  const char*         backend;
+  const char*         cache;
+  int                 symbols, depth, frames;
+  struct bench_result r;
+};
+
+static struct row rows[MAX_ROWS];
+static int nrows;
+
+static struct stack stack;
+static FILE* devnull;
+static int have_daemon;
+static const struct bench_config config = { 10000000ull, 5000000ull, 9, 3.0 };
+
+// --- the phases ---
+
+// How the handler finds a frame's module: elfsym_resolve() stops there when there's no room
+static void find_modules(struct stack* s)
+{
+  int i;
+  for(i = 0; i < s->n; i++)
+    elfsym_resolve((char*)s->trace[i] - 1, NULL, 0, &s->module[i]);
+}
+
+static void find_modules_dladdr(struct stack* s)
+{
+  int i;
+  for(i = 0; i < s->n; i++){
+    Dl_info info;
+    struct link_map* lm = NULL;
+    s->module[i] = NULL;
+    if(dladdr1((char*)s->trace[i] - 1, &info, (void**)&lm, RTLD_DL_LINKMAP) && lm)
+      s->module[i] = *lm->l_name ? lm->l_name : "/proc/self/exe";
+  }
+}
+
+// What printSourceLines() calls. The first time, elfsym parses the modules.
+static void resolve(struct stack* s)
+{
+  int i;
+  for(i = 0; i < s->n; i++)
+    s->nframes[i] = elfsym_resolve((char*)s->trace[i] - 1, s->frames[i], MAX_INLINE, &s->module[i]);
+}
+
+static void demangle(struct stack* s)
+{
+  int i, j;
+  for(i = 0; i < s->n; i++){
+    for(j = 0; j < s->nframes[i]; j++){
+      int status = -1;
+      free(s->names[i][j]);
+      s->names[i][j] = s->frames[i][j].function ? __cxa_demangle(s->frames[i][j].function, NULL, NULL, &status) : NULL;
+    }
+  }
+}
+
+// The lines printSourceLines() writes
+static void output(FILE* out, const struct stack* s)
+{
+  int i, j;
+  for(i = 0; i < s->n; i++){
+    const char* path = s->module[i] ? s->module[i] : "??";
+    fprintf(out, "  %-30s [%p]\n", path, s->trace[i]);
+    if(s->nframes[i] == 0)
+      fprintf(out, "      ??:0\n");
+    for(j = 0; j < s->nframes[i]; j++){
+      const struct elfsym_frame* f = &s->frames[i][j];
+      const char* name = s->names[i][j] ? s->names[i][j] : f->function ? f->function : "??";
+      fprintf(out, "      %s:%u %s%s\n", f->file ? f->file : "??", f->line, name, j < s->nframes[i] - 1 ? " (inlined)" : "");
+    }
+  }
+  fflush(out);
+}
+
+static void total(FILE* out)
+{
+  void* addrs[MAX_FRAMES];
+  int n = stack_dump_capture(addrs, MAX_FRAMES, 0);
+  stack_dump_print(out, addrs, n);
+  fflush(out);
+}
+
+static void bm_capture(uint64_t iters, void* arg)
+{
+  const struct unwinder* u = (const struct unwinder*)arg;
+  void* addrs[MAX_FRAMES];
+  uint64_t i;
+  for(i = 0; i < iters; i++)
+    BENCH_DO_NOT_OPTIMIZE(u->fn(addrs, MAX_FRAMES));
+}
+
+static void bm_module(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++){
+    find_modules(&stack);
+    BENCH_CLOBBER();
+  }
+}
+
+static void bm_module_dladdr(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++){
+    find_modules_dladdr(&stack);
+    BENCH_CLOBBER();
+  }
+}
+
+static void bm_resolve(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++){
+    resolve(&stack);
+    BENCH_CLOBBER();
+  }
+}
+
+static void bm_demangle(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++){
+    demangle(&stack);
+    BENCH_CLOBBER();
+  }
+}
+
+static void bm_output(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++)
+    output(devnull, &stack);
+}
+
+static void bm_symbolizerd(uint64_t iters, void* arg)
+{
+  void* calls[MAX_FRAMES];
+  uint64_t i;
+  int j;
+  (void)arg;
+  for(j = 0; j < stack.n; j++)
+    calls[j] = (char*)stack.trace[j] - 1;
+  for(i = 0; i < iters; i++)
+    free(symbolizer_resolve(calls, stack.n));
+}
+
+static void bm_backtrace_symbols(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++)
+    free(backtrace_symbols(stack.trace, stack.n));
+}
+
+static void bm_total(uint64_t iters, void* arg)
+{
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++)
+    total(devnull);
+}
+
+// --- bookkeeping ---
+
+static struct row* add_row(const char* phase, const char* backend, const char* cache, int symbols, int depth, int frames)
+{
+  struct row* r = &rows[nrows++];
+  snprintf(r->name, sizeof(r->name), "%s %s %s", phase, backend, cache);
+  r->phase = phase;
+  r->backend = backend;
+  r->cache = cache;
+  r->symbols = symbols;
+  r->depth = depth;
+  r->frames = frames;
+  return r;
+}
+
+static void warm(const char* phase, const char* backend, bench_fn fn, void* arg, int symbols, int depth, int frames)
+{
+  struct row* r;
+  if(nrows == MAX_ROWS)
+    return;
+  r = add_row(phase, backend, "warm", symbols, depth, frames);
+  bench_run(r->name, fn, arg, &config, &r->r);
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// The first calls of COLD_RUNS processes, as a result like bench_run()'s
+static void cold(const char* phase, const char* backend, const uint64_t* ns, int n, int symbols, int depth, int frames)
+{
+  double v[COLD_RUNS], dev[COLD_RUNS];
+  struct row* r;
+  int i;
+  if(nrows == MAX_ROWS || n == 0)
+    return;
+  r = add_row(phase, backend, "cold", symbols, depth, frames);
+  for(i = 0; i < n; i++)
+    v[i] = (double)ns[i];
+  qsort(v, n, sizeof(double), cmp_double);
+  memset(&r->r, 0, sizeof(r->r));
+  r->r.name = r->name;
+  r->r.iters = 1;
+  r->r.reps = n;
+  r->r.median_ns = n % 2 ? v[n/2] : 0.5 * (v[n/2 - 1] + v[n/2]);
+  r->r.min_ns = v[0];
+  r->r.max_ns = v[n-1];
+  for(i = 0; i < n; i++)
+    dev[i] = v[i] > r->r.median_ns ? v[i] - r->r.median_ns : r->r.median_ns - v[i];
+  qsort(dev, n, sizeof(double), cmp_double);
+  r->r.mad_ns = n % 2 ? dev[n/2] : 0.5 * (dev[n/2 - 1] + dev[n/2]);
+}
+
+static void write_json(FILE* out)
+{
+  int i;
+  fprintf(out, "[\n");
+  for(i = 0; i < nrows; i++){
+    const struct row* r = &rows[i];
+    fprintf(out, "  {\"name\":\"%s\",\"phase\":\"%s\",\"backend\":\"%s\",\"cache\":\"%s\",\"symbols\":%d,\"depth\":%d,"
+                 "\"frames\":%d,\"median_ns\":%.4f,\"mad_ns\":%.4f,\"min_ns\":%.4f,\"max_ns\":%.4f,"
+                 "\"iters\":%llu,\"reps\":%u,\"outliers\":%u}%s\n",
+            r->name, r->phase, r->backend, r->cache, r->symbols, r->depth, r->frames,
+            r->r.median_ns, r->r.mad_ns, r->r.min_ns, r->r.max_ns,
+            (unsigned long long)r->r.iters, r->r.reps, r->r.outliers, i+1 < nrows ? "," : "");
+  }
+  fprintf(out, "]\n");
+}
+
+// --- the synthetic libraries ---
+
+typedef int (*synth_cb)(void* arg);
+typedef int (*synth_enter)(synth_cb cb, void* arg);
+
+struct library
+{
+  int         symbols;
+  char        path[1024];
+  void*       handle;
+  synth_enter enter[NDEPTHS];
+};
+
+static int build_library(const char* dir, struct library* lib)
+{
+  const char* cxx = getenv("CXX") ? getenv("CXX") : "c++";
+  char src[1024], cmd[4096];
+  uint64_t t;
+  FILE* f;
+  int i;
+
+  snprintf(src, sizeof(src), "%s/synth%d.cc", dir, lib->symbols);
+  snprintf(lib->path, sizeof(lib->path), "%s/libsynth%d.so", dir, lib->symbols);
+  if(!(f = fopen(src, "w")))
+    return -1;
+  fprintf(f, "volatile int synth_sink;\n"
+             "static inline __attribute__((always_inline)) int synth_mix(int x){ return (int)((unsigned)(x ^ synth_sink) * 2654435761u >> 7); }\n");
+  for(i = 0; i < lib->symbols; i++)
+    fprintf(f, "namespace synth { namespace unit%d { int filler%d(const int* v, unsigned n){ return synth_mix(v[n %% 8] + %d); } } }\n",
+            i / 100, i, i);
+  // every call in the chain is made from an inlined function, so each frame has two
+  fprintf(f, "namespace synth {\n"
+             "template<int D> struct Chain { __attribute__((noinline)) static int run(int (*cb)(void*), void* arg); };\n"
+             "template<int D> inline __attribute__((always_inline)) int step(int (*cb)(void*), void* arg){ return Chain<D>::run(cb, arg) + synth_sink; }\n"
+             "template<int D> int Chain<D>::run(int (*cb)(void*), void* arg){ int r = step<D-1>(cb, arg); return r + synth_mix(r); }\n"
+             "template<> int Chain<1>::run(int (*cb)(void*), void* arg){ int r = cb(arg); return r + synth_mix(r); }\n"
+             "}\n");
+  for(i = 0; i < NDEPTHS; i++)
+    fprintf(f, "extern \"C\" int synth_enter_%d(int (*cb)(void*), void* arg){ return synth::Chain<%d>::run(cb, arg); }\n",
+            depths[i], depths[i]);
+  if(fclose(f))
+    return -1;
+
+  printf("building %s with %d functions... ", lib->path, lib->symbols);
+  fflush(stdout);
+  t = nanotime();
+  snprintf(cmd, sizeof(cmd), "%s -O0 -g -fPIC -fno-omit-frame-pointer -shared -o %s %s", cxx, lib->path, src);
+  if(system(cmd)){
+    printf("failed: %s\n", cmd);
+    return -1;
+  }
+  printf("%.1f s\n", (nanotime() - t) / 1e9);
+  unlink(src);
+
+  if(!(lib->handle = dlopen(lib->path, RTLD_NOW | RTLD_LOCAL))){
+    printf("%s\n", dlerror());
+    return -1;
+  }
+  for(i = 0; i < NDEPTHS; i++){
+    char name[64];
+    snprintf(name, sizeof(name), "synth_enter_%d", depths[i]);
+    if(!(lib->enter[i] = (synth_enter)dlsym(lib->handle, name)))
+      return -1;
+  }
+  return 0;
+}
+
+// --- cold: forked at the bottom of the chain, before the parent has warmed anything ---
+
+enum { T_CAPTURE, T_MODULE = T_CAPTURE + NUNWINDERS, T_MODULE_DLADDR, T_RESOLVE, T_DEMANGLE, T_OUTPUT, T_TOTAL, T_TOTAL_DAEMON, T_FRAMES, NTIMES };
+
+static void cold_phases(uint64_t* t)
+{
+  void* addrs[MAX_FRAMES];
+  uint64_t t0;
+  int u, n;
+
+  // the first one is backtrace(), its trace is the one symbolized
+  for(u = 0; u < NUNWINDERS; u++){
+    t0 = nanotime();
+    n = unwinders[u].fn(u ? addrs : stack.trace, MAX_FRAMES);
+    t[T_CAPTURE + u] = nanotime() - t0;
+    if(u == 0)
+      stack.n = n;
+  }
+  t[T_FRAMES] = stack.n;
+  t0 = nanotime();
+  find_modules_dladdr(&stack);
+  t[T_MODULE_DLADDR] = nanotime() - t0;
+  t0 = nanotime();
+  find_modules(&stack);
+  t[T_MODULE] = nanotime() - t0;
+  t0 = nanotime();
+  resolve(&stack);
+  t[T_RESOLVE] = nanotime() - t0;
+  t0 = nanotime();
+  demangle(&stack);
+  t[T_DEMANGLE] = nanotime() - t0;
+  t0 = nanotime();
+  output(devnull, &stack);
+  t[T_OUTPUT] = nanotime() - t0;
+}
+
+static void cold_total(uint64_t* t)
+{
+  uint64_t t0 = nanotime();
+  total(devnull);
+  t[T_TOTAL] = nanotime() - t0;
+}
+
+static void cold_total_daemon(uint64_t* t)
+{
+  uint64_t t0;
+  stack_dump_set_symbolizer(symbolizer_resolve);
+  t0 = nanotime();
+  total(devnull);
+  t[T_TOTAL_DAEMON] = nanotime() - t0;
+}
+
+// Runs fn in a child and adds what it measured to t
+static int in_child(void (*fn)(uint64_t* t), uint64_t* t)
+{
+  uint64_t got[NTIMES];
+  int fds[2], i, status;
+  pid_t pid;
+
+  if(pipe(fds))
+    return -1;
+  fflush(stdout);
+  if((pid = fork()) < 0)
+    return -1;
+  if(pid == 0){
+    memset(got, 0, sizeof(got));
+    close(fds[0]);
+    fn(got);
+    _exit(write(fds[1], got, sizeof(got)) == sizeof(got) ? 0 : 1);
+  }
+  close(fds[1]);
+  i = read(fds[0], got, sizeof(got)) == sizeof(got);
+  close(fds[0]);
+  waitpid(pid, &status, 0);
+  if(!i)
+    return -1;
+  for(i = 0; i < NTIMES; i++)
+    t[i] += got[i];
+  return 0;
+}
+
+struct run
+{
+  int symbols, depth;
+  int cold_done;
+};
+
+static int at_depth_cold(void* arg)
+{
+  struct run* run = (struct run*)arg;
+  uint64_t samples[NTIMES][COLD_RUNS];
+  int i, k, n = 0, frames;
+
+  for(i = 0; i < COLD_RUNS; i++){
+    uint64_t t[NTIMES];
+    memset(t, 0, sizeof(t));
+    if(in_child(cold_phases, t) || in_child(cold_total, t) || (have_daemon && in_child(cold_total_daemon, t)))
+      continue;
+    for(k = 0; k < NTIMES; k++)
+      samples[k][n] = t[k];
+    n++;
+  }
+  // the parent mustn't unwind here, or the children forked for the next library would inherit it
+  frames = n ? (int)samples[T_FRAMES][0] : 0;
+
+  for(i = 0; i < NUNWINDERS; i++)
+    cold("capture", unwinders[i].name, samples[T_CAPTURE + i], n, run->symbols, run->depth, frames);
+  cold("module", "elfsym", samples[T_MODULE], n, run->symbols, run->depth, frames);
+  cold("module", "dladdr", samples[T_MODULE_DLADDR], n, run->symbols, run->depth, frames);
+  cold("resolve", "elfsym", samples[T_RESOLVE], n, run->symbols, run->depth, frames);
+  cold("demangle", "cxa_demangle", samples[T_DEMANGLE], n, run->symbols, run->depth, frames);
+  cold("output", "fprintf", samples[T_OUTPUT], n, run->symbols, run->depth, frames);
+  cold("total", HANDLER, samples[T_TOTAL], n, run->symbols, run->depth, frames);
+  if(have_daemon)
+    cold("total", "symbolizerd", samples[T_TOTAL_DAEMON], n, run->symbols, run->depth, frames);
+  run->cold_done = n;
+  return 0;
+}
+
+// --- warm ---
+
+static int at_depth_warm(void* arg)
+{
+  struct run* run = (struct run*)arg;
+  int u;
+
+  for(u = 0; u < NUNWINDERS; u++){
+    void* addrs[MAX_FRAMES];
+    warm("capture", unwinders[u].name, bm_capture, (void*)&unwinders[u], run->symbols, run->depth, unwinders[u].fn(addrs, MAX_FRAMES));
+  }
+  // the trace the other phases work on, which stays valid while the library is loaded
+  stack.n = backtrace(stack.trace, MAX_FRAMES);
+  warm("total", HANDLER, bm_total, NULL, run->symbols, run->depth, stack.n);
+  if(have_daemon){
+    stack_dump_set_symbolizer(symbolizer_resolve);
+    warm("total", "symbolizerd", bm_total, NULL, run->symbols, run->depth, stack.n);
+    stack_dump_set_symbolizer(NULL);
+  }
+  return 0;
+}
+
+static void warm_phases(const struct run* run)
+{
+  find_modules(&stack);
+  resolve(&stack);
+  demangle(&stack);
+  warm("module", "elfsym", bm_module, NULL, run->symbols, run->depth, stack.n);
+  warm("module", "dladdr", bm_module_dladdr, NULL, run->symbols, run->depth, stack.n);
+  warm("resolve", "elfsym", bm_resolve, NULL, run->symbols, run->depth, stack.n);
+  if(have_daemon)
+    warm("resolve", "symbolizerd", bm_symbolizerd, NULL, run->symbols, run->depth, stack.n);
+  warm("resolve", "backtrace_symbols", bm_backtrace_symbols, NULL, run->symbols, run->depth, stack.n);
+  warm("demangle", "cxa_demangle", bm_demangle, NULL, run->symbols, run->depth, stack.n);
+  warm("output", "fprintf", bm_output, NULL, run->symbols, run->depth, stack.n);
+}
+
+int main(int argc, char** argv)
+{
+  char dir[] = "/tmp/bench_crash.XXXXXX";
+  struct library libs[NSYMS];
+  int s, d, i, ok = 1;
+
+  if(!mkdtemp(dir) || !(devnull = fopen("/dev/null", "w"))){
+    perror("bench_crash");
+    return 1;
+  }
+  memset(libs, 0, sizeof(libs));
+  for(s = 0; s < NSYMS && ok; s++){
+    libs[s].symbols = symbol_counts[s];
+    ok = !build_library(dir, &libs[s]);
+  }
+  if(ok){
+    void* probe[1] = { (void*)main };
+    struct symbolizer_stack* answer = symbolizer_resolve(probe, 1);
+    have_daemon = answer != NULL;
+    free(answer);
+    printf("symbolizerd %s\n", have_daemon ? "answered, including it" : "isn't running, skipping it");
+
+    // everything cold first, while the parent has nothing cached
+    for(s = 0; s < NSYMS; s++){
+      for(d = 0; d < NDEPTHS; d++){
+        struct run run = { symbol_counts[s], depths[d], 0 };
+        libs[s].enter[d](at_depth_cold, &run);
+        if(!run.cold_done)
+          printf("the cold runs failed for %d symbols, depth %d\n", run.symbols, run.depth);
+      }
+    }
+    for(s = 0; s < NSYMS; s++){
+      for(d = 0; d < NDEPTHS; d++){
+        struct run run = { symbol_counts[s], depths[d], 0 };
+        libs[s].enter[d](at_depth_warm, &run);
+        warm_phases(&run);
+      }
+    }
+
+    for(s = 0; s < NSYMS; s++){
+      for(d = 0; d < NDEPTHS; d++){
+        printf("\n%d symbols, depth %d\n", symbol_counts[s], depths[d]);
+        for(i = 0; i < nrows; i++)
+          if(rows[i].symbols == symbol_counts[s] && rows[i].depth == depths[d])
+            bench_print(stdout, &rows[i].r);
+      }
+    }
+    if(argc > 1){
+      FILE* f = fopen(argv[1], "w");
+      if(f){
+        write_json(f);
+        fclose(f);
+      }
+    }
+  }
+
+  for(s = 0; s < NSYMS; s++)
+    unlink(libs[s].path);
+  rmdir(dir);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+// Compares the in-process elfsym lookups against the addr2line/nm shell pipeline that
+// stack_dump_on_assert used to run for every frame
+// Author: Paul Foster
+// Public domain
+//
+// linux, build and run with:
+//   gcc -O2 -g -rdynamic -o bench_symbolize bench_symbolize.c elfsym.c bench.c time.c -lpthread && ./bench_symbolize
+// An optional argument names a JSON file for the results.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <execinfo.h>
+
+#include "bench.h"
+#include "elfsym.h"
+
+#define DEPTH 8
+
+static void* trace[64];
+static int   ntrace;
+static char** names;
+
+__attribute__((noinline)) static void capture(int depth)
+{
+  if(depth > 0){
+    capture(depth - 1);
+    BENCH_CLOBBER();  //no tail call
+    return;
+  }
+  ntrace = backtrace(trace, 64);
+}
+
+// Every frame of the trace, the way the assert handler resolves them
+static void bm_elfsym_warm(uint64_t iters, void* arg)
+{
+  struct elfsym_frame f[16];
+  uint64_t i;
+  int j;
+  (void)arg;
+  for(i = 0; i < iters; i++)
+    for(j = 0; j < ntrace; j++)
+      BENCH_DO_NOT_OPTIMIZE(elfsym_resolve((char*)trace[j] - 1, f, 16, NULL));
+}
+
+// The first trace through a module: open it, parse the symbols, lines and inlines, one lookup
+static void bm_elfsym_cold(uint64_t iters, void* arg)
+{
+  struct elfsym_frame f[16];
+  uint64_t i;
+  (void)arg;
+  for(i = 0; i < iters; i++){
+    struct elfsym_module* m = elfsym_open("/proc/self/exe");
+    BENCH_DO_NOT_OPTIMIZE(elfsym_lookup(m, 0x1000, f, 16));
+    elfsym_close(m);
+  }
+}
+
+// The old per frame pipeline, for the frames backtrace_symbols could name
+static void bm_shell(uint64_t iters, void* arg)
+{
+  char cmd[4096];
+  uint64_t i;
+  int j;
+  (void)arg;
+  for(i = 0; i < iters; i++){
+    for(j = 0; j < ntrace; j++){
+      char line[1024];
+      char* name = strchr(strcpy(line, names[j]), '(');
+      char* off = name ? strchr(name, '+') : NULL;
+      char* end = off ? strchr(off, ')') : NULL;
+      if(!end || name + 1 == off)
+        continue;
+      *name++ = *off++ = *end = '\0';
+      snprintf(cmd, sizeof(cmd),
+               "addr2line  -i -e %s"
+               " $( printf '%%x\\n' $(( 0x0`nm %s 2>/dev/null"
+                  " | grep ' %s' "
+                  " | cut -d \" \" -f 1` +%s"
+               " )) 2>/dev/null) >/dev/null 2>&1", line, line, name, off);
+      BENCH_DO_NOT_OPTIMIZE(system(cmd));
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  struct bench_config slow = { 0, 1000000, 5, 3.0 };
+  struct bench_result r[3];
+  int i, named = 0;
+
+  capture(DEPTH);
+  names = backtrace_symbols(trace, ntrace);
+  for(i = 0; i < ntrace; i++){
+    char* p = strchr(names[i], '(');
+    named += p && p[1] != '+' && p[1] != ')';
+  }
+  printf("%d frames, %d with a symbol name for the shell pipeline\n", ntrace, named);
+
+  bench_run("elfsym_resolve, whole trace (cached)", bm_elfsym_warm, NULL, NULL, &r[0]);
+  bench_run("elfsym open+parse+lookup (first trace)", bm_elfsym_cold, NULL, &slow, &r[1]);
+  bench_run("addr2line/nm shell-out, whole trace", bm_shell, NULL, &slow, &r[2]);
+  for(i = 0; i < 3; i++)
+    bench_print(stdout, &r[i]);
+  printf("cached lookups are %.0fx faster than the shell-out\n", r[2].median_ns / r[0].median_ns);
+
+  if(argc > 1){
+    FILE* f = fopen(argv[1], "w");
+    if(f){
+      bench_write_json(f, r, 3);
+      fclose(f);
+    }
+  }
+  free(names);
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Cost per frame of backtrace() against the frame pointer and cached CFI unwinders
+// Author: Paul Foster
+// Public domain
+//
+// linux, build and run with:
+//   gcc -O2 -g -fno-omit-frame-pointer -o bench_unwind bench_unwind.c unwind.c bench.c time.c -lpthread && ./bench_unwind
+// Frame pointers are kept so unwind_fp() sees the same frames as the others, which is checked
+// before timing, along with the _context versions surviving a frame pointer into a PROT_NONE
+// page. An optional argument names a JSON file for the results.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+#include "unwind.h"
+
+#define MAX_FRAMES 128
+#define NBENCH 6
+
+struct unwinder
+{
+  const char* name;
+  int (*fn)(void** addrs, int max_frames);
+};
+
+static const struct unwinder unwinders[] = {
+  { "backtrace", backtrace },
+  { "unwind_fp", unwind_fp },
+  { "unwind_cfi", unwind_cfi },
+};
+
+static struct bench_result results[NBENCH];
+static int nresults;
+static int frames[NBENCH];
+
+static void bm_unwind(uint64_t iters, void* arg)
+{
+  const struct unwinder* u = (const struct unwinder*)arg;
+  void* addrs[MAX_FRAMES];
+  uint64_t i;
+  for(i = 0; i < iters; i++)
+    BENCH_DO_NOT_OPTIMIZE(u->fn(addrs, MAX_FRAMES));
+}
+
+// Everything below main's own frame has the frame pointer, so stop comparing there
+static int same_frames(void** a, int na, void** b, int nb, int depth)
+{
+  int i;
+  for(i = 1; i < depth && i < na && i < nb; i++)
+    if(a[i] != b[i])
+      return 0;
+  return na > depth && nb > depth;
+}
+
+__attribute__((noinline)) static void run_at(int depth, int want)
+{
+  if(depth < want){
+    run_at(depth + 1, want);
+    BENCH_CLOBBER();  //no tail call
+    return;
+  }
+
+  void* ref[MAX_FRAMES];
+  void* got[MAX_FRAMES];
+  int nref = backtrace(ref, MAX_FRAMES);
+  size_t u;
+  for(u = 0; u < sizeof(unwinders) / sizeof(unwinders[0]); u++){
+    char name[64];
+    int n = unwinders[u].fn(got, MAX_FRAMES);
+    if(!same_frames(ref, nref, got, n, want))
+      printf("%s doesn't agree with backtrace() at depth %d\n", unwinders[u].name, want);
+    snprintf(name, sizeof(name), "%s, %d frames", unwinders[u].name, n);
+    frames[nresults] = n;
+    bench_run(strdup(name), bm_unwind, (void*)&unwinders[u], NULL, &results[nresults++]);
+  }
+}
+
+// A guard page is mapped, so a check that only asks whether it is mapped lets the load fault
+static void check_prot_none()
+{
+  ucontext_t uc;
+  void* addrs[MAX_FRAMES];
+  char* guard = (char*)mmap(NULL, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(guard == MAP_FAILED || getcontext(&uc))
+    return;
+#if defined(__x86_64__)
+  uc.uc_mcontext.gregs[REG_RBP] = (greg_t)(guard + 64);
+  uc.uc_mcontext.gregs[REG_RSP] = (greg_t)(guard + 64);
+#elif defined(__aarch64__)
+  uc.uc_mcontext.regs[29] = (uintptr_t)(guard + 64);
+  uc.uc_mcontext.sp = (uintptr_t)(guard + 64);
+#endif
+  if(unwind_fp_context(&uc, addrs, MAX_FRAMES) != 1 || unwind_cfi_context(&uc, addrs, MAX_FRAMES) != 1)
+    printf("unwinding from a PROT_NONE frame went past it\n");
+  munmap(guard, 4096);
+}
+
+int main(int argc, char** argv)
+{
+  int i;
+
+  check_prot_none();
+  run_at(0, 8);
+  run_at(0, 32);
+  for(i = 0; i < nresults; i++){
+    bench_print(stdout, &results[i]);
+    printf("  %.1f ns per frame\n", results[i].median_ns / frames[i]);
+  }
+  printf("at depth 32, unwind_fp is %.0fx and unwind_cfi %.0fx faster than backtrace()\n",
+         results[3].median_ns / results[4].median_ns, results[3].median_ns / results[5].median_ns);
+
+  if(argc > 1){
+    FILE* f = fopen(argv[1], "w");
+    if(f){
+      bench_write_json(f, results, nresults);
+      fclose(f);
+    }
+  }
+  return 0;
+}
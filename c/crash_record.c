@@ -0,0 +1,349 @@
+// Crash handler that writes a binary record for offline symbolization, see crash_record.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c crash_record.c
+//
+// The module list is read from /proc/self/maps rather than dl_iterate_phdr, which takes the
+// loader lock. The build-id and load bias of each module are read from its ELF and program
+// headers in memory, only where they lie inside the mapping at file offset 0, so a module that
+// was mapped some unusual way gets no build-id instead of a second fault.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <signal.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "crash_record.h"
+
+#define ALTSTACK_SIZE (256*1024)
+
+extern char* program_invocation_short_name;
+
+static char record_prefix[CRASH_PATH_MAX + 64];  //dir/program.
+static uintptr_t page_mask;
+static int crashing_tid = 0;
+
+// Everything the handler touches is allocated up front
+static struct {
+  struct crash_record_header hdr;
+  uint64_t frames[CRASH_MAX_FRAMES];
+  struct crash_record_module modules[CRASH_MAX_MODULES];
+  void*    raw[CRASH_MAX_FRAMES];
+  char     maps[4096];
+  char     path[sizeof(record_prefix) + 32];
+  char     msg[sizeof(record_prefix) + 128];
+  // the last mapping at file offset 0, whose headers the following mappings of the file share
+  char     elf_path[CRASH_PATH_MAX];
+  uint64_t elf_bias;
+  uint8_t  elf_id[CRASH_BUILD_ID_MAX];
+  uint32_t elf_id_size;
+} rec;
+
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+static uintptr_t fault_pc(void* uc)
+{
+#if defined(__x86_64__)
+  return (uintptr_t)((ucontext_t*)uc)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+  return (uintptr_t)((ucontext_t*)uc)->uc_mcontext.pc;
+#else
+  return 0;
+#endif
+}
+
+static char* append(char* p, const char* end, const char* s)
+{
+  while(*s && p < end - 1)
+    *p++ = *s++;
+  *p = '\0';
+  return p;
+}
+
+static char* append_dec(char* p, const char* end, long v)
+{
+  char tmp[24];
+  int i = sizeof(tmp) - 1;
+  tmp[i] = '\0';
+  do{
+    tmp[--i] = '0' + v % 10;
+    v /= 10;
+  }while(v > 0);
+  return append(p, end, tmp + i);
+}
+
+static uint64_t parse_hex(const char** s)
+{
+  uint64_t v = 0;
+  for(;; (*s)++){
+    char c = **s;
+    if(c >= '0' && c <= '9')
+      v = v * 16 + (c - '0');
+    else if(c >= 'a' && c <= 'f')
+      v = v * 16 + (c - 'a' + 10);
+    else
+      return v;
+  }
+}
+
+static int inside(uint64_t a, uint64_t size, uint64_t start, uint64_t end)
+{
+  return a >= start && a + size <= end && a + size >= a;
+}
+
+// The ELF header at the start of a mapping at offset 0: the load bias and the build-id
+static void read_elf_headers(uint64_t start, uint64_t end, const char* path)
+{
+  const Elf64_Ehdr* eh = (const Elf64_Ehdr*)start;
+  int i;
+
+  rec.elf_path[0] = '\0';
+  rec.elf_id_size = 0;
+  if(!inside(start, sizeof(Elf64_Ehdr), start, end) || memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS64)
+    return;
+  if(eh->e_phentsize != sizeof(Elf64_Phdr) || !inside(start + eh->e_phoff, (uint64_t)eh->e_phnum * sizeof(Elf64_Phdr), start, end))
+    return;
+  const Elf64_Phdr* ph = (const Elf64_Phdr*)(start + eh->e_phoff);
+
+  // the mapping at offset 0 is the first PT_LOAD
+  for(i = 0; i < eh->e_phnum; i++)
+    if(ph[i].p_type == PT_LOAD)
+      break;
+  if(i == eh->e_phnum)
+    return;
+  rec.elf_bias = start - (ph[i].p_vaddr & page_mask);
+  append(rec.elf_path, rec.elf_path + sizeof(rec.elf_path), path);
+
+  for(i = 0; i < eh->e_phnum; i++){
+    uint64_t note = rec.elf_bias + ph[i].p_vaddr, note_end = note + ph[i].p_filesz;
+    if(ph[i].p_type != PT_NOTE || !inside(note, ph[i].p_filesz, start, end))
+      continue;
+    while(note + sizeof(Elf64_Nhdr) <= note_end){
+      const Elf64_Nhdr* nh = (const Elf64_Nhdr*)note;
+      uint64_t desc = note + sizeof(Elf64_Nhdr) + ((nh->n_namesz + 3) & ~3u);
+      if(nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 && !memcmp(nh + 1, "GNU", 4)
+         && nh->n_descsz <= CRASH_BUILD_ID_MAX && desc + nh->n_descsz <= note_end){
+        memcpy(rec.elf_id, (const void*)desc, nh->n_descsz);
+        rec.elf_id_size = nh->n_descsz;
+        return;
+      }
+      note = desc + ((nh->n_descsz + 3) & ~3u);
+    }
+  }
+}
+
+// "start-end perms offset dev inode path"
+static void add_mapping(const char* line)
+{
+  const char* s = line;
+  uint64_t start = parse_hex(&s), end, offset;
+  const char* perms;
+  int field;
+
+  if(*s++ != '-')
+    return;
+  end = parse_hex(&s);
+  if(*s++ != ' ')
+    return;
+  perms = s;
+  s += 5;
+  offset = parse_hex(&s);
+  for(field = 0; field < 2 && *s; field++){  //dev and inode
+    while(*s == ' ')
+      s++;
+    while(*s && *s != ' ')
+      s++;
+  }
+  while(*s == ' ')
+    s++;
+  if(*s != '/')
+    return;  //anonymous, [stack], [vdso] and the like have no file to symbolize against
+
+  if(offset == 0 && perms[0] == 'r')
+    read_elf_headers(start, end, s);
+  if(perms[2] != 'x' || rec.hdr.nmodules == CRASH_MAX_MODULES)
+    return;
+
+  struct crash_record_module* m = &rec.modules[rec.hdr.nmodules++];
+  memset(m, 0, sizeof(*m));
+  m->start = start;
+  m->end = end;
+  append(m->path, m->path + sizeof(m->path), s);
+  if(!strcmp(s, rec.elf_path)){
+    m->bias = rec.elf_bias;
+    memcpy(m->build_id, rec.elf_id, rec.elf_id_size);
+    m->build_id_size = rec.elf_id_size;
+  }
+  else
+    m->bias = start - offset;  //no headers seen, right for the usual layouts
+}
+
+static void read_maps()
+{
+  int fd = open("/proc/self/maps", O_RDONLY);
+  int have = 0;
+  if(fd < 0)
+    return;
+  for(;;){
+    ssize_t n = read(fd, rec.maps + have, sizeof(rec.maps) - 1 - have);
+    if(n <= 0)
+      break;
+    have += (int)n;
+    rec.maps[have] = '\0';
+
+    char* line = rec.maps;
+    char* nl;
+    while((nl = strchr(line, '\n'))){
+      *nl = '\0';
+      add_mapping(line);
+      line = nl + 1;
+    }
+    have -= (int)(line - rec.maps);
+    memmove(rec.maps, line, have);
+    if(have == (int)sizeof(rec.maps) - 1)
+      have = 0;  //a line longer than the buffer, drop it
+  }
+  close(fd);
+}
+
+static int write_all(int fd, const void* p, size_t n)
+{
+  while(n){
+    ssize_t w = write(fd, p, n);
+    if(w < 0 && errno == EINTR)
+      continue;
+    if(w <= 0)
+      return -1;
+    p = (const char*)p + w;
+    n -= w;
+  }
+  return 0;
+}
+
+static void crash_handler(int signum, siginfo_t* info, void* uc)
+{
+  int tid = (int)syscall(SYS_gettid);
+  int expected = 0;
+  struct timespec ts;
+  char* p;
+
+  if(!__atomic_compare_exchange_n(&crashing_tid, &expected, tid, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+    if(expected == tid){
+      // crashed while writing the record, give up and take the default action
+      signal(signum, SIG_DFL);
+      raise(signum);
+      return;
+    }
+    // another thread is already writing, let it finish
+    for(;;){
+      struct timespec t = { 1, 0 };
+      nanosleep(&t, NULL);
+    }
+  }
+
+  rec.hdr.magic = CRASH_RECORD_MAGIC;
+  rec.hdr.version = CRASH_RECORD_VERSION;
+  rec.hdr.header_size = sizeof(struct crash_record_header);
+  rec.hdr.module_size = sizeof(struct crash_record_module);
+  rec.hdr.signo = signum;
+  rec.hdr.code = info->si_code;
+  rec.hdr.pid = getpid();
+  rec.hdr.tid = tid;
+  rec.hdr.fault_addr = (uintptr_t)info->si_addr;
+  rec.hdr.pc = fault_pc(uc);
+  clock_gettime(CLOCK_REALTIME, &ts);
+  rec.hdr.time_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+  // start at the faulting frame rather than in this handler
+  int n = backtrace(rec.raw, CRASH_MAX_FRAMES), i, first = 0;
+  for(i = 0; i < n; i++){
+    if((uintptr_t)rec.raw[i] == rec.hdr.pc){
+      first = i;
+      break;
+    }
+  }
+  rec.hdr.nframes = 0;
+  for(i = first; i < n; i++)
+    rec.frames[rec.hdr.nframes++] = (uintptr_t)rec.raw[i];
+
+  rec.hdr.nmodules = 0;
+  read_maps();
+
+  p = append(rec.path, rec.path + sizeof(rec.path), record_prefix);
+  p = append_dec(p, rec.path + sizeof(rec.path), rec.hdr.pid);
+  append(p, rec.path + sizeof(rec.path), ".crash");
+  int fd = open(rec.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  int ok = fd >= 0
+        && !write_all(fd, &rec.hdr, sizeof(rec.hdr))
+        && !write_all(fd, rec.frames, rec.hdr.nframes * sizeof(uint64_t))
+        && !write_all(fd, rec.modules, rec.hdr.nmodules * sizeof(struct crash_record_module));
+  if(fd >= 0)
+    close(fd);
+
+  p = append(rec.msg, rec.msg + sizeof(rec.msg), "Caught signal ");
+  p = append_dec(p, rec.msg + sizeof(rec.msg), signum);
+  p = append(p, rec.msg + sizeof(rec.msg), ok ? ", crash record written to " : ", could not write crash record ");
+  p = append(p, rec.msg + sizeof(rec.msg), rec.path);
+  append(p, rec.msg + sizeof(rec.msg), "\n");
+  write_all(2, rec.msg, strlen(rec.msg));
+
+  signal(signum, SIG_DFL);
+  raise(signum);
+}
+
+int crash_record_thread_init()
+{
+  stack_t ss;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t size = ALTSTACK_SIZE;
+
+  // with a guard page below, so overflowing the alternate stack faults instead of corrupting
+  char* p = (char*)mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    return -1;
+  mprotect(p, page, PROT_NONE);
+
+  ss.ss_sp = p + page;
+  ss.ss_size = size;
+  ss.ss_flags = 0;
+  return sigaltstack(&ss, NULL);
+}
+
+int setup_crash_record(const char* dir)
+{
+  struct sigaction sa;
+  unsigned int i;
+  char* p;
+
+  p = append(record_prefix, record_prefix + sizeof(record_prefix), dir ? dir : ".");
+  p = append(p, record_prefix + sizeof(record_prefix), "/");
+  p = append(p, record_prefix + sizeof(record_prefix), program_invocation_short_name);
+  append(p, record_prefix + sizeof(record_prefix), ".");
+  page_mask = ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+
+  // the first backtrace() loads libgcc_s, which must not happen inside the handler
+  backtrace(rec.raw, 1);
+  if(crash_record_thread_init())
+    return -1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = crash_handler;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigfillset(&sa.sa_mask);
+  for(i = 0; i < sizeof(crash_signals)/sizeof(crash_signals[0]); i++)
+    if(sigaction(crash_signals[i], &sa, NULL))
+      return -1;
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Crash handler that writes a small binary record for symbolizing later, instead of a stack trace
+// Author: Paul Foster
+// Public domain
+//
+// Resolving symbols is the slow and fragile part of a crash handler, and on a production build
+// with the debug info stripped it can't be done well anyway. This handler only writes what is
+// needed to do it later: the signal, the thread, the raw return addresses and the loaded modules
+// with their build-ids and load addresses. It runs on an alternate stack, makes only async-signal-
+// safe calls and takes a few microseconds. The record is symbolized offline, against the matching
+// unstripped binaries or debug files, with crash_symbolize:
+//   crash_symbolize [-d symbol_dir]... /var/crash/myserver.12345.crash
+//
+// To use, call setup_crash_record("/var/crash") from main, and crash_record_thread_init() at the
+// start of any other thread you want stack overflows reported for. Linux only.
+//
+// The record is the header, then nframes uint64_t addresses, innermost first, then nmodules
+// module entries. Everything is little endian.
+
+#ifndef P_CRASH_RECORD_H
+#define P_CRASH_RECORD_H
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CRASH_RECORD_MAGIC   0x48535243u  //"CRSH"
+#define CRASH_RECORD_VERSION 1
+#define CRASH_MAX_FRAMES     128
+#define CRASH_MAX_MODULES    512
+#define CRASH_BUILD_ID_MAX   32
+#define CRASH_PATH_MAX       256
+
+struct crash_record_header
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;     //sizeof(struct crash_record_header), so fields can be added at the end
+  uint16_t module_size;     //sizeof(struct crash_record_module)
+  uint16_t reserved;
+  int32_t  signo;
+  int32_t  code;            //si_code
+  int32_t  pid;
+  int32_t  tid;
+  uint64_t fault_addr;      //si_addr
+  uint64_t pc;
+  uint64_t time_ns;         //CLOCK_REALTIME
+  uint32_t nframes;
+  uint32_t nmodules;
+};
+
+// One executable mapping. A module with several gets several entries.
+struct crash_record_module
+{
+  uint64_t start;
+  uint64_t end;
+  uint64_t bias;            //subtract from an address to get the file address
+  uint8_t  build_id[CRASH_BUILD_ID_MAX];
+  uint32_t build_id_size;
+  uint32_t reserved;
+  char     path[CRASH_PATH_MAX];
+};
+
+// Installs the handler for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT. Records are written to
+// dir/<program>.<pid>.crash. Returns 0 on success.
+int setup_crash_record(const char* dir);
+
+// Installs an alternate signal stack for the calling thread. Returns 0 on success.
+int crash_record_thread_init();
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_CRASH_RECORD_H
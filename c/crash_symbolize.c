@@ -0,0 +1,235 @@
+// Symbolizes the crash records written by crash_record.c
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -O2 -o crash_symbolize crash_symbolize.c elfsym.c -lpthread
+// or as C++ to get demangled names: g++ -O2 -o crash_symbolize -x c++ crash_symbolize.c -x c++ elfsym.c -lpthread
+//
+//   crash_symbolize [-d symbol_dir]... record...
+//
+// Each module is looked up by build-id, in order: symbol_dir/.build-id/xx/rest.debug,
+// symbol_dir/.build-id/xx/rest, symbol_dir/<file name>(.debug), then the path the crashing process
+// loaded it from, which also finds /usr/lib/debug. A file is only used if its build-id matches,
+// so a binary that was rebuilt since the crash is not silently used with the old addresses.
+// Modules are opened once for all the records given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "crash_record.h"
+#include "elfsym.h"
+
+#ifdef __cplusplus
+#include <cxxabi.h>
+#endif
+
+#define MAX_DIRS 16
+
+struct opened
+{
+  char                  path[CRASH_PATH_MAX];
+  uint8_t               build_id[CRASH_BUILD_ID_MAX];
+  uint32_t              build_id_size;
+  struct elfsym_module* module;  //NULL if no matching file was found
+  char                  found[4096];
+};
+
+static const char* dirs[MAX_DIRS];
+static int ndirs;
+static struct opened* opened;
+static int nopened;
+
+static const char* signal_name(int signum)
+{
+  switch(signum){
+  case SIGABRT: return "SIGABRT";
+  case SIGSEGV: return "SIGSEGV";
+  case SIGBUS:  return "SIGBUS";
+  case SIGILL:  return "SIGILL";
+  case SIGFPE:  return "SIGFPE";
+  }
+  return "?";
+}
+
+static void print_function(const char* name)
+{
+#ifdef __cplusplus
+  int status = 0;
+  char* d = name ? abi::__cxa_demangle(name, NULL, NULL, &status) : NULL;
+  if(status == 0 && d){
+    printf("%s", d);
+    free(d);
+    return;
+  }
+#endif
+  printf("%s", name ? name : "??");
+}
+
+static struct elfsym_module* try_open(const char* path, const struct crash_record_module* want)
+{
+  struct elfsym_module* m = elfsym_open(path);
+  unsigned char id[CRASH_BUILD_ID_MAX];
+  int n;
+  if(!m || !want->build_id_size)
+    return m;
+  n = elfsym_build_id(m, id, sizeof(id));
+  if(n == (int)want->build_id_size && !memcmp(id, want->build_id, n))
+    return m;
+  elfsym_close(m);
+  return NULL;
+}
+
+static struct opened* find_module(const struct crash_record_module* mod)
+{
+  char hex[2*CRASH_BUILD_ID_MAX + 1], path[4096];
+  const char* base = strrchr(mod->path, '/');
+  struct opened* o;
+  uint32_t i;
+  int d;
+
+  for(d = 0; d < nopened; d++){
+    o = &opened[d];
+    if(o->build_id_size == mod->build_id_size && !memcmp(o->build_id, mod->build_id, mod->build_id_size)
+       && (mod->build_id_size || !strcmp(o->path, mod->path)))
+      return o;
+  }
+
+  opened = (struct opened*)realloc(opened, (nopened + 1) * sizeof(struct opened));
+  o = &opened[nopened++];
+  memset(o, 0, sizeof(*o));
+  memcpy(o->path, mod->path, sizeof(o->path));
+  memcpy(o->build_id, mod->build_id, sizeof(o->build_id));
+  o->build_id_size = mod->build_id_size;
+  base = base ? base + 1 : mod->path;
+  for(i = 0; i < mod->build_id_size; i++)
+    sprintf(hex + 2*i, "%02x", mod->build_id[i]);
+
+  for(d = 0; d < ndirs && !o->module; d++){
+    const char* formats[] = { "%s/.build-id/%.2s/%s.debug", "%s/.build-id/%.2s/%s", "%s/%s%s", "%s/%s%s.debug" };
+    int f;
+    for(f = 0; f < 4 && !o->module; f++){
+      if(f < 2 && mod->build_id_size < 2)
+        continue;
+      if(f < 2)
+        snprintf(path, sizeof(path), formats[f], dirs[d], hex, hex + 2);
+      else
+        snprintf(path, sizeof(path), formats[f], dirs[d], base, "");
+      if((o->module = try_open(path, mod)))
+        snprintf(o->found, sizeof(o->found), "%s", path);
+    }
+  }
+  if(!o->module && (o->module = try_open(mod->path, mod)))
+    snprintf(o->found, sizeof(o->found), "%s", mod->path);
+  if(!o->module)
+    fprintf(stderr, "no file with build-id %s found for %s\n", mod->build_id_size ? hex : "(none)", mod->path);
+  return o;
+}
+
+static int symbolize(const char* file)
+{
+  FILE* f = fopen(file, "rb");
+  struct crash_record_header hdr;
+  uint64_t* frames;
+  struct crash_record_module* mods;
+  uint32_t i, j;
+
+  if(!f){
+    perror(file);
+    return 1;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  if(fread(&hdr, 1, 12, f) != 12 || hdr.magic != CRASH_RECORD_MAGIC || hdr.version != CRASH_RECORD_VERSION
+     || hdr.header_size < sizeof(hdr) || hdr.module_size < sizeof(struct crash_record_module)){
+    fprintf(stderr, "%s is not a crash record this tool understands\n", file);
+    fclose(f);
+    return 1;
+  }
+  fseek(f, 0, SEEK_SET);
+  if(fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.nframes > CRASH_MAX_FRAMES || hdr.nmodules > CRASH_MAX_MODULES){
+    fprintf(stderr, "%s is truncated\n", file);
+    fclose(f);
+    return 1;
+  }
+  fseek(f, hdr.header_size, SEEK_SET);
+  frames = (uint64_t*)calloc(hdr.nframes + 1, sizeof(uint64_t));
+  mods = (struct crash_record_module*)calloc(hdr.nmodules + 1, sizeof(struct crash_record_module));
+  if(fread(frames, sizeof(uint64_t), hdr.nframes, f) != hdr.nframes)
+    hdr.nframes = 0;
+  for(i = 0; i < hdr.nmodules; i++){
+    if(fread(&mods[i], sizeof(struct crash_record_module), 1, f) != 1)
+      break;
+    fseek(f, hdr.module_size - sizeof(struct crash_record_module), SEEK_CUR);
+    mods[i].path[CRASH_PATH_MAX-1] = '\0';
+  }
+  hdr.nmodules = i;
+  fclose(f);
+
+  time_t secs = (time_t)(hdr.time_ns / 1000000000u);
+  char when[64];
+  strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+  printf("%s: signal %d (%s) code %d addr 0x%llx pc 0x%llx pid %d tid %d at %s\n", file, hdr.signo, signal_name(hdr.signo),
+         hdr.code, (unsigned long long)hdr.fault_addr, (unsigned long long)hdr.pc, hdr.pid, hdr.tid, when);
+
+  for(i = 0; i < hdr.nframes; i++){
+    const struct crash_record_module* mod = NULL;
+    struct elfsym_frame sf[16];
+    int n = 0, k;
+    for(j = 0; j < hdr.nmodules && !mod; j++)
+      if(frames[i] >= mods[j].start && frames[i] < mods[j].end)
+        mod = &mods[j];
+
+    printf("  #%-3u 0x%016llx", i, (unsigned long long)frames[i]);
+    if(!mod){
+      printf("  ??\n");
+      continue;
+    }
+    uint64_t addr = frames[i] - mod->bias;
+    const char* base = strrchr(mod->path, '/');
+    printf("  %s+0x%llx\n", base ? base + 1 : mod->path, (unsigned long long)addr);
+
+    // every frame but the first is a return address, just past the call
+    struct opened* o = find_module(mod);
+    if(o->module)
+      n = elfsym_lookup(o->module, i ? addr - 1 : addr, sf, 16);
+    for(k = 0; k < n; k++){
+      printf("        ");
+      print_function(sf[k].function);
+      if(k == n - 1 && sf[k].function)
+        printf(" + 0x%llx", (unsigned long long)(sf[k].offset + (i ? 1 : 0)));
+      printf("  %s:%u%s\n", sf[k].file ? sf[k].file : "??", sf[k].line, k < n - 1 ? " (inlined)" : "");
+    }
+  }
+  free(frames);
+  free(mods);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  int i, failed = 0, files = 0;
+
+  for(i = 1; i < argc; i++){
+    if(!strcmp(argv[i], "-d") && i + 1 < argc){
+      if(ndirs < MAX_DIRS)
+        dirs[ndirs++] = argv[++i];
+      continue;
+    }
+    if(argv[i][0] == '-'){
+      fprintf(stderr, "usage: %s [-d symbol_dir]... record...\n", argv[0]);
+      return 2;
+    }
+    failed |= symbolize(argv[i]);
+    files++;
+  }
+  if(!files){
+    fprintf(stderr, "usage: %s [-d symbol_dir]... record...\n", argv[0]);
+    return 2;
+  }
+  for(i = 0; i < nopened; i++)
+    elfsym_close(opened[i].module);
+  free(opened);
+  return failed;
+}
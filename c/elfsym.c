@@ -0,0 +1,1466 @@
+// In-process ELF/DWARF symbolizer, see elfsym.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c elfsym.c
+//
+// Three tables per module, each sorted by address and searched with a binary search:
+//   symbols  the functions from .symtab and .dynsym
+//   rows     the .debug_line matrix, one row per address where the line changes. Each sequence
+//            ends with a row with no file, so addresses between sequences find nothing
+//   inlines  the address ranges of every DW_TAG_inlined_subroutine, with its nesting depth, name
+//            and call site. max_hi is the running maximum of hi, so a lookup can walk backwards
+//            from its position and stop as soon as nothing earlier can still contain the address
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <link.h>
+#include <pthread.h>
+#include <stddef.h> //offsetof
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elfsym.h"
+
+#define NO_FILE 0xffffffffu
+#define MAX_DEPTH 64
+
+struct section
+{
+  const uint8_t* data;
+  uint64_t       size;
+};
+
+struct image
+{
+  void*          map;
+  size_t         size;
+  const Elf64_Shdr* shdrs;
+  int            nshdrs;
+  const char*    shstr;
+};
+
+struct sym
+{
+  uint64_t    addr;
+  uint64_t    size;
+  const char* name;
+};
+
+struct line_row
+{
+  uint64_t addr;
+  uint32_t file;
+  uint32_t line;
+};
+
+struct sequence
+{
+  uint64_t addr;
+  size_t   first;
+  size_t   count;
+};
+
+struct inline_range
+{
+  uint64_t    lo, hi, max_hi;
+  const char* name;
+  uint32_t    call_file;
+  uint32_t    call_line;
+  uint32_t    depth;
+};
+
+struct attrspec
+{
+  uint64_t name;
+  uint64_t form;
+  int64_t  implicit;
+};
+
+struct abbrev
+{
+  uint64_t         code;
+  uint64_t         tag;
+  int              children;
+  struct attrspec* specs;
+  size_t           nspecs;
+};
+
+// A line program, shared by every unit with the same DW_AT_stmt_list
+struct line_table
+{
+  uint64_t offset;
+  uint32_t file_base;   //into elfsym_module.files
+  uint32_t nfiles;
+  int      first_file;  //1 before DWARF 5, 0 since
+};
+
+struct unit
+{
+  uint64_t       offset, end;   //of the header, and one past the unit, in .debug_info
+  const uint8_t* dies;
+  int            version, offset_size, addr_size;
+  struct abbrev* abbrevs;
+  size_t         nabbrevs;
+  uint64_t       base;          //DW_AT_low_pc, the base of range lists
+  uint64_t       str_offsets_base, addr_base, rnglists_base;
+  const char*    comp_dir;
+  int            table;         //index into line_tables, -1 for none
+};
+
+struct elfsym_module
+{
+  char*          path;
+  struct image   img, dbg;
+  struct section info, abbrev, line, str, line_str, ranges, rnglists, addr, str_offsets;
+  int            parsed;
+
+  struct sym*    syms;
+  size_t         nsyms;
+  struct line_row* rows;
+  size_t         nrows;
+  char**         files;
+  size_t         nfiles, capfiles;
+  struct line_table* tables;
+  size_t         ntables;
+  struct inline_range* inl;
+  size_t         ninl, capinl;
+  struct unit*   units;
+  size_t         nunits;
+};
+
+// --- reading ---
+
+struct reader
+{
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+static uint64_t rd_u(struct reader* r, int n)
+{
+  uint64_t v = 0;
+  if(r->end - r->p < n){
+    r->p = r->end;
+    return 0;
+  }
+  memcpy(&v, r->p, n);  //little endian only
+  r->p += n;
+  return v;
+}
+
+static uint64_t rd_uleb(struct reader* r)
+{
+  uint64_t v = 0;
+  int shift = 0;
+  while(r->p < r->end){
+    uint8_t b = *r->p++;
+    if(shift < 64)
+      v |= (uint64_t)(b & 0x7f) << shift;
+    shift += 7;
+    if(!(b & 0x80))
+      break;
+  }
+  return v;
+}
+
+static int64_t rd_sleb(struct reader* r)
+{
+  int64_t v = 0;
+  int shift = 0;
+  uint8_t b = 0;
+  while(r->p < r->end){
+    b = *r->p++;
+    if(shift < 64)
+      v |= (int64_t)(b & 0x7f) << shift;
+    shift += 7;
+    if(!(b & 0x80))
+      break;
+  }
+  if(shift < 64 && (b & 0x40))
+    v |= -((int64_t)1 << shift);
+  return v;
+}
+
+static const char* rd_str(struct reader* r)
+{
+  const char* s = (const char*)r->p;
+  const uint8_t* z = (const uint8_t*)memchr(r->p, 0, r->end - r->p);
+  if(!z){
+    r->p = r->end;
+    return NULL;
+  }
+  r->p = z + 1;
+  return s;
+}
+
+static void skip(struct reader* r, uint64_t n)
+{
+  r->p = n < (uint64_t)(r->end - r->p) ? r->p + n : r->end;
+}
+
+// Reads a unit length, and returns its end. offset_size gets 4 or 8.
+static const uint8_t* rd_length(struct reader* r, int* offset_size)
+{
+  uint64_t len = rd_u(r, 4);
+  *offset_size = 4;
+  if(len == 0xffffffff){
+    len = rd_u(r, 8);
+    *offset_size = 8;
+  }
+  return len < (uint64_t)(r->end - r->p) ? r->p + len : r->end;
+}
+
+static const char* section_str(const struct section* s, uint64_t off)
+{
+  if(off >= s->size)
+    return NULL;
+  if(!memchr(s->data + off, 0, s->size - off))
+    return NULL;
+  return (const char*)s->data + off;
+}
+
+// --- ELF files ---
+
+static int map_image(struct image* img, const char* path)
+{
+  struct stat st;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  memset(img, 0, sizeof(*img));
+  if(fd < 0)
+    return -1;
+  if(fstat(fd, &st) || st.st_size < (off_t)sizeof(Elf64_Ehdr)){
+    close(fd);
+    return -1;
+  }
+  img->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(img->map == MAP_FAILED){
+    img->map = NULL;
+    return -1;
+  }
+  img->size = st.st_size;
+
+  const Elf64_Ehdr* eh = (const Elf64_Ehdr*)img->map;
+  if(memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS64 || eh->e_ident[EI_DATA] != ELFDATA2LSB
+     || eh->e_shentsize != sizeof(Elf64_Shdr) || eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr) > img->size
+     || eh->e_shstrndx >= eh->e_shnum){
+    munmap(img->map, img->size);
+    img->map = NULL;
+    return -1;
+  }
+  img->shdrs = (const Elf64_Shdr*)((const char*)img->map + eh->e_shoff);
+  img->nshdrs = eh->e_shnum;
+  img->shstr = (const char*)img->map + img->shdrs[eh->e_shstrndx].sh_offset;
+  return 0;
+}
+
+static void unmap_image(struct image* img)
+{
+  if(img->map)
+    munmap(img->map, img->size);
+  img->map = NULL;
+}
+
+static int section_data(const struct image* img, const Elf64_Shdr* sh, struct section* out)
+{
+  if(sh->sh_type == SHT_NOBITS || (sh->sh_flags & SHF_COMPRESSED) || sh->sh_offset + sh->sh_size > img->size)
+    return -1;
+  out->data = (const uint8_t*)img->map + sh->sh_offset;
+  out->size = sh->sh_size;
+  return 0;
+}
+
+static const Elf64_Shdr* find_section(const struct image* img, const char* name)
+{
+  int i;
+  if(!img->map)
+    return NULL;
+  for(i = 0; i < img->nshdrs; i++)
+    if(!strcmp(img->shstr + img->shdrs[i].sh_name, name))
+      return &img->shdrs[i];
+  return NULL;
+}
+
+static void get_section(const struct elfsym_module* m, const char* name, struct section* out)
+{
+  const Elf64_Shdr* sh = find_section(&m->img, name);
+  memset(out, 0, sizeof(*out));
+  if(sh && !section_data(&m->img, sh, out))
+    return;
+  sh = find_section(&m->dbg, name);
+  if(sh)
+    section_data(&m->dbg, sh, out);
+}
+
+static int build_id(const struct image* img, const uint8_t** id)
+{
+  struct section s;
+  const Elf64_Shdr* sh = find_section(img, ".note.gnu.build-id");
+  if(!sh || section_data(img, sh, &s) || s.size <= sizeof(Elf64_Nhdr) + 4)
+    return 0;
+  const Elf64_Nhdr* nh = (const Elf64_Nhdr*)s.data;
+  *id = s.data + sizeof(Elf64_Nhdr) + ((nh->n_namesz + 3) & ~3u);
+  if(nh->n_type != NT_GNU_BUILD_ID || !nh->n_descsz || *id + nh->n_descsz > s.data + s.size)
+    return 0;
+  return (int)nh->n_descsz;
+}
+
+// The separate debug file, from the build-id note or the .gnu_debuglink section
+static void open_debug_file(struct elfsym_module* m)
+{
+  char path[4096];
+  struct section s;
+  const Elf64_Shdr* sh;
+  const uint8_t* id;
+  int idlen = build_id(&m->img, &id);
+
+  if(idlen >= 2){
+    int i, n = snprintf(path, sizeof(path), "/usr/lib/debug/.build-id/%02x/", id[0]);
+    for(i = 1; i < idlen; i++)
+      n += snprintf(path + n, sizeof(path) - n, "%02x", id[i]);
+    snprintf(path + n, sizeof(path) - n, ".debug");
+    if(!map_image(&m->dbg, path))
+      return;
+  }
+
+  sh = find_section(&m->img, ".gnu_debuglink");
+  if(sh && !section_data(&m->img, sh, &s) && memchr(s.data, 0, s.size)){
+    const char* name = (const char*)s.data;
+    const char* slash = strrchr(m->path, '/');
+    int dirlen = slash ? (int)(slash - m->path) : 0;
+    const char* formats[] = { "%.*s/%s", "%.*s/.debug/%s", "/usr/lib/debug%.*s/%s" };
+    unsigned int i;
+    for(i = 0; i < sizeof(formats)/sizeof(formats[0]); i++){
+      snprintf(path, sizeof(path), formats[i], dirlen, m->path, name);
+      if(strcmp(path, m->path) && !map_image(&m->dbg, path))
+        return;
+    }
+  }
+}
+
+static int compare_syms(const void* a, const void* b)
+{
+  const struct sym* x = (const struct sym*)a;
+  const struct sym* y = (const struct sym*)b;
+  if(x->addr != y->addr)
+    return x->addr < y->addr ? -1 : 1;
+  return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;  //sized ones first
+}
+
+static void add_symbols(struct elfsym_module* m, const struct image* img, uint32_t type)
+{
+  int i;
+  for(i = 0; img->map && i < img->nshdrs; i++){
+    const Elf64_Shdr* sh = &img->shdrs[i];
+    struct section syms, strs;
+    if(sh->sh_type != type || sh->sh_link >= (uint32_t)img->nshdrs || sh->sh_entsize != sizeof(Elf64_Sym))
+      continue;
+    if(section_data(img, sh, &syms) || section_data(img, &img->shdrs[sh->sh_link], &strs))
+      continue;
+
+    size_t n = syms.size / sizeof(Elf64_Sym), j;
+    m->syms = (struct sym*)realloc(m->syms, (m->nsyms + n) * sizeof(struct sym));
+    for(j = 0; j < n; j++){
+      const Elf64_Sym* s = (const Elf64_Sym*)syms.data + j;
+      int t = ELF64_ST_TYPE(s->st_info);
+      const char* name;
+      if((t != STT_FUNC && t != STT_GNU_IFUNC) || s->st_shndx == SHN_UNDEF || !s->st_value)
+        continue;
+      if(!(name = section_str(&strs, s->st_name)) || !*name)
+        continue;
+      m->syms[m->nsyms].addr = s->st_value;
+      m->syms[m->nsyms].size = s->st_size;
+      m->syms[m->nsyms].name = name;
+      m->nsyms++;
+    }
+  }
+}
+
+static void load_symbols(struct elfsym_module* m)
+{
+  size_t i, n = 0;
+  add_symbols(m, &m->img, SHT_SYMTAB);
+  add_symbols(m, &m->dbg, SHT_SYMTAB);
+  add_symbols(m, &m->img, SHT_DYNSYM);
+  if(!m->nsyms)
+    return;
+
+  // one symbol per address, the sized one if there is one
+  qsort(m->syms, m->nsyms, sizeof(struct sym), compare_syms);
+  for(i = 0; i < m->nsyms; i++)
+    if(!n || m->syms[i].addr != m->syms[n-1].addr)
+      m->syms[n++] = m->syms[i];
+  m->nsyms = n;
+}
+
+// --- DWARF forms ---
+
+enum
+{
+  FORM_addr = 0x01, FORM_block2 = 0x03, FORM_block4, FORM_data2, FORM_data4, FORM_data8, FORM_string,
+  FORM_block, FORM_block1, FORM_data1, FORM_flag, FORM_sdata, FORM_strp, FORM_udata, FORM_ref_addr,
+  FORM_ref1, FORM_ref2, FORM_ref4, FORM_ref8, FORM_ref_udata, FORM_indirect, FORM_sec_offset,
+  FORM_exprloc, FORM_flag_present, FORM_strx, FORM_addrx, FORM_ref_sup4, FORM_strp_sup, FORM_data16,
+  FORM_line_strp, FORM_ref_sig8, FORM_implicit_const, FORM_loclistx, FORM_rnglistx, FORM_ref_sup8,
+  FORM_strx1, FORM_strx2, FORM_strx3, FORM_strx4, FORM_addrx1, FORM_addrx2, FORM_addrx3, FORM_addrx4,
+  FORM_GNU_addr_index = 0x1f01, FORM_GNU_str_index = 0x1f02, FORM_GNU_ref_alt = 0x1f20, FORM_GNU_strp_alt = 0x1f21
+};
+
+enum { VAL_NONE, VAL_CONST, VAL_ADDR, VAL_ADDRX, VAL_STR, VAL_STRX, VAL_REF, VAL_RNGLISTX, VAL_SEC_OFFSET };
+
+enum
+{
+  AT_name = 0x03, AT_stmt_list = 0x10, AT_low_pc = 0x11, AT_high_pc = 0x12, AT_comp_dir = 0x1b,
+  AT_abstract_origin = 0x31, AT_specification = 0x47, AT_ranges = 0x55, AT_call_file = 0x58,
+  AT_call_line = 0x59, AT_linkage_name = 0x6e, AT_str_offsets_base = 0x72, AT_addr_base = 0x73,
+  AT_rnglists_base = 0x74, AT_MIPS_linkage_name = 0x2007
+};
+
+#define TAG_compile_unit 0x11
+#define TAG_partial_unit 0x3c
+#define TAG_skeleton_unit 0x4a
+#define TAG_inlined_subroutine 0x1d
+
+struct value
+{
+  int         kind;
+  uint64_t    u;
+  const char* s;
+};
+
+static void read_form(const struct elfsym_module* m, const struct unit* u, struct reader* r, uint64_t form, int64_t implicit, struct value* v)
+{
+  v->kind = VAL_CONST;
+  v->s = NULL;
+  switch(form){
+  case FORM_addr:         v->kind = VAL_ADDR; v->u = rd_u(r, u->addr_size); break;
+  case FORM_data1:
+  case FORM_flag:         v->u = rd_u(r, 1); break;
+  case FORM_data2:        v->u = rd_u(r, 2); break;
+  case FORM_data4:        v->u = rd_u(r, 4); break;
+  case FORM_data8:        v->u = rd_u(r, 8); break;
+  case FORM_data16:       skip(r, 16); v->kind = VAL_NONE; break;
+  case FORM_sdata:        v->u = (uint64_t)rd_sleb(r); break;
+  case FORM_udata:        v->u = rd_uleb(r); break;
+  case FORM_implicit_const: v->u = (uint64_t)implicit; break;
+  case FORM_flag_present: v->u = 1; break;
+  case FORM_string:       v->kind = VAL_STR; v->s = rd_str(r); break;
+  case FORM_strp:         v->kind = VAL_STR; v->s = section_str(&m->str, rd_u(r, u->offset_size)); break;
+  case FORM_line_strp:    v->kind = VAL_STR; v->s = section_str(&m->line_str, rd_u(r, u->offset_size)); break;
+  case FORM_strx:
+  case FORM_GNU_str_index: v->kind = VAL_STRX; v->u = rd_uleb(r); break;
+  case FORM_strx1:        v->kind = VAL_STRX; v->u = rd_u(r, 1); break;
+  case FORM_strx2:        v->kind = VAL_STRX; v->u = rd_u(r, 2); break;
+  case FORM_strx3:        v->kind = VAL_STRX; v->u = rd_u(r, 3); break;
+  case FORM_strx4:        v->kind = VAL_STRX; v->u = rd_u(r, 4); break;
+  case FORM_addrx:
+  case FORM_GNU_addr_index: v->kind = VAL_ADDRX; v->u = rd_uleb(r); break;
+  case FORM_addrx1:       v->kind = VAL_ADDRX; v->u = rd_u(r, 1); break;
+  case FORM_addrx2:       v->kind = VAL_ADDRX; v->u = rd_u(r, 2); break;
+  case FORM_addrx3:       v->kind = VAL_ADDRX; v->u = rd_u(r, 3); break;
+  case FORM_addrx4:       v->kind = VAL_ADDRX; v->u = rd_u(r, 4); break;
+  case FORM_ref1:         v->kind = VAL_REF; v->u = u->offset + rd_u(r, 1); break;
+  case FORM_ref2:         v->kind = VAL_REF; v->u = u->offset + rd_u(r, 2); break;
+  case FORM_ref4:         v->kind = VAL_REF; v->u = u->offset + rd_u(r, 4); break;
+  case FORM_ref8:         v->kind = VAL_REF; v->u = u->offset + rd_u(r, 8); break;
+  case FORM_ref_udata:    v->kind = VAL_REF; v->u = u->offset + rd_uleb(r); break;
+  case FORM_ref_addr:     v->kind = VAL_REF; v->u = rd_u(r, u->version <= 2 ? u->addr_size : u->offset_size); break;
+  case FORM_sec_offset:   v->kind = VAL_SEC_OFFSET; v->u = rd_u(r, u->offset_size); break;
+  case FORM_rnglistx:     v->kind = VAL_RNGLISTX; v->u = rd_uleb(r); break;
+  case FORM_loclistx:     v->kind = VAL_NONE; rd_uleb(r); break;
+  case FORM_ref_sig8:     v->kind = VAL_NONE; skip(r, 8); break;
+  case FORM_ref_sup4:     v->kind = VAL_NONE; skip(r, 4); break;
+  case FORM_ref_sup8:     v->kind = VAL_NONE; skip(r, 8); break;
+  case FORM_strp_sup:
+  case FORM_GNU_ref_alt:
+  case FORM_GNU_strp_alt: v->kind = VAL_NONE; skip(r, u->offset_size); break;
+  case FORM_block1:       v->kind = VAL_NONE; skip(r, rd_u(r, 1)); break;
+  case FORM_block2:       v->kind = VAL_NONE; skip(r, rd_u(r, 2)); break;
+  case FORM_block4:       v->kind = VAL_NONE; skip(r, rd_u(r, 4)); break;
+  case FORM_block:
+  case FORM_exprloc:      v->kind = VAL_NONE; skip(r, rd_uleb(r)); break;
+  case FORM_indirect:     read_form(m, u, r, rd_uleb(r), 0, v); break;
+  default:
+    // a form we can't size, the rest of the unit can't be read
+    v->kind = VAL_NONE;
+    r->p = r->end;
+  }
+}
+
+static const char* value_str(const struct elfsym_module* m, const struct unit* u, const struct value* v)
+{
+  if(v->kind == VAL_STR)
+    return v->s;
+  if(v->kind == VAL_STRX && u->str_offsets_base){
+    uint64_t at = u->str_offsets_base + v->u * u->offset_size;
+    struct reader r = { m->str_offsets.data + (at < m->str_offsets.size ? at : m->str_offsets.size), m->str_offsets.data + m->str_offsets.size };
+    return section_str(&m->str, rd_u(&r, u->offset_size));
+  }
+  return NULL;
+}
+
+static uint64_t value_addr(const struct elfsym_module* m, const struct unit* u, const struct value* v)
+{
+  if(v->kind == VAL_ADDRX){
+    uint64_t at = u->addr_base + v->u * u->addr_size;
+    struct reader r = { m->addr.data + (at < m->addr.size ? at : m->addr.size), m->addr.data + m->addr.size };
+    return rd_u(&r, u->addr_size);
+  }
+  return v->u;
+}
+
+static const struct abbrev* find_abbrev(const struct unit* u, uint64_t code)
+{
+  size_t i;
+  if(code - 1 < u->nabbrevs && u->abbrevs[code-1].code == code)
+    return &u->abbrevs[code-1];
+  for(i = 0; i < u->nabbrevs; i++)
+    if(u->abbrevs[i].code == code)
+      return &u->abbrevs[i];
+  return NULL;
+}
+
+static void read_abbrevs(const struct elfsym_module* m, struct unit* u, uint64_t off)
+{
+  struct reader r = { m->abbrev.data + (off < m->abbrev.size ? off : m->abbrev.size), m->abbrev.data + m->abbrev.size };
+  size_t cap = 0;
+
+  for(;;){
+    uint64_t code = rd_uleb(&r);
+    if(!code || r.p >= r.end)
+      break;
+    if(u->nabbrevs == cap){
+      cap = cap ? cap * 2 : 64;
+      u->abbrevs = (struct abbrev*)realloc(u->abbrevs, cap * sizeof(struct abbrev));
+    }
+    struct abbrev* a = &u->abbrevs[u->nabbrevs++];
+    size_t speccap = 0;
+    a->code = code;
+    a->tag = rd_uleb(&r);
+    a->children = (int)rd_u(&r, 1);
+    a->specs = NULL;
+    a->nspecs = 0;
+    for(;;){
+      uint64_t name = rd_uleb(&r), form = rd_uleb(&r);
+      int64_t implicit = form == FORM_implicit_const ? rd_sleb(&r) : 0;
+      if((!name && !form) || r.p >= r.end)
+        break;
+      if(a->nspecs == speccap){
+        speccap = speccap ? speccap * 2 : 8;
+        a->specs = (struct attrspec*)realloc(a->specs, speccap * sizeof(struct attrspec));
+      }
+      a->specs[a->nspecs].name = name;
+      a->specs[a->nspecs].form = form;
+      a->specs[a->nspecs].implicit = implicit;
+      a->nspecs++;
+    }
+  }
+}
+
+// --- line tables ---
+
+static uint32_t add_file(struct elfsym_module* m, const char* dir, const char* name)
+{
+  char* path;
+  if(!name)
+    name = "??";
+  if(name[0] == '/' || !dir || !*dir)
+    path = strdup(name);
+  else{
+    size_t n = strlen(dir) + strlen(name) + 2;
+    path = (char*)malloc(n);
+    snprintf(path, n, "%s/%s", dir, name);
+  }
+  if(m->nfiles == m->capfiles){
+    m->capfiles = m->capfiles ? m->capfiles * 2 : 256;
+    m->files = (char**)realloc(m->files, m->capfiles * sizeof(char*));
+  }
+  m->files[m->nfiles] = path;
+  return (uint32_t)m->nfiles++;
+}
+
+static uint32_t table_file(const struct elfsym_module* m, int table, uint64_t index)
+{
+  const struct line_table* t;
+  if(table < 0)
+    return NO_FILE;
+  t = &m->tables[table];
+  if(index < (uint64_t)t->first_file || index - t->first_file >= t->nfiles)
+    return NO_FILE;
+  return t->file_base + (uint32_t)(index - t->first_file);
+}
+
+// The DWARF 5 directory and file lists: a format, then entries in that format
+static void read_entry_list(struct elfsym_module* m, const struct unit* u, struct reader* r, int version,
+                            const char** dirs, size_t ndirs, const char*** out, size_t* nout, int is_files)
+{
+  uint64_t types[16], forms[16];
+  int nformat = (int)rd_u(r, 1), i;
+  uint64_t count, j;
+  struct unit fake = *u;
+  fake.version = version;
+
+  for(i = 0; i < nformat; i++){
+    uint64_t type = rd_uleb(r), form = rd_uleb(r);
+    if(i < 16){
+      types[i] = type;
+      forms[i] = form;
+    }
+  }
+  if(nformat > 16){
+    r->p = r->end;
+    return;
+  }
+  count = rd_uleb(r);
+  *out = (const char**)calloc(count ? count : 1, sizeof(char*) * (is_files ? 2 : 1));
+  *nout = 0;
+  for(j = 0; j < count && r->p < r->end; j++){
+    const char* name = NULL;
+    uint64_t dir = 0;
+    for(i = 0; i < nformat; i++){
+      struct value v;
+      read_form(m, &fake, r, forms[i], 0, &v);
+      if(types[i] == 1)       //DW_LNCT_path
+        name = value_str(m, &fake, &v);
+      else if(types[i] == 2)  //DW_LNCT_directory_index
+        dir = v.u;
+    }
+    if(is_files){
+      (*out)[2*j] = name;
+      (*out)[2*j+1] = dir < ndirs ? dirs[dir] : NULL;
+    }
+    else
+      (*out)[j] = name;
+    (*nout)++;
+  }
+}
+
+static void push_row(struct line_row** rows, size_t* n, size_t* cap, uint64_t addr, uint32_t file, uint32_t line)
+{
+  if(*n == *cap){
+    *cap = *cap ? *cap * 2 : 4096;
+    *rows = (struct line_row*)realloc(*rows, *cap * sizeof(struct line_row));
+  }
+  (*rows)[*n].addr = addr;
+  (*rows)[*n].file = file;
+  (*rows)[*n].line = line;
+  (*n)++;
+}
+
+static int read_line_table(struct elfsym_module* m, const struct unit* u, uint64_t off,
+                           struct line_row** rows, size_t* nrows, size_t* caprows,
+                           struct sequence** seqs, size_t* nseqs, size_t* capseqs)
+{
+  struct reader r = { m->line.data + off, m->line.data + m->line.size };
+  int offset_size, version, addr_size = u->addr_size, i;
+  const uint8_t* end;
+  const uint8_t* program;
+  struct line_table t;
+
+  if(off >= m->line.size)
+    return -1;
+  end = rd_length(&r, &offset_size);
+  r.end = end;
+  version = (int)rd_u(&r, 2);
+  if(version < 2 || version > 5)
+    return -1;
+  if(version >= 5){
+    addr_size = (int)rd_u(&r, 1);
+    rd_u(&r, 1);  //segment selector size
+  }
+  uint64_t header_length = rd_u(&r, offset_size);
+  program = header_length < (uint64_t)(end - r.p) ? r.p + header_length : end;
+  int min_inst = (int)rd_u(&r, 1);
+  if(version >= 4)
+    rd_u(&r, 1);  //maximum operations per instruction, only for VLIW
+  int default_is_stmt = (int)rd_u(&r, 1);
+  int line_base = (int8_t)rd_u(&r, 1);
+  int line_range = (int)rd_u(&r, 1);
+  int opcode_base = (int)rd_u(&r, 1);
+  uint8_t lengths[256];
+  for(i = 1; i < opcode_base; i++)
+    lengths[i] = (uint8_t)rd_u(&r, 1);
+  if(!line_range)
+    return -1;
+  (void)default_is_stmt;
+
+  t.offset = off;
+  t.file_base = (uint32_t)m->nfiles;
+  if(version >= 5){
+    const char** dirs = NULL;
+    const char** files = NULL;
+    size_t ndirs, nfiles, j;
+    read_entry_list(m, u, &r, version, NULL, 0, &dirs, &ndirs, 0);
+    read_entry_list(m, u, &r, version, dirs, ndirs, &files, &nfiles, 1);
+    for(j = 0; j < nfiles; j++){
+      const char* dir = files[2*j+1];
+      // directory entries other than 0 are usually relative to the compilation directory
+      if(dir && dir[0] != '/' && ndirs && dirs[0] && dir != dirs[0]){
+        char joined[4096];
+        snprintf(joined, sizeof(joined), "%s/%s", dirs[0], dir);
+        add_file(m, joined, files[2*j]);
+      }
+      else
+        add_file(m, dir, files[2*j]);
+    }
+    t.first_file = 0;
+    t.nfiles = (uint32_t)nfiles;
+    free(dirs);
+    free(files);
+  }
+  else{
+    const char* dirs[1024];
+    int ndirs = 1;
+    const char* s;
+    dirs[0] = u->comp_dir;
+    while((s = rd_str(&r)) && *s)
+      if(ndirs < 1024)
+        dirs[ndirs++] = s;
+    t.nfiles = 0;
+    while((s = rd_str(&r)) && *s){
+      uint64_t dir = rd_uleb(&r);
+      rd_uleb(&r);  //mtime
+      rd_uleb(&r);  //length
+      const char* d = dir < (uint64_t)ndirs ? dirs[dir] : NULL;
+      if(d && d[0] != '/' && dir && u->comp_dir){
+        char joined[4096];
+        snprintf(joined, sizeof(joined), "%s/%s", u->comp_dir, d);
+        add_file(m, joined, s);
+      }
+      else
+        add_file(m, d, s);
+      t.nfiles++;
+    }
+    t.first_file = 1;
+  }
+
+  m->tables = (struct line_table*)realloc(m->tables, (m->ntables + 1) * sizeof(struct line_table));
+  m->tables[m->ntables++] = t;
+  int table = (int)m->ntables - 1;
+
+  // the state machine
+  r.p = program;
+  uint64_t address = 0, file = 1, line = 1;
+  size_t seq_start = *nrows;
+  while(r.p < r.end){
+    int op = (int)rd_u(&r, 1);
+    if(op >= opcode_base){
+      int adj = op - opcode_base;
+      address += (uint64_t)(adj / line_range) * min_inst;
+      line += line_base + adj % line_range;
+      push_row(rows, nrows, caprows, address, table_file(m, table, file), (uint32_t)line);
+      continue;
+    }
+    switch(op){
+    case 0:{
+      uint64_t len = rd_uleb(&r);
+      const uint8_t* next = len < (uint64_t)(r.end - r.p) ? r.p + len : r.end;
+      int sub = (int)rd_u(&r, 1);
+      if(sub == 1){  //end_sequence
+        push_row(rows, nrows, caprows, address, NO_FILE, 0);
+        // sequences at 0 are functions the linker threw away
+        uint64_t first = (*rows)[seq_start].addr;
+        if(first == 0 || first == ~(uint64_t)0)
+          *nrows = seq_start;
+        else{
+          if(*nseqs == *capseqs){
+            *capseqs = *capseqs ? *capseqs * 2 : 256;
+            *seqs = (struct sequence*)realloc(*seqs, *capseqs * sizeof(struct sequence));
+          }
+          (*seqs)[*nseqs].addr = first;
+          (*seqs)[*nseqs].first = seq_start;
+          (*seqs)[*nseqs].count = *nrows - seq_start;
+          (*nseqs)++;
+        }
+        seq_start = *nrows;
+        address = 0;
+        file = 1;
+        line = 1;
+      }
+      else if(sub == 2)  //set_address
+        address = rd_u(&r, len - 1 < 8 ? (int)(len - 1) : addr_size);
+      r.p = next;
+      break;
+    }
+    case 1:  //copy
+      push_row(rows, nrows, caprows, address, table_file(m, table, file), (uint32_t)line);
+      break;
+    case 2:  //advance_pc
+      address += rd_uleb(&r) * min_inst;
+      break;
+    case 3:  //advance_line
+      line += rd_sleb(&r);
+      break;
+    case 4:  //set_file
+      file = rd_uleb(&r);
+      break;
+    case 8:  //const_add_pc
+      address += (uint64_t)((255 - opcode_base) / line_range) * min_inst;
+      break;
+    case 9:  //fixed_advance_pc
+      address += rd_u(&r, 2);
+      break;
+    default:
+      // set_column, negate_stmt, basic_block, prologue_end, epilogue_begin, set_isa and anything
+      // newer all just take their operands
+      for(i = 0; i < lengths[op]; i++)
+        rd_uleb(&r);
+    }
+  }
+  *nrows = seq_start;  //a sequence that never ended
+  return table;
+}
+
+static int compare_sequences(const void* a, const void* b)
+{
+  const struct sequence* x = (const struct sequence*)a;
+  const struct sequence* y = (const struct sequence*)b;
+  if(x->addr != y->addr)
+    return x->addr < y->addr ? -1 : 1;
+  return x->first < y->first ? -1 : x->first > y->first;
+}
+
+// --- ranges ---
+
+struct range_list
+{
+  uint64_t (*r)[2];
+  size_t   n, cap;
+};
+
+static void push_range(struct range_list* l, uint64_t lo, uint64_t hi)
+{
+  if(lo >= hi)
+    return;
+  if(l->n == l->cap){
+    l->cap = l->cap ? l->cap * 2 : 8;
+    l->r = (uint64_t (*)[2])realloc(l->r, l->cap * sizeof(*l->r));
+  }
+  l->r[l->n][0] = lo;
+  l->r[l->n][1] = hi;
+  l->n++;
+}
+
+static void read_ranges(const struct elfsym_module* m, const struct unit* u, const struct value* v, struct range_list* out)
+{
+  uint64_t base = u->base;
+  struct value x;
+
+  if(u->version < 5){
+    struct reader r = { m->ranges.data + (v->u < m->ranges.size ? v->u : m->ranges.size), m->ranges.data + m->ranges.size };
+    uint64_t maxaddr = u->addr_size == 4 ? 0xffffffffu : ~(uint64_t)0;
+    while(r.p < r.end){
+      uint64_t lo = rd_u(&r, u->addr_size), hi = rd_u(&r, u->addr_size);
+      if(!lo && !hi)
+        break;
+      if(lo == maxaddr)
+        base = hi;
+      else
+        push_range(out, base + lo, base + hi);
+    }
+    return;
+  }
+
+  uint64_t off = v->u;
+  if(v->kind == VAL_RNGLISTX){
+    uint64_t at = u->rnglists_base + v->u * u->offset_size;
+    struct reader r = { m->rnglists.data + (at < m->rnglists.size ? at : m->rnglists.size), m->rnglists.data + m->rnglists.size };
+    off = u->rnglists_base + rd_u(&r, u->offset_size);
+  }
+  struct reader r = { m->rnglists.data + (off < m->rnglists.size ? off : m->rnglists.size), m->rnglists.data + m->rnglists.size };
+  x.kind = VAL_ADDRX;
+  while(r.p < r.end){
+    int kind = (int)rd_u(&r, 1);
+    uint64_t a, b;
+    switch(kind){
+    case 0:  //end_of_list
+      return;
+    case 1:  //base_addressx
+      x.u = rd_uleb(&r);
+      base = value_addr(m, u, &x);
+      break;
+    case 2:  //startx_endx
+      x.u = rd_uleb(&r);
+      a = value_addr(m, u, &x);
+      x.u = rd_uleb(&r);
+      push_range(out, a, value_addr(m, u, &x));
+      break;
+    case 3:  //startx_length
+      x.u = rd_uleb(&r);
+      a = value_addr(m, u, &x);
+      push_range(out, a, a + rd_uleb(&r));
+      break;
+    case 4:  //offset_pair
+      a = rd_uleb(&r);
+      b = rd_uleb(&r);
+      push_range(out, base + a, base + b);
+      break;
+    case 5:  //base_address
+      base = rd_u(&r, u->addr_size);
+      break;
+    case 6:  //start_end
+      a = rd_u(&r, u->addr_size);
+      b = rd_u(&r, u->addr_size);
+      push_range(out, a, b);
+      break;
+    case 7:  //start_length
+      a = rd_u(&r, u->addr_size);
+      push_range(out, a, a + rd_uleb(&r));
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+// --- debug info ---
+
+static struct unit* unit_at(struct elfsym_module* m, uint64_t off)
+{
+  size_t lo = 0, hi = m->nunits;
+  while(lo < hi){
+    size_t mid = (lo + hi) / 2;
+    if(m->units[mid].offset <= off)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo && off < m->units[lo-1].end)
+    return &m->units[lo-1];
+  return NULL;
+}
+
+// The name of the function the DIE at off refers to. The linkage name is preferred, and can
+// be a specification or abstract origin or two away.
+static const char* die_name(struct elfsym_module* m, uint64_t off, int hops)
+{
+  struct unit* u = unit_at(m, off);
+  const char* name = NULL;
+  uint64_t next = 0;
+  size_t i;
+
+  if(!u || hops > 4)
+    return NULL;
+  struct reader r = { m->info.data + off, m->info.data + u->end };
+  const struct abbrev* a = find_abbrev(u, rd_uleb(&r));
+  if(!a)
+    return NULL;
+  for(i = 0; i < a->nspecs; i++){
+    struct value v;
+    read_form(m, u, &r, a->specs[i].form, a->specs[i].implicit, &v);
+    switch(a->specs[i].name){
+    case AT_linkage_name:
+    case AT_MIPS_linkage_name:
+      if(value_str(m, u, &v))
+        return value_str(m, u, &v);
+      break;
+    case AT_name:
+      name = value_str(m, u, &v);
+      break;
+    case AT_specification:
+    case AT_abstract_origin:
+      if(v.kind == VAL_REF)
+        next = v.u;
+      break;
+    }
+  }
+  if(next){
+    const char* linked = die_name(m, next, hops + 1);
+    if(linked)
+      return linked;
+  }
+  return name;
+}
+
+static void push_inline(struct elfsym_module* m, uint64_t lo, uint64_t hi, const char* name, uint32_t call_file, uint32_t call_line, int depth)
+{
+  if(m->ninl == m->capinl){
+    m->capinl = m->capinl ? m->capinl * 2 : 1024;
+    m->inl = (struct inline_range*)realloc(m->inl, m->capinl * sizeof(struct inline_range));
+  }
+  struct inline_range* x = &m->inl[m->ninl++];
+  x->lo = lo;
+  x->hi = hi;
+  x->name = name;
+  x->call_file = call_file;
+  x->call_line = call_line;
+  x->depth = (uint32_t)depth;
+}
+
+static void read_inlines(struct elfsym_module* m, struct unit* u, struct range_list* ranges)
+{
+  struct reader r = { u->dies, m->info.data + u->end };
+  int depth = 0;
+
+  while(r.p < r.end){
+    uint64_t code = rd_uleb(&r);
+    const struct abbrev* a;
+    size_t i;
+    if(!code){
+      if(--depth <= 0)
+        break;
+      continue;
+    }
+    if(!(a = find_abbrev(u, code)))
+      break;
+
+    if(a->tag != TAG_inlined_subroutine){
+      struct value v;
+      for(i = 0; i < a->nspecs; i++)
+        read_form(m, u, &r, a->specs[i].form, a->specs[i].implicit, &v);
+    }
+    else{
+      struct value v, low = { VAL_NONE, 0, NULL }, high = { VAL_NONE, 0, NULL }, rng = { VAL_NONE, 0, NULL };
+      uint64_t origin = 0, call_file = 0, call_line = 0;
+      int high_is_offset = 0;
+      for(i = 0; i < a->nspecs; i++){
+        read_form(m, u, &r, a->specs[i].form, a->specs[i].implicit, &v);
+        switch(a->specs[i].name){
+        case AT_low_pc:           low = v; break;
+        case AT_high_pc:          high = v; high_is_offset = v.kind == VAL_CONST; break;
+        case AT_ranges:           rng = v; break;
+        case AT_abstract_origin:  origin = v.kind == VAL_REF ? v.u : 0; break;
+        case AT_call_file:        call_file = v.u; break;
+        case AT_call_line:        call_line = v.u; break;
+        }
+      }
+      const char* name = origin ? die_name(m, origin, 0) : NULL;
+      uint32_t file = table_file(m, u->table, call_file);
+      ranges->n = 0;
+      if(rng.kind != VAL_NONE)
+        read_ranges(m, u, &rng, ranges);
+      else if(low.kind != VAL_NONE && high.kind != VAL_NONE){
+        uint64_t lo = value_addr(m, u, &low);
+        push_range(ranges, lo, high_is_offset ? lo + high.u : value_addr(m, u, &high));
+      }
+      for(i = 0; i < ranges->n; i++)
+        push_inline(m, ranges->r[i][0], ranges->r[i][1], name, file, (uint32_t)call_line, depth);
+    }
+    if(a->children)
+      depth++;
+    else if(depth == 0)
+      break;  //a unit DIE without children
+  }
+}
+
+static int compare_inlines(const void* a, const void* b)
+{
+  const struct inline_range* x = (const struct inline_range*)a;
+  const struct inline_range* y = (const struct inline_range*)b;
+  if(x->lo != y->lo)
+    return x->lo < y->lo ? -1 : 1;
+  return x->depth < y->depth ? -1 : x->depth > y->depth;
+}
+
+// Reads the unit headers and unit DIEs, and the line table of each unit
+static void read_units(struct elfsym_module* m, struct line_row** rows, size_t* nrows, size_t* caprows,
+                       struct sequence** seqs, size_t* nseqs, size_t* capseqs)
+{
+  struct reader r = { m->info.data, m->info.data + m->info.size };
+  size_t cap = 0;
+
+  while(r.p < r.end){
+    struct unit u;
+    uint64_t abbrev_off;
+    const uint8_t* end;
+    memset(&u, 0, sizeof(u));
+    u.offset = r.p - m->info.data;
+    end = rd_length(&r, &u.offset_size);
+    u.end = end - m->info.data;
+    u.version = (int)rd_u(&r, 2);
+    u.table = -1;
+    if(u.version >= 5){
+      int type = (int)rd_u(&r, 1);
+      u.addr_size = (int)rd_u(&r, 1);
+      abbrev_off = rd_u(&r, u.offset_size);
+      if(type == 4 || type == 5)        //skeleton and split compile
+        skip(&r, 8);
+      else if(type == 2 || type == 6)   //type units
+        skip(&r, 8 + u.offset_size);
+    }
+    else{
+      abbrev_off = rd_u(&r, u.offset_size);
+      u.addr_size = (int)rd_u(&r, 1);
+    }
+    u.dies = r.p;
+    r.p = end;
+    if(u.version < 2 || u.version > 5 || (u.addr_size != 4 && u.addr_size != 8))
+      continue;
+    read_abbrevs(m, &u, abbrev_off);
+
+    // the unit DIE: the bases have to be known before the values that use them are resolved
+    struct reader d = { u.dies, end };
+    const struct abbrev* a = find_abbrev(&u, rd_uleb(&d));
+    struct value v, low = { VAL_NONE, 0, NULL }, comp_dir = { VAL_NONE, 0, NULL };
+    uint64_t stmt_list = ~(uint64_t)0;
+    size_t i;
+    if(a && (a->tag == TAG_compile_unit || a->tag == TAG_partial_unit || a->tag == TAG_skeleton_unit)){
+      for(i = 0; i < a->nspecs; i++){
+        read_form(m, &u, &d, a->specs[i].form, a->specs[i].implicit, &v);
+        switch(a->specs[i].name){
+        case AT_low_pc:           low = v; break;
+        case AT_comp_dir:         comp_dir = v; break;
+        case AT_stmt_list:        stmt_list = v.u; break;
+        case AT_str_offsets_base: u.str_offsets_base = v.u; break;
+        case AT_addr_base:        u.addr_base = v.u; break;
+        case AT_rnglists_base:    u.rnglists_base = v.u; break;
+        }
+      }
+      if(low.kind != VAL_NONE)
+        u.base = value_addr(m, &u, &low);
+      u.comp_dir = value_str(m, &u, &comp_dir);
+    }
+
+    if(stmt_list != ~(uint64_t)0){
+      for(i = 0; i < m->ntables; i++)
+        if(m->tables[i].offset == stmt_list)
+          u.table = (int)i;
+      if(u.table < 0)
+        u.table = read_line_table(m, &u, stmt_list, rows, nrows, caprows, seqs, nseqs, capseqs);
+    }
+
+    if(m->nunits == cap){
+      cap = cap ? cap * 2 : 64;
+      m->units = (struct unit*)realloc(m->units, cap * sizeof(struct unit));
+    }
+    m->units[m->nunits++] = u;
+  }
+}
+
+static void parse(struct elfsym_module* m)
+{
+  struct line_row* rows = NULL;
+  struct sequence* seqs = NULL;
+  size_t nrows = 0, caprows = 0, nseqs = 0, capseqs = 0, i;
+  struct range_list ranges = { NULL, 0, 0 };
+
+  m->parsed = 1;
+  load_symbols(m);
+  if(!m->info.data || !m->abbrev.data)
+    return;
+
+  read_units(m, &rows, &nrows, &caprows, &seqs, &nseqs, &capseqs);
+
+  // the sequences come in whatever order the units were linked, put them in address order
+  qsort(seqs, nseqs, sizeof(struct sequence), compare_sequences);
+  m->rows = (struct line_row*)malloc((nrows ? nrows : 1) * sizeof(struct line_row));
+  for(i = 0; i < nseqs; i++){
+    memcpy(m->rows + m->nrows, rows + seqs[i].first, seqs[i].count * sizeof(struct line_row));
+    m->nrows += seqs[i].count;
+  }
+  free(rows);
+  free(seqs);
+
+  for(i = 0; i < m->nunits; i++)
+    read_inlines(m, &m->units[i], &ranges);
+  free(ranges.r);
+  qsort(m->inl, m->ninl, sizeof(struct inline_range), compare_inlines);
+  for(i = 0; i < m->ninl; i++)
+    m->inl[i].max_hi = i && m->inl[i-1].max_hi > m->inl[i].hi ? m->inl[i-1].max_hi : m->inl[i].hi;
+}
+
+// --- lookups ---
+
+static const struct line_row* find_row(const struct elfsym_module* m, uint64_t addr)
+{
+  size_t lo = 0, hi = m->nrows;
+  while(lo < hi){
+    size_t mid = (lo + hi) / 2;
+    if(m->rows[mid].addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(!lo || m->rows[lo-1].file == NO_FILE)
+    return NULL;
+  return &m->rows[lo-1];
+}
+
+static const struct sym* find_sym(const struct elfsym_module* m, uint64_t addr)
+{
+  size_t lo = 0, hi = m->nsyms;
+  while(lo < hi){
+    size_t mid = (lo + hi) / 2;
+    if(m->syms[mid].addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(!lo || (m->syms[lo-1].size && addr >= m->syms[lo-1].addr + m->syms[lo-1].size))
+    return NULL;
+  return &m->syms[lo-1];
+}
+
+struct elfsym_module* elfsym_open(const char* path)
+{
+  struct elfsym_module* m = (struct elfsym_module*)calloc(1, sizeof(struct elfsym_module));
+  if(map_image(&m->img, path)){
+    free(m);
+    return NULL;
+  }
+  m->path = strdup(path);
+  if(!find_section(&m->img, ".debug_info") || !find_section(&m->img, ".debug_line"))
+    open_debug_file(m);
+
+  get_section(m, ".debug_info", &m->info);
+  get_section(m, ".debug_abbrev", &m->abbrev);
+  get_section(m, ".debug_line", &m->line);
+  get_section(m, ".debug_str", &m->str);
+  get_section(m, ".debug_line_str", &m->line_str);
+  get_section(m, ".debug_ranges", &m->ranges);
+  get_section(m, ".debug_rnglists", &m->rnglists);
+  get_section(m, ".debug_addr", &m->addr);
+  get_section(m, ".debug_str_offsets", &m->str_offsets);
+  return m;
+}
+
+void elfsym_close(struct elfsym_module* m)
+{
+  size_t i, j;
+  if(!m)
+    return;
+  for(i = 0; i < m->nunits; i++){
+    for(j = 0; j < m->units[i].nabbrevs; j++)
+      free(m->units[i].abbrevs[j].specs);
+    free(m->units[i].abbrevs);
+  }
+  for(i = 0; i < m->nfiles; i++)
+    free(m->files[i]);
+  free(m->units);
+  free(m->files);
+  free(m->tables);
+  free(m->rows);
+  free(m->syms);
+  free(m->inl);
+  unmap_image(&m->img);
+  unmap_image(&m->dbg);
+  free(m->path);
+  free(m);
+}
+
+int elfsym_build_id(const struct elfsym_module* m, unsigned char* id, int max)
+{
+  const uint8_t* p;
+  int n = build_id(&m->img, &p);
+  if(n <= 0)
+    return 0;
+  if(n > max)
+    n = max;
+  memcpy(id, p, n);
+  return n;
+}
+
+size_t elfsym_memory(const struct elfsym_module* m)
+{
+  size_t bytes, i, j;
+  if(!m)
+    return 0;
+  bytes = sizeof(*m) + m->img.size + m->dbg.size + m->nsyms * sizeof(struct sym) + m->nrows * sizeof(struct line_row)
+        + m->ntables * sizeof(struct line_table) + m->capinl * sizeof(struct inline_range) + m->nunits * sizeof(struct unit)
+        + m->capfiles * sizeof(char*);
+  for(i = 0; i < m->nfiles; i++)
+    bytes += strlen(m->files[i]) + 1;
+  for(i = 0; i < m->nunits; i++){
+    bytes += m->units[i].nabbrevs * sizeof(struct abbrev);
+    for(j = 0; j < m->units[i].nabbrevs; j++)
+      bytes += m->units[i].abbrevs[j].nspecs * sizeof(struct attrspec);
+  }
+  return bytes;
+}
+
+int elfsym_lookup(struct elfsym_module* m, uint64_t addr, struct elfsym_frame* frames, int max)
+{
+  const struct inline_range* chain[MAX_DEPTH];
+  int nchain = 0, n = 0, i;
+  size_t lo = 0, hi;
+
+  if(!m || max <= 0)
+    return 0;
+  if(!m->parsed)
+    parse(m);
+
+  // every inlined range containing addr, deepest first
+  hi = m->ninl;
+  while(lo < hi){
+    size_t mid = (lo + hi) / 2;
+    if(m->inl[mid].lo <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  while(lo-- > 0 && m->inl[lo].max_hi > addr){
+    if(addr < m->inl[lo].hi && nchain < MAX_DEPTH)
+      chain[nchain++] = &m->inl[lo];
+  }
+  for(i = 1; i < nchain; i++){
+    const struct inline_range* x = chain[i];
+    int j = i;
+    for(; j > 0 && chain[j-1]->depth < x->depth; j--)
+      chain[j] = chain[j-1];
+    chain[j] = x;
+  }
+
+  const struct line_row* row = find_row(m, addr);
+  const struct sym* sym = find_sym(m, addr);
+  if(!row && !sym && !nchain)
+    return 0;
+
+  // the innermost frame has the line of the address, each frame out has the call site of the
+  // one inside it
+  const char* file = row ? m->files[row->file] : NULL;
+  unsigned int line = row ? row->line : 0;
+  for(i = 0; i < nchain && n < max; i++){
+    frames[n].function = chain[i]->name;
+    frames[n].file = file;
+    frames[n].line = line;
+    frames[n].offset = 0;
+    n++;
+    file = chain[i]->call_file != NO_FILE ? m->files[chain[i]->call_file] : NULL;
+    line = chain[i]->call_line;
+  }
+  if(n < max){
+    frames[n].function = sym ? sym->name : NULL;
+    frames[n].file = file;
+    frames[n].line = line;
+    frames[n].offset = sym ? addr - sym->addr : 0;
+    n++;
+  }
+  return n;
+}
+
+// --- modules of this process ---
+
+struct loaded_range
+{
+  uint64_t start, end, bias;
+  struct elfsym_module* module;  //NULL if it couldn't be opened
+};
+
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct elfsym_module** opened;
+static char** opened_paths;
+static size_t nopened;
+static struct loaded_range* loaded;
+static size_t nloaded, caploaded;
+static unsigned long long loaded_adds, loaded_subs;
+
+static struct elfsym_module* module_for(const char* path)
+{
+  size_t i;
+  for(i = 0; i < nopened; i++)
+    if(!strcmp(opened_paths[i], path))
+      return opened[i];
+  opened = (struct elfsym_module**)realloc(opened, (nopened + 1) * sizeof(*opened));
+  opened_paths = (char**)realloc(opened_paths, (nopened + 1) * sizeof(*opened_paths));
+  opened[nopened] = elfsym_open(path);  //NULL is remembered too, so it isn't retried
+  opened_paths[nopened] = strdup(path);
+  return opened[nopened++];
+}
+
+static int read_counts(struct dl_phdr_info* info, size_t size, void* data)
+{
+  unsigned long long* counts = (unsigned long long*)data;
+  if(size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)){
+    counts[0] = info->dlpi_adds;
+    counts[1] = info->dlpi_subs;
+  }
+  return 1;
+}
+
+static int add_ranges(struct dl_phdr_info* info, size_t size, void* data)
+{
+  const char* path = info->dlpi_name && *info->dlpi_name ? info->dlpi_name : "/proc/self/exe";
+  int i;
+  (void)size;
+  (void)data;
+  if(!strncmp(path, "linux-vdso", 10))
+    return 0;
+  for(i = 0; i < info->dlpi_phnum; i++){
+    const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+    if(ph->p_type != PT_LOAD)
+      continue;
+    if(nloaded == caploaded){
+      caploaded = caploaded ? caploaded * 2 : 64;
+      loaded = (struct loaded_range*)realloc(loaded, caploaded * sizeof(struct loaded_range));
+    }
+    loaded[nloaded].start = info->dlpi_addr + ph->p_vaddr;
+    loaded[nloaded].end = loaded[nloaded].start + ph->p_memsz;
+    loaded[nloaded].bias = info->dlpi_addr;
+    loaded[nloaded].module = module_for(path);
+    nloaded++;
+  }
+  return 0;
+}
+
+static int compare_loaded(const void* a, const void* b)
+{
+  uint64_t x = ((const struct loaded_range*)a)->start, y = ((const struct loaded_range*)b)->start;
+  return x < y ? -1 : x > y;
+}
+
+static void refresh_loaded()
+{
+  unsigned long long counts[2] = { ~0ULL, ~0ULL };
+  dl_iterate_phdr(read_counts, counts);
+  if(nloaded && counts[0] != ~0ULL && counts[0] == loaded_adds && counts[1] == loaded_subs)
+    return;
+
+  nloaded = 0;
+  dl_iterate_phdr(add_ranges, NULL);
+  qsort(loaded, nloaded, sizeof(struct loaded_range), compare_loaded);
+  loaded_adds = counts[0];
+  loaded_subs = counts[1];
+}
+
+// Called with resolve_lock held
+static int resolve_locked(const void* addr, struct elfsym_frame* frames, int max, const char** module)
+{
+  uint64_t a = (uint64_t)(uintptr_t)addr;
+  size_t lo = 0, hi;
+  int n = 0;
+
+  refresh_loaded();
+  hi = nloaded;
+  while(lo < hi){
+    size_t mid = (lo + hi) / 2;
+    if(loaded[mid].start <= a)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo && a < loaded[lo-1].end && loaded[lo-1].module){
+    n = elfsym_lookup(loaded[lo-1].module, a - loaded[lo-1].bias, frames, max);
+    if(module)
+      *module = loaded[lo-1].module->path;
+  }
+  else if(module)
+    *module = NULL;
+  return n;
+}
+
+int elfsym_resolve(const void* addr, struct elfsym_frame* frames, int max, const char** module)
+{
+  int n;
+  pthread_mutex_lock(&resolve_lock);
+  n = resolve_locked(addr, frames, max, module);
+  pthread_mutex_unlock(&resolve_lock);
+  return n;
+}
+
+int elfsym_resolve_nowait(const void* addr, struct elfsym_frame* frames, int max, const char** module)
+{
+  int n;
+  if(pthread_mutex_trylock(&resolve_lock))
+    return -1;
+  n = resolve_locked(addr, frames, max, module);
+  pthread_mutex_unlock(&resolve_lock);
+  return n;
+}
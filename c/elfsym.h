@@ -0,0 +1,71 @@
+// In-process ELF/DWARF symbolizer: address -> function, file:line, including inlined frames
+// Author: Paul Foster
+// Public domain
+//
+// Reads the module with mmap and needs no external programs and no libbfd. Function names come
+// from .symtab/.dynsym, lines from .debug_line (DWARF 2 to 5) and inlined frames from the
+// DW_TAG_inlined_subroutine entries in .debug_info. If the module has no debug info of its own,
+// the separate debug file is found through the build-id or .gnu_debuglink, the way gdb does.
+// Compressed debug sections (SHF_COMPRESSED, ld --compress-debug-sections) are not supported,
+// those modules get function names only. With -gsplit-dwarf the lines are found but the inlined
+// frames, which are in the .dwo files, are not.
+//
+// Everything is parsed on the first lookup in a module and kept, after that a lookup is a few
+// binary searches. Names are the linkage names, so C++ ones still need demangling.
+//
+//   struct elfsym_frame f[8];
+//   int n = elfsym_resolve((char*)return_address - 1, f, 8, NULL);
+//   for(i = 0; i < n; i++)
+//     printf("%s at %s:%u\n", f[i].function, f[i].file, f[i].line);
+//
+// Pass return addresses minus one, so the call is looked up rather than whatever follows it.
+// 64 bit little endian ELF only. Link with -lpthread.
+
+#ifndef P_ELFSYM_H
+#define P_ELFSYM_H
+#include <stdint.h>
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct elfsym_module;
+
+struct elfsym_frame
+{
+  const char*  function;  //NULL if unknown
+  const char*  file;      //NULL if there is no line info
+  unsigned int line;
+  uint64_t     offset;    //from the start of the function symbol, outermost frame only
+};
+
+// Opens a module for lookups with file addresses (runtime address minus the load bias).
+// Returns NULL if the file isn't a readable ELF file.
+struct elfsym_module* elfsym_open(const char* path);
+void elfsym_close(struct elfsym_module* m);
+
+// Copies up to max bytes of the GNU build-id and returns its length, 0 if there is none
+int elfsym_build_id(const struct elfsym_module* m, unsigned char* id, int max);
+
+// Fills frames innermost first: the inlined functions, then the function the code was inlined
+// into. Returns how many were filled, 0 if nothing is known about the address. The strings
+// belong to the module and stay valid until it is closed.
+int elfsym_lookup(struct elfsym_module* m, uint64_t addr, struct elfsym_frame* frames, int max);
+
+// Bytes the module holds: its parsed tables, and the files it has mapped. The tables are built
+// by the first lookup, so this grows after that.
+size_t elfsym_memory(const struct elfsym_module* m);
+
+// Same for an address in this process. The module is found with dl_iterate_phdr, opened the
+// first time and kept open. If module isn't NULL it gets the module's path, and with max 0 that
+// is all that is done, the module isn't parsed. Thread safe.
+int elfsym_resolve(const void* addr, struct elfsym_frame* frames, int max, const char** module);
+
+// For crash handlers: returns -1 instead of waiting when another lookup holds the lock, which
+// may be the crashed thread itself, half way through one. Otherwise the same as elfsym_resolve.
+int elfsym_resolve_nowait(const void* addr, struct elfsym_frame* frames, int max, const char** module);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_ELFSYM_H
@@ -0,0 +1,798 @@
+// Heap profiler, see heapprof.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, build with:
+//   gcc -shared -fPIC -O2 -o libheapprof.so heapprof.c stack_dump_on_assert.c elfsym.c unwind.c time.c -lpthread -lm
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "heapprof.h"
+#include "stack_dump_on_assert.h"
+#include "elfsym.h"
+#include "time.h"
+
+#ifdef __cplusplus
+#include <cxxabi.h>
+#define HP_NOTHROW noexcept
+#else
+#define HP_NOTHROW
+#endif
+
+#define HEAPPROF_DEPTH       32
+#define HEAPPROF_TABLE       1024       //stacks per thread, power of two
+#define HEAPPROF_PROBE       16
+#define HEAPPROF_LIVE_SLOTS  (1 << 16)  //sampled blocks alive at once, power of two
+#define HP_FILTER_BITS       18
+#define HP_ONE               256        //object counts are fixed point, a sample can stand for 1.3 objects
+
+// glibc's allocator under the names that aren't interposed, so there is no dlsym() to bootstrap
+#ifdef __cplusplus
+extern "C" {
+#endif
+void* __libc_malloc(size_t size);
+void  __libc_free(void* p);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t align, size_t size);
+void* __libc_valloc(size_t size);
+#ifdef __cplusplus
+}
+#endif
+
+struct hp_entry
+{
+  uint64_t hash;         //0 means empty, written last
+  uint32_t depth;
+  // only the owning thread writes these
+  uint64_t samples;
+  uint64_t alloc_objs;   //HP_ONE per object
+  uint64_t alloc_bytes;
+  // and any thread that frees one of the samples these
+  uint64_t live_objs;
+  uint64_t live_bytes;
+  uint64_t freed;        //samples freed
+  uint64_t lifetime_ns;  //how long they lived, in total
+  void*    stack[HEAPPROF_DEPTH];
+};
+
+// Kept until exit, since the live samples point into it. When its thread exits it goes on the
+// spare list, and the next new thread takes it over, entries and all.
+struct hp_table
+{
+  struct hp_table* next;
+  struct hp_table* next_spare;
+  uint32_t         tid;
+  uint32_t         used;       //entries taken
+  uint64_t         dropped;
+  struct hp_entry  e[HEAPPROF_TABLE];
+};
+
+// A sampled block that hasn't been freed
+struct hp_live
+{
+  void*            ptr;    //NULL if the slot is empty
+  struct hp_entry* e;
+  uint64_t         objs, bytes;
+  uint64_t         born;   //nanotime()
+};
+
+enum { HP_STARTING = 0, HP_ON, HP_OFF };
+
+#define HP_TLS __thread __attribute__((tls_model("initial-exec")))
+static HP_TLS int64_t hp_left = 0;               //bytes until this thread's next sample
+static HP_TLS uint64_t hp_rng = 0;               //0 until the thread's first allocation
+static HP_TLS int hp_busy = 0;                   //set while the profiler itself allocates
+static HP_TLS struct hp_table* hp_tls = NULL;
+
+static int hp_state = HP_STARTING;
+static double hp_mean;                           //HEAPPROF_RATE
+static uint64_t hp_start;
+static struct hp_table* hp_tables = NULL;
+static struct hp_table* hp_spare = NULL;         //of exited threads, under hp_spare_lock
+static int hp_spare_lock = 0;
+static pthread_key_t hp_exit_key;
+static char hp_prefix[256];
+static int hp_dumping = 0;
+
+// Live samples, open addressing under a spinlock. The filter counts them per hash bucket, so a
+// free of anything else is turned away without the lock.
+static struct hp_live hp_live[HEAPPROF_LIVE_SLOTS];
+static uint16_t hp_filter[1 << HP_FILTER_BITS];
+static int hp_live_lock = 0;
+static uint32_t hp_nlive = 0;
+static uint64_t hp_live_dropped = 0;
+
+static sem_t hp_dump_sem;
+
+static inline size_t filter_slot(const void* p)
+{
+  return (size_t)(((uintptr_t)p >> 4) * 0x9e3779b97f4a7c15ull >> (64 - HP_FILTER_BITS));
+}
+
+static inline size_t live_slot(const void* p)
+{
+  return (size_t)(((uintptr_t)p >> 4) * 0xff51afd7ed558ccdull >> 32) & (HEAPPROF_LIVE_SLOTS - 1);
+}
+
+static void spin_lock(int* lock)
+{
+  while(__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+    while(__atomic_load_n(lock, __ATOMIC_RELAXED))
+      ;
+}
+
+static void spin_unlock(int* lock)
+{
+  __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+static void live_lock()
+{
+  spin_lock(&hp_live_lock);
+}
+
+static void live_unlock()
+{
+  spin_unlock(&hp_live_lock);
+}
+
+static int live_insert(void* p, struct hp_entry* e, uint64_t objs, uint64_t bytes)
+{
+  size_t i = live_slot(p);
+  uint64_t born = nanotime();
+
+  live_lock();
+  // keep it at most 3/4 full so the probes stay short
+  if(hp_nlive >= HEAPPROF_LIVE_SLOTS / 4 * 3){
+    hp_live_dropped++;
+    live_unlock();
+    return 0;
+  }
+  while(hp_live[i].ptr)
+    i = (i + 1) & (HEAPPROF_LIVE_SLOTS - 1);
+  hp_live[i].ptr = p;
+  hp_live[i].e = e;
+  hp_live[i].objs = objs;
+  hp_live[i].bytes = bytes;
+  hp_live[i].born = born;
+  hp_nlive++;
+  // whoever frees p got it after this, through the program's own synchronization
+  __atomic_add_fetch(&hp_filter[filter_slot(p)], 1, __ATOMIC_RELAXED);
+  live_unlock();
+  return 1;
+}
+
+// Called before p goes back to glibc, which could hand it straight to another thread's sample
+static __attribute__((noinline)) void live_remove(void* p)
+{
+  size_t i = live_slot(p), j, home;
+  struct hp_live gone;
+
+  live_lock();
+  while(hp_live[i].ptr && hp_live[i].ptr != p)
+    i = (i + 1) & (HEAPPROF_LIVE_SLOTS - 1);
+  if(!hp_live[i].ptr){
+    // another block in the same filter bucket
+    live_unlock();
+    return;
+  }
+  gone = hp_live[i];
+  // close the gap: pull back later entries of the run that may sit in it
+  for(j = (i + 1) & (HEAPPROF_LIVE_SLOTS - 1); hp_live[j].ptr; j = (j + 1) & (HEAPPROF_LIVE_SLOTS - 1)){
+    home = live_slot(hp_live[j].ptr);
+    if(((j - home) & (HEAPPROF_LIVE_SLOTS - 1)) >= ((j - i) & (HEAPPROF_LIVE_SLOTS - 1))){
+      hp_live[i] = hp_live[j];
+      i = j;
+    }
+  }
+  hp_live[i].ptr = NULL;
+  hp_nlive--;
+  __atomic_sub_fetch(&hp_filter[filter_slot(p)], 1, __ATOMIC_RELAXED);
+  live_unlock();
+
+  __atomic_sub_fetch(&gone.e->live_objs, gone.objs, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&gone.e->live_bytes, gone.bytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&gone.e->freed, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&gone.e->lifetime_ns, nanotime() - gone.born, __ATOMIC_RELAXED);
+}
+
+// Exponentially distributed, so samples are a Poisson process over the bytes allocated
+static int64_t next_interval()
+{
+  uint64_t x = hp_rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  hp_rng = x;
+  double u = ((x * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+  double n = -log(1.0 - u) * hp_mean;
+  return n < 1 ? 1 : (n > 1e15 ? (int64_t)1e15 : (int64_t)n);
+}
+
+// At thread exit. An allocation in a later destructor of the same thread takes a table again.
+static void table_exit(void* arg)
+{
+  struct hp_table* t = (struct hp_table*)arg;
+  hp_tls = NULL;
+  spin_lock(&hp_spare_lock);
+  t->next_spare = hp_spare;
+  hp_spare = t;
+  spin_unlock(&hp_spare_lock);
+}
+
+static struct hp_table* thread_table()
+{
+  struct hp_table* t;
+
+  spin_lock(&hp_spare_lock);
+  if((t = hp_spare))
+    hp_spare = t->next_spare;
+  spin_unlock(&hp_spare_lock);
+
+  if(!t){
+    void* p = mmap(NULL, sizeof(struct hp_table), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+      return NULL;
+    t = (struct hp_table*)p;
+    t->next = __atomic_load_n(&hp_tables, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&hp_tables, &t->next, t, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+  t->tid = (uint32_t)syscall(SYS_gettid);
+  hp_tls = t;
+  pthread_setspecific(hp_exit_key, t);
+  return t;
+}
+
+static uint64_t hash_stack(void* const* stack, int depth)
+{
+  uint64_t h = 1469598103934665603ull;
+  int i;
+  for(i = 0; i < depth; i++)
+    h = (h ^ (uintptr_t)stack[i]) * 1099511628211ull;
+  return h ? h : 1;
+}
+
+static struct hp_entry* find_entry(void* const* stack, int depth)
+{
+  struct hp_table* t = hp_tls;
+  int i;
+  if(!t && !(t = thread_table()))
+    return NULL;
+
+  uint64_t h = hash_stack(stack, depth);
+  for(i = 0; i < HEAPPROF_PROBE; i++){
+    struct hp_entry* e = &t->e[(h + i) & (HEAPPROF_TABLE - 1)];
+    if(e->hash == 0){
+      e->depth = depth;
+      memcpy(e->stack, stack, depth * sizeof(void*));
+      __atomic_store_n(&e->hash, h, __ATOMIC_RELEASE);
+      __atomic_store_n(&t->used, t->used + 1, __ATOMIC_RELAXED);
+      return e;
+    }
+    if(e->hash == h && e->depth == (uint32_t)depth && !memcmp(e->stack, stack, depth * sizeof(void*)))
+      return e;
+  }
+  t->dropped++;
+  return NULL;
+}
+
+// The countdown ran out. Called straight from the wrappers, so the stack is theirs plus two.
+static __attribute__((noinline)) void sample(void* p, size_t size)
+{
+  void* stack[HEAPPROF_DEPTH];
+  struct hp_entry* e;
+  int state = __atomic_load_n(&hp_state, __ATOMIC_ACQUIRE), depth;
+
+  if(state != HP_ON){
+    // before the constructor this comes back on every allocation, which is fine for a while
+    if(state == HP_OFF)
+      hp_left = INT64_MAX;
+    return;
+  }
+  if(!hp_rng){
+    hp_rng = ((uintptr_t)&hp_rng * 0x9e3779b97f4a7c15ull) | 1;
+    hp_left = next_interval();
+    return;
+  }
+  hp_left = next_interval();
+  if(hp_busy || !p)
+    return;
+
+  hp_busy = 1;
+  depth = stack_dump_capture(stack, HEAPPROF_DEPTH, 3);
+  if((e = find_entry(stack, depth))){
+    // a block of this size is sampled with probability 1 - e^(-size/mean), so it stands for
+    // 1/that of them
+    double prob = 1.0 - exp(-(double)(size ? size : 1) / hp_mean);
+    uint64_t objs = (uint64_t)(HP_ONE / prob + 0.5), bytes = (uint64_t)(size / prob + 0.5);
+    __atomic_store_n(&e->samples, e->samples + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->alloc_objs, e->alloc_objs + objs, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->alloc_bytes, e->alloc_bytes + bytes, __ATOMIC_RELAXED);
+    // charged first, so a free racing the insert never takes it below zero
+    __atomic_add_fetch(&e->live_objs, objs, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&e->live_bytes, bytes, __ATOMIC_RELAXED);
+    if(!live_insert(p, e, objs, bytes)){
+      __atomic_sub_fetch(&e->live_objs, objs, __ATOMIC_RELAXED);
+      __atomic_sub_fetch(&e->live_bytes, bytes, __ATOMIC_RELAXED);
+    }
+  }
+  hp_busy = 0;
+}
+
+// A macro rather than a function, to keep the stack depth the same in every wrapper
+#define HP_COUNT(p, size) \
+  do{ \
+    if(__builtin_expect((hp_left -= (int64_t)(size)) <= 0, 0)) \
+      sample(p, size); \
+  }while(0)
+
+#define HP_FORGET(p) \
+  do{ \
+    if((p) && __builtin_expect(__atomic_load_n(&hp_filter[filter_slot(p)], __ATOMIC_RELAXED) != 0, 0)) \
+      live_remove(p); \
+  }while(0)
+
+void* malloc(size_t size) HP_NOTHROW
+{
+  void* p = __libc_malloc(size);
+  HP_COUNT(p, size);
+  return p;
+}
+
+void free(void* p) HP_NOTHROW
+{
+  HP_FORGET(p);
+  __libc_free(p);
+}
+
+void* calloc(size_t n, size_t size) HP_NOTHROW
+{
+  void* p = __libc_calloc(n, size);
+  // a non NULL result means n * size didn't overflow
+  if(p)
+    HP_COUNT(p, n * size);
+  return p;
+}
+
+// Counted as a new allocation of the whole size, like tcmalloc. If it fails the old block is
+// no longer tracked, which only loses that one sample.
+void* realloc(void* p, size_t size) HP_NOTHROW
+{
+  HP_FORGET(p);
+  p = __libc_realloc(p, size);
+  if(p)
+    HP_COUNT(p, size);
+  return p;
+}
+
+// glibc's goes to its own realloc directly, which would miss the free
+void* reallocarray(void* p, size_t n, size_t size) HP_NOTHROW
+{
+  size_t bytes;
+  if(__builtin_mul_overflow(n, size, &bytes)){
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(p, bytes);
+}
+
+void* memalign(size_t align, size_t size) HP_NOTHROW
+{
+  void* p = __libc_memalign(align, size);
+  HP_COUNT(p, size);
+  return p;
+}
+
+void* aligned_alloc(size_t align, size_t size) HP_NOTHROW
+{
+  void* p;
+  if(!align || (align & (align - 1))){
+    errno = EINVAL;
+    return NULL;
+  }
+  p = __libc_memalign(align, size);
+  HP_COUNT(p, size);
+  return p;
+}
+
+int posix_memalign(void** out, size_t align, size_t size) HP_NOTHROW
+{
+  void* p;
+  if(!align || (align & (align - 1)) || align % sizeof(void*))
+    return EINVAL;
+  if(!(p = __libc_memalign(align, size)))
+    return ENOMEM;
+  HP_COUNT(p, size);
+  *out = p;
+  return 0;
+}
+
+void* valloc(size_t size) HP_NOTHROW
+{
+  void* p = __libc_valloc(size);
+  HP_COUNT(p, size);
+  return p;
+}
+
+// --- output ---
+
+static int cmp_stack(const void* a, const void* b)
+{
+  const struct hp_entry* x = (const struct hp_entry*)a;
+  const struct hp_entry* y = (const struct hp_entry*)b;
+  if(x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  if(x->depth != y->depth)
+    return (int)x->depth - (int)y->depth;
+  return memcmp(x->stack, y->stack, x->depth * sizeof(void*));
+}
+
+static int cmp_alloc(const void* a, const void* b)
+{
+  const struct hp_entry* x = (const struct hp_entry*)a;
+  const struct hp_entry* y = (const struct hp_entry*)b;
+  return x->alloc_bytes < y->alloc_bytes ? 1 : (x->alloc_bytes > y->alloc_bytes ? -1 : 0);
+}
+
+// A copy of every thread's entries, with the same stacks merged
+static struct hp_entry* snapshot(size_t* count, uint64_t* dropped)
+{
+  struct hp_table* t;
+  struct hp_entry* all;
+  size_t n = 0, out = 0, i, cap = 0;
+
+  // entries taken after this count are left for the next snapshot
+  *dropped = 0;
+  for(t = __atomic_load_n(&hp_tables, __ATOMIC_ACQUIRE); t; t = t->next)
+    cap += __atomic_load_n(&t->used, __ATOMIC_RELAXED);
+  if(!(all = (struct hp_entry*)malloc((cap ? cap : 1) * sizeof(struct hp_entry))))
+    return NULL;
+  for(t = __atomic_load_n(&hp_tables, __ATOMIC_ACQUIRE); t; t = t->next){
+    *dropped += t->dropped;
+    for(i = 0; i < HEAPPROF_TABLE && n < cap; i++){
+      const struct hp_entry* e = &t->e[i];
+      if(!__atomic_load_n(&e->hash, __ATOMIC_ACQUIRE))
+        continue;
+      all[n] = *e;
+      all[n].samples = __atomic_load_n(&e->samples, __ATOMIC_RELAXED);
+      all[n].alloc_objs = __atomic_load_n(&e->alloc_objs, __ATOMIC_RELAXED);
+      all[n].alloc_bytes = __atomic_load_n(&e->alloc_bytes, __ATOMIC_RELAXED);
+      all[n].live_objs = __atomic_load_n(&e->live_objs, __ATOMIC_RELAXED);
+      all[n].live_bytes = __atomic_load_n(&e->live_bytes, __ATOMIC_RELAXED);
+      all[n].freed = __atomic_load_n(&e->freed, __ATOMIC_RELAXED);
+      all[n].lifetime_ns = __atomic_load_n(&e->lifetime_ns, __ATOMIC_RELAXED);
+      n++;
+    }
+  }
+  *dropped += __atomic_load_n(&hp_live_dropped, __ATOMIC_RELAXED);
+
+  qsort(all, n, sizeof(struct hp_entry), cmp_stack);
+  for(i = 0; i < n; i++){
+    if(out && !cmp_stack(&all[out-1], &all[i])){
+      struct hp_entry* o = &all[out-1];
+      o->samples += all[i].samples;
+      o->alloc_objs += all[i].alloc_objs;
+      o->alloc_bytes += all[i].alloc_bytes;
+      o->live_objs += all[i].live_objs;
+      o->live_bytes += all[i].live_bytes;
+      o->freed += all[i].freed;
+      o->lifetime_ns += all[i].lifetime_ns;
+    }else{
+      all[out++] = all[i];
+    }
+  }
+  *count = out;
+  return all;
+}
+
+// Appends the names for a return address, root first, inlined functions included
+static void append_frame(char** line, size_t* len, size_t* room, void* addr)
+{
+  struct elfsym_frame f[16];
+  const char* module = NULL;
+  char buf[4096];
+  int n = elfsym_resolve((char*)addr - 1, f, 16, &module), i, used = 0;
+
+  if(n <= 0 || !f[n-1].function){
+    const char* base = module ? strrchr(module, '/') : NULL;
+    if(module)
+      used = snprintf(buf, sizeof(buf), "[%s]", base ? base + 1 : module);
+    else
+      used = snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)(uintptr_t)addr);
+  }
+  for(i = n - 1; i >= 0 && f[n-1].function && used < (int)sizeof(buf); i--){
+    const char* name = f[i].function ? f[i].function : "??";
+    char* demangled = NULL;
+#ifdef __cplusplus
+    int status = 0;
+    demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+    if(status == 0)
+      name = demangled;
+#endif
+    used += snprintf(buf + used, sizeof(buf) - used, "%s%s", i == n - 1 ? "" : ";", name);
+    free(demangled);
+  }
+  if(used >= (int)sizeof(buf))
+    used = sizeof(buf) - 1;
+  for(i = 0; i < used; i++)
+    if(buf[i] == '\n')
+      buf[i] = ' ';
+
+  if(*len + used + 2 > *room){
+    *room = 2 * (*len + used + 2);
+    *line = (char*)realloc(*line, *room);
+  }
+  if(*len)
+    (*line)[(*len)++] = ';';
+  memcpy(*line + *len, buf, used);
+  *len += used;
+  (*line)[*len] = '\0';
+}
+
+struct folded
+{
+  char*    line;
+  uint64_t bytes;
+};
+
+static int cmp_folded(const void* a, const void* b)
+{
+  return strcmp(((const struct folded*)a)->line, ((const struct folded*)b)->line);
+}
+
+uint64_t heapprof_write_folded(FILE* out, int which)
+{
+  struct hp_entry* all;
+  struct folded* lines;
+  uint64_t dropped, total = 0;
+  size_t n, nlines = 0, i;
+  int busy = hp_busy, j;
+
+  hp_busy = 1;
+  if(!(all = snapshot(&n, &dropped)) || !(lines = (struct folded*)malloc((n + 1) * sizeof(struct folded)))){
+    free(all);
+    hp_busy = busy;
+    return 0;
+  }
+  for(i = 0; i < n; i++){
+    uint64_t bytes = which == HEAPPROF_LIVE ? all[i].live_bytes : all[i].alloc_bytes;
+    size_t len = 0, room = 256;
+    if(!bytes)
+      continue;
+    lines[nlines].line = (char*)malloc(room);
+    lines[nlines].line[0] = '\0';
+    lines[nlines].bytes = bytes;
+    for(j = (int)all[i].depth - 1; j >= 0; j--)
+      append_frame(&lines[nlines].line, &len, &room, all[i].stack[j]);
+    nlines++;
+  }
+  free(all);
+
+  // different call sites in the same functions fold to the same line
+  qsort(lines, nlines, sizeof(struct folded), cmp_folded);
+  for(i = 0; i < nlines; i++){
+    uint64_t bytes = lines[i].bytes;
+    while(i + 1 < nlines && !strcmp(lines[i].line, lines[i+1].line)){
+      free(lines[i].line);
+      bytes += lines[++i].bytes;
+    }
+    fprintf(out, "%s %llu\n", lines[i].line, (unsigned long long)bytes);
+    free(lines[i].line);
+    total += bytes;
+  }
+  free(lines);
+  fflush(out);
+  hp_busy = busy;
+  return total;
+}
+
+static unsigned long long objects(uint64_t fixed)
+{
+  return (unsigned long long)((fixed + HP_ONE / 2) / HP_ONE);
+}
+
+uint64_t heapprof_write_pprof(FILE* out)
+{
+  struct hp_entry* all;
+  uint64_t dropped, live_objs = 0, live_bytes = 0, alloc_objs = 0, alloc_bytes = 0;
+  char buf[4096];
+  size_t n, i;
+  uint32_t j;
+  int busy = hp_busy;
+
+  hp_busy = 1;
+  if(!(all = snapshot(&n, &dropped))){
+    hp_busy = busy;
+    return 0;
+  }
+  for(i = 0; i < n; i++){
+    live_objs += all[i].live_objs;
+    live_bytes += all[i].live_bytes;
+    alloc_objs += all[i].alloc_objs;
+    alloc_bytes += all[i].alloc_bytes;
+  }
+  // "heapprofile" tells pprof the counts are already scaled up from the samples
+  fprintf(out, "heap profile: %llu: %llu [%llu: %llu] @ heapprofile\n", objects(live_objs),
+          (unsigned long long)live_bytes, objects(alloc_objs), (unsigned long long)alloc_bytes);
+  for(i = 0; i < n; i++){
+    fprintf(out, "%llu: %llu [%llu: %llu] @", objects(all[i].live_objs), (unsigned long long)all[i].live_bytes,
+            objects(all[i].alloc_objs), (unsigned long long)all[i].alloc_bytes);
+    for(j = 0; j < all[i].depth; j++)
+      fprintf(out, " %p", all[i].stack[j]);
+    fprintf(out, "\n");
+  }
+  free(all);
+
+  // pprof maps the addresses back to the binaries with this
+  fprintf(out, "\nMAPPED_LIBRARIES:\n");
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if(maps){
+    while((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+      fwrite(buf, 1, n, out);
+    fclose(maps);
+  }
+  fflush(out);
+  hp_busy = busy;
+  return live_bytes;
+}
+
+void heapprof_report(FILE* out)
+{
+  struct hp_entry* all;
+  uint64_t dropped, samples = 0, freed = 0, live_objs = 0, live_bytes = 0, alloc_objs = 0, alloc_bytes = 0;
+  double secs = hp_start ? (nanotime() - hp_start) / 1e9 : 0;
+  size_t n, i;
+  int busy = hp_busy, top = getenv("HEAPPROF_TOP") ? atoi(getenv("HEAPPROF_TOP")) : 20;
+
+  hp_busy = 1;
+  if(!(all = snapshot(&n, &dropped))){
+    hp_busy = busy;
+    return;
+  }
+  if(secs <= 0)
+    secs = 1e-9;
+  for(i = 0; i < n; i++){
+    samples += all[i].samples;
+    freed += all[i].freed;
+    live_objs += all[i].live_objs;
+    live_bytes += all[i].live_bytes;
+    alloc_objs += all[i].alloc_objs;
+    alloc_bytes += all[i].alloc_bytes;
+  }
+
+  fprintf(out, "==== heapprof report, pid %d, %.1f s, one sample per %.0f bytes ====\n",
+          (int)getpid(), secs, hp_mean);
+  fprintf(out, "allocated %.3f MB (%.3f MB/s) in ~%llu objects, %.3f MB live in ~%llu objects\n",
+          alloc_bytes / 1e6, alloc_bytes / 1e6 / secs, objects(alloc_objs), live_bytes / 1e6, objects(live_objs));
+  fprintf(out, "%llu samples, %llu of them freed\n", (unsigned long long)samples, (unsigned long long)freed);
+  if(dropped)
+    fprintf(out, "(%llu samples dropped, the tables were full)\n", (unsigned long long)dropped);
+
+  qsort(all, n, sizeof(struct hp_entry), cmp_alloc);
+  fprintf(out, "\n-- top stacks by bytes allocated --\n");
+  for(i = 0; i < n && (int)i < top; i++){
+    fprintf(out, "#%zu %.3f MB (%.3f MB/s) in ~%llu objects, %.3f MB live", i + 1, all[i].alloc_bytes / 1e6,
+            all[i].alloc_bytes / 1e6 / secs, objects(all[i].alloc_objs), all[i].live_bytes / 1e6);
+    if(all[i].freed)
+      fprintf(out, ", freed after %.3f ms on average\n", all[i].lifetime_ns / 1e6 / all[i].freed);
+    else
+      fprintf(out, ", none freed\n");
+    stack_dump_print(out, all[i].stack, all[i].depth);
+  }
+  fflush(out);
+  free(all);
+  hp_busy = busy;
+}
+
+void heapprof_dump(const char* prefix)
+{
+  static const char* const suffix[4] = { "live.folded", "alloc.folded", "heap", "txt" };
+  char path[512];
+  FILE* out;
+  int busy = hp_busy, i;
+
+  if(__atomic_exchange_n(&hp_dumping, 1, __ATOMIC_ACQUIRE))
+    return;
+  hp_busy = 1;
+  for(i = 0; i < 4; i++){
+    snprintf(path, sizeof(path), "%s.%s", prefix, suffix[i]);
+    if(!(out = fopen(path, "w")))
+      continue;
+    if(i == 0)
+      heapprof_write_folded(out, HEAPPROF_LIVE);
+    else if(i == 1)
+      heapprof_write_folded(out, HEAPPROF_ALLOCATED);
+    else if(i == 2)
+      heapprof_write_pprof(out);
+    else
+      heapprof_report(out);
+    fclose(out);
+  }
+  hp_busy = busy;
+  __atomic_store_n(&hp_dumping, 0, __ATOMIC_RELEASE);
+}
+
+static void on_signal(int sig)
+{
+  (void)sig;
+  sem_post(&hp_dump_sem);
+}
+
+// Writes the files for the signal, outside the handler
+static void* dumper_main(void* arg)
+{
+  char prefix[300];
+  int seq = 0;
+
+  (void)arg;
+  hp_busy = 1;
+  for(;;){
+    while(sem_wait(&hp_dump_sem))
+      ;
+    snprintf(prefix, sizeof(prefix), "%s.%d", hp_prefix, ++seq);
+    heapprof_dump(prefix);
+  }
+  return NULL;
+}
+
+__attribute__((constructor)) static void heapprof_init()
+{
+  const char* rate = getenv("HEAPPROF_RATE");
+  const char* output = getenv("HEAPPROF_OUTPUT");
+  const char* s = getenv("HEAPPROF_SIGNAL");
+  int sig = s ? atoi(s) : SIGUSR1;
+  pthread_t thread;
+
+  hp_mean = rate ? atof(rate) : 524288;
+  if(hp_mean <= 0){
+    __atomic_store_n(&hp_state, HP_OFF, __ATOMIC_RELEASE);
+    return;
+  }
+  hp_busy = 1;
+  if(output)
+    snprintf(hp_prefix, sizeof(hp_prefix), "%s", output);
+  else
+    snprintf(hp_prefix, sizeof(hp_prefix), "heapprof.%d", (int)getpid());
+  nanotime_calibrate();
+  hp_start = nanotime();
+  // the first backtrace() loads libgcc_s, get that out of the way now
+  void* warm[4];
+  stack_dump_capture(warm, 4, 0);
+  if(pthread_key_create(&hp_exit_key, table_exit)){
+    __atomic_store_n(&hp_state, HP_OFF, __ATOMIC_RELEASE);
+    hp_busy = 0;
+    return;
+  }
+  if(sig > 0 && !sem_init(&hp_dump_sem, 0, 0) && !pthread_create(&thread, NULL, dumper_main, NULL)){
+    struct sigaction sa;
+    pthread_detach(thread);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(sig, &sa, NULL);
+  }
+  __atomic_store_n(&hp_state, HP_ON, __ATOMIC_RELEASE);
+  hp_busy = 0;
+}
+
+__attribute__((destructor)) static void heapprof_fini()
+{
+  if(__atomic_load_n(&hp_state, __ATOMIC_ACQUIRE) == HP_ON)
+    heapprof_dump(hp_prefix);
+}
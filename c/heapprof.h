@@ -0,0 +1,59 @@
+// Heap profiler: sampled allocation stacks, written as live heap and allocation profiles
+// Author: Paul Foster
+// Public domain
+//
+// Interposes malloc, free, calloc, realloc and the aligned allocators (C++ new and delete end up
+// in malloc and free), and passes everything on to glibc. Allocations are sampled the way
+// tcmalloc does it: each thread counts down the bytes it allocates and takes a sample when the
+// count runs out, then draws the next count from an exponential distribution with a mean of
+// HEAPPROF_RATE bytes. So an allocation that isn't sampled costs a subtraction and a branch,
+// and a free that isn't of a sampled block one load from a mostly zero filter. A sample records
+// the stack with stack_dump_capture() into a per thread table, weighted by the inverse of the
+// chance of sampling an allocation of that size, so the totals are estimates of the real ones.
+// A thread's table is handed on to the next new thread when it exits, so a program that keeps
+// starting threads has only as many tables as it ever had threads running at once.
+// Sampled blocks are kept in a table of live samples until they are freed, which gives the live
+// heap and how long each stack's allocations lived.
+//
+// Preload it into an unmodified program:
+//   gcc -shared -fPIC -O2 -o libheapprof.so heapprof.c stack_dump_on_assert.c elfsym.c unwind.c time.c -lpthread -lm
+//   LD_PRELOAD=./libheapprof.so ./myserver
+// or link the same files into the program. At exit, and every time the process gets
+// HEAPPROF_SIGNAL (default SIGUSR1, 0 turns it off), these are written, with a sequence number
+// after the prefix for the signal's:
+//   <prefix>.live.folded    live bytes per stack, for flamegraph.pl
+//   <prefix>.alloc.folded   bytes allocated per stack since the start
+//   <prefix>.heap           both, in the gperftools heap profile format: pprof ./myserver x.heap
+//   <prefix>.txt            the top stacks with allocation rate, live bytes and mean lifetime
+//   HEAPPROF_OUTPUT=prefix  default heapprof.<pid>
+//   HEAPPROF_RATE=bytes     mean bytes between samples (default 524288, 0 turns sampling off)
+//   HEAPPROF_TOP=n          how many stacks go in the text report (default 20)
+// Build the program with -g -rdynamic so the stacks resolve.
+
+#ifndef P_HEAPPROF_H
+#define P_HEAPPROF_H
+#include <stdio.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEAPPROF_LIVE       0   //bytes still allocated
+#define HEAPPROF_ALLOCATED  1   //bytes allocated since the start
+
+// One line per unique stack, root first, frames separated by ';', then the estimated bytes.
+// Returns the total.
+uint64_t heapprof_write_folded(FILE* out, int which);
+// The gperftools heap profile, with live and allocated objects and bytes per stack, which pprof
+// reads directly
+uint64_t heapprof_write_pprof(FILE* out);
+// Text report of the top stacks by bytes allocated
+void heapprof_report(FILE* out);
+
+// Writes all four files with this prefix, as on exit
+void heapprof_dump(const char* prefix);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_HEAPPROF_H
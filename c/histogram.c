@@ -0,0 +1,158 @@
+// HDR style latency histogram, see histogram.h
+// Author: Paul Foster
+// Public domain
+//
+// compile with: gcc -c histogram.c
+
+#include <string.h>
+#include <stdio.h>
+
+#include "histogram.h"
+
+#define HISTOGRAM_MAGIC   0x48444831u  //"HDH1"
+
+// Largest value that lands in bucket idx
+static uint64_t bucket_top(unsigned int idx)
+{
+  if(idx < HISTOGRAM_SUB_COUNT)
+    return idx;
+  unsigned int shift = (idx >> HISTOGRAM_SUB_BITS) - 1;
+  uint64_t sub = idx & (HISTOGRAM_SUB_COUNT - 1);
+  return ((HISTOGRAM_SUB_COUNT + sub) << shift) + ((1ull << shift) - 1);
+}
+
+void histogram_reset(struct histogram* h)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+void histogram_merge(struct histogram* dst, const struct histogram* src)
+{
+  unsigned int i;
+  if(src->count == 0)
+    return;
+
+  if(dst->count == 0 || src->min < dst->min)
+    dst->min = src->min;
+  if(src->max > dst->max)
+    dst->max = src->max;
+  dst->count += src->count;
+  dst->sum += src->sum;
+  for(i = 0; i < HISTOGRAM_BUCKETS; i++)
+    dst->buckets[i] += src->buckets[i];
+}
+
+uint64_t histogram_percentile(const struct histogram* h, double p)
+{
+  unsigned int i;
+  if(h->count == 0)
+    return 0;
+  if(p >= 100.0)
+    return h->max;
+
+  // the rank of the sample we want, 1 based
+  uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+  if(rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for(i = 0; i < HISTOGRAM_BUCKETS; i++){
+    seen += h->buckets[i];
+    if(seen >= rank){
+      uint64_t v = bucket_top(i);
+      return v > h->max ? h->max : (v < h->min ? h->min : v);
+    }
+  }
+  return h->max;
+}
+
+double histogram_mean(const struct histogram* h)
+{
+  return h->count ? (double)h->sum / (double)h->count : 0.0;
+}
+
+void histogram_print(FILE* out, const char* name, const struct histogram* h)
+{
+  fprintf(out, "%-20s n=%-10llu min=%-8llu mean=%-10.1f p50=%-8llu p99=%-8llu p99.9=%-8llu max=%llu\n",
+          name, (unsigned long long)h->count, (unsigned long long)(h->count ? h->min : 0), histogram_mean(h),
+          (unsigned long long)histogram_percentile(h, 50.0),
+          (unsigned long long)histogram_percentile(h, 99.0),
+          (unsigned long long)histogram_percentile(h, 99.9),
+          (unsigned long long)h->max);
+}
+
+// LEB128 style varints. The writers always count the bytes but only store inside the buffer.
+static size_t put_varint(unsigned char* buf, size_t size, size_t pos, uint64_t v)
+{
+  do{
+    unsigned char c = v & 0x7f;
+    v >>= 7;
+    if(v)
+      c |= 0x80;
+    if(pos < size)
+      buf[pos] = c;
+    pos++;
+  }while(v);
+  return pos;
+}
+
+static int get_varint(const unsigned char* buf, size_t len, size_t* pos, uint64_t* v)
+{
+  unsigned int shift = 0;
+  *v = 0;
+  while(*pos < len && shift < 64){
+    unsigned char c = buf[(*pos)++];
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if(!(c & 0x80))
+      return 0;
+    shift += 7;
+  }
+  return -1;
+}
+
+size_t histogram_serialize(const struct histogram* h, unsigned char* buf, size_t size)
+{
+  unsigned int i, last = 0;
+  size_t pos = 0;
+
+  pos = put_varint(buf, size, pos, HISTOGRAM_MAGIC);
+  pos = put_varint(buf, size, pos, HISTOGRAM_SUB_BITS);
+  pos = put_varint(buf, size, pos, h->count);
+  pos = put_varint(buf, size, pos, h->sum);
+  pos = put_varint(buf, size, pos, h->min);
+  pos = put_varint(buf, size, pos, h->max);
+
+  for(i = 0; i < HISTOGRAM_BUCKETS; i++){
+    if(!h->buckets[i])
+      continue;
+    pos = put_varint(buf, size, pos, i - last);
+    pos = put_varint(buf, size, pos, h->buckets[i]);
+    last = i;
+  }
+  return pos;
+}
+
+int histogram_deserialize(struct histogram* h, const unsigned char* buf, size_t len)
+{
+  uint64_t magic, bits, gap, n, idx = 0;
+  size_t pos = 0;
+
+  histogram_reset(h);
+  if(get_varint(buf, len, &pos, &magic) || magic != HISTOGRAM_MAGIC)
+    return -1;
+  if(get_varint(buf, len, &pos, &bits) || bits != HISTOGRAM_SUB_BITS)
+    return -1;
+  if(get_varint(buf, len, &pos, &h->count) || get_varint(buf, len, &pos, &h->sum) ||
+     get_varint(buf, len, &pos, &h->min) || get_varint(buf, len, &pos, &h->max))
+    return -1;
+
+  while(pos < len){
+    if(get_varint(buf, len, &pos, &gap) || get_varint(buf, len, &pos, &n))
+      return -1;
+    idx += gap;
+    if(idx >= HISTOGRAM_BUCKETS)
+      return -1;
+    h->buckets[idx] += n;
+  }
+  return 0;
+}
@@ -0,0 +1,83 @@
+// HDR style latency histogram with bounded relative error, meant to be fed nanotime() deltas
+// Author: Paul Foster
+// Public domain
+//
+// Keep one histogram per thread, recording is a couple of shifts and a plain increment,
+// then histogram_merge() them together when you want numbers out:
+//
+//   static __thread struct histogram h;     //zeroed memory is an empty histogram
+//   uint64_t t = nanotime();
+//   handle_request();
+//   histogram_record(&h, nanotime() - t);
+//   ...
+//   histogram_merge(&total, &h);
+//   histogram_print(stderr, "request", &total);
+//
+// Values below 2^HISTOGRAM_SUB_BITS are exact, everything above lands in a bucket no wider than
+// 1/2^HISTOGRAM_SUB_BITS of its value (0.8% with the default), up to the full 64 bit range.
+
+#ifndef P_HISTOGRAM_H
+#define P_HISTOGRAM_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef HISTOGRAM_SUB_BITS
+#define HISTOGRAM_SUB_BITS 7
+#endif
+#define HISTOGRAM_SUB_COUNT (1ull << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((65 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_COUNT)
+
+struct histogram
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;      //only meaningful when count != 0
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static inline unsigned int histogram_index(uint64_t v)
+{
+  if(v < HISTOGRAM_SUB_COUNT)
+    return (unsigned int)v;
+  unsigned int shift = 63 - __builtin_clzll(v) - HISTOGRAM_SUB_BITS;
+  return (unsigned int)(((shift + 1) << HISTOGRAM_SUB_BITS) + ((v >> shift) - HISTOGRAM_SUB_COUNT));
+}
+
+static inline void histogram_record(struct histogram* h, uint64_t v)
+{
+  if(h->count == 0 || v < h->min)
+    h->min = v;
+  if(v > h->max)
+    h->max = v;
+  h->count++;
+  h->sum += v;
+  h->buckets[histogram_index(v)]++;
+}
+
+void histogram_reset(struct histogram* h);
+
+// dst += src. Both can be live, but then the result is only approximately consistent.
+void histogram_merge(struct histogram* dst, const struct histogram* src);
+
+// Value at percentile p (0-100), reported as the top of its bucket clamped to the real max
+uint64_t histogram_percentile(const struct histogram* h, double p);
+double   histogram_mean(const struct histogram* h);
+
+// Prints count/min/mean/p50/p99/p99.9/max on one line
+void histogram_print(FILE* out, const char* name, const struct histogram* h);
+
+// Compact binary form: a small header then the non-empty buckets as varint (gap, count) pairs.
+// Returns the number of bytes the encoding needs; nothing past size is written, so call with
+// size 0 to find out how much to allocate. Deserialize returns 0 on success, -1 on bad input.
+size_t histogram_serialize(const struct histogram* h, unsigned char* buf, size_t size);
+int    histogram_deserialize(struct histogram* h, const unsigned char* buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_HISTOGRAM_H
@@ -0,0 +1,368 @@
+// Lock contention and blocking time profiler, see lockprof.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, build with:
+//   gcc -shared -fPIC -O2 -o liblockprof.so lockprof.c stack_dump_on_assert.c elfsym.c unwind.c time.c -ldl -lpthread
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "lockprof.h"
+#include "stack_dump_on_assert.h"
+#include "time.h"
+
+#define LOCKPROF_DEPTH  16
+#define LOCKPROF_TABLE  1024     //entries per thread, power of two
+#define LOCKPROF_PROBE  16
+#define LP_REPORT_WAIT_MS 10000  //how long a report waits for one in progress
+
+enum { LP_MUTEX = 0, LP_RDLOCK, LP_WRLOCK, LP_COND, LP_NKINDS };
+static const char* const lp_kind_names[LP_NKINDS] = { "mutex", "rwlock-rd", "rwlock-wr", "condwait" };
+
+struct lp_entry
+{
+  uint64_t    hash;      //0 means empty, written last
+  const void* lock;
+  uint32_t    kind;
+  uint32_t    depth;
+  uint64_t    count;
+  uint64_t    total_ns;
+  uint64_t    max_ns;
+  void*       stack[LOCKPROF_DEPTH];
+};
+
+struct lp_table
+{
+  struct lp_table* next;
+  uint32_t         tid;
+  uint64_t         dropped;
+  struct lp_entry  e[LOCKPROF_TABLE];
+};
+
+#define LP_TLS __thread __attribute__((tls_model("initial-exec")))
+static LP_TLS struct lp_table* lp_tls = NULL;
+static LP_TLS int lp_busy = 0;    //set while the profiler itself runs, so its own locking goes straight through
+
+static struct lp_table* lp_tables = NULL;
+static sem_t lp_dump_sem;
+static int lp_reporting = 0;
+
+static int (*real_mutex_lock)(pthread_mutex_t*);
+static int (*real_cond_wait)(pthread_cond_t*, pthread_mutex_t*);
+static int (*real_rdlock)(pthread_rwlock_t*);
+static int (*real_wrlock)(pthread_rwlock_t*);
+
+static void resolve()
+{
+  real_mutex_lock = (int (*)(pthread_mutex_t*))dlsym(RTLD_NEXT, "pthread_mutex_lock");
+  // plain dlsym hands back the pre 2.3.2 condvar ABI, which breaks modern condvars
+  real_cond_wait = (int (*)(pthread_cond_t*, pthread_mutex_t*))dlvsym(RTLD_NEXT, "pthread_cond_wait", "GLIBC_2.3.2");
+  if(!real_cond_wait)
+    real_cond_wait = (int (*)(pthread_cond_t*, pthread_mutex_t*))dlsym(RTLD_NEXT, "pthread_cond_wait");
+  real_rdlock = (int (*)(pthread_rwlock_t*))dlsym(RTLD_NEXT, "pthread_rwlock_rdlock");
+  real_wrlock = (int (*)(pthread_rwlock_t*))dlsym(RTLD_NEXT, "pthread_rwlock_wrlock");
+}
+
+static struct lp_table* thread_table()
+{
+  void* p = mmap(NULL, sizeof(struct lp_table), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    return NULL;
+  struct lp_table* t = (struct lp_table*)p;
+  t->tid = (uint32_t)syscall(SYS_gettid);
+  t->next = __atomic_load_n(&lp_tables, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&lp_tables, &t->next, t, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  lp_tls = t;
+  return t;
+}
+
+static uint64_t hash_key(const void* lock, int kind, void* const* stack, int depth)
+{
+  uint64_t h = 1469598103934665603ull ^ (uintptr_t)lock ^ ((uint64_t)kind << 56);
+  int i;
+  for(i = 0; i < depth; i++)
+    h = (h ^ (uintptr_t)stack[i]) * 1099511628211ull;
+  return h ? h : 1;
+}
+
+static void record(const void* lock, int kind, void* const* stack, int depth, uint64_t ns)
+{
+  struct lp_table* t = lp_tls;
+  int i;
+  if(!t && !(t = thread_table()))
+    return;
+
+  uint64_t h = hash_key(lock, kind, stack, depth);
+  for(i = 0; i < LOCKPROF_PROBE; i++){
+    struct lp_entry* e = &t->e[(h + i) & (LOCKPROF_TABLE - 1)];
+    if(e->hash == 0){
+      e->lock = lock;
+      e->kind = kind;
+      e->depth = depth;
+      memcpy(e->stack, stack, depth * sizeof(void*));
+      __atomic_store_n(&e->hash, h, __ATOMIC_RELEASE);
+    }else if(e->hash != h || e->lock != lock || e->kind != (uint32_t)kind){
+      continue;
+    }
+    __atomic_store_n(&e->count, e->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->total_ns, e->total_ns + ns, __ATOMIC_RELAXED);
+    if(ns > e->max_ns)
+      __atomic_store_n(&e->max_ns, ns, __ATOMIC_RELAXED);
+    return;
+  }
+  t->dropped++;
+}
+
+// Timing starts after the failed trylock, so the stack walk is not counted as waiting
+#define LP_SLOW_PATH(kind, lock, call) \
+  do{ \
+    void* stack_[LOCKPROF_DEPTH]; \
+    lp_busy = 1; \
+    int depth_ = stack_dump_capture(stack_, LOCKPROF_DEPTH, 2); \
+    lp_busy = 0; \
+    uint64_t t0_ = nanotime(); \
+    ret = call; \
+    uint64_t dt_ = nanotime() - t0_; \
+    lp_busy = 1; \
+    record(lock, kind, stack_, depth_, dt_); \
+    lp_busy = 0; \
+  }while(0)
+
+int pthread_mutex_lock(pthread_mutex_t* m)
+{
+  int ret;
+  if(__builtin_expect(!real_mutex_lock, 0))
+    resolve();
+  if(lp_busy)
+    return real_mutex_lock(m);
+  ret = pthread_mutex_trylock(m);
+  if(ret != EBUSY)
+    return ret;
+  LP_SLOW_PATH(LP_MUTEX, m, real_mutex_lock(m));
+  return ret;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t* l)
+{
+  int ret;
+  if(__builtin_expect(!real_rdlock, 0))
+    resolve();
+  if(lp_busy)
+    return real_rdlock(l);
+  ret = pthread_rwlock_tryrdlock(l);
+  if(ret != EBUSY)
+    return ret;
+  LP_SLOW_PATH(LP_RDLOCK, l, real_rdlock(l));
+  return ret;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t* l)
+{
+  int ret;
+  if(__builtin_expect(!real_wrlock, 0))
+    resolve();
+  if(lp_busy)
+    return real_wrlock(l);
+  ret = pthread_rwlock_trywrlock(l);
+  if(ret != EBUSY)
+    return ret;
+  LP_SLOW_PATH(LP_WRLOCK, l, real_wrlock(l));
+  return ret;
+}
+
+// A condition wait always blocks, so it is always timed
+int pthread_cond_wait(pthread_cond_t* c, pthread_mutex_t* m)
+{
+  int ret;
+  if(__builtin_expect(!real_cond_wait, 0))
+    resolve();
+  if(lp_busy)
+    return real_cond_wait(c, m);
+  LP_SLOW_PATH(LP_COND, c, real_cond_wait(c, m));
+  return ret;
+}
+
+static int cmp_key(const void* a, const void* b)
+{
+  const struct lp_entry* x = (const struct lp_entry*)a;
+  const struct lp_entry* y = (const struct lp_entry*)b;
+  if(x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  if(x->lock != y->lock)
+    return (uintptr_t)x->lock < (uintptr_t)y->lock ? -1 : 1;
+  return (int)x->kind - (int)y->kind;
+}
+
+static int cmp_lock(const void* a, const void* b)
+{
+  const struct lp_entry* x = (const struct lp_entry*)a;
+  const struct lp_entry* y = (const struct lp_entry*)b;
+  if(x->lock != y->lock)
+    return (uintptr_t)x->lock < (uintptr_t)y->lock ? -1 : 1;
+  return (int)x->kind - (int)y->kind;
+}
+
+static int cmp_total(const void* a, const void* b)
+{
+  const struct lp_entry* x = (const struct lp_entry*)a;
+  const struct lp_entry* y = (const struct lp_entry*)b;
+  return x->total_ns < y->total_ns ? 1 : (x->total_ns > y->total_ns ? -1 : 0);
+}
+
+// Merges entries with the same key that sit next to each other, returns the new count
+static size_t combine(struct lp_entry* e, size_t n, int (*same)(const void*, const void*))
+{
+  size_t i, out = 0;
+  for(i = 0; i < n; i++){
+    if(out && !same(&e[out-1], &e[i])){
+      e[out-1].count += e[i].count;
+      e[out-1].total_ns += e[i].total_ns;
+      if(e[i].max_ns > e[out-1].max_ns)
+        e[out-1].max_ns = e[i].max_ns;
+    }else{
+      e[out++] = e[i];
+    }
+  }
+  return out;
+}
+
+void lockprof_report(FILE* out)
+{
+  struct lp_table* t;
+  size_t n = 0, i, cap = 0;
+  uint64_t dropped = 0, total[LP_NKINDS] = {0}, count[LP_NKINDS] = {0};
+  int busy = lp_busy, top = getenv("LOCKPROF_TOP") ? atoi(getenv("LOCKPROF_TOP")) : 20;
+
+  // one report at a time: a signal's may still be going when the one at exit starts, which waits
+  // for it rather than get lost, but not forever in case that thread is stuck
+  for(i = 0; __atomic_exchange_n(&lp_reporting, 1, __ATOMIC_ACQUIRE); i++){
+    if(i == LP_REPORT_WAIT_MS){
+      fprintf(out, "lockprof: another report is still being written, skipping this one\n");
+      return;
+    }
+    usleep(1000);
+  }
+  lp_busy = 1;
+
+  for(t = __atomic_load_n(&lp_tables, __ATOMIC_ACQUIRE); t; t = t->next)
+    cap += LOCKPROF_TABLE;
+  struct lp_entry* all = (struct lp_entry*)malloc((cap ? cap : 1) * sizeof(struct lp_entry));
+  if(!all)
+    goto done;
+
+  for(t = __atomic_load_n(&lp_tables, __ATOMIC_ACQUIRE); t; t = t->next){
+    dropped += t->dropped;
+    for(i = 0; i < LOCKPROF_TABLE; i++){
+      if(__atomic_load_n(&t->e[i].hash, __ATOMIC_ACQUIRE))
+        all[n++] = t->e[i];
+    }
+  }
+
+  qsort(all, n, sizeof(struct lp_entry), cmp_key);
+  n = combine(all, n, cmp_key);
+  for(i = 0; i < n; i++){
+    total[all[i].kind] += all[i].total_ns;
+    count[all[i].kind] += all[i].count;
+  }
+
+  fprintf(out, "==== lockprof report, pid %d ====\n", (int)getpid());
+  for(i = 0; i < LP_NKINDS; i++)
+    fprintf(out, "%-10s %10llu waits %12.3f ms\n", lp_kind_names[i],
+            (unsigned long long)count[i], total[i] / 1e6);
+  if(dropped)
+    fprintf(out, "(%llu waits dropped, per thread tables were full)\n", (unsigned long long)dropped);
+
+  // per stack, the biggest first
+  qsort(all, n, sizeof(struct lp_entry), cmp_total);
+  fprintf(out, "\n-- top stacks by total wait --\n");
+  for(i = 0; i < n && (int)i < top; i++){
+    fprintf(out, "#%zu %s %p: %.3f ms in %llu waits, max %.1f us\n", i + 1, lp_kind_names[all[i].kind],
+            all[i].lock, all[i].total_ns / 1e6, (unsigned long long)all[i].count, all[i].max_ns / 1e3);
+    stack_dump_print(out, all[i].stack, all[i].depth);
+  }
+
+  // then rolled up per lock
+  qsort(all, n, sizeof(struct lp_entry), cmp_lock);
+  n = combine(all, n, cmp_lock);
+  qsort(all, n, sizeof(struct lp_entry), cmp_total);
+  fprintf(out, "\n-- locks by total wait --\n%-10s %-18s %12s %10s %12s\n", "kind", "lock", "total ms", "waits", "max us");
+  for(i = 0; i < n; i++)
+    fprintf(out, "%-10s %-18p %12.3f %10llu %12.1f\n", lp_kind_names[all[i].kind], all[i].lock,
+            all[i].total_ns / 1e6, (unsigned long long)all[i].count, all[i].max_ns / 1e3);
+  fflush(out);
+  free(all);
+
+done:
+  lp_busy = busy;
+  __atomic_store_n(&lp_reporting, 0, __ATOMIC_RELEASE);
+}
+
+// To LOCKPROF_OUTPUT or stderr
+static void report_to_output()
+{
+  const char* path = getenv("LOCKPROF_OUTPUT");
+  FILE* out = path ? fopen(path, "a") : stderr;
+  lockprof_report(out ? out : stderr);
+  if(out && out != stderr)
+    fclose(out);
+}
+
+static void on_signal(int sig)
+{
+  (void)sig;
+  sem_post(&lp_dump_sem);
+}
+
+// Writes the report for the signal, outside the handler and without any of the program's locks
+static void* dumper_main(void* arg)
+{
+  (void)arg;
+  lp_busy = 1;
+  for(;;){
+    while(sem_wait(&lp_dump_sem))
+      ;
+    report_to_output();
+  }
+  return NULL;
+}
+
+__attribute__((constructor)) static void lockprof_init()
+{
+  const char* s = getenv("LOCKPROF_SIGNAL");
+  int sig = s ? atoi(s) : SIGUSR2;
+  pthread_t thread;
+
+  lp_busy = 1;
+  resolve();
+  nanotime_calibrate();
+  // the first backtrace() loads libgcc_s, get that out of the way now
+  void* warm[4];
+  stack_dump_capture(warm, 4, 0);
+  if(sig > 0 && !sem_init(&lp_dump_sem, 0, 0) && !pthread_create(&thread, NULL, dumper_main, NULL)){
+    struct sigaction sa;
+    pthread_detach(thread);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(sig, &sa, NULL);
+  }
+  lp_busy = 0;
+}
+
+__attribute__((destructor)) static void lockprof_fini()
+{
+  report_to_output();
+}
@@ -0,0 +1,34 @@
+// Lock contention and blocking time profiler
+// Author: Paul Foster
+// Public domain
+//
+// Interposes pthread_mutex_lock, pthread_cond_wait and pthread_rwlock_rdlock/wrlock. Acquisitions
+// that succeed on the first try cost one extra trylock and are not recorded. When the lock is
+// contended the wait is timed with nanotime() and charged to the lock and to the acquiring stack,
+// in per thread tables, so the profiler itself adds no shared locks. Condition variable waits are
+// reported separately since an idle worker waiting for work is not contention.
+//
+// Preload it into an unmodified program:
+//   gcc -shared -fPIC -O2 -o liblockprof.so lockprof.c stack_dump_on_assert.c elfsym.c unwind.c time.c -ldl -lpthread
+//   LD_PRELOAD=./liblockprof.so ./myserver
+// A report sorted by total wait time is printed at exit, or when the process gets LOCKPROF_SIGNAL
+// (default SIGUSR2, 0 turns it off). The handler only wakes a thread of the profiler's own, which
+// writes the report, so no thread of the program does the work or waits for it.
+//   LOCKPROF_OUTPUT=file   append the report there instead of stderr
+//   LOCKPROF_TOP=n         how many stacks to print (default 20)
+// Build the program with -g -rdynamic so the stacks resolve.
+
+#ifndef P_LOCKPROF_H
+#define P_LOCKPROF_H
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Writes the report now, for programs that link the profiler in rather than preloading it
+void lockprof_report(FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_LOCKPROF_H
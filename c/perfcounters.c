@@ -0,0 +1,157 @@
+// Hardware performance counters for the calling thread, see perfcounters.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c perfcounters.c time.c -lpthread
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfcounters.h"
+#include "time.h"
+
+const char* const perf_counter_names[PERF_NCOUNTERS] = {
+  "cycles", "instructions", "llc-misses", "branch-misses", "context-switches"
+};
+
+static const struct { uint32_t type; uint64_t config; } perf_events[PERF_NCOUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+static int open_event(int i, int group_fd)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = perf_events[i].type;
+  attr.config = perf_events[i].config;
+  attr.exclude_hv = 1;
+  // context switches happen in the kernel, so only hide the kernel from the hardware counters
+  attr.exclude_kernel = perf_events[i].type == PERF_TYPE_HARDWARE;
+
+  int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+  if(fd < 0 && !attr.exclude_kernel){
+    // perf_event_paranoid >= 2 only allows user space counting
+    attr.exclude_kernel = 1;
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+  }
+  return fd;
+}
+
+int perf_counters_open(struct perf_counters* pc)
+{
+  int i, leader = -1;
+  long pagesize = sysconf(_SC_PAGESIZE);
+
+  pc->nopen = 0;
+  for(i = 0; i < PERF_NCOUNTERS; i++){
+    pc->fd[i] = open_event(i, leader);
+    if(pc->fd[i] < 0 && leader >= 0)
+      pc->fd[i] = open_event(i, -1); //some PMUs can't fit everything in one group, count it on its own
+    pc->page[i] = NULL;
+    if(pc->fd[i] < 0)
+      continue;
+
+    if(leader < 0)
+      leader = pc->fd[i];
+    pc->nopen++;
+
+    void* page = mmap(NULL, pagesize, PROT_READ, MAP_SHARED, pc->fd[i], 0);
+    if(page != MAP_FAILED)
+      pc->page[i] = page;
+  }
+  return pc->nopen;
+}
+
+void perf_counters_close(struct perf_counters* pc)
+{
+  int i;
+  long pagesize = sysconf(_SC_PAGESIZE);
+  for(i = 0; i < PERF_NCOUNTERS; i++){
+    if(pc->page[i])
+      munmap(pc->page[i], pagesize);
+    if(pc->fd[i] >= 0)
+      close(pc->fd[i]);
+    pc->page[i] = NULL;
+    pc->fd[i] = -1;
+  }
+  pc->nopen = 0;
+}
+
+// The user space read protocol from linux/perf_event.h. Returns 0 if the kernel
+// won't let us rdpmc this counter right now, so the caller falls back to read().
+static int read_user(const struct perf_event_mmap_page* p, uint64_t* value)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t seq, idx;
+  uint64_t count;
+  do{
+    seq = p->lock;
+    __asm__ volatile("" ::: "memory");
+    idx = p->index;
+    count = p->offset;
+    if(!p->cap_user_rdpmc || !idx)
+      return 0;
+    int64_t pmc = (int64_t)__builtin_ia32_rdpmc(idx - 1);
+    pmc <<= 64 - p->pmc_width;
+    pmc >>= 64 - p->pmc_width;
+    count += pmc;
+    __asm__ volatile("" ::: "memory");
+  }while(p->lock != seq);
+  *value = count;
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+void perf_counters_read(const struct perf_counters* pc, struct perf_sample* s)
+{
+  int i;
+  for(i = 0; i < PERF_NCOUNTERS; i++){
+    s->valid[i] = 0;
+    s->value[i] = 0;
+    if(pc->fd[i] < 0)
+      continue;
+    if(pc->page[i] && read_user((const struct perf_event_mmap_page*)pc->page[i], &s->value[i]))
+      s->valid[i] = 1;
+    else
+      s->valid[i] = read(pc->fd[i], &s->value[i], sizeof(uint64_t)) == sizeof(uint64_t);
+  }
+  s->ns = nanotime();
+}
+
+void perf_sample_diff(const struct perf_sample* begin, const struct perf_sample* end, struct perf_sample* out)
+{
+  int i;
+  out->ns = end->ns - begin->ns;
+  for(i = 0; i < PERF_NCOUNTERS; i++){
+    out->valid[i] = begin->valid[i] && end->valid[i];
+    out->value[i] = out->valid[i] ? end->value[i] - begin->value[i] : 0;
+  }
+}
+
+void perf_sample_print(FILE* out, const char* name, const struct perf_sample* s)
+{
+  int i;
+  fprintf(out, "%s: %llu ns", name, (unsigned long long)s->ns);
+  for(i = 0; i < PERF_NCOUNTERS; i++){
+    if(s->valid[i])
+      fprintf(out, ", %llu %s", (unsigned long long)s->value[i], perf_counter_names[i]);
+  }
+  if(s->valid[PERF_CYCLES] && s->valid[PERF_INSTRUCTIONS] && s->value[PERF_CYCLES]){
+    fprintf(out, ", %.2f IPC", (double)s->value[PERF_INSTRUCTIONS] / s->value[PERF_CYCLES]);
+    if(s->ns)
+      fprintf(out, ", %.2f GHz", (double)s->value[PERF_CYCLES] / s->ns);
+  }
+  fprintf(out, "\n");
+}
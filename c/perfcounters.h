@@ -0,0 +1,69 @@
+// Hardware performance counters for the calling thread, sampled alongside nanotime()
+// Author: Paul Foster
+// Public domain
+//
+// Usage:
+//   struct perf_counters pc;
+//   struct perf_sample a, b, d;
+//   perf_counters_open(&pc);          //per thread, returns how many counters it got
+//   perf_counters_read(&pc, &a);
+//   hot_loop();
+//   perf_counters_read(&pc, &b);
+//   perf_sample_diff(&a, &b, &d);
+//   perf_sample_print(stderr, "hot_loop", &d);
+//   perf_counters_close(&pc);
+//
+// Counters are read with rdpmc straight from user space when the kernel allows it
+// (/sys/bus/event_source/devices/cpu/rdpmc), otherwise with one read() each.
+// If perf events are unavailable (perf_event_paranoid, containers, VMs) the counters are
+// simply marked invalid and you still get the elapsed time.
+// Linux only.
+
+#ifndef P_PERFCOUNTERS_H
+#define P_PERFCOUNTERS_H
+#include <stdint.h>
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum perf_counter_id
+{
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_CONTEXT_SWITCHES,
+  PERF_NCOUNTERS
+};
+
+struct perf_counters
+{
+  int   fd[PERF_NCOUNTERS];      //-1 if that counter could not be opened
+  void* page[PERF_NCOUNTERS];    //mmapped perf_event_mmap_page, NULL if not mapped
+  int   nopen;
+};
+
+struct perf_sample
+{
+  uint64_t ns;                       //nanotime()
+  uint64_t value[PERF_NCOUNTERS];
+  int      valid[PERF_NCOUNTERS];
+};
+
+extern const char* const perf_counter_names[PERF_NCOUNTERS];
+
+// Opens the counters as one group for the calling thread. Returns the number opened, 0 means time only.
+int  perf_counters_open(struct perf_counters* pc);
+void perf_counters_close(struct perf_counters* pc);
+
+void perf_counters_read(const struct perf_counters* pc, struct perf_sample* s);
+
+// out = end - begin
+void perf_sample_diff(const struct perf_sample* begin, const struct perf_sample* end, struct perf_sample* out);
+void perf_sample_print(FILE* out, const char* name, const struct perf_sample* s);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_PERFCOUNTERS_H
@@ -0,0 +1,549 @@
+// Sampling CPU profiler, see sampleprof.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, see sampleprof.h for how to build it
+//
+// Each thread gets a ring of words that only its signal handler writes the head of, and only
+// the drain thread writes the tail of. A sample is its frame count followed by the frames, pc
+// first. Rings are mmapped by the handler itself the first time a thread is sampled, so threads
+// the program starts on its own are covered too, and are given to a new thread once the drain
+// thread sees the old one has gone and the ring is empty.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+#include "sampleprof.h"
+#include "unwind.h"
+#include "elfsym.h"
+
+#ifdef __cplusplus
+#include <cxxabi.h>
+#endif
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define RING_WORDS (1 << 16)
+#define RING_MASK (RING_WORDS - 1)
+#define MAX_FRAMES 64
+#define DRAIN_MS 100
+
+struct ring
+{
+  struct ring* next;
+  int          in_use;
+  int          stopped;   //the thread called sampleprof_thread_stop()
+  uint32_t     tid;
+  uint64_t     head __attribute__((aligned(64)));  //only the owning thread's handler writes this
+  uint64_t     tail __attribute__((aligned(64)));  //only the drain thread writes this
+  uintptr_t    w[RING_WORDS] __attribute__((aligned(64)));
+};
+
+struct stack
+{
+  uint64_t   hash;
+  uint64_t   count;
+  uint32_t   n;
+  uintptr_t* frames;
+};
+
+static struct ring* rings = NULL;
+static __thread struct ring* tls_ring __attribute__((tls_model("initial-exec")));
+static __thread timer_t tls_timer __attribute__((tls_model("initial-exec")));
+static __thread int tls_has_timer __attribute__((tls_model("initial-exec")));
+static int running = 0;
+static int all_threads = 0;
+static int frame_pointers = 0;
+static long period_ns;
+static uint64_t dropped = 0;
+
+// The unique stacks, guarded by agg_lock along with the tails of the rings
+static pthread_mutex_t agg_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stack* stacks;
+static size_t nstacks, capstacks;
+
+static struct {
+  pthread_t thread;
+  int       running;
+} drainer;
+
+static struct ring* claim_ring()
+{
+  struct ring* r;
+  for(r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next){
+    int expected = 0;
+    if(__atomic_compare_exchange_n(&r->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      break;
+  }
+  if(!r){
+    // mmap rather than malloc, this runs in the signal handler
+    r = (struct ring*)mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(r == MAP_FAILED)
+      return NULL;
+    r->in_use = 1;
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+  r->stopped = 0;
+  r->tid = (uint32_t)syscall(SYS_gettid);
+  tls_ring = r;
+  return r;
+}
+
+static void on_sigprof(int sig, siginfo_t* info, void* uc)
+{
+  int saved_errno = errno;
+  void* raw[MAX_FRAMES];
+  struct ring* r;
+  uint64_t head;
+  int n, i;
+  (void)sig;
+  (void)info;
+
+  if(!__atomic_load_n(&running, __ATOMIC_RELAXED))
+    goto out;
+  if(!(r = tls_ring) && !(r = claim_ring()))
+    goto out;
+
+  // from the interrupted context, so this handler and the signal frame aren't in it
+  if(frame_pointers)
+    n = unwind_fp_context(uc, raw, MAX_FRAMES);
+  else
+    n = unwind_cfi_context(uc, raw, MAX_FRAMES);
+
+  head = r->head;
+  if(head + 1 + n - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > RING_WORDS){
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    goto out;
+  }
+  r->w[head++ & RING_MASK] = (uintptr_t)n;
+  for(i = 0; i < n; i++)
+    r->w[head++ & RING_MASK] = (uintptr_t)raw[i];
+  __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+out:
+  errno = saved_errno;
+}
+
+static uint64_t hash_frames(const uintptr_t* f, uint32_t n)
+{
+  uint64_t h = 14695981039346656037ull;
+  uint32_t i;
+  for(i = 0; i < n; i++)
+    h = (h ^ f[i]) * 1099511628211ull;
+  return h ^ (h >> 29);
+}
+
+static void grow_stacks()
+{
+  size_t old = capstacks, i;
+  struct stack* s = stacks;
+  capstacks = capstacks ? capstacks * 2 : 1024;
+  stacks = (struct stack*)calloc(capstacks, sizeof(struct stack));
+  for(i = 0; i < old; i++){
+    if(!s[i].frames)
+      continue;
+    size_t j = s[i].hash & (capstacks - 1);
+    while(stacks[j].frames)
+      j = (j + 1) & (capstacks - 1);
+    stacks[j] = s[i];
+  }
+  free(s);
+}
+
+static void add_stack(const uintptr_t* f, uint32_t n)
+{
+  uint64_t h = hash_frames(f, n);
+  size_t j;
+  if(2 * (nstacks + 1) > capstacks)
+    grow_stacks();
+  for(j = h & (capstacks - 1); stacks[j].frames; j = (j + 1) & (capstacks - 1)){
+    if(stacks[j].hash == h && stacks[j].n == n && !memcmp(stacks[j].frames, f, n * sizeof(uintptr_t))){
+      stacks[j].count++;
+      return;
+    }
+  }
+  stacks[j].hash = h;
+  stacks[j].count = 1;
+  stacks[j].n = n;
+  stacks[j].frames = (uintptr_t*)malloc(n * sizeof(uintptr_t));
+  memcpy(stacks[j].frames, f, n * sizeof(uintptr_t));
+  nstacks++;
+}
+
+// Moves everything in the rings into the table. Called with agg_lock held.
+static void drain()
+{
+  struct ring* r;
+  uintptr_t f[MAX_FRAMES];
+  for(r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next){
+    if(!__atomic_load_n(&r->in_use, __ATOMIC_ACQUIRE))
+      continue;
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), tail = r->tail;
+    while(tail < head){
+      uint32_t n = (uint32_t)r->w[tail++ & RING_MASK], i;
+      for(i = 0; i < n && i < MAX_FRAMES; i++)
+        f[i] = r->w[(tail + i) & RING_MASK];
+      tail += n;
+      add_stack(f, n < MAX_FRAMES ? n : MAX_FRAMES);
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+    // the ring of a thread that is gone can go to the next new thread
+    if(__atomic_load_n(&r->stopped, __ATOMIC_ACQUIRE)
+       || (syscall(SYS_tgkill, getpid(), r->tid, 0) && errno == ESRCH)){
+      if(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+        __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+static void* drain_main(void* arg)
+{
+  sigset_t block;
+  (void)arg;
+  // the drain thread's own CPU time isn't part of the profile
+  sigemptyset(&block);
+  sigaddset(&block, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &block, NULL);
+
+  while(__atomic_load_n(&drainer.running, __ATOMIC_ACQUIRE)){
+    struct timespec ts = { 0, DRAIN_MS * 1000000L };
+    nanosleep(&ts, NULL);
+    unwind_refresh();  //the handler can't look up modules loaded since it started
+    pthread_mutex_lock(&agg_lock);
+    drain();
+    pthread_mutex_unlock(&agg_lock);
+  }
+  return NULL;
+}
+
+int sampleprof_thread_start()
+{
+  struct sigevent sev;
+  struct itimerspec its;
+
+  if(tls_has_timer)
+    return 0;
+  unwind_thread_init();
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+  if(timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &tls_timer))
+    return -1;
+  its.it_interval.tv_sec = period_ns / 1000000000L;
+  its.it_interval.tv_nsec = period_ns % 1000000000L;
+  its.it_value = its.it_interval;
+  if(timer_settime(tls_timer, 0, &its, NULL)){
+    timer_delete(tls_timer);
+    return -1;
+  }
+  tls_has_timer = 1;
+  return 0;
+}
+
+void sampleprof_thread_stop()
+{
+  if(tls_has_timer){
+    timer_delete(tls_timer);
+    tls_has_timer = 0;
+  }
+  if(tls_ring){
+    __atomic_store_n(&tls_ring->stopped, 1, __ATOMIC_RELEASE);
+    tls_ring = NULL;
+  }
+}
+
+int sampleprof_start(int hz, int flags)
+{
+  struct sigaction sa;
+
+  if(hz <= 0 || __atomic_load_n(&running, __ATOMIC_RELAXED))
+    return -1;
+  period_ns = 1000000000L / hz;
+  all_threads = flags & SAMPLEPROF_ALL_THREADS;
+  frame_pointers = flags & SAMPLEPROF_FRAME_POINTERS;
+  unwind_refresh();
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = on_sigprof;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if(sigaction(SIGPROF, &sa, NULL))
+    return -1;
+
+  __atomic_store_n(&drainer.running, 1, __ATOMIC_RELEASE);
+  if(pthread_create(&drainer.thread, NULL, drain_main, NULL)){
+    drainer.running = 0;
+    return -1;
+  }
+  __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+
+  if(all_threads){
+    struct itimerval it;
+    it.it_interval.tv_sec = period_ns / 1000000000L;
+    it.it_interval.tv_usec = (period_ns % 1000000000L) / 1000;
+    it.it_value = it.it_interval;
+    return setitimer(ITIMER_PROF, &it, NULL);
+  }
+  return sampleprof_thread_start();
+}
+
+void sampleprof_stop()
+{
+  if(!__atomic_load_n(&running, __ATOMIC_RELAXED))
+    return;
+  if(all_threads){
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_PROF, &it, NULL);
+  }
+  else
+    sampleprof_thread_stop();
+  __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+
+  __atomic_store_n(&drainer.running, 0, __ATOMIC_RELEASE);
+  pthread_join(drainer.thread, NULL);
+  pthread_mutex_lock(&agg_lock);
+  drain();
+  pthread_mutex_unlock(&agg_lock);
+}
+
+uint64_t sampleprof_dropped()
+{
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+// --- output ---
+
+// The folded names of an address, root first, memoized so each is symbolized once per write
+struct name_entry
+{
+  uintptr_t addr;
+  char*     name;
+};
+
+static struct name_entry* names;
+static size_t capnames, nnames;
+
+static char* describe(uintptr_t addr)
+{
+  struct elfsym_frame f[16];
+  char buf[4096];
+  const char* module = NULL;
+  int n = elfsym_resolve((const void*)addr, f, 16, &module), i, len = 0;
+
+  if(n <= 0 || !f[n-1].function){
+    // no symbol, which module it was in still says something
+    const char* base = module ? strrchr(module, '/') : NULL;
+    if(module)
+      snprintf(buf, sizeof(buf), "[%s]", base ? base + 1 : module);
+    else
+      snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)addr);
+    return strdup(buf);
+  }
+  buf[0] = '\0';
+  for(i = n - 1; i >= 0 && len < (int)sizeof(buf); i--){
+    const char* name = f[i].function ? f[i].function : "??";
+    char* demangled = NULL;
+#ifdef __cplusplus
+    int status = 0;
+    demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+    if(status == 0)
+      name = demangled;
+#endif
+    len += snprintf(buf + len, sizeof(buf) - len, "%s%s", i == n - 1 ? "" : ";", name);
+    free(demangled);
+  }
+  // the separators of the format can't appear in a frame
+  for(i = 0; buf[i]; i++)
+    if(buf[i] == '\n')
+      buf[i] = ' ';
+  return strdup(buf);
+}
+
+static const char* name_of(uintptr_t addr)
+{
+  size_t j;
+  if(2 * (nnames + 1) > capnames){
+    struct name_entry* old = names;
+    size_t oldcap = capnames, i;
+    capnames = capnames ? capnames * 2 : 4096;
+    names = (struct name_entry*)calloc(capnames, sizeof(struct name_entry));
+    for(i = 0; i < oldcap; i++){
+      if(!old[i].name)
+        continue;
+      for(j = (old[i].addr * 0x9e3779b97f4a7c15ull >> 20) & (capnames - 1); names[j].name; j = (j + 1) & (capnames - 1))
+        ;
+      names[j] = old[i];
+    }
+    free(old);
+  }
+  for(j = (addr * 0x9e3779b97f4a7c15ull >> 20) & (capnames - 1); names[j].name; j = (j + 1) & (capnames - 1))
+    if(names[j].addr == addr)
+      return names[j].name;
+  names[j].addr = addr;
+  names[j].name = describe(addr);
+  nnames++;
+  return names[j].name;
+}
+
+static void free_names()
+{
+  size_t i;
+  for(i = 0; i < capnames; i++)
+    free(names[i].name);
+  free(names);
+  names = NULL;
+  capnames = nnames = 0;
+}
+
+struct folded
+{
+  char*    line;
+  uint64_t count;
+};
+
+static int cmp_folded(const void* a, const void* b)
+{
+  return strcmp(((const struct folded*)a)->line, ((const struct folded*)b)->line);
+}
+
+uint64_t sampleprof_write_folded(FILE* out)
+{
+  struct folded* lines;
+  uint64_t total = 0;
+  size_t i, n = 0;
+  int j;
+
+  pthread_mutex_lock(&agg_lock);
+  drain();
+  lines = (struct folded*)malloc((nstacks + 1) * sizeof(struct folded));
+  for(i = 0; i < capstacks; i++){
+    const struct stack* s = &stacks[i];
+    size_t len = 0, room = 256;
+    if(!s->frames)
+      continue;
+    lines[n].line = (char*)malloc(room);
+    lines[n].line[0] = '\0';
+    lines[n].count = s->count;
+    for(j = (int)s->n - 1; j >= 0; j--){
+      // all but the pc are return addresses, name the call rather than what follows it
+      const char* name = name_of(j ? s->frames[j] - 1 : s->frames[j]);
+      size_t add = strlen(name) + 1;
+      if(len + add + 1 > room){
+        room = 2 * (len + add + 1);
+        lines[n].line = (char*)realloc(lines[n].line, room);
+      }
+      memcpy(lines[n].line + len, name, add - 1);
+      len += add - 1;
+      if(j)
+        lines[n].line[len++] = ';';
+      lines[n].line[len] = '\0';
+    }
+    n++;
+  }
+  free_names();
+  pthread_mutex_unlock(&agg_lock);
+
+  // different pcs in the same functions fold to the same line
+  qsort(lines, n, sizeof(struct folded), cmp_folded);
+  for(i = 0; i < n; i++){
+    uint64_t count = lines[i].count;
+    while(i + 1 < n && !strcmp(lines[i].line, lines[i+1].line)){
+      free(lines[i].line);
+      count += lines[++i].count;
+    }
+    fprintf(out, "%s %llu\n", lines[i].line, (unsigned long long)count);
+    free(lines[i].line);
+    total += count;
+  }
+  free(lines);
+  fflush(out);
+  return total;
+}
+
+uint64_t sampleprof_write_pprof(FILE* out)
+{
+  uintptr_t header[5] = { 0, 3, 0, (uintptr_t)(period_ns / 1000), 0 };
+  uintptr_t trailer[3] = { 0, 1, 0 };
+  uint64_t total = 0;
+  char buf[4096];
+  size_t i, n;
+
+  pthread_mutex_lock(&agg_lock);
+  drain();
+  fwrite(header, sizeof(header), 1, out);
+  for(i = 0; i < capstacks; i++){
+    const struct stack* s = &stacks[i];
+    uintptr_t rec[2];
+    if(!s->frames)
+      continue;
+    rec[0] = (uintptr_t)s->count;
+    rec[1] = s->n;
+    fwrite(rec, sizeof(rec), 1, out);
+    fwrite(s->frames, sizeof(uintptr_t), s->n, out);
+    total += s->count;
+  }
+  pthread_mutex_unlock(&agg_lock);
+  fwrite(trailer, sizeof(trailer), 1, out);
+
+  // pprof maps the addresses back to the binaries with this
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if(maps){
+    while((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+      fwrite(buf, 1, n, out);
+    fclose(maps);
+  }
+  fflush(out);
+  return total;
+}
+
+__attribute__((constructor)) static void sampleprof_init()
+{
+  const char* hz = getenv("SAMPLEPROF_HZ");
+  const char* fp = getenv("SAMPLEPROF_FRAME_POINTERS");
+  if(hz && atoi(hz) > 0)
+    sampleprof_start(atoi(hz), SAMPLEPROF_ALL_THREADS | (fp && atoi(fp) ? SAMPLEPROF_FRAME_POINTERS : 0));
+}
+
+__attribute__((destructor)) static void sampleprof_fini()
+{
+  const char* path = getenv("SAMPLEPROF_OUTPUT");
+  const char* pprof = getenv("SAMPLEPROF_PPROF");
+  char name[64];
+  FILE* out;
+
+  if(!getenv("SAMPLEPROF_HZ"))
+    return;
+  sampleprof_stop();
+  if(!path){
+    snprintf(name, sizeof(name), "sampleprof.%d.folded", (int)getpid());
+    path = name;
+  }
+  if((out = fopen(path, "w"))){
+    sampleprof_write_folded(out);
+    fclose(out);
+  }
+  if(pprof && (out = fopen(pprof, "wb"))){
+    sampleprof_write_pprof(out);
+    fclose(out);
+  }
+}
@@ -0,0 +1,61 @@
+// Sampling CPU profiler: SIGPROF stack samples, written as folded stacks or a pprof profile
+// Author: Paul Foster
+// Public domain
+//
+// A CPU time timer sends SIGPROF at the chosen rate, the handler captures the interrupted stack with
+// unwind_cfi_context() into a lock-free per thread buffer and returns. A background thread drains
+// the buffers into a table of unique stacks, and the stacks are symbolized with elfsym once each,
+// when the profile is written. At 100Hz that is well under 1% of a core.
+//
+//   sampleprof_start(100, SAMPLEPROF_ALL_THREADS);
+//   ...
+//   sampleprof_stop();
+//   sampleprof_write_folded(f);   //flamegraph.pl f > out.svg
+//   sampleprof_write_pprof(f);    //pprof -http=: ./myprogram f
+//
+// Without SAMPLEPROF_ALL_THREADS only threads that call sampleprof_thread_start() are sampled, each
+// by its own CLOCK_THREAD_CPUTIME_ID timer, which charges every thread exactly for its own CPU time.
+// With it, one setitimer(ITIMER_PROF) covers the whole process and the kernel picks the thread.
+//
+// Or preload it into an unmodified program:
+//   gcc -shared -fPIC -O2 -o libsampleprof.so sampleprof.c unwind.c elfsym.c -lpthread -lrt
+//   SAMPLEPROF_HZ=200 LD_PRELOAD=./libsampleprof.so ./myserver
+//   SAMPLEPROF_OUTPUT=file   folded stacks go there at exit (default sampleprof.<pid>.folded)
+//   SAMPLEPROF_PPROF=file    and a pprof profile there
+//   SAMPLEPROF_FRAME_POINTERS=1  to unwind with frame pointers
+// Build the program with -g, and -fno-omit-frame-pointer for SAMPLEPROF_FRAME_POINTERS. CPU time
+// timers only fire on the kernel tick, so rates above CONFIG_HZ (often 250) get fewer samples.
+
+#ifndef P_SAMPLEPROF_H
+#define P_SAMPLEPROF_H
+#include <stdio.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAMPLEPROF_ALL_THREADS     1
+#define SAMPLEPROF_FRAME_POINTERS  2  //unwind_fp_context() instead of unwind_cfi_context()
+
+// Starts sampling at hz samples per second of CPU time. Returns 0 on success.
+int  sampleprof_start(int hz, int flags);
+void sampleprof_stop();
+
+// Per thread timers, when started without SAMPLEPROF_ALL_THREADS. sampleprof_start() arms the
+// calling thread. Stop each thread before it exits.
+int  sampleprof_thread_start();
+void sampleprof_thread_stop();
+
+// One line per unique stack, root first, frames separated by ';', then the sample count.
+// Inlined functions get their own frames. Returns the number of samples written.
+uint64_t sampleprof_write_folded(FILE* out);
+// The gperftools CPU profile format, with the memory map appended, which pprof reads directly
+uint64_t sampleprof_write_pprof(FILE* out);
+
+// Samples lost because a thread buffer was full
+uint64_t sampleprof_dropped();
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_SAMPLEPROF_H
@@ -0,0 +1,171 @@
+// Counters, gauges and timing accumulators in shared memory, see shm_metrics.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c shm_metrics.c time.c -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "shm_metrics.h"
+#include "time.h"
+
+__thread struct shm_metric_slot* shm_metrics_tls = NULL;
+__thread int shm_metrics_tls_shared = 0;
+struct shm_metric_slot* shm_metrics_gauges = NULL;
+
+static struct {
+  struct shm_metrics_header* hdr;
+  struct shm_metric_desc*    desc;
+  char*                      blocks;
+  size_t                     size;
+  char                       path[128];
+} shm;
+
+static pthread_mutex_t shm_register_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Blocks of threads that have exited, handed to the next new thread with their sums in them, so a
+// pool that keeps replacing its threads doesn't run out and fall back to the shared block
+static pthread_mutex_t shm_free_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t shm_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shm_thread_key;
+static uint32_t* shm_free;
+static uint32_t shm_nfree;
+
+static struct shm_metric_slot* block(unsigned int i)
+{
+  return (struct shm_metric_slot*)(shm.blocks + (size_t)i * shm.hdr->block_size);
+}
+
+int shm_metrics_open(const char* name, unsigned int max_metrics, unsigned int max_threads)
+{
+  if(shm.hdr)
+    return -1;
+  if(!max_metrics)
+    max_metrics = 256;
+  if(!max_threads)
+    max_threads = 256;
+  free(shm_free);
+  shm_nfree = 0;
+  if(!(shm_free = (uint32_t*)malloc(max_threads * sizeof(uint32_t))))
+    return -1;
+
+  uint32_t block_size = (uint32_t)((max_metrics * sizeof(struct shm_metric_slot) + 63) & ~(size_t)63);
+  size_t head = (sizeof(struct shm_metrics_header) + max_metrics * sizeof(struct shm_metric_desc) + 63) & ~(size_t)63;
+  size_t size = head + (size_t)block_size * (max_threads + 2);
+
+  snprintf(shm.path, sizeof(shm.path), "/dev/shm/shm_metrics.%s.%d", name, (int)getpid());
+  int fd = open(shm.path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0){
+    perror(shm.path);
+    return -1;
+  }
+  if(ftruncate(fd, size)){
+    perror(shm.path);
+    close(fd);
+    unlink(shm.path);
+    return -1;
+  }
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED){
+    perror(shm.path);
+    unlink(shm.path);
+    return -1;
+  }
+
+  // the file comes back zeroed from ftruncate, which is every metric at 0
+  shm.size = size;
+  shm.hdr = (struct shm_metrics_header*)p;
+  shm.desc = (struct shm_metric_desc*)(shm.hdr + 1);
+  shm.blocks = (char*)p + head;
+  shm.hdr->version = SHM_METRICS_VERSION;
+  shm.hdr->pid = (uint32_t)getpid();
+  shm.hdr->max_metrics = max_metrics;
+  shm.hdr->max_threads = max_threads;
+  shm.hdr->block_size = block_size;
+  shm.hdr->start_ns = nanotime();
+  strncpy(shm.hdr->name, name, SHM_METRICS_NAME_LEN - 1);
+  shm_metrics_gauges = block(max_threads + 1);
+  __atomic_store_n(&shm.hdr->magic, SHM_METRICS_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Threads that still hold slot pointers after this will crash, so only close at shutdown
+void shm_metrics_close(int remove_file)
+{
+  if(!shm.hdr)
+    return;
+  shm_metrics_gauges = NULL;
+  munmap(shm.hdr, shm.size);
+  shm.hdr = NULL;
+  if(remove_file)
+    unlink(shm.path);
+}
+
+int shm_metric_register(const char* name, enum shm_metric_type type)
+{
+  int id = -1;
+  uint32_t i;
+  if(!shm.hdr)
+    return -1;
+
+  pthread_mutex_lock(&shm_register_lock);
+  for(i = 0; i < shm.hdr->nmetrics; i++){
+    if(!strncmp(shm.desc[i].name, name, SHM_METRICS_NAME_LEN - 1)){
+      id = shm.desc[i].type == (uint32_t)type ? (int)i : -1;
+      goto done;
+    }
+  }
+  if(shm.hdr->nmetrics < shm.hdr->max_metrics){
+    id = (int)shm.hdr->nmetrics;
+    strncpy(shm.desc[id].name, name, SHM_METRICS_NAME_LEN - 1);
+    shm.desc[id].type = type;
+    __atomic_store_n(&shm.hdr->nmetrics, id + 1, __ATOMIC_RELEASE);
+  }
+done:
+  pthread_mutex_unlock(&shm_register_lock);
+  return id;
+}
+
+// At thread exit, the key's value is the block index + 1
+static void thread_exit(void* arg)
+{
+  shm_metrics_tls = NULL;
+  pthread_mutex_lock(&shm_free_lock);
+  if(shm.hdr && shm_nfree < shm.hdr->max_threads)
+    shm_free[shm_nfree++] = (uint32_t)((uintptr_t)arg - 1);
+  pthread_mutex_unlock(&shm_free_lock);
+}
+
+static void make_key()
+{
+  pthread_key_create(&shm_thread_key, thread_exit);
+}
+
+struct shm_metric_slot* shm_metrics_thread_slots()
+{
+  uint32_t t = UINT32_MAX;
+  if(!shm.hdr)
+    return NULL;
+  pthread_once(&shm_key_once, make_key);
+  pthread_mutex_lock(&shm_free_lock);
+  if(shm_nfree)
+    t = shm_free[--shm_nfree];
+  pthread_mutex_unlock(&shm_free_lock);
+
+  if(t == UINT32_MAX)
+    t = __atomic_fetch_add(&shm.hdr->nthreads, 1, __ATOMIC_RELAXED);
+  if(t >= shm.hdr->max_threads){
+    shm_metrics_tls_shared = 1;
+    t = shm.hdr->max_threads;
+  }else
+    pthread_setspecific(shm_thread_key, (void*)((uintptr_t)t + 1));
+  shm_metrics_tls = block(t);
+  return shm_metrics_tls;
+}
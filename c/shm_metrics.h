@@ -0,0 +1,127 @@
+// Counters, gauges and timing accumulators in shared memory, so another process can read them live
+// Author: Paul Foster
+// Public domain
+//
+// Usage:
+//   shm_metrics_open("myserver", 0, 0);            //creates /dev/shm/shm_metrics.myserver.<pid>
+//   int req = shm_metric_register("requests", SHM_COUNTER);
+//   int lat = shm_metric_register("request_ns", SHM_TIMING);
+//   ...
+//   shm_counter_add(req, 1);
+//   shm_timing_record(lat, nanotime() - t);
+//
+// and from a shell: shm_metrics_reader myserver   (see shm_metrics_reader.c)
+//
+// Every thread gets its own cache line aligned block of slots in the file and is the only writer
+// of it, so an update is a plain load and store: no syscalls, no locks, no shared cache lines.
+// The reader sums the blocks. Registering is the only thing that takes a lock. When a thread exits
+// its block goes to the next new thread, sums and all, so max_threads bounds the threads running at
+// once, not the threads ever started.
+// Linux only, link with -lpthread
+
+#ifndef P_SHM_METRICS_H
+#define P_SHM_METRICS_H
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHM_METRICS_MAGIC   0x534d4554u  //"SMET"
+#define SHM_METRICS_VERSION 1
+#define SHM_METRICS_NAME_LEN 48
+
+enum shm_metric_type
+{
+  SHM_COUNTER = 1,   //summed over threads
+  SHM_GAUGE,         //last value set by any thread
+  SHM_TIMING         //count and total, summed over threads
+};
+
+// The file layout, shared with the reader:
+//   header | descriptors[max_metrics] | thread blocks[max_threads] | overflow block | gauge block
+// The overflow block is shared (with atomic adds) by any threads past max_threads.
+struct shm_metrics_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;
+  uint32_t max_metrics;
+  uint32_t max_threads;
+  uint32_t nmetrics;        //published with release ordering once the descriptor is written
+  uint32_t nthreads;
+  uint32_t block_size;      //bytes per thread block, a multiple of 64
+  uint64_t start_ns;        //nanotime() when the file was created
+  char     name[SHM_METRICS_NAME_LEN];
+};
+
+struct shm_metric_desc
+{
+  char     name[SHM_METRICS_NAME_LEN];
+  uint32_t type;
+  uint32_t pad;
+};
+
+struct shm_metric_slot
+{
+  uint64_t value;   //counter value, gauge value, timing count
+  uint64_t total;   //timing total ns
+};
+
+// 0 for either limit means the default (256 metrics, 256 threads)
+int  shm_metrics_open(const char* name, unsigned int max_metrics, unsigned int max_threads);
+void shm_metrics_close(int remove_file);
+
+// Returns the metric id, the same id again if the name is already registered, or -1
+int shm_metric_register(const char* name, enum shm_metric_type type);
+
+// Internals for the inline updates below
+extern __thread struct shm_metric_slot* shm_metrics_tls;
+extern __thread int shm_metrics_tls_shared;
+struct shm_metric_slot* shm_metrics_thread_slots();
+extern struct shm_metric_slot* shm_metrics_gauges;
+
+static inline struct shm_metric_slot* shm_metric_slot_(int id)
+{
+  struct shm_metric_slot* s = shm_metrics_tls;
+  if(__builtin_expect(!s, 0))
+    s = shm_metrics_thread_slots();
+  return s ? s + id : 0;
+}
+
+static inline void shm_counter_add(int id, uint64_t n)
+{
+  struct shm_metric_slot* s = shm_metric_slot_(id);
+  if(id < 0 || !s)
+    return;
+  if(__builtin_expect(shm_metrics_tls_shared, 0))
+    __atomic_fetch_add(&s->value, n, __ATOMIC_RELAXED);
+  else
+    __atomic_store_n(&s->value, s->value + n, __ATOMIC_RELAXED);
+}
+
+static inline void shm_timing_record(int id, uint64_t ns)
+{
+  struct shm_metric_slot* s = shm_metric_slot_(id);
+  if(id < 0 || !s)
+    return;
+  if(__builtin_expect(shm_metrics_tls_shared, 0)){
+    __atomic_fetch_add(&s->value, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->total, ns, __ATOMIC_RELAXED);
+  }else{
+    __atomic_store_n(&s->value, s->value + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->total, s->total + ns, __ATOMIC_RELAXED);
+  }
+}
+
+// Gauges live in one shared block since they are a single value, not a sum
+static inline void shm_gauge_set(int id, int64_t v)
+{
+  struct shm_metric_slot* g = shm_metrics_gauges;
+  if(id >= 0 && g)
+    __atomic_store_n(&g[id].value, (uint64_t)v, __ATOMIC_RELAXED);
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_SHM_METRICS_H
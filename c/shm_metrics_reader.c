@@ -0,0 +1,173 @@
+// Attaches to the shared memory metrics of a running process (see shm_metrics.h) and prints them
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -O2 -o shm_metrics_reader shm_metrics_reader.c
+//
+//   shm_metrics_reader                    lists the processes exposing metrics
+//   shm_metrics_reader myserver           prints every second, with rates
+//   shm_metrics_reader -1 12345           prints once, by pid
+//   shm_metrics_reader -i 250 /dev/shm/shm_metrics.myserver.12345
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_metrics.h"
+
+#define SHM_DIR "/dev/shm"
+#define SHM_PREFIX "shm_metrics."
+
+static int process_alive(const char* file)
+{
+  const char* dot = strrchr(file, '.');
+  return dot && kill(atoi(dot + 1), 0) == 0;
+}
+
+static int list_files()
+{
+  DIR* d = opendir(SHM_DIR);
+  struct dirent* e;
+  int n = 0;
+  if(!d)
+    return 1;
+  while((e = readdir(d))){
+    if(strncmp(e->d_name, SHM_PREFIX, strlen(SHM_PREFIX)))
+      continue;
+    printf("%s/%s%s\n", SHM_DIR, e->d_name, process_alive(e->d_name) ? "" : "  (process gone)");
+    n++;
+  }
+  closedir(d);
+  if(!n)
+    printf("no processes are exposing metrics\n");
+  return 0;
+}
+
+// Accepts a path, a pid or the name given to shm_metrics_open()
+static int find_file(const char* arg, char* path, size_t size)
+{
+  struct stat st;
+  if(strchr(arg, '/') && !stat(arg, &st)){
+    snprintf(path, size, "%s", arg);
+    return 0;
+  }
+
+  DIR* d = opendir(SHM_DIR);
+  struct dirent* e;
+  int found = -1;
+  size_t len = strlen(arg);
+  if(!d)
+    return -1;
+  while((e = readdir(d))){
+    const char* rest = e->d_name + strlen(SHM_PREFIX);
+    const char* dot = strrchr(e->d_name, '.');
+    if(strncmp(e->d_name, SHM_PREFIX, strlen(SHM_PREFIX)) || !dot)
+      continue;
+    int by_name = !strncmp(rest, arg, len) && rest + len == dot;
+    int by_pid = !strcmp(dot + 1, arg);
+    if((by_name || by_pid) && (found < 0 || process_alive(e->d_name))){
+      snprintf(path, size, "%s/%s", SHM_DIR, e->d_name);
+      found = 0;
+    }
+  }
+  closedir(d);
+  return found;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned int interval_ms = 1000;
+  int once = 0, opt;
+  char path[512];
+
+  while((opt = getopt(argc, argv, "1i:")) != -1){
+    if(opt == '1')
+      once = 1;
+    else if(opt == 'i')
+      interval_ms = (unsigned int)atoi(optarg);
+    else{
+      fprintf(stderr, "usage: %s [-1] [-i interval_ms] [name|pid|path]\n", argv[0]);
+      return 2;
+    }
+  }
+  if(optind >= argc)
+    return list_files();
+  if(find_file(argv[optind], path, sizeof(path))){
+    fprintf(stderr, "no metrics found for %s\n", argv[optind]);
+    return 1;
+  }
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st)){
+    perror(path);
+    return 1;
+  }
+  const char* base = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED){
+    perror(path);
+    return 1;
+  }
+
+  const struct shm_metrics_header* hdr = (const struct shm_metrics_header*)base;
+  if(__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_METRICS_MAGIC || hdr->version != SHM_METRICS_VERSION){
+    fprintf(stderr, "%s is not a metrics file this reader understands\n", path);
+    return 1;
+  }
+  const struct shm_metric_desc* desc = (const struct shm_metric_desc*)(hdr + 1);
+  size_t head = (sizeof(struct shm_metrics_header) + hdr->max_metrics * sizeof(struct shm_metric_desc) + 63) & ~(size_t)63;
+  const char* blocks = base + head;
+  const struct shm_metric_slot* gauges = (const struct shm_metric_slot*)(blocks + (size_t)hdr->block_size * (hdr->max_threads + 1));
+
+  uint64_t* prev = (uint64_t*)calloc(hdr->max_metrics, sizeof(uint64_t));
+  uint32_t seen = 0;
+
+  for(;;){
+    uint32_t nmetrics = __atomic_load_n(&hdr->nmetrics, __ATOMIC_ACQUIRE);
+    uint32_t nthreads = __atomic_load_n(&hdr->nthreads, __ATOMIC_RELAXED);
+    uint32_t i, t;
+    double secs = interval_ms / 1000.0;
+
+    // the overflow block is only ever nonzero once the per thread blocks ran out
+    if(nthreads > hdr->max_threads)
+      nthreads = hdr->max_threads + 1;
+
+    printf("== %s (pid %u, %u threads) ==\n", hdr->name, hdr->pid, nthreads);
+    for(i = 0; i < nmetrics; i++){
+      uint64_t value = 0, total = 0;
+      if(desc[i].type == SHM_GAUGE){
+        printf("  %-40s %20lld\n", desc[i].name, (long long)__atomic_load_n(&gauges[i].value, __ATOMIC_RELAXED));
+        continue;
+      }
+      for(t = 0; t < nthreads; t++){
+        const struct shm_metric_slot* s = (const struct shm_metric_slot*)(blocks + (size_t)t * hdr->block_size) + i;
+        value += __atomic_load_n(&s->value, __ATOMIC_RELAXED);
+        total += __atomic_load_n(&s->total, __ATOMIC_RELAXED);
+      }
+      if(desc[i].type == SHM_COUNTER)
+        printf("  %-40s %20llu", desc[i].name, (unsigned long long)value);
+      else
+        printf("  %-40s %20llu x %.1f ns", desc[i].name, (unsigned long long)value, value ? (double)total / value : 0.0);
+      if(i < seen)
+        printf("  %12.1f/s", (value - prev[i]) / secs);
+      printf("\n");
+      prev[i] = value;
+    }
+    fflush(stdout);
+    seen = nmetrics;
+
+    if(once || !process_alive(path))
+      break;
+    usleep(interval_ms * 1000);
+  }
+
+  free(prev);
+  return 0;
+}
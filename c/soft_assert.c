@@ -0,0 +1,210 @@
+// Non-fatal asserts, see soft_assert.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c soft_assert.c
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "soft_assert.h"
+#include "stack_dump_on_assert.h"
+#include "time.h"
+
+#define SA_DEPTH   32
+#define SA_STACKS  1024    //distinct failing stacks, power of two
+#define SA_PROBE   32
+#define MINUTE_NS  60000000000ull
+
+struct sa_stack
+{
+  uint64_t hash;        //0 means empty, claimed with a CAS
+  int      ready;       //set once the rest is filled in
+  int      logged;      //0 if the rate limit kept it out of the log
+  uint32_t id;
+  uint32_t depth;
+  struct soft_assert_site* site;
+  uint64_t count;
+  uint64_t summarized;  //count as of the last summary
+  void*    stack[SA_DEPTH];
+};
+
+static struct sa_stack sa_stacks[SA_STACKS];
+static struct soft_assert_site* sa_sites = NULL;
+static uint64_t sa_failures = 0;
+static uint32_t sa_nstacks = 0;
+static uint64_t sa_untracked = 0;      //failures from stacks that didn't fit in the table
+static uint64_t sa_last_summary = 0;   //cached_nanotime(), 0 until the first failure
+static uint64_t sa_interval = MINUTE_NS;
+static FILE* sa_out = NULL;
+
+// for the log itself, which is rare
+static pthread_mutex_t sa_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t sa_window_start;
+static unsigned int sa_window_logs;
+static uint64_t sa_summarized_failures;
+
+void soft_assert_setup(FILE* out, uint64_t summary_interval_ns)
+{
+  sa_out = out;
+  if(summary_interval_ns)
+    __atomic_store_n(&sa_interval, summary_interval_ns, __ATOMIC_RELAXED);
+}
+
+static uint64_t hash_stack(const struct soft_assert_site* site, void* const* frames, int n)
+{
+  uint64_t h = 14695981039346656037ull ^ (uintptr_t)site;
+  int i;
+  for(i = 0; i < n; i++)
+    h = (h ^ (uintptr_t)frames[i]) * 1099511628211ull;
+  return h ? h : 1;
+}
+
+// The entry for this stack, claiming an empty one if it is new. *fresh is set for the claimer.
+static struct sa_stack* find_stack(uint64_t h, struct soft_assert_site* site, void* const* frames, int depth, int* fresh)
+{
+  int i;
+  *fresh = 0;
+  for(i = 0; i < SA_PROBE; i++){
+    struct sa_stack* s = &sa_stacks[(h + i) & (SA_STACKS - 1)];
+    uint64_t cur = __atomic_load_n(&s->hash, __ATOMIC_ACQUIRE);
+    if(cur == 0){
+      uint64_t expected = 0;
+      if(!__atomic_compare_exchange_n(&s->hash, &expected, h, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+        if(expected != h)
+          continue;
+        return s;
+      }
+      s->site = site;
+      s->depth = depth;
+      memcpy(s->stack, frames, depth * sizeof(void*));
+      s->id = __atomic_add_fetch(&sa_nstacks, 1, __ATOMIC_RELAXED);
+      __atomic_store_n(&s->ready, 1, __ATOMIC_RELEASE);
+      *fresh = 1;
+      return s;
+    }
+    if(cur == h)
+      return s;
+  }
+  return NULL;
+}
+
+static void register_site(struct soft_assert_site* site)
+{
+  if(__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE) || __atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL))
+    return;
+  site->next = __atomic_load_n(&sa_sites, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&sa_sites, &site->next, site, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+// The full report for a new stack, unless too many have gone out this minute
+static void log_first(struct sa_stack* s, const char* func, uint64_t now, const char* fmt, va_list ap)
+{
+  FILE* out = sa_out ? sa_out : stderr;
+
+  pthread_mutex_lock(&sa_lock);
+  if(now - sa_window_start >= MINUTE_NS){
+    sa_window_start = now;
+    sa_window_logs = 0;
+  }
+  if(sa_window_logs >= SOFT_ASSERT_LOGS_PER_MINUTE){
+    pthread_mutex_unlock(&sa_lock);
+    return;
+  }
+  sa_window_logs++;
+  s->logged = 1;
+
+  fprintf(out, "soft assert #%u failed: %s at %s:%d in %s", s->id, s->site->cond, s->site->file, s->site->line, func);
+  if(fmt){
+    fprintf(out, ": ");
+    vfprintf(out, fmt, ap);
+  }
+  fprintf(out, "\n");
+  stack_dump_print(out, s->stack, s->depth);
+  fflush(out);
+  pthread_mutex_unlock(&sa_lock);
+}
+
+void soft_assert_failed(struct soft_assert_site* site, const char* func, const char* fmt, ...)
+{
+  void* frames[SA_DEPTH];
+  int depth = stack_dump_capture(frames, SA_DEPTH, 2), fresh;
+  uint64_t now = cached_nanotime(), last;
+  struct sa_stack* s;
+
+  __atomic_add_fetch(&site->failures, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&sa_failures, 1, __ATOMIC_RELAXED);
+  register_site(site);
+
+  s = find_stack(hash_stack(site, frames, depth), site, frames, depth, &fresh);
+  if(!s)
+    __atomic_add_fetch(&sa_untracked, 1, __ATOMIC_RELAXED);
+  else
+    __atomic_add_fetch(&s->count, 1, __ATOMIC_RELAXED);
+  if(fresh){
+    va_list ap;
+    va_start(ap, fmt);
+    log_first(s, func, now, fmt, ap);
+    va_end(ap);
+  }
+
+  // the first failure after the interval writes the summary
+  last = __atomic_load_n(&sa_last_summary, __ATOMIC_RELAXED);
+  if(!last)
+    __atomic_compare_exchange_n(&sa_last_summary, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  else if(now - last >= __atomic_load_n(&sa_interval, __ATOMIC_RELAXED) &&
+          __atomic_compare_exchange_n(&sa_last_summary, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    soft_assert_summary(sa_out ? sa_out : stderr);
+}
+
+void soft_assert_summary(FILE* out)
+{
+  struct soft_assert_site* site;
+  uint64_t total, stacks = 0;
+  size_t i;
+
+  pthread_mutex_lock(&sa_lock);
+  total = __atomic_load_n(&sa_failures, __ATOMIC_RELAXED);
+  fprintf(out, "soft assert summary: %llu failures since the last one, %llu in all\n",
+          (unsigned long long)(total - sa_summarized_failures), (unsigned long long)total);
+  sa_summarized_failures = total;
+  for(i = 0; i < SA_STACKS; i++){
+    struct sa_stack* s = &sa_stacks[i];
+    uint64_t count;
+    if(!__atomic_load_n(&s->ready, __ATOMIC_ACQUIRE))
+      continue;
+    stacks++;
+    count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+    if(count == s->summarized)
+      continue;
+    fprintf(out, "  #%u %s at %s:%d: %llu more, %llu in all%s\n", s->id, s->site->cond, s->site->file, s->site->line,
+            (unsigned long long)(count - s->summarized), (unsigned long long)count,
+            s->logged ? "" : " (stack not logged, over the rate limit)");
+    s->summarized = count;
+  }
+  for(site = __atomic_load_n(&sa_sites, __ATOMIC_ACQUIRE); site; site = site->next)
+    fprintf(out, "  %s at %s:%d has failed %llu times\n", site->cond, site->file, site->line,
+            (unsigned long long)__atomic_load_n(&site->failures, __ATOMIC_RELAXED));
+  if(sa_untracked)
+    fprintf(out, "  %llu failures from stacks past the first %llu weren't told apart\n",
+            (unsigned long long)__atomic_load_n(&sa_untracked, __ATOMIC_RELAXED), (unsigned long long)stacks);
+  fflush(out);
+  pthread_mutex_unlock(&sa_lock);
+}
+
+uint64_t soft_assert_failures()
+{
+  return __atomic_load_n(&sa_failures, __ATOMIC_RELAXED);
+}
+
+uint64_t soft_assert_stacks()
+{
+  return __atomic_load_n(&sa_nstacks, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,79 @@
+// Non-fatal asserts for production: a failure is counted per stack, logged in full the first time
+// Author: Paul Foster
+// Public domain
+//
+//   if(!SOFT_ASSERT(queue->size <= queue->capacity))
+//     return;
+//   SOFT_CHECK(rc == 0, "write returned %d for fd %d", rc, fd);
+//
+// Both evaluate to whether the condition held, and never stop the program. On a failure the stack
+// is captured with stack_dump_capture() and hashed. The first failure with a given stack is logged
+// with the symbolized stack. After that it only bumps the count in a lock-free table and the
+// failing call site's own count. Every summary interval the first failure after it prints one
+// line per stack that failed again since the last summary. So an invariant that breaks thousands
+// of times a second costs a stack walk and an atomic add each time, and a few log lines a minute.
+// At most SOFT_ASSERT_LOGS_PER_MINUTE new stacks are logged in full a minute. Past that they
+// are only counted, and show up in the summaries.
+//
+// Capturing with backtrace() is most of the cost of a failure (microseconds).
+// stack_dump_set_unwinder(unwind_cfi) from unwind.c makes it about 10x cheaper.
+// Link with stack_dump_on_assert.c elfsym.c unwind.c time.c and -lpthread, build with -g -rdynamic
+// so the stacks resolve.
+
+#ifndef P_SOFT_ASSERT_H
+#define P_SOFT_ASSERT_H
+#include <stdio.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef SOFT_ASSERT_LOGS_PER_MINUTE
+#define SOFT_ASSERT_LOGS_PER_MINUTE 10
+#endif
+
+// One per SOFT_ASSERT in the source, registered on its first failure
+struct soft_assert_site
+{
+  const char* cond;
+  const char* file;
+  int         line;
+  int         registered;
+  uint64_t    failures;
+  struct soft_assert_site* next;
+};
+
+#define SOFT_ASSERT(cond) SOFT_CHECK(cond, NULL)
+
+#define SOFT_CHECK(cond, ...) \
+  __extension__ ({ \
+    int soft_ok_ = !!(cond); \
+    if(__builtin_expect(!soft_ok_, 0)){ \
+      static struct soft_assert_site soft_site_ = { #cond, __FILE__, __LINE__, 0, 0, NULL }; \
+      soft_assert_failed(&soft_site_, __func__, __VA_ARGS__); \
+    } \
+    soft_ok_; \
+  })
+
+#if !defined(CHECK) && !defined(SOFT_ASSERT_NO_CHECK)
+#define CHECK(cond) SOFT_ASSERT(cond)
+#endif
+
+// Where the log goes (default stderr) and how often summaries are due (default a minute)
+void soft_assert_setup(FILE* out, uint64_t summary_interval_ns);
+
+// Prints the summary now: every stack that has failed since the last one, with its counts
+void soft_assert_summary(FILE* out);
+
+// Failures counted since the start, and how many distinct stacks they came from
+uint64_t soft_assert_failures();
+uint64_t soft_assert_stacks();
+
+// The slow path behind the macros. fmt is printf-style and may be NULL.
+void soft_assert_failed(struct soft_assert_site* site, const char* func, const char* fmt, ...)
+  __attribute__((noinline, cold, format(printf, 3, 4)));
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_SOFT_ASSERT_H
@@ -6,14 +6,28 @@
 //NOTE: I have tried to make this c compatible, but it won't demangle if you compile as c
 
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h> //fprintf
 #include <signal.h>
 #include <execinfo.h> //basic stack info
+#include <string.h> //memcpy
+#include <errno.h>
+#include <fcntl.h> //listing /proc/self/task
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <ucontext.h>
+#include <sys/syscall.h>
 
 #include "stack_dump_on_assert.h"
+#include "elfsym.h" //file and line lookup
+#include "symbolizer.h" //the same from symbolizerd
+#include "unwind.h" //other threads' stacks, from their signal handler
 
 #ifdef __cplusplus
-    #include <errno.h>  //c++ demangle
     #include <cxxabi.h> //c++ demangle
     #include <cstdlib>
 
@@ -24,10 +38,15 @@
 
 static inline void printStackTrace( FILE *out, unsigned int max_frames);
 static void abortHandler( int signum );
+static void printSourceLines( FILE *out, void* addr, const struct symbolizer_stack* remote );
+static void installCollector();
+static void dumpThreads( FILE *out, int skipTid );
+static __thread int inCrashHandler = 0; // set by abortHandler, which mustn't wait for the symbolizer lock
 
 
 void setup_stack_dump_on_assert()
 {
+  installCollector();
   signal( SIGABRT, abortHandler );
   signal( SIGSEGV, abortHandler );
   signal( SIGILL,  abortHandler );
@@ -58,7 +77,11 @@ static void abortHandler( int signum )
       fprintf( stderr, "Caught signal %d\n", signum );
  
    // Dump a stack trace.
+   inCrashHandler = 1;
    printStackTrace(stderr,63);
+
+   // and the other threads, one of which may well be holding what this one was waiting for
+   dumpThreads( stderr, (int)syscall( SYS_gettid ));
  
    // If you caught one of the above signals, it is likely you just 
    // want to quit your program right now.
@@ -72,27 +95,125 @@ static inline void printStackTrace( FILE *out, unsigned int max_frames)
     // storage array for stack trace address data
     void* addrlist[max_frames+1];
 
-    // retrieve current stack addresses
-    unsigned int addrlen = backtrace( addrlist, sizeof( addrlist ) / sizeof( void* ));
+    // retrieve current stack addresses, skipping this function and the signal handler frames
+    int addrlen = stack_dump_capture( addrlist, max_frames+1, 5 );
 
-    if ( addrlen == 0 )
+    if ( addrlen <= 0 )
     {
         fprintf( out, "  \n" );
         return;
     }
+
+    stack_dump_print( out, addrlist, addrlen );
+}
+
+static stack_dump_symbolizer symbolizer = NULL;
+
+void stack_dump_set_symbolizer( stack_dump_symbolizer fn )
+{
+    symbolizer = fn;
+}
+
+// Asks the symbolizer for the whole stack at once, NULL if there is none or it didn't answer
+static struct symbolizer_stack* remoteLookup( void* const* addrlist, int n )
+{
+    void* calls[n > 0 ? n : 1];
+    int i;
+    if ( !symbolizer || n <= 0 )
+        return NULL;
+    // a return address is just past the call, look up the call itself
+    for ( i = 0; i < n; i++ )
+        calls[i] = (char*)addrlist[i] - 1;
+    return symbolizer( calls, n );
+}
+
+// Prints file:line for a frame, and for every function inlined at that point, innermost first.
+// The names come from remote when the symbolizer answered, they are demangled already.
+static void printSourceLines( FILE *out, void* addr, const struct symbolizer_stack* remote )
+{
+    struct elfsym_frame frames[16];
+    int n, i;
+
+    if ( remote )
+    {
+        if ( remote->n <= 0 )
+            fprintf( out, "      ??:0\n" );
+        for ( i = 0; i < remote->n; i++ )
+            fprintf( out, "      %s:%u %s%s\n", remote->frames[i].file ? remote->frames[i].file : "??", remote->frames[i].line,
+                     remote->frames[i].function ? remote->frames[i].function : "??", i < remote->n - 1 ? " (inlined)" : "" );
+        return;
+    }
+
+    // a return address is just past the call, look up the call itself. A crash may come while
+    // this thread or another one is half way through a lookup, then the module and offset
+    // backtrace_symbols printed above are all there is.
+    if ( inCrashHandler )
+        n = elfsym_resolve_nowait( (char*)addr - 1, frames, 16, NULL );
+    else
+        n = elfsym_resolve( (char*)addr - 1, frames, 16, NULL );
+    if ( n < 0 )
+    {
+        fprintf( out, "      ??:0 (symbolizer busy)\n" );
+        return;
+    }
+    if ( n == 0 )
+    {
+        fprintf( out, "      ??:0\n" );
+        return;
+    }
+    for ( i = 0; i < n; i++ )
+    {
+        const char* fname = frames[i].function ? frames[i].function : "??";
+        char* demangled = NULL;
+#ifdef __cplusplus
+        int status = 0;
+        demangled = abi::__cxa_demangle( fname, NULL, NULL, &status );
+        if ( status == 0 )
+            fname = demangled;
+#endif
+        fprintf( out, "      %s:%u %s%s\n", frames[i].file ? frames[i].file : "??", frames[i].line,
+                 fname, i < n - 1 ? " (inlined)" : "" );
+        free( demangled );
+    }
+}
+
+static stack_dump_unwinder unwinder = backtrace;
+
+void stack_dump_set_unwinder( stack_dump_unwinder fn )
+{
+    unwinder = fn ? fn : backtrace;
+}
+
+int stack_dump_capture( void** addrs, int max_frames, int skip )
+{
+    void* all[max_frames + skip];
+    int n = unwinder( all, max_frames + skip );
+    if ( n <= skip )
+        return 0;
+    memcpy( addrs, all + skip, ( n - skip ) * sizeof( void* ));
+    return n - skip;
+}
+
+void stack_dump_print( FILE *out, void* const* addrlist, int n )
+{
+    unsigned int addrlen = n;
     
     // resolve addresses into strings containing "filename(function+address)",
     // Actually it will be ## program address function + offset
     // this array must be free()-ed
     char** symbollist = backtrace_symbols( addrlist, addrlen );
+    struct symbolizer_stack* remote = remoteLookup( addrlist, n );
 
 #ifndef __cplusplus
     
     //IF USING PURE C, USE THIS AS THE REMAINDER OF THE FUNCTION
     // print the stack trace.
     unsigned int i;
-    for (i = 4; i < addrlen; i++ )
+    for (i = 0; i < addrlen; i++ )
+    {
         fprintf( out, "%s\n", symbollist[i]);
+        printSourceLines( out, addrlist[i], remote ? &remote[i] : NULL );
+    }
 
     free(symbollist);
 #else //__cplusplus
@@ -102,7 +223,7 @@ static inline void printStackTrace( FILE *out, unsigned int max_frames)
  
    // iterate over the returned symbol lines. skip the first, it is the
    // address of this function.
-   for ( unsigned int i = 4; i < addrlen; i++ )
+   for ( unsigned int i = 0; i < addrlen; i++ )
    {
       char* begin_name   = NULL;
       char* begin_offset = NULL;
@@ -166,31 +287,7 @@ static inline void printStackTrace( FILE *out, unsigned int max_frames)
          // mangled name is now in [begin_name, begin_offset) and caller
          // offset in [begin_offset, end_offset).
 
-         // IN: usr/local/lib/libopencv_core.so.3.2(_ZNK2cv12_OutputArray6createEiiiibi+0x5c5) [0x7f9c569d5dd5]
-         // DO: addr2line  -i -e /usr/local/lib/libopencv_core.so.3.2  $( printf '%x\n' $((0x`nm /usr/local/lib/libopencv_core.so.3.2 | grep _ZNK2cv12_OutputArray6createEiiiibi| cut -d " " -f 1` +0x5c5)) )
-         size_t syscommandsize = 4096;
-         char* syscommand = (char*)malloc(syscommandsize);
-
-         if(begin_name+1 < begin_offset){
-             syscommandsize = syscommand ? syscommandsize : funcnamesize;
-             syscommand = syscommand ? syscommand : funcname;               //use funcname if cannot alloc
-             snprintf(syscommand, syscommandsize,
-                      "addr2line  -i -e %s"
-                      " $( printf '%%x\\n' $(( 0x0`nm %s 2>/dev/null"
-                         " | grep ' %s' "
-                         " | cut -d \" \" -f 1` +%s"
-                         " )) 2>/dev/null) 1>&2", symbollist[i], symbollist[i], begin_name, begin_offset);
-
-             //fprintf(stderr,">%s\n",syscommand);
-             system(syscommand);
-         }
-         else
-         {
-             fprintf(stderr, "??:0\n");
-         }
- 
-         // Now apply
-         // __cxa_demangle():
+         // now apply __cxa_demangle():
  
          int status = 0;
          char* ret = abi::__cxa_demangle( begin_name, funcname,
@@ -212,9 +309,317 @@ static inline void printStackTrace( FILE *out, unsigned int max_frames)
          // couldn't parse the line? print the whole line.
          fprintf(out, "  %-40s\n", symbollist[i]);
       }
+      printSourceLines( out, addrlist[i], remote ? &remote[i] : NULL );
    }
    free(symbollist);
 #endif //__cplusplus
+   free(remote);
+}
+
+// --- every thread's stack ---
+
+// Each thread is sent the collection signal and writes its own stack into its slot, since only
+// a thread can unwind itself. The slots are static so nothing is allocated while collecting.
+#define MAX_THREADS 256
+#define THREAD_FRAMES 64
+#define THREAD_TIMEOUT_MS 1000
+
+struct threadStack
+{
+    int   tid;
+    int   n;      // -1 until the thread answers
+    void* frames[THREAD_FRAMES];
+};
+
+static struct threadStack threadStacks[MAX_THREADS];
+static int nThreadStacks;
+static int dumping = 0;
+static sem_t dumpRequest;
+
+static int collectSig = 0;  // 0 until installCollector finds a free one
+
+static int collectSignal()
+{
+    return __atomic_load_n( &collectSig, __ATOMIC_ACQUIRE );
+}
+
+// The first real-time signal from SIGRTMIN+5 up that nothing handles yet, so collecting stacks
+// doesn't take over a signal the program or some library uses
+static int freeSignal()
+{
+    struct sigaction old;
+    int s;
+    for ( s = SIGRTMIN + 5; s <= SIGRTMAX; s++ )
+        if ( !sigaction( s, NULL, &old ) && !( old.sa_flags & SA_SIGINFO ) && old.sa_handler == SIG_DFL )
+            return s;
+    return 0;
+}
+
+static void collectHandler( int signum, siginfo_t* info, void* ucontext )
+{
+    int savedErrno = errno;
+    int tid = (int)syscall( SYS_gettid );
+    int i;
+    (void)signum;
+    (void)info;
+
+    for ( i = 0; i < nThreadStacks && threadStacks[i].tid != tid; i++ )
+        ;
+    // from the interrupted pc, which leaves out this handler, and unlike backtrace() it is
+    // async-signal-safe
+    if ( i < nThreadStacks )
+        __atomic_store_n( &threadStacks[i].n, unwind_cfi_context( ucontext, threadStacks[i].frames, THREAD_FRAMES ), __ATOMIC_RELEASE );
+    errno = savedErrno;
+}
+
+static void installCollector()
+{
+    static pthread_mutex_t installLock = PTHREAD_MUTEX_INITIALIZER;
+    struct sigaction sa;
+    int signum;
+
+    // the handler can't look up modules loaded since the last time
+    unwind_refresh();
+    pthread_mutex_lock( &installLock );
+    if ( !collectSignal() && ( signum = freeSignal() ))
+    {
+        memset( &sa, 0, sizeof( sa ));
+        sa.sa_sigaction = collectHandler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset( &sa.sa_mask );
+        if ( !sigaction( signum, &sa, NULL ))
+            __atomic_store_n( &collectSig, signum, __ATOMIC_RELEASE );
+    }
+    pthread_mutex_unlock( &installLock );
+}
+
+struct linuxDirent64
+{
+    unsigned long long d_ino;
+    long long          d_off;
+    unsigned short     d_reclen;
+    unsigned char      d_type;
+    char               d_name[];
+};
+
+// Fills the slots with every thread but skipTid, straight from the kernel, no opendir/malloc
+static void listThreads( int skipTid )
+{
+    char buf[4096];
+    long len;
+    int fd = open( "/proc/self/task", O_RDONLY | O_DIRECTORY );
+
+    nThreadStacks = 0;
+    if ( fd < 0 )
+        return;
+    while (( len = syscall( SYS_getdents64, fd, buf, sizeof( buf ))) > 0 )
+    {
+        long pos;
+        for ( pos = 0; pos < len; )
+        {
+            struct linuxDirent64* d = (struct linuxDirent64*)( buf + pos );
+            int tid = atoi( d->d_name );
+            pos += d->d_reclen;
+            if ( tid <= 0 || tid == skipTid || nThreadStacks == MAX_THREADS )
+                continue;
+            threadStacks[nThreadStacks].tid = tid;
+            threadStacks[nThreadStacks].n = -1;
+            nThreadStacks++;
+        }
+    }
+    close( fd );
+}
+
+static void threadName( int tid, char* name, size_t size )
+{
+    char path[64];
+    int fd;
+    ssize_t len = 0;
+    snprintf( path, sizeof( path ), "/proc/self/task/%d/comm", tid );
+    if (( fd = open( path, O_RDONLY )) >= 0 )
+    {
+        len = read( fd, name, size - 1 );
+        close( fd );
+    }
+    if ( len > 0 && name[len - 1] == '\n' )
+        len--;
+    name[len > 0 ? len : 0] = '\0';
+}
+
+static int sameStack( const struct threadStack* a, const struct threadStack* b )
+{
+    return a->n == b->n && !memcmp( a->frames, b->frames, a->n * sizeof( void* ));
+}
+
+static void dumpThreads( FILE *out, int skipTid )
+{
+    int i, j, waited, pending, expected = 0;
+    char name[64];
+    struct timespec tick = { 0, 1000000 };
+
+    // a second thread crashing while the first is dumping just prints its own stack
+    if ( !__atomic_compare_exchange_n( &dumping, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ))
+        return;
+
+    listThreads( skipTid );
+    if ( nThreadStacks && !collectSignal() )
+    {
+        fprintf( out, "%d other threads, no free real-time signal to collect their stacks with\n", nThreadStacks );
+        nThreadStacks = 0;
+        __atomic_store_n( &dumping, 0, __ATOMIC_RELEASE );
+        return;
+    }
+    for ( i = 0; i < nThreadStacks; i++ )
+    {
+        if ( syscall( SYS_tgkill, getpid(), threadStacks[i].tid, collectSignal() ))
+            threadStacks[i].n = -2;  // gone already
+    }
+    for ( waited = 0; waited < THREAD_TIMEOUT_MS; waited++ )
+    {
+        for ( pending = 0, i = 0; i < nThreadStacks; i++ )
+            pending += __atomic_load_n( &threadStacks[i].n, __ATOMIC_ACQUIRE ) == -1;
+        if ( !pending )
+            break;
+        nanosleep( &tick, NULL );
+    }
+
+    if ( nThreadStacks )
+        fprintf( out, "%d other threads:\n", nThreadStacks );
+    for ( i = 0; i < nThreadStacks; i++ )
+    {
+        struct threadStack* t = &threadStacks[i];
+        int n = __atomic_load_n( &t->n, __ATOMIC_ACQUIRE ), count = 0;
+        if ( n < 0 || !t->tid )
+            continue;
+        for ( j = i; j < nThreadStacks; j++ )
+            count += threadStacks[j].tid && sameStack( t, &threadStacks[j] );
+        fprintf( out, "\n%d thread%s with this stack:", count, count > 1 ? "s" : "" );
+        for ( j = i; j < nThreadStacks; j++ )
+        {
+            if ( j != i && ( !threadStacks[j].tid || !sameStack( t, &threadStacks[j] )))
+                continue;
+            threadName( threadStacks[j].tid, name, sizeof( name ));
+            fprintf( out, " %d (%s)", threadStacks[j].tid, name );
+            if ( j != i )
+                threadStacks[j].tid = 0;
+        }
+        fprintf( out, "\n" );
+        stack_dump_print( out, t->frames, n );
+        t->tid = 0;
+    }
+    for ( pending = 0, i = 0; i < nThreadStacks; i++ )
+    {
+        if ( !threadStacks[i].tid )
+            continue;
+        if ( !pending++ )
+            fprintf( out, "\nno stack from:" );
+        threadName( threadStacks[i].tid, name, sizeof( name ));
+        fprintf( out, " %d (%s)%s", threadStacks[i].tid, name, threadStacks[i].n == -2 ? " exited" : "" );
+        threadStacks[i].tid = 0;
+    }
+    if ( pending )
+        fprintf( out, " (blocking the signal, or stuck in the kernel)\n" );
+    else if ( nThreadStacks )
+        fprintf( out, "\n" );
+    fflush( out );
+    __atomic_store_n( &dumping, 0, __ATOMIC_RELEASE );
+}
+
+int stack_dump_thread( int tid, void** addrs, int max_frames, int timeout_ms )
+{
+    struct timespec tick = { 0, 1000000 };
+    int waited, n = -1, expected = 0;
+
+    installCollector();
+    // the slots are shared with the all-threads dump, wait for it rather than fail
+    for ( waited = 0; !__atomic_compare_exchange_n( &dumping, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ); waited++ )
+    {
+        if ( waited >= timeout_ms )
+            return -1;
+        expected = 0;
+        nanosleep( &tick, NULL );
+    }
+    threadStacks[0].tid = tid;
+    threadStacks[0].n = -1;
+    nThreadStacks = 1;
+    if ( collectSignal() && !syscall( SYS_tgkill, getpid(), tid, collectSignal() ))
+    {
+        for ( ; waited <= timeout_ms; waited++ )
+        {
+            if (( n = __atomic_load_n( &threadStacks[0].n, __ATOMIC_ACQUIRE )) >= 0 )
+                break;
+            nanosleep( &tick, NULL );
+        }
+    }
+    if ( n > max_frames )
+        n = max_frames;
+    if ( n > 0 )
+        memcpy( addrs, threadStacks[0].frames, n * sizeof( void* ));
+    threadStacks[0].tid = 0;
+    nThreadStacks = 0;
+    __atomic_store_n( &dumping, 0, __ATOMIC_RELEASE );
+    return n;
+}
+
+void stack_dump_all_threads( FILE *out )
+{
+    void* addrs[THREAD_FRAMES];
+    int n;
+
+    installCollector();
+    n = stack_dump_capture( addrs, THREAD_FRAMES, 1 );
+    fprintf( out, "this thread:\n" );
+    stack_dump_print( out, addrs, n );
+    dumpThreads( out, (int)syscall( SYS_gettid ));
+}
+
+// Only sem_post() is safe in a handler, the dumping happens on this thread
+static void* dumperMain( void* arg )
+{
+    sigset_t all;
+    (void)arg;
+    // the process directed on-demand signal should land on a thread worth dumping
+    sigfillset( &all );
+    if ( collectSignal() )
+        sigdelset( &all, collectSignal() );
+    pthread_sigmask( SIG_BLOCK, &all, NULL );
+    for ( ;; )
+    {
+        while ( sem_wait( &dumpRequest ) && errno == EINTR )
+            ;
+        fprintf( stderr, "stack dump requested\n" );
+        dumpThreads( stderr, (int)syscall( SYS_gettid ));
+    }
+    return NULL;
+}
+
+static void onDemandHandler( int signum )
+{
+    int savedErrno = errno;
+    (void)signum;
+    sem_post( &dumpRequest );
+    errno = savedErrno;
+}
+
+int setup_stack_dump_on_signal( int signum )
+{
+    static int started = 0;
+    pthread_t dumper;
+    struct sigaction sa;
+
+    installCollector();
+    if ( !started )
+    {
+        if ( sem_init( &dumpRequest, 0, 0 ) || pthread_create( &dumper, NULL, dumperMain, NULL ))
+            return -1;
+        pthread_detach( dumper );
+        started = 1;
+    }
+    memset( &sa, 0, sizeof( sa ));
+    sa.sa_handler = onDemandHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset( &sa.sa_mask );
+    return sigaction( signum, &sa, NULL );
 }
 
 #ifdef __cplusplus
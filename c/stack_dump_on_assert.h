@@ -1,16 +1,53 @@
 // Makes assert() print out a stack trace on unixlike systems. There is a windows version, but I did not implement.
 //To use, call setup_stack_dump_on_assert() from main.
 //Make sure to enable -rdynamic and -g to keep the symbols
+//Files and lines are looked up in process by elfsym.c, and other threads are unwound by unwind.c,
+//so link those in too (and -lpthread)
+//When it fires, every other thread's stack is printed too: each is sent a real-time signal and
+//records its own stack, identical stacks are printed once with the threads that share them. The
+//signal is the first from SIGRTMIN+5 up with no handler when setup runs.
 
 // Adapted from rafael on https://oroboro.com/stack-trace-on-crash/, who has graciously put it in the public domain, and I also release my changes to the public domain
 #ifndef P_STACK_DUMP_ON_ASSERT_H
 #define P_STACK_DUMP_ON_ASSERT_H
+#include <stdio.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void setup_stack_dump_on_assert();
 
+// Prints every thread's stack whenever signum arrives (SIGUSR2, say), without stopping anything,
+// for looking at a live process that has stalled: kill -USR2 <pid>. Returns 0 on success.
+// Like under a profiler, a sleep or wait in another thread can return early with EINTR.
+int  setup_stack_dump_on_signal( int signum );
+
+// The same dump, on demand, starting with the calling thread
+void stack_dump_all_threads( FILE *out );
+
+// Captures another thread's stack, by the same signal, into addrs. Returns the number of
+// frames, or -1 if the thread didn't answer within timeout_ms or no signal was free to ask it with.
+int  stack_dump_thread( int tid, void** addrs, int max_frames, int timeout_ms );
+
+// The pieces the assert handler is built from, for code that wants stacks without crashing.
+// Capture stores up to max_frames return addresses after skipping the innermost skip frames
+// (the capture call itself counts as one) and returns how many it stored.
+int  stack_dump_capture( void** addrs, int max_frames, int skip );
+// Symbolizes and prints a captured stack, one line per frame
+void stack_dump_print( FILE *out, void* const* addrs, int n );
+
+// Replaces backtrace() behind stack_dump_capture, with anything that has its signature, like
+// unwind_cfi() or unwind_fp() from unwind.c. NULL goes back to backtrace().
+typedef int (*stack_dump_unwinder)( void** addrs, int max_frames );
+void stack_dump_set_unwinder( stack_dump_unwinder fn );
+
+// Hands the file and line lookup to something else first, like symbolizer_resolve() from
+// symbolizer.c, which asks a symbolizerd that has the tables loaded already. When it returns NULL
+// the lookup is done in process as before. NULL turns it off.
+struct symbolizer_stack;
+typedef struct symbolizer_stack* (*stack_dump_symbolizer)( void* const* addrs, int n );
+void stack_dump_set_symbolizer( stack_dump_symbolizer fn );
+
 #ifdef __cplusplus
 }
 #endif
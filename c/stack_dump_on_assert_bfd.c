@@ -11,8 +11,10 @@
 #include <stdio.h> //fprintf
 #include <signal.h>
 #include <execinfo.h> //basic stack info
+#include <string.h> //memcpy
 
 #include "stack_dump_on_assert_bfd.h"
+#include "symbolizer.h"
 
 #ifdef __cplusplus
     #include <errno.h>  //c++ demangle
@@ -27,6 +29,7 @@
 
 static inline void printStackTrace( FILE *out, unsigned int max_frames);
 static void abortHandler( int signum );
+static __thread int inCrashHandler = 0; // set by abortHandler, which mustn't wait for the symbol lock
 
 
 void setup_stack_dump_on_assert()
@@ -61,6 +64,7 @@ static void abortHandler( int signum )
       fprintf( stderr, "Caught signal %d\n", signum );
  
    // Dump a stack trace.
+   inCrashHandler = 1;
    printStackTrace(stderr,63);
  
    // If you caught one of the above signals, it is likely you just 
@@ -75,15 +79,32 @@ static inline void printStackTrace( FILE *out, unsigned int max_frames)
     // storage array for stack trace address data
     void* addrlist[max_frames+1];
 
-    // retrieve current stack addresses
-    unsigned int addrlen = backtrace( addrlist, sizeof( addrlist ) / sizeof( void* ));
+    // retrieve current stack addresses, skipping this function and the signal handler frames
+    int addrlen = stack_dump_capture( addrlist, max_frames+1, 5 );
 
-    if ( addrlen == 0 )
+    if ( addrlen <= 0 )
     {
         fprintf( out, "  \n" );
         return;
     }
 
+    stack_dump_print( out, addrlist, addrlen );
+}
+
+int stack_dump_capture( void** addrs, int max_frames, int skip )
+{
+    void* all[max_frames + skip];
+    int n = backtrace( all, max_frames + skip );
+    if ( n <= skip )
+        return 0;
+    memcpy( addrs, all + skip, ( n - skip ) * sizeof( void* ));
+    return n - skip;
+}
+
+void stack_dump_print( FILE *out, void* const* addrlist, int n )
+{
+    unsigned int addrlen = n;
+
 
 #ifndef __cplusplus
     //IF USING PURE C, USE THIS AS THE REMAINDER OF THE FUNCTION
@@ -94,7 +115,7 @@ static inline void printStackTrace( FILE *out, unsigned int max_frames)
     //IF USING PURE C, USE THIS AS THE REMAINDER OF THE FUNCTION
     // print the stack trace.
     unsigned int i;
-    for (i = 4; i < addrlen; i++ )
+    for (i = 0; i < addrlen; i++ )
         fprintf( out, "%s\n", symbollist[i]);
 
     free(symbollist);
@@ -112,7 +133,7 @@ static inline void printStackTrace( FILE *out, unsigned int max_frames)
  
    // iterate over the returned symbol lines. skip the first, it is the
    // address of this function.
-   for ( unsigned int i = 4; i < addrlen; i++ )
+   for ( unsigned int i = 0; i < addrlen; i++ )
    {
       char* begin_name   = NULL;
       char* begin_offset = NULL;
@@ -212,13 +233,57 @@ static inline void printStackTrace( FILE *out, unsigned int max_frames)
 #include <bfd.h>    //c++ lookup file
 #include <dlfcn.h>  //c++ lookup file
 #include <link.h>   //c++ lookup file
+#include <pthread.h>
+#include <stddef.h> //offsetof
 
 #include <string.h>
 #include <cassert>
+
+// Opening a module, checking its format and slurping its symbol table is what makes a trace slow,
+// and bfd_find_nearest_line parses the debug info on first use and caches it in the bfd. So every
+// module is opened once and kept open, with its allocated sections sorted by address, and the
+// address ranges of all loaded modules are kept in a sorted table that is only rebuilt when
+// something was dlopen()ed or dlclose()d. A repeated trace is then a few binary searches per frame.
+// libbfd isn't thread safe, so all of it is behind symLock.
+
+struct SectionRange
+{
+   bfd_vma   mVma;
+   bfd_vma   mEnd;
+   asection* mSection;
+};
+
+struct SymModule
+{
+   char*         mFile;
+   int           mTried;     // opened already, successfully or not, so failures aren't retried
+   bfd*          mBfd;
+   asymbol**     mSyms;
+   SectionRange* mSections;  // sorted by mVma
+   int           mNumSections;
+};
+
+struct ModuleRange
+{
+   ElfW(Addr)  mStart;
+   ElfW(Addr)  mEnd;
+   ElfW(Addr)  mBase;
+   SymModule*  mModule;
+};
+
+static pthread_mutex_t symLock = PTHREAD_MUTEX_INITIALIZER;
+static SymModule**  symModules    = NULL;
+static int          numSymModules = 0;
+static ModuleRange* moduleRanges  = NULL;
+static int          numRanges     = 0;
+static int          capRanges     = 0;
+static unsigned long long loadedAdds = 0, loadedSubs = 0;
+static int          bfdReady      = 0;
+
 class FileLineDesc
 {
 public:
-   FileLineDesc( asymbol** syms, bfd_vma pc ) : mPc( pc ), mFound( false ), mSyms( syms ) {}
+   FileLineDesc( asymbol** syms, bfd_vma pc ) : mPc( pc ), mFilename( NULL ), mFunctionname( NULL ), mLine( 0 ), mFound( false ), mSyms( syms ) {}
 
    void findAddressInSection( bfd* abfd, asection* section );
 
@@ -250,69 +315,6 @@ void FileLineDesc::findAddressInSection( bfd* abfd, asection* section )
                                    (const char**)&mFilename, (const char**)&mFunctionname, &mLine );
 }
 
-static void findAddressInSection( bfd* abfd, asection* section, void* data )
-{
-   FileLineDesc* desc = (FileLineDesc*)data;
-   assert( desc );
-   return desc->findAddressInSection( abfd, section );
-}
-
-static char** translateAddressesBuf( bfd* abfd, bfd_vma* addr, int numAddr, asymbol** syms )
-{
-   char** ret_buf = NULL;
-   int    total   = 0;
-
-   char   b;
-   char*  buf     = &b;
-   int    len     = 0;
-
-   for ( unsigned int state = 0; state < 2; state++ )
-   {
-      if ( state == 1 )
-      {
-         ret_buf = (char**)malloc( total + ( sizeof(char*) * numAddr ));
-         buf = (char*)(ret_buf + numAddr);
-         len = total;
-      }
-
-      for ( int i = 0; i < numAddr; i++ )
-      {
-         FileLineDesc desc( syms, addr[i] );
-
-         if ( state == 1 )
-            ret_buf[i] = buf;
-
-         bfd_map_over_sections( abfd, findAddressInSection, (void*)&desc );
-
-         if ( !desc.mFound )
-         {
-            total += snprintf( buf, len, "[0x%llx] \?\? \?\?:0", (long long unsigned int) addr[i] ) + 1;
-
-         } else {
-
-            const char* name = desc.mFunctionname;
-            if ( name == NULL || *name == '\0' )
-               name = "??";
-            if ( desc.mFilename != NULL )
-            {
-               char* h = strrchr( desc.mFilename, '/' );
-               if ( h != NULL )
-                  desc.mFilename = h + 1;
-            }
-            total += snprintf( buf, len, "%s:%u %s", desc.mFilename ? desc.mFilename : "??", desc.mLine, name ) + 1;
-            // elog << "\"" << buf << "\"\n";
-         }
-      }
-
-      if ( state == 1 )
-      {
-         buf = buf + total + 1;
-      }
-   }
-
-   return ret_buf;
-}
-
 static asymbol** kstSlurpSymtab( bfd* abfd, const char* fileName )
 {
   if ( !( bfd_get_file_flags( abfd ) & HAS_SYMS ))
@@ -337,20 +339,53 @@ static asymbol** kstSlurpSymtab( bfd* abfd, const char* fileName )
   return syms;
 }
 
-static char** processFile( const char* fileName, bfd_vma* addr, int naddr )
+static void addSection( bfd* abfd, asection* section, void* data )
+{
+   SymModule* mod = (SymModule*)data;
+
+   if (( bfd_get_section_flags( abfd, section ) & SEC_ALLOC ) == 0 )
+      return;
+   // .tbss and friends overlap the real sections
+   if ( bfd_get_section_flags( abfd, section ) & SEC_THREAD_LOCAL )
+      return;
+
+   bfd_size_type size = bfd_section_size( abfd, section );
+   if ( size == 0 )
+      return;
+
+   SectionRange* r = &mod->mSections[mod->mNumSections++];
+   r->mVma     = bfd_get_section_vma( abfd, section );
+   r->mEnd     = r->mVma + size;
+   r->mSection = section;
+}
+
+static int compareSections( const void* a, const void* b )
 {
+   bfd_vma va = ((const SectionRange*)a)->mVma;
+   bfd_vma vb = ((const SectionRange*)b)->mVma;
+   return va < vb ? -1 : va > vb;
+}
+
+// Opens the module the first time a frame lands in it, and keeps it open
+static int openModule( SymModule* mod )
+{
+  if ( mod->mTried )
+     return mod->mBfd != NULL;
+  mod->mTried = 1;
+
+  const char* fileName = mod->mFile;
   bfd* abfd = bfd_openr( fileName, NULL );
   if ( !abfd )
   {
      printf( "Error opening bfd file \"%s\"\n", fileName );
-     return NULL;
+     return 0;
   }
 
   if ( bfd_check_format( abfd, bfd_archive ) )
   {
      printf( "Cannot get addresses from archive \"%s\"\n", fileName );
      bfd_close( abfd );
-     return NULL;
+     return 0;
   }
 
   char** matching;
@@ -358,7 +393,7 @@ static char** processFile( const char* fileName, bfd_vma* addr, int naddr )
   {
      printf( "Format does not match for archive \"%s\"\n", fileName );
      bfd_close( abfd );
-     return NULL;
+     return 0;
   }
 
   asymbol** syms = kstSlurpSymtab( abfd, fileName );
@@ -366,93 +401,322 @@ static char** processFile( const char* fileName, bfd_vma* addr, int naddr )
   {
      printf( "Failed to read symbol table for archive \"%s\"\n", fileName );
      bfd_close( abfd );
-     return NULL;
+     return 0;
   }
 
-  char** retBuf = translateAddressesBuf( abfd, addr, naddr, syms );
+  mod->mSections = (SectionRange*)malloc( bfd_count_sections( abfd ) * sizeof( SectionRange ));
+  mod->mNumSections = 0;
+  bfd_map_over_sections( abfd, addSection, (void*)mod );
+  qsort( mod->mSections, mod->mNumSections, sizeof( SectionRange ), compareSections );
 
-  free( syms );
+  mod->mBfd  = abfd;
+  mod->mSyms = syms;
+  return 1;
+}
 
-  bfd_close( abfd );
-  return retBuf;
+static void lookupInModule( SymModule* mod, FileLineDesc* desc )
+{
+   // last section starting at or below the address. Sections don't overlap once .tbss is out,
+   // but walk back a little in case a linker script made them
+   int lo = 0, hi = mod->mNumSections;
+   while ( lo < hi )
+   {
+      int mid = ( lo + hi ) / 2;
+      if ( mod->mSections[mid].mVma <= desc->mPc )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   for ( int i = lo - 1; i >= 0 && !desc->mFound; i-- )
+   {
+      if ( desc->mPc < mod->mSections[i].mEnd )
+         desc->findAddressInSection( mod->mBfd, mod->mSections[i].mSection );
+   }
 }
 
-class FileMatch
+static SymModule* findOrAddModule( const char* file )
 {
-public:
-  FileMatch( void* addr ) : mAddress( addr ), mFile( NULL ), mBase( NULL ) {}
+  for ( int i = 0; i < numSymModules; i++ )
+  {
+     if ( !strcmp( symModules[i]->mFile, file ))
+        return symModules[i];
+  }
 
-  void*       mAddress;
-  const char* mFile;
-  void*       mBase;
-};
+  SymModule* mod = (SymModule*)calloc( 1, sizeof( SymModule ));
+  mod->mFile = strdup( file );
+  symModules = (SymModule**)realloc( symModules, ( numSymModules + 1 ) * sizeof( SymModule* ));
+  symModules[numSymModules++] = mod;
+  return mod;
+}
+
+static int readLoadCounts( struct dl_phdr_info* info, size_t size, void* data )
+{
+  unsigned long long* counts = (unsigned long long*)data;
+  if ( size >= offsetof( struct dl_phdr_info, dlpi_subs ) + sizeof( info->dlpi_subs ))
+  {
+     counts[0] = info->dlpi_adds;
+     counts[1] = info->dlpi_subs;
+  }
+  return 1; // the counts are the same in every entry, one is enough
+}
 
-static int findMatchingFile( struct dl_phdr_info* info, size_t size, void* data )
+static int addModuleRanges( struct dl_phdr_info* info, size_t size, void* data )
 {
-  FileMatch* match = (FileMatch*)data;
+  // the main program has an empty name
+  const char* file = ( info->dlpi_name && *info->dlpi_name ) ? info->dlpi_name : "/proc/self/exe";
+  SymModule* mod = NULL;
 
   for ( unsigned int i = 0; i < info->dlpi_phnum; i++ )
   {
      const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
 
-     if ( phdr.p_type == PT_LOAD )
+     if ( phdr.p_type != PT_LOAD )
+        continue;
+     // the vdso has no file to read
+     if ( !mod && !strncmp( file, "linux-vdso", 10 ))
+        return 0;
+     if ( !mod )
+        mod = findOrAddModule( file );
+
+     if ( numRanges == capRanges )
      {
-        ElfW(Addr) vaddr = phdr.p_vaddr + info->dlpi_addr;
-        ElfW(Addr) maddr = ElfW(Addr)(match->mAddress);
-        if (( maddr >= vaddr ) &&
-            ( maddr < vaddr + phdr.p_memsz ))
-        {
-           match->mFile =        info->dlpi_name;
-           match->mBase = (void*)info->dlpi_addr;
-           return 1;
-        }
+        capRanges = capRanges ? capRanges * 2 : 64;
+        moduleRanges = (ModuleRange*)realloc( moduleRanges, capRanges * sizeof( ModuleRange ));
      }
+     ModuleRange* r = &moduleRanges[numRanges++];
+     r->mStart  = phdr.p_vaddr + info->dlpi_addr;
+     r->mEnd    = r->mStart + phdr.p_memsz;
+     r->mBase   = info->dlpi_addr;
+     r->mModule = mod;
   }
   return 0;
 }
 
-static char** backtraceSymbols( void* const* addrList, int numAddr )
+static int compareRanges( const void* a, const void* b )
 {
-  char*** locations = (char***) alloca( sizeof( char** ) * numAddr );
+   ElfW(Addr) sa = ((const ModuleRange*)a)->mStart;
+   ElfW(Addr) sb = ((const ModuleRange*)b)->mStart;
+   return sa < sb ? -1 : sa > sb;
+}
 
-  // initialize the bfd library
-  bfd_init();
+// Rebuilds the address range table if the set of loaded modules changed since the last trace
+static void refreshModules()
+{
+  unsigned long long counts[2] = { ~0ULL, ~0ULL };
+  dl_iterate_phdr( readLoadCounts, counts );
+
+  // an old libc that doesn't report the counts gets a rebuild every time, which is still cheap
+  if ( numRanges && counts[0] != ~0ULL && counts[0] == loadedAdds && counts[1] == loadedSubs )
+     return;
+
+  numRanges = 0;
+  dl_iterate_phdr( addModuleRanges, NULL );
+  qsort( moduleRanges, numRanges, sizeof( ModuleRange ), compareRanges );
+  loadedAdds = counts[0];
+  loadedSubs = counts[1];
+}
 
-  int total = 0;
-  unsigned int idx = numAddr;
-  for ( int i = 0; i < numAddr; i++ )
+static ModuleRange* findRange( ElfW(Addr) addr )
+{
+  int lo = 0, hi = numRanges;
+  while ( lo < hi )
   {
-     // find which executable, or library the symbol is from
-     FileMatch match( addrList[--idx] );
-     dl_iterate_phdr( findMatchingFile, &match );
-
-     // adjust the address in the global space of your binary to an
-     // offset in the relevant library
-     bfd_vma addr  = (bfd_vma)( addrList[idx] );
-             addr -= (bfd_vma)( match.mBase );
-
-     // lookup the symbol
-     if ( match.mFile && strlen( match.mFile ))
-        locations[idx] = processFile( match.mFile,      &addr, 1 );
+     int mid = ( lo + hi ) / 2;
+     if ( moduleRanges[mid].mStart <= addr )
+        lo = mid + 1;
      else
-        locations[idx] = processFile( "/proc/self/exe", &addr, 1 );
+        hi = mid;
+  }
+  if ( lo > 0 && addr < moduleRanges[lo-1].mEnd )
+     return &moduleRanges[lo-1];
+  return NULL;
+}
+
+static stack_dump_symbolizer symbolizer = NULL;
+
+void stack_dump_set_symbolizer( stack_dump_symbolizer fn )
+{
+  symbolizer = fn;
+}
+
+// The same strings as below, from what the symbolizer answered: the innermost frame of each
+// address, like bfd_find_nearest_line gives
+static char** remoteSymbols( const symbolizer_stack* remote, int numAddr )
+{
+  char** ret_buf = NULL;
+  char*  buf     = NULL;
+  int    total   = 0;
+  int    len     = 0;
+
+  for ( unsigned int state = 0; state < 2; state++ )
+  {
+     if ( state == 1 )
+     {
+        ret_buf = (char**)malloc( total + ( sizeof(char*) * numAddr ));
+        if ( !ret_buf )
+           return NULL;
+        buf = (char*)(ret_buf + numAddr);
+        len = total;
+        total = 0;
+     }
+
+     for ( int i = 0; i < numAddr; i++ )
+     {
+        char*  dst  = state ? buf + total : NULL;
+        size_t room = state ? len - total : 0;
+        int n;
+
+        if ( state == 1 )
+           ret_buf[i] = dst;
+
+        if ( remote[i].n <= 0 )
+        {
+           n = snprintf( dst, room, "\?\?:0 \?\?" );
+        } else {
+           const symbolizer_frame& f = remote[i].frames[0];
+           const char* file = f.file;
+           if ( file != NULL )
+           {
+              const char* h = strrchr( file, '/' );
+              if ( h != NULL )
+                 file = h + 1;
+           }
+           n = snprintf( dst, room, "%s:%u %s", file ? file : "??", f.line, f.function ? f.function : "??" );
+        }
+        total += n + 1;
+     }
+  }
+  return ret_buf;
+}
+
+static char** backtraceSymbols( void* const* addrList, int numAddr )
+{
+  // the daemon has the tables loaded already, when there is one
+  if ( symbolizer )
+  {
+     void** calls = (void**) alloca( sizeof( void* ) * numAddr );
+     for ( int i = 0; i < numAddr; i++ )
+        calls[i] = (char*)addrList[i] - 1;
+     symbolizer_stack* remote = symbolizer( calls, numAddr );
+     if ( remote )
+     {
+        char** ret = remoteSymbols( remote, numAddr );
+        free( remote );
+        if ( ret )
+           return ret;
+     }
+  }
+
+  ModuleRange** owner = (ModuleRange**) alloca( sizeof( ModuleRange* ) * numAddr );
+  FileLineDesc* descs = (FileLineDesc*) alloca( sizeof( FileLineDesc ) * numAddr );
+  int*          done  = (int*) alloca( sizeof( int ) * numAddr );
+
+  // A crash may come while this thread or another one holds symLock, even in the middle of libbfd.
+  // Rather than deadlock then, the trace is printed with raw addresses.
+  int locked = 1;
+  if ( inCrashHandler )
+     locked = pthread_mutex_trylock( &symLock ) == 0;
+  else
+     pthread_mutex_lock( &symLock );
 
-     total += strlen( locations[idx][0] ) + 1;
+  if ( !locked )
+  {
+     for ( int i = 0; i < numAddr; i++ )
+     {
+        descs[i] = FileLineDesc( NULL, (bfd_vma)addrList[i] );
+        done[i] = 1;
+     }
+  } else {
+     if ( !bfdReady )
+     {
+        bfd_init();
+        bfdReady = 1;
+     }
+     refreshModules();
   }
 
-  // return all the file and line information for each address
-  char** final = (char**)malloc( total + ( numAddr * sizeof( char* )));
-  char* f_strings = (char*)( final + numAddr );
+  // find which executable or library each address is from, and make it an offset in that file
+  for ( int i = 0; locked && i < numAddr; i++ )
+  {
+     owner[i] = findRange( (ElfW(Addr))addrList[i] );
+     bfd_vma addr = (bfd_vma)addrList[i];
+     if ( owner[i] )
+        addr -= (bfd_vma)owner[i]->mBase;
+     descs[i] = FileLineDesc( NULL, addr );
+     done[i] = owner[i] == NULL;
+  }
 
+  // look the frames up one module at a time, so each module is touched once per trace
   for ( int i = 0; i < numAddr; i++ )
   {
-     strcpy( f_strings, locations[i][0] );
-     free( locations[i] );
-     final[i] = f_strings;
-     f_strings += strlen( f_strings ) + 1;
+     if ( done[i] )
+        continue;
+     SymModule* mod = owner[i]->mModule;
+     int ok = openModule( mod );
+     for ( int j = i; j < numAddr; j++ )
+     {
+        if ( done[j] || owner[j]->mModule != mod )
+           continue;
+        done[j] = 1;
+        if ( !ok )
+           continue;
+        descs[j].mSyms = mod->mSyms;
+        lookupInModule( mod, &descs[j] );
+     }
+  }
+
+  // two passes, the first to size the buffer, the second to fill it. The strings point into the
+  // cached bfds, so this stays under the lock
+  char** ret_buf = NULL;
+  char*  buf     = NULL;
+  int    total   = 0;
+  int    len     = 0;
+
+  for ( unsigned int state = 0; state < 2; state++ )
+  {
+     if ( state == 1 )
+     {
+        ret_buf = (char**)malloc( total + ( sizeof(char*) * numAddr ));
+        buf = (char*)(ret_buf + numAddr);
+        len = total;
+        total = 0;
+     }
+
+     for ( int i = 0; i < numAddr; i++ )
+     {
+        FileLineDesc& desc = descs[i];
+        char*  dst  = state ? buf + total : NULL;
+        size_t room = state ? len - total : 0;
+        int n;
+
+        if ( state == 1 )
+           ret_buf[i] = dst;
+
+        if ( !desc.mFound )
+        {
+           n = snprintf( dst, room, "[0x%llx] \?\? \?\?:0", (long long unsigned int) desc.mPc );
+
+        } else {
+
+           const char* name = desc.mFunctionname;
+           if ( name == NULL || *name == '\0' )
+              name = "??";
+           const char* file = desc.mFilename;
+           if ( file != NULL )
+           {
+              const char* h = strrchr( file, '/' );
+              if ( h != NULL )
+                 file = h + 1;
+           }
+           n = snprintf( dst, room, "%s:%u %s", file ? file : "??", desc.mLine, name );
+        }
+        total += n + 1;
+     }
   }
 
-  return final;
+  if ( locked )
+     pthread_mutex_unlock( &symLock );
+  return ret_buf;
 }
 
 #ifdef __cplusplus
@@ -2,16 +2,34 @@
 // Makes assert() print out a stack trace on unixlike systems. There is a windows version, but I did not implement.
 //To use, call setup_stack_dump_on_assert() from main.
 //Make sure to enable -rdynamic and -g to keep the symbols
+//Each module's symbols are loaded the first time a trace goes through it and kept, so later traces are fast
+//Only the crashing thread's stack is printed. For every thread's, use stack_dump_on_assert.c: libbfd
+//is behind one lock that a crash may find taken, and a crash handler is no place to load it for dozens of stacks.
 
 // Adapted from rafael on https://oroboro.com/stack-trace-on-crash/, who has graciously put it in the public domain, and I also release my changes to the public domain
 #ifndef P_STACK_DUMP_ON_ASSERT_H
 #define P_STACK_DUMP_ON_ASSERT_H
+#include <stdio.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void setup_stack_dump_on_assert();
 
+// The pieces the assert handler is built from, for code that wants stacks without crashing.
+// Capture stores up to max_frames return addresses after skipping the innermost skip frames
+// (the capture call itself counts as one) and returns how many it stored.
+int  stack_dump_capture( void** addrs, int max_frames, int skip );
+// Symbolizes and prints a captured stack, one line per frame
+void stack_dump_print( FILE *out, void* const* addrs, int n );
+
+// Hands the file and line lookup to something else first, like symbolizer_resolve() from
+// symbolizer.c, which asks a symbolizerd that has the tables loaded already, so libbfd doesn't
+// load them again in every process. When it returns NULL libbfd is used as before.
+struct symbolizer_stack;
+typedef struct symbolizer_stack* (*stack_dump_symbolizer)( void* const* addrs, int n );
+void stack_dump_set_symbolizer( stack_dump_symbolizer fn );
+
 #ifdef __cplusplus
 }
 #endif
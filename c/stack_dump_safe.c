@@ -0,0 +1,278 @@
+// Crash handler that only makes async-signal-safe calls, see stack_dump_safe.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c stack_dump_safe.c unwind.c
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <signal.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "stack_dump_safe.h"
+#include "unwind.h"
+
+#define SAFE_MAX_FRAMES 128
+#define SAFE_ALTSTACK_SIZE (256*1024)
+
+static int safe_fd = 2;
+static int safe_crashing_tid = 0;
+static int safe_signum = 0;  //what the reporting thread caught
+
+// Everything the handler touches is allocated up front
+static struct {
+  char  buf[4096];
+  int   len;
+  void* frames[SAFE_MAX_FRAMES];
+  char  maps[4096];
+} out;
+
+static const int safe_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+static void flush()
+{
+  int off = 0;
+  while(off < out.len){
+    ssize_t n = write(safe_fd, out.buf + off, out.len - off);
+    if(n <= 0)
+      break;
+    off += (int)n;
+  }
+  out.len = 0;
+}
+
+static void put_str(const char* s)
+{
+  while(*s){
+    if(out.len == (int)sizeof(out.buf))
+      flush();
+    out.buf[out.len++] = *s++;
+  }
+}
+
+static void put_hex(uintptr_t v)
+{
+  char tmp[2 + 2*sizeof(uintptr_t) + 1];
+  int i = sizeof(tmp) - 1;
+  tmp[i] = '\0';
+  do{
+    tmp[--i] = "0123456789abcdef"[v & 15];
+    v >>= 4;
+  }while(v);
+  tmp[--i] = 'x';
+  tmp[--i] = '0';
+  put_str(tmp + i);
+}
+
+static void put_dec(long v)
+{
+  char tmp[24];
+  int i = sizeof(tmp) - 1;
+  unsigned long u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+  tmp[i] = '\0';
+  do{
+    tmp[--i] = '0' + u % 10;
+    u /= 10;
+  }while(u);
+  if(v < 0)
+    tmp[--i] = '-';
+  put_str(tmp + i);
+}
+
+static const char* signal_name(int signum)
+{
+  switch(signum){
+  case SIGABRT: return "SIGABRT";
+  case SIGSEGV: return "SIGSEGV";
+  case SIGBUS:  return "SIGBUS";
+  case SIGILL:  return "SIGILL";
+  case SIGFPE:  return "SIGFPE";
+  }
+  return "?";
+}
+
+static uintptr_t fault_pc(void* uc)
+{
+#if defined(__x86_64__)
+  return (uintptr_t)((ucontext_t*)uc)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+  return (uintptr_t)((ucontext_t*)uc)->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+  return (uintptr_t)((ucontext_t*)uc)->uc_mcontext.pc;
+#else
+  return 0;
+#endif
+}
+
+// Copies the executable lines of /proc/self/maps to the output
+static void dump_maps()
+{
+  int fd = open("/proc/self/maps", O_RDONLY);
+  int have = 0;
+  if(fd < 0)
+    return;
+
+  put_str("executable mappings:\n");
+  for(;;){
+    ssize_t n = read(fd, out.maps + have, sizeof(out.maps) - 1 - have);
+    if(n <= 0)
+      break;
+    have += (int)n;
+    out.maps[have] = '\0';
+
+    char* line = out.maps;
+    char* nl;
+    while((nl = strchr(line, '\n'))){
+      *nl = '\0';
+      // "start-end perms offset dev inode path", perms is the second field
+      char* perms = strchr(line, ' ');
+      if(perms && perms[3] == 'x'){
+        put_str("  ");
+        put_str(line);
+        put_str("\n");
+      }
+      line = nl + 1;
+    }
+    have -= (int)(line - out.maps);
+    memmove(out.maps, line, have);
+    if(have == (int)sizeof(out.maps) - 1)
+      have = 0; //a line longer than the buffer, drop it
+  }
+  close(fd);
+}
+
+// The alarm went off in backtrace_symbols_fd(). Die of the original signal, not of SIGALRM,
+// so the exit status and the core dump are still the crash's.
+static void symbols_timeout(int signum)
+{
+  sigset_t set;
+  (void)signum;
+  put_str("(timed out)\n");
+  flush();
+  signal(safe_signum, SIG_DFL);
+  sigemptyset(&set);
+  sigaddset(&set, safe_signum);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+  raise(safe_signum);
+  _exit(128 + safe_signum);
+}
+
+static void crash_handler(int signum, siginfo_t* info, void* uc)
+{
+  int tid = (int)syscall(SYS_gettid);
+  int expected = 0;
+
+  if(!__atomic_compare_exchange_n(&safe_crashing_tid, &expected, tid, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+    if(expected == tid){
+      // crashed inside the handler, give up and take the default action
+      signal(signum, SIG_DFL);
+      raise(signum);
+      return;
+    }
+    // another thread is already reporting, let it finish
+    for(;;){
+      struct timespec ts = { 1, 0 };
+      nanosleep(&ts, NULL);
+    }
+  }
+
+  uintptr_t pc = fault_pc(uc);
+  put_str("Caught signal ");
+  put_dec(signum);
+  put_str(" (");
+  put_str(signal_name(signum));
+  put_str(") code ");
+  put_dec(info->si_code);
+  put_str(" addr ");
+  put_hex((uintptr_t)info->si_addr);
+  put_str(" pc ");
+  put_hex(pc);
+  put_str(" pid ");
+  put_dec(getpid());
+  put_str(" tid ");
+  put_dec(tid);
+  put_str("\nstack trace:\n");
+
+  // from the interrupted context, so the handler's own frames never show up
+  int n = unwind_cfi_context(uc, out.frames, SAFE_MAX_FRAMES);
+  int i;
+  for(i = 0; i < n; i++){
+    put_str("  #");
+    put_dec(i);
+    put_str(" ");
+    put_hex((uintptr_t)out.frames[i]);
+    put_str("\n");
+  }
+  dump_maps();
+  flush();
+
+  // Everything needed is out. Names are a bonus: backtrace_symbols_fd doesn't malloc but does
+  // take the loader lock, so don't let it hang the process if the crash happened holding it.
+  put_str("symbols:\n");
+  flush();
+  sigset_t alrm;
+  sigemptyset(&alrm);
+  sigaddset(&alrm, SIGALRM);
+  safe_signum = signum;
+  signal(SIGALRM, symbols_timeout);
+  sigprocmask(SIG_UNBLOCK, &alrm, NULL);
+  alarm(2);
+  backtrace_symbols_fd(out.frames, n, safe_fd);
+  alarm(0);
+
+  signal(signum, SIG_DFL);
+  raise(signum);
+}
+
+int stack_dump_safe_thread_init()
+{
+  stack_t ss;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t size = SAFE_ALTSTACK_SIZE;
+#ifdef _SC_SIGSTKSZ
+  if((size_t)sysconf(_SC_SIGSTKSZ) > size)
+    size = sysconf(_SC_SIGSTKSZ);
+#endif
+
+  // with a guard page below, so overflowing the alternate stack faults instead of corrupting
+  char* p = (char*)mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    return -1;
+  mprotect(p, page, PROT_NONE);
+
+  ss.ss_sp = p + page;
+  ss.ss_size = size;
+  ss.ss_flags = 0;
+  return sigaltstack(&ss, NULL);
+}
+
+void stack_dump_safe_set_fd(int fd)
+{
+  safe_fd = fd;
+}
+
+void setup_stack_dump_safe()
+{
+  struct sigaction sa;
+  unsigned int i;
+
+  // the handler can't look modules up, so make sure the unwinder has them
+  unwind_refresh();
+  stack_dump_safe_thread_init();
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = crash_handler;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigfillset(&sa.sa_mask);
+  for(i = 0; i < sizeof(safe_signals)/sizeof(safe_signals[0]); i++)
+    sigaction(safe_signals[i], &sa, NULL);
+}
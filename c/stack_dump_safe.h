@@ -0,0 +1,39 @@
+// Crash handler that only makes async-signal-safe calls, for when stack_dump_on_assert is too fragile
+// Author: Paul Foster
+// Public domain
+//
+// setup_stack_dump_on_assert() prints with fprintf, mallocs for the symbols and shells out to
+// addr2line from inside the signal handler, which can deadlock on the malloc lock, and it has no
+// alternate stack so a stack overflow can't be reported at all. This version:
+//   - runs on a sigaltstack, so stack overflows get reported
+//   - formats into a preallocated buffer and write()s it, no stdio, no heap, no fork
+//   - unwinds from the interrupted context with unwind_cfi_context(), which neither allocates nor
+//     loads anything, and prints the raw return addresses and the executable mappings from
+//     /proc/self/maps, which is enough to resolve everything offline with
+//     addr2line -e <module> <address - base>
+//   - then tries backtrace_symbols_fd() for names, under an alarm in case the loader lock is held.
+//     If that times out it dies of the original signal anyway
+//   - re-raises the signal with the default action, so you still get the core dump
+//
+// To use, call setup_stack_dump_safe() from main, and stack_dump_safe_thread_init() at the start
+// of any other thread you want stack overflows reported for (sigaltstack is per thread).
+// Call unwind_refresh() after a dlopen for the new module's frames to unwind. Linux only.
+
+#ifndef P_STACK_DUMP_SAFE_H
+#define P_STACK_DUMP_SAFE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void setup_stack_dump_safe();
+
+// Installs an alternate signal stack for the calling thread. Returns 0 on success.
+int stack_dump_safe_thread_init();
+
+// Where the report goes, stderr by default
+void stack_dump_safe_set_fd(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_STACK_DUMP_SAFE_H
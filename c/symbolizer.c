@@ -0,0 +1,303 @@
+// Client for symbolizerd, see symbolizer.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c symbolizer.c
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <link.h>
+#include <elf.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "symbolizer.h"
+
+#define MAX_MODULES   256
+#define BUILD_ID_MAX  64
+
+struct module
+{
+  uint64_t start, end, bias;
+  char     path[1024];
+  char     build_id[2 * BUILD_ID_MAX + 1];  //hex, "-" if there is none
+};
+
+struct modules
+{
+  struct module* m;
+  int            n;
+};
+
+// growable text buffer
+struct buf
+{
+  char*  p;
+  size_t len, cap;
+};
+
+static const char* socket_path = NULL;
+
+void symbolizer_set_socket(const char* path)
+{
+  socket_path = path;
+}
+
+int symbolizer_default_socket(char* path, size_t size, int create)
+{
+  const char* run = getenv("XDG_RUNTIME_DIR");
+  char dir[512];
+  struct stat st;
+
+  if(run && *run)
+    snprintf(dir, sizeof(dir), "%s", run);
+  else
+    snprintf(dir, sizeof(dir), "/tmp/symbolizerd-%u", (unsigned)getuid());
+  if(create && mkdir(dir, 0700) && errno != EEXIST)
+    return -1;
+  // lstat, so a link to somewhere else doesn't pass
+  if(lstat(dir, &st) || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077))
+    return -1;
+  return snprintf(path, size, "%s/" SYMBOLIZER_SOCKET_NAME, dir) < (int)size ? 0 : -1;
+}
+
+static int put(struct buf* b, const char* s, size_t n)
+{
+  if(b->len + n + 1 > b->cap){
+    size_t cap = b->cap ? b->cap * 2 : 4096;
+    char* p;
+    while(cap < b->len + n + 1)
+      cap *= 2;
+    if(!(p = (char*)realloc(b->p, cap)))
+      return -1;
+    b->p = p;
+    b->cap = cap;
+  }
+  memcpy(b->p + b->len, s, n);
+  b->len += n;
+  b->p[b->len] = '\0';
+  return 0;
+}
+
+// The GNU build-id note, read from the loaded image
+static void read_build_id(const struct dl_phdr_info* info, char* hex)
+{
+  int i;
+  strcpy(hex, "-");
+  for(i = 0; i < info->dlpi_phnum; i++){
+    const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+    const uint8_t* p = (const uint8_t*)(info->dlpi_addr + ph->p_vaddr);
+    const uint8_t* end = p + ph->p_memsz;
+    if(ph->p_type != PT_NOTE)
+      continue;
+    while(p + sizeof(ElfW(Nhdr)) <= end){
+      const ElfW(Nhdr)* nh = (const ElfW(Nhdr)*)p;
+      const uint8_t* name = p + sizeof(ElfW(Nhdr));
+      const uint8_t* desc = name + ((nh->n_namesz + 3) & ~3u);
+      if(desc + nh->n_descsz > end)
+        break;
+      if(nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 && !memcmp(name, "GNU", 4) &&
+         nh->n_descsz && nh->n_descsz <= BUILD_ID_MAX){
+        uint32_t j;
+        for(j = 0; j < nh->n_descsz; j++)
+          sprintf(hex + 2*j, "%02x", desc[j]);
+        return;
+      }
+      p = desc + ((nh->n_descsz + 3) & ~3u);
+    }
+  }
+}
+
+static int add_module(struct dl_phdr_info* info, size_t size, void* data)
+{
+  struct modules* mods = (struct modules*)data;
+  const char* path = info->dlpi_name;
+  struct module* m;
+  int i;
+  (void)size;
+
+  if(mods->n == MAX_MODULES || (path && !strncmp(path, "linux-vdso", 10)))
+    return 0;
+  m = &mods->m[mods->n];
+  m->start = ~0ull;
+  m->end = 0;
+  for(i = 0; i < info->dlpi_phnum; i++){
+    const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+    if(ph->p_type != PT_LOAD)
+      continue;
+    if(info->dlpi_addr + ph->p_vaddr < m->start)
+      m->start = info->dlpi_addr + ph->p_vaddr;
+    if(info->dlpi_addr + ph->p_vaddr + ph->p_memsz > m->end)
+      m->end = info->dlpi_addr + ph->p_vaddr + ph->p_memsz;
+  }
+  if(m->start >= m->end)
+    return 0;
+  m->bias = info->dlpi_addr;
+  // the daemon is another process, so the main program needs its real path
+  if(!path || !*path){
+    ssize_t n = readlink("/proc/self/exe", m->path, sizeof(m->path) - 1);
+    m->path[n > 0 ? n : 0] = '\0';
+  }else{
+    snprintf(m->path, sizeof(m->path), "%s", path);
+  }
+  read_build_id(info, m->build_id);
+  mods->n++;
+  return 0;
+}
+
+static int connect_daemon()
+{
+  const char* path = socket_path ? socket_path : getenv("SYMBOLIZER_SOCKET");
+  struct sockaddr_un sa;
+  struct timeval tv = { SYMBOLIZER_TIMEOUT_MS / 1000, (SYMBOLIZER_TIMEOUT_MS % 1000) * 1000 };
+  char def[sizeof(sa.sun_path)];
+  int fd;
+
+  if(!path){
+    if(symbolizer_default_socket(def, sizeof(def), 0))
+      return -1;
+    path = def;
+  }
+  if(strlen(path) >= sizeof(sa.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, path);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  if(connect(fd, (struct sockaddr*)&sa, sizeof(sa))){
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Sends the batch and reads until the empty line that ends the answer
+static int exchange(int fd, const struct buf* req, struct buf* resp)
+{
+  size_t off = 0;
+  char chunk[16384];
+  ssize_t n;
+
+  while(off < req->len){
+    if((n = send(fd, req->p + off, req->len - off, MSG_NOSIGNAL)) <= 0)
+      return -1;
+    off += n;
+  }
+  for(;;){
+    if(resp->len >= 2 && !memcmp(resp->p + resp->len - 2, "\n\n", 2))
+      return 0;
+    if((n = recv(fd, chunk, sizeof(chunk), 0)) <= 0 || put(resp, chunk, n))
+      return -1;
+  }
+}
+
+// Splits the answer into lines in place, and checks it has everything that was asked for
+static int count_frames(char* p, const char* end, int nsent, int* total)
+{
+  int i;
+  *total = 0;
+  for(i = 0; i < nsent; i++){
+    char* nl = (char*)memchr(p, '\n', end - p);
+    int k, n;
+    if(!nl)
+      return -1;
+    n = atoi(p);
+    if(n < 0 || n > 256)
+      return -1;
+    p = nl + 1;
+    for(k = 0; k < n; k++){
+      if(!(nl = (char*)memchr(p, '\n', end - p)))
+        return -1;
+      p = nl + 1;
+    }
+    *total += n;
+  }
+  return 0;
+}
+
+static char* field(char** p)
+{
+  char* s = *p;
+  char* e = s + strcspn(s, "\t\n");
+  if(*e)
+    *e++ = '\0';
+  *p = e;
+  return s;
+}
+
+struct symbolizer_stack* symbolizer_resolve(void* const* addrs, int n)
+{
+  struct module* table = (struct module*)malloc(MAX_MODULES * sizeof(struct module));
+  struct modules mods = { table, 0 };
+  struct symbolizer_stack* out = NULL;
+  struct symbolizer_frame* frames;
+  struct buf req = { NULL, 0, 0 }, resp = { NULL, 0, 0 };
+  int* which = (int*)malloc((n + 1) * sizeof(int));
+  int i, j, nsent = 0, total = 0, fd = -1;
+  char line[1024 + 256], *p;
+
+  if(!table || !which || n <= 0)
+    goto done;
+  dl_iterate_phdr(add_module, &mods);
+  for(i = 0; i < n; i++){
+    uint64_t a = (uint64_t)(uintptr_t)addrs[i];
+    which[i] = -1;
+    for(j = 0; j < mods.n && which[i] < 0; j++)
+      if(a >= table[j].start && a < table[j].end)
+        which[i] = j;
+    if(which[i] < 0)
+      continue;
+    snprintf(line, sizeof(line), "%s %llx %s\n", table[which[i]].build_id,
+             (unsigned long long)(a - table[which[i]].bias), table[which[i]].path);
+    if(put(&req, line, strlen(line)))
+      goto done;
+    nsent++;
+  }
+  // with no address in a module there is nothing to ask
+  if(nsent && (put(&req, "\n", 1) || (fd = connect_daemon()) < 0 || exchange(fd, &req, &resp) ||
+               count_frames(resp.p, resp.p + resp.len, nsent, &total)))
+    goto done;
+
+  // one block: the stacks, their frames, then the text the strings point into
+  if(!(out = (struct symbolizer_stack*)malloc(n * sizeof(struct symbolizer_stack) +
+                                              total * sizeof(struct symbolizer_frame) + resp.len + 1)))
+    goto done;
+  frames = (struct symbolizer_frame*)(out + n);
+  p = (char*)(frames + total);
+  if(resp.len)
+    memcpy(p, resp.p, resp.len + 1);
+  for(i = 0; i < n; i++){
+    out[i].n = 0;
+    out[i].frames = frames;
+    if(which[i] < 0)
+      continue;
+    out[i].n = atoi(field(&p));
+    for(j = 0; j < out[i].n; j++){
+      const char* fn = field(&p);
+      const char* file = field(&p);
+      frames[j].function = strcmp(fn, "??") ? fn : NULL;
+      frames[j].file = strcmp(file, "??") ? file : NULL;
+      frames[j].line = (unsigned int)atoi(field(&p));
+    }
+    frames += out[i].n;
+  }
+
+done:
+  if(fd >= 0)
+    close(fd);
+  free(req.p);
+  free(resp.p);
+  free(which);
+  free(table);
+  return out;
+}
@@ -0,0 +1,65 @@
+// Client for symbolizerd, the out-of-process symbolizer
+// Author: Paul Foster
+// Public domain
+//
+// Every process that symbolizes its own stacks parses the symbols and debug info of each module
+// again, which for a big binary takes longer than everything else in a crash report or profile.
+// symbolizerd (symbolizerd.c) keeps the parsed tables in memory, per build-id, for all processes on
+// the machine and answers batches of lookups over a Unix socket:
+//
+//   stack_dump_set_symbolizer(symbolizer_resolve);   //the assert handler asks the daemon first
+//
+// symbolizer_resolve() returns NULL if the daemon isn't running or doesn't answer within
+// SYMBOLIZER_TIMEOUT_MS, and the handlers then resolve in process as before. The socket is the
+// one given to symbolizer_set_socket(), else $SYMBOLIZER_SOCKET, else the default one below.
+//
+// The protocol is plain text, one request per line, and an empty line ends a batch:
+//   <build-id in hex, or -> <file address in hex> <path of the module>
+// For each request the daemon answers with the number of frames and then one line per frame,
+// innermost first, and an empty line after the batch:
+//   <n>
+//   <demangled function, or ??>\t<file, or ??>\t<line>
+// So it can be tried by hand with socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/symbolizerd.sock.
+//
+// linux, compile with: gcc -c symbolizer.c
+
+#ifndef P_SYMBOLIZER_H
+#define P_SYMBOLIZER_H
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYMBOLIZER_SOCKET_NAME    "symbolizerd.sock"
+#define SYMBOLIZER_TIMEOUT_MS     2000
+
+struct symbolizer_frame
+{
+  const char*  function;  //demangled, NULL if unknown
+  const char*  file;      //NULL if there is no line info
+  unsigned int line;
+};
+
+// The frames of one address: the inlined functions, then the function they were inlined into
+struct symbolizer_stack
+{
+  int                      n;       //0 if nothing is known about the address
+  struct symbolizer_frame* frames;
+};
+
+void symbolizer_set_socket(const char* path);
+
+// The default socket, SYMBOLIZER_SOCKET_NAME in $XDG_RUNTIME_DIR, or in /tmp/symbolizerd-<uid>
+// without one, which is made with mode 0700 if create is set. The directory must belong to this
+// user and be closed to everyone else, since whoever can put a socket there answers the lookups.
+// Returns 0, or -1 if there is no such directory or the path doesn't fit in size.
+int symbolizer_default_socket(char* path, size_t size, int create);
+
+// Looks up n addresses in this process (return addresses minus one, as for elfsym_resolve).
+// Returns n stacks in a single allocation, free() it. NULL if the daemon couldn't be asked.
+struct symbolizer_stack* symbolizer_resolve(void* const* addrs, int n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_SYMBOLIZER_H
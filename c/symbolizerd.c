@@ -0,0 +1,347 @@
+// Symbolizer daemon: keeps the symbol and line tables of every module it has been asked about
+// Author: Paul Foster
+// Public domain
+//
+//   symbolizerd [-s socket] [-m max_mb] [-d symbol_dir]...
+//
+// Listens on a Unix socket (default from symbolizer_default_socket()) for the batches that
+// symbolizer_resolve() sends, protocol in symbolizer.h. Modules are opened with elfsym and kept by
+// build-id, so the processes that share a binary share one copy of its tables, and a binary that
+// was rebuilt since gets a fresh entry. A module is found in the -d directories the way
+// crash_symbolize does it (.build-id/xx/rest.debug, .build-id/xx/rest, then the file name),
+// then at the path the client loaded it from, and only used if its build-id matches. A module
+// that isn't found is looked for again a minute later, so symbols copied into a -d directory
+// after the first miss are picked up without a restart. When the tables add up to more than
+// max_mb (default 1024) the least recently used modules are closed.
+// Each connection gets a thread, and lookups share one lock. It won't replace the socket of a
+// daemon that is still answering, only a stale one.
+//
+// linux, compile with: gcc -O2 -o symbolizerd symbolizerd.c symbolizer.c elfsym.c -lpthread -lstdc++
+// (libstdc++ only for __cxa_demangle)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+
+#include "symbolizer.h"
+#include "elfsym.h"
+
+#ifdef __cplusplus
+#include <cxxabi.h>
+using abi::__cxa_demangle;
+#else
+char* __cxa_demangle(const char* mangled, char* buf, size_t* len, int* status);
+#endif
+
+#define MAX_DIRS     16
+#define MAX_CACHED   4096   //entries, including the misses
+#define MAX_FRAMES   64
+#define BUILD_ID_MAX 64
+#define MISS_RETRY_S 60     //how long a module that wasn't found stays not found
+
+struct cached
+{
+  char*                 key;       //the build-id in hex, or the path for modules without one
+  char*                 path;      //what was opened
+  struct elfsym_module* module;    //NULL if no matching file was found
+  size_t                bytes;
+  uint64_t              last_used;
+  time_t                retry_at;  //when to look for a missing module again
+};
+
+static const char* dirs[MAX_DIRS];
+static int ndirs;
+static size_t max_bytes = (size_t)1024 << 20;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cached cache[MAX_CACHED];
+static int ncached;
+static size_t total_bytes;
+static uint64_t clock_tick;
+
+static void hex_of(const unsigned char* id, int n, char* hex)
+{
+  int i;
+  for(i = 0; i < n; i++)
+    sprintf(hex + 2*i, "%02x", id[i]);
+  hex[2*n] = '\0';
+}
+
+static struct elfsym_module* try_open(const char* path, const char* want)
+{
+  struct elfsym_module* m = elfsym_open(path);
+  unsigned char id[BUILD_ID_MAX];
+  char hex[2*BUILD_ID_MAX + 1];
+  if(!m || !strcmp(want, "-"))
+    return m;
+  hex_of(id, elfsym_build_id(m, id, sizeof(id)), hex);
+  if(!strcmp(hex, want))
+    return m;
+  elfsym_close(m);
+  return NULL;
+}
+
+static struct elfsym_module* find_file(const char* build_id, const char* path, char* found, size_t size)
+{
+  const char* base = strrchr(path, '/');
+  struct elfsym_module* m = NULL;
+  int d, f;
+
+  base = base ? base + 1 : path;
+  for(d = 0; d < ndirs && !m; d++){
+    const char* formats[] = { "%s/.build-id/%.2s/%s.debug", "%s/.build-id/%.2s/%s", "%s/%s%s", "%s/%s%s.debug" };
+    for(f = 0; f < 4 && !m; f++){
+      if(f < 2 && strlen(build_id) < 4)
+        continue;
+      if(f < 2)
+        snprintf(found, size, formats[f], dirs[d], build_id, build_id + 2);
+      else
+        snprintf(found, size, formats[f], dirs[d], base, "");
+      m = try_open(found, build_id);
+    }
+  }
+  if(!m && (m = try_open(path, build_id)))
+    snprintf(found, size, "%s", path);
+  return m;
+}
+
+static void evict(struct cached* c)
+{
+  if(c->module)
+    fprintf(stderr, "symbolizerd: closing %s (%zu KB)\n", c->path, c->bytes >> 10);
+  elfsym_close(c->module);
+  total_bytes -= c->bytes;
+  free(c->key);
+  free(c->path);
+  *c = cache[--ncached];
+}
+
+// Closes the least recently used modules until the tables fit, keeping at least the last one used.
+// Under cache_lock.
+static void trim()
+{
+  while(ncached > 1 && (total_bytes > max_bytes || ncached == MAX_CACHED)){
+    struct cached* lru = &cache[0];
+    int i;
+    for(i = 1; i < ncached; i++)
+      if(cache[i].last_used < lru->last_used)
+        lru = &cache[i];
+    evict(lru);
+  }
+}
+
+static time_t now_s()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+// The entry for a module, opened on first use. Under cache_lock.
+static struct cached* lookup_module(const char* build_id, const char* path)
+{
+  const char* key = strcmp(build_id, "-") ? build_id : path;
+  char found[4096];
+  struct cached* c;
+  int i;
+
+  for(i = 0; i < ncached; i++){
+    if(!strcmp(cache[i].key, key)){
+      cache[i].last_used = ++clock_tick;
+      if(cache[i].module || now_s() < cache[i].retry_at)
+        return &cache[i];
+      break;  //a miss that is due for another look
+    }
+  }
+  if(i < ncached){
+    c = &cache[i];
+    free(c->path);
+  }
+  else{
+    if(ncached == MAX_CACHED)
+      trim();
+    c = &cache[ncached++];
+    c->key = strdup(key);
+    c->last_used = ++clock_tick;
+  }
+  c->module = find_file(build_id, path, found, sizeof(found));
+  c->path = strdup(c->module ? found : path);
+  c->bytes = 0;
+  c->retry_at = now_s() + MISS_RETRY_S;
+  if(c->module)
+    fprintf(stderr, "symbolizerd: opened %s for %s\n", found, key);
+  else
+    fprintf(stderr, "symbolizerd: no file with build-id %s found for %s\n", build_id, path);
+  return c;
+}
+
+// Tabs and newlines would break the protocol
+static void put_field(FILE* out, const char* s)
+{
+  for(; *s; s++)
+    fputc(*s == '\t' || *s == '\n' ? ' ' : *s, out);
+}
+
+// The answer is put together under the lock and only written after, since a slow client can take
+// up to the send timeout
+static void answer(FILE* client, char* line)
+{
+  struct elfsym_frame frames[MAX_FRAMES];
+  char* save = NULL;
+  char* build_id = strtok_r(line, " ", &save);
+  char* offset = strtok_r(NULL, " ", &save);
+  char* path = strtok_r(NULL, "\n", &save);
+  struct cached* c;
+  char* text = NULL;
+  size_t len = 0;
+  FILE* out;
+  int n = 0, i;
+
+  if(!build_id || !offset || !path || !(out = open_memstream(&text, &len))){
+    fprintf(client, "0\n");
+    return;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  c = lookup_module(build_id, path);
+  if(c->module){
+    size_t bytes;
+    n = elfsym_lookup(c->module, strtoull(offset, NULL, 16), frames, MAX_FRAMES);
+    // the first lookup parses the debug info
+    bytes = elfsym_memory(c->module);
+    total_bytes += bytes - c->bytes;
+    c->bytes = bytes;
+  }
+  fprintf(out, "%d\n", n);
+  for(i = 0; i < n; i++){
+    int status = -1;
+    char* demangled = frames[i].function ? __cxa_demangle(frames[i].function, NULL, NULL, &status) : NULL;
+    put_field(out, status == 0 ? demangled : frames[i].function ? frames[i].function : "??");
+    fputc('\t', out);
+    put_field(out, frames[i].file ? frames[i].file : "??");
+    fprintf(out, "\t%u\n", frames[i].line);
+    free(demangled);
+  }
+  pthread_mutex_unlock(&cache_lock);
+  fclose(out);
+  fwrite(text, 1, len, client);
+  free(text);
+}
+
+static void* serve(void* arg)
+{
+  int fd = (int)(intptr_t)arg;
+  FILE* in = fdopen(fd, "r");
+  FILE* out = fdopen(dup(fd), "w");
+  char* line = NULL;
+  size_t cap = 0;
+
+  while(in && out && getline(&line, &cap, in) > 0){
+    if(line[0] == '\n'){
+      // end of the batch, the modules it needed stay open until here
+      pthread_mutex_lock(&cache_lock);
+      trim();
+      pthread_mutex_unlock(&cache_lock);
+      fputc('\n', out);
+      if(fflush(out))
+        break;
+      continue;
+    }
+    answer(out, line);
+  }
+  free(line);
+  if(in)
+    fclose(in);
+  if(out)
+    fclose(out);
+  return NULL;
+}
+
+int main(int argc, char** argv)
+{
+  const char* path = getenv("SYMBOLIZER_SOCKET");
+  struct sockaddr_un sa;
+  struct stat st;
+  char def[sizeof(sa.sun_path)];
+  int i, fd;
+
+  for(i = 1; i < argc; i++){
+    if(!strcmp(argv[i], "-s") && i + 1 < argc)
+      path = argv[++i];
+    else if(!strcmp(argv[i], "-m") && i + 1 < argc)
+      max_bytes = (size_t)atol(argv[++i]) << 20;
+    else if(!strcmp(argv[i], "-d") && i + 1 < argc && ndirs < MAX_DIRS)
+      dirs[ndirs++] = argv[++i];
+    else{
+      fprintf(stderr, "usage: %s [-s socket] [-m max_mb] [-d symbol_dir]...\n", argv[0]);
+      return 2;
+    }
+  }
+  if(!path){
+    if(symbolizer_default_socket(def, sizeof(def), 1)){
+      fprintf(stderr, "symbolizerd: no private directory for the socket, $XDG_RUNTIME_DIR or /tmp/symbolizerd-%u"
+              " must be a directory of this user's with mode 0700, or give one with -s\n", (unsigned)getuid());
+      return 1;
+    }
+    path = def;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(sa.sun_path)){
+    fprintf(stderr, "socket path too long: %s\n", path);
+    return 1;
+  }
+  strcpy(sa.sun_path, path);
+  if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0){
+    perror("socket");
+    return 1;
+  }
+  // a socket nobody answers on is left from a daemon that died, anything else is kept
+  if(!lstat(path, &st)){
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0), alive = 1;
+    if(probe >= 0){
+      alive = !connect(probe, (struct sockaddr*)&sa, sizeof(sa));
+      close(probe);
+    }
+    if(S_ISSOCK(st.st_mode) && !alive){
+      unlink(path);
+    }else{
+      fprintf(stderr, "symbolizerd: %s is %s\n", path, S_ISSOCK(st.st_mode) ? "taken by a running daemon" : "not a socket");
+      return 1;
+    }
+  }
+  if(bind(fd, (struct sockaddr*)&sa, sizeof(sa)) || listen(fd, 64)){
+    perror(path);
+    return 1;
+  }
+  fprintf(stderr, "symbolizerd: listening on %s, up to %zu MB of tables\n", path, max_bytes >> 20);
+
+  for(;;){
+    pthread_t thread;
+    // a client that stops reading mustn't hold the lock for long
+    struct timeval tv = { 2, 0 };
+    int client = accept(fd, NULL, NULL);
+    if(client < 0)
+      continue;
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if(pthread_create(&thread, NULL, serve, (void*)(intptr_t)client))
+      close(client);
+    else
+      pthread_detach(thread);
+  }
+  return 0;
+}
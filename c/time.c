@@ -1,26 +1,375 @@
-/* 
+/*
 author: jbenet, Paul Foster <anuranbaka>
 made by jdenet, modified by Paul Foster to have nanotime function
 Appears public domain
 
-os x/modern linux, compile with: gcc -o testo test.c 
-old linux, compile with: gcc -o testo test.c -lrt
+os x/modern linux, compile with: gcc -o testo test.c -lpthread
+old linux, compile with: gcc -o testo test.c -lrt -lpthread
 */
 
 #include <time.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "time.h"
 
 #ifdef __MACH__
 #include <mach/clock.h>
 #include <mach/mach.h>
 #endif
 
-uint64_t nanotime(){
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define NANOTIME_HAVE_TSC
+#endif
+
+// nanotime() state. The conversion is ns = base_ns + ((tsc - base_tsc) * mult) >> NANOTIME_SHIFT.
+// The parameters are published under a seqlock so the drift correction never blocks readers.
+#define NANOTIME_SHIFT 32
+#define NANOTIME_CALIBRATE_NS  10000000ull  // how long the startup calibration spins
+#define NANOTIME_RECAL_NS    1000000000ull  // how often the drift correction runs
+
+enum { NT_UNINIT = 0, NT_TSC, NT_CLOCK };
+
+static int nt_mode = NT_UNINIT;
+static int nt_rdtscp = 0;
+static pthread_once_t nt_once = PTHREAD_ONCE_INIT;
+
+static struct {
+  uint32_t seq;
+  uint64_t base_tsc;
+  uint64_t base_ns;
+  uint64_t mult;
+  uint64_t recal_ticks;
+  int64_t  wall_offset;   // CLOCK_REALTIME - CLOCK_MONOTONIC
+} nt;
+
+// long term anchor for estimating the frequency, and the lock for whoever is recalibrating
+static uint64_t nt_anchor_tsc, nt_anchor_ns;
+static int nt_recal_lock = 0;
+static uint64_t nt_wall_refreshed = 0;   // monotonic_ns() of the last wall_offset update without the TSC
+
+static uint64_t monotonic_ns(){
+  struct timespec ts;
+#ifdef __MACH__
+  clock_serv_t cclock;
+  mach_timespec_t mts;
+  host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+  clock_get_time(cclock, &mts);
+  mach_port_deallocate(mach_task_self(), cclock);
+  ts.tv_sec = mts.tv_sec;
+  ts.tv_nsec = mts.tv_nsec;
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t realtime_ns(){
   struct timespec ts;
   current_utc_time(&ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+#ifdef NANOTIME_HAVE_TSC
+static inline uint64_t read_tsc(){
+  unsigned int aux;
+  // rdtscp keeps earlier instructions from drifting past the stamp
+  if(nt_rdtscp)
+    return __rdtscp(&aux);
+  return __rdtsc();
+}
 
-  return (((uint64_t)ts.tv_sec)<<32)+ ts.tv_nsec);
+static int tsc_is_invariant(){
+  unsigned int a, b, c, d;
+  if(!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+    return 0;
+  __get_cpuid(0x80000001, &a, &b, &c, &d);
+  nt_rdtscp = (d >> 27) & 1;
+  __get_cpuid(0x80000007, &a, &b, &c, &d);
+  return (d >> 8) & 1;
+}
+
+// Takes a (tsc, monotonic ns) pair, keeping the tightest bracket of a few tries
+static void sample_pair(uint64_t *tsc, uint64_t *ns){
+  uint64_t best = UINT64_MAX;
+  int i;
+  for(i = 0; i < 5; i++){
+    uint64_t t0 = read_tsc();
+    uint64_t n = monotonic_ns();
+    uint64_t t1 = read_tsc();
+    if(t1 - t0 < best){
+      best = t1 - t0;
+      *tsc = t0 + (t1 - t0)/2;
+      *ns = n;
+    }
+  }
+}
+
+static void publish(uint64_t base_tsc, uint64_t base_ns, uint64_t mult, int64_t wall_offset){
+  uint32_t seq = __atomic_load_n(&nt.seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&nt.seq, seq+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&nt.base_tsc, base_tsc, __ATOMIC_RELAXED);
+  __atomic_store_n(&nt.base_ns, base_ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&nt.mult, mult, __ATOMIC_RELAXED);
+  __atomic_store_n(&nt.wall_offset, wall_offset, __ATOMIC_RELAXED);
+  __atomic_store_n(&nt.seq, seq+2, __ATOMIC_RELEASE);
+}
+
+static inline void read_params(uint64_t *base_tsc, uint64_t *base_ns, uint64_t *mult){
+  uint32_t seq;
+  do{
+    seq = __atomic_load_n(&nt.seq, __ATOMIC_ACQUIRE);
+    *base_tsc = __atomic_load_n(&nt.base_tsc, __ATOMIC_RELAXED);
+    *base_ns  = __atomic_load_n(&nt.base_ns, __ATOMIC_RELAXED);
+    *mult     = __atomic_load_n(&nt.mult, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }while((seq & 1) || seq != __atomic_load_n(&nt.seq, __ATOMIC_RELAXED));
+}
+
+static inline uint64_t ticks_to_ns(uint64_t tsc, uint64_t base_tsc, uint64_t base_ns, uint64_t mult){
+  // signed, since another thread may have rebased just after we read the counter
+  int64_t dt = (int64_t)(tsc - base_tsc);
+  return base_ns + (int64_t)(((__int128)dt * (__int128)mult) >> NANOTIME_SHIFT);
+}
+
+// Re-anchors to CLOCK_MONOTONIC. The new rate is the long term average frequency,
+// nudged so that any accumulated error is slewed out over the next interval instead
+// of stepping the clock, which keeps nanotime() monotonic.
+static void drift_correct(){
+  if(__atomic_exchange_n(&nt_recal_lock, 1, __ATOMIC_ACQUIRE))
+    return; // someone else is already on it
+
+  uint64_t base_tsc, base_ns, mult, tsc, ns;
+  read_params(&base_tsc, &base_ns, &mult);
+  sample_pair(&tsc, &ns);
+  int64_t wall_offset = (int64_t)(realtime_ns() - monotonic_ns());
+
+  uint64_t now = ticks_to_ns(tsc, base_tsc, base_ns, mult);
+  int64_t err = (int64_t)(ns - now);
+  int64_t interval = NANOTIME_RECAL_NS;
+  if(err >  interval/2) err =  interval/2;
+  if(err < -interval/2) err = -interval/2;
+
+  uint64_t freq_mult = (uint64_t)(((unsigned __int128)(ns - nt_anchor_ns) << NANOTIME_SHIFT) / (tsc - nt_anchor_tsc));
+  uint64_t new_mult = (uint64_t)(((__int128)freq_mult * (interval + err)) / interval);
+
+  publish(tsc, now, new_mult, wall_offset);
+  __atomic_store_n(&nt_recal_lock, 0, __ATOMIC_RELEASE);
+}
+#endif //NANOTIME_HAVE_TSC
+
+static void calibrate_once(){
+  int mode = NT_CLOCK;
+#ifdef NANOTIME_HAVE_TSC
+  if(!getenv("NANOTIME_NO_TSC") && tsc_is_invariant()){
+    uint64_t tsc0, ns0, tsc1, ns1;
+    sample_pair(&tsc0, &ns0);
+    while(monotonic_ns() - ns0 < NANOTIME_CALIBRATE_NS)
+      ;
+    sample_pair(&tsc1, &ns1);
+
+    double hz = (double)(tsc1 - tsc0) * 1e9 / (double)(ns1 - ns0);
+    if(hz > 1e8){ // a frequency that low means something is off (VM, broken counter), so don't trust it
+      nt_anchor_tsc = tsc0;
+      nt_anchor_ns = ns0;
+      nt.recal_ticks = (uint64_t)(hz * (NANOTIME_RECAL_NS / 1e9));
+      uint64_t mult = (uint64_t)(((unsigned __int128)(ns1 - ns0) << NANOTIME_SHIFT) / (tsc1 - tsc0));
+      publish(tsc1, ns1, mult, (int64_t)(realtime_ns() - monotonic_ns()));
+      mode = NT_TSC;
+    }
+  }
+#endif
+  if(mode == NT_CLOCK){
+    nt.wall_offset = (int64_t)(realtime_ns() - monotonic_ns());
+    nt_wall_refreshed = monotonic_ns();
+  }
+  __atomic_store_n(&nt_mode, mode, __ATOMIC_RELEASE);
+}
+
+void nanotime_calibrate(){
+  pthread_once(&nt_once, calibrate_once);
+}
+
+uint64_t nanotime(){
+  int mode = __atomic_load_n(&nt_mode, __ATOMIC_ACQUIRE);
+#ifdef NANOTIME_HAVE_TSC
+  if(__builtin_expect(mode == NT_TSC, 1)){
+    uint64_t base_tsc, base_ns, mult;
+    uint64_t tsc = read_tsc();
+    read_params(&base_tsc, &base_ns, &mult);
+    if(__builtin_expect((int64_t)(tsc - base_tsc) > (int64_t)nt.recal_ticks, 0)){
+      drift_correct();
+      read_params(&base_tsc, &base_ns, &mult);
+    }
+    return ticks_to_ns(tsc, base_tsc, base_ns, mult);
+  }
+#endif
+  if(mode == NT_UNINIT){
+    nanotime_calibrate();
+    return nanotime();
+  }
+  return monotonic_ns();
+}
+
+int nanotime_uses_tsc(){
+  nanotime_calibrate();
+  return nt_mode == NT_TSC;
+}
+
+uint64_t nanotime_to_walltime(uint64_t t){
+  nanotime_calibrate();
+  // without the TSC there's no drift correction to refresh the offset, so it's done here on the
+  // same cadence, or an NTP step would never show up
+  if(nt_mode == NT_CLOCK){
+    uint64_t now = monotonic_ns();
+    if(now - __atomic_load_n(&nt_wall_refreshed, __ATOMIC_RELAXED) > NANOTIME_RECAL_NS){
+      __atomic_store_n(&nt.wall_offset, (int64_t)(realtime_ns() - monotonic_ns()), __ATOMIC_RELAXED);
+      __atomic_store_n(&nt_wall_refreshed, now, __ATOMIC_RELAXED);
+    }
+  }
+  return t + __atomic_load_n(&nt.wall_offset, __ATOMIC_RELAXED);
+}
+
+uint64_t nanotime_ticks(){
+#ifdef NANOTIME_HAVE_TSC
+  if(nanotime_uses_tsc())
+    return read_tsc();
+#endif
+  return 0;
+}
+
+double nanotime_tsc_hz(){
+#ifdef NANOTIME_HAVE_TSC
+  if(nanotime_uses_tsc()){
+    uint64_t base_tsc, base_ns, mult;
+    read_params(&base_tsc, &base_ns, &mult);
+    return 1e9 * (double)(1ull << NANOTIME_SHIFT) / (double)mult;
+  }
+#endif
+  return 0;
+}
+
+// Cached clock. The ticker publishes {nanotime, wall time} into one cache line under a seqlock.
+// mono doubles as the "ticker is running" flag, so cached_nanotime() is a single load.
+static struct {
+  uint32_t seq;
+  uint64_t mono;
+  uint64_t wall;
+} nt_cache __attribute__((aligned(64)));
+
+static struct {
+  pthread_t thread;
+  int running;
+  unsigned int tick_us;
+} nt_ticker;
+
+static void cache_publish(uint64_t mono, uint64_t wall){
+  uint32_t seq = __atomic_load_n(&nt_cache.seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&nt_cache.seq, seq+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&nt_cache.mono, mono, __ATOMIC_RELAXED);
+  __atomic_store_n(&nt_cache.wall, wall, __ATOMIC_RELAXED);
+  __atomic_store_n(&nt_cache.seq, seq+2, __ATOMIC_RELEASE);
+}
+
+static void* ticker_main(void* arg){
+  struct timespec ts;
+  (void)arg;
+  ts.tv_sec = nt_ticker.tick_us / 1000000;
+  ts.tv_nsec = (nt_ticker.tick_us % 1000000) * 1000l;
+  while(__atomic_load_n(&nt_ticker.running, __ATOMIC_ACQUIRE)){
+    uint64_t t = nanotime();
+    cache_publish(t, nanotime_to_walltime(t));
+    nanosleep(&ts, NULL);
+  }
+  return NULL;
+}
+
+int nanotime_cache_start(unsigned int tick_us){
+  if(nt_ticker.running)
+    return -1;
+  nanotime_calibrate();
+  uint64_t t = nanotime();
+  cache_publish(t, nanotime_to_walltime(t));
+  nt_ticker.tick_us = tick_us ? tick_us : 1000;
+  nt_ticker.running = 1;
+  if(pthread_create(&nt_ticker.thread, NULL, ticker_main, NULL)){
+    nt_ticker.running = 0;
+    cache_publish(0, 0);
+    return -1;
+  }
+  return 0;
+}
+
+void nanotime_cache_stop(){
+  if(!nt_ticker.running)
+    return;
+  __atomic_store_n(&nt_ticker.running, 0, __ATOMIC_RELEASE);
+  pthread_join(nt_ticker.thread, NULL);
+  cache_publish(0, 0);
+}
+
+static uint64_t coarse_ns(clockid_t id){
+#if defined(CLOCK_MONOTONIC_COARSE) && !defined(__MACH__)
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+#else
+  return id == CLOCK_REALTIME ? realtime_ns() : monotonic_ns();
+#endif
+}
+
+uint64_t cached_nanotime(){
+  uint64_t t = __atomic_load_n(&nt_cache.mono, __ATOMIC_RELAXED);
+  if(__builtin_expect(t != 0, 1))
+    return t;
+#ifdef CLOCK_MONOTONIC_COARSE
+  return coarse_ns(CLOCK_MONOTONIC_COARSE);
+#else
+  return coarse_ns(CLOCK_MONOTONIC);
+#endif
+}
+
+uint64_t cached_walltime(){
+  uint64_t mono, wall;
+  cached_time(&mono, &wall);
+  return wall;
+}
+
+void cached_time(uint64_t *mono, uint64_t *wall){
+  uint32_t seq;
+  do{
+    seq = __atomic_load_n(&nt_cache.seq, __ATOMIC_ACQUIRE);
+    *mono = __atomic_load_n(&nt_cache.mono, __ATOMIC_RELAXED);
+    *wall = __atomic_load_n(&nt_cache.wall, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }while((seq & 1) || seq != __atomic_load_n(&nt_cache.seq, __ATOMIC_RELAXED));
+
+  if(*mono == 0){
+#ifdef CLOCK_REALTIME_COARSE
+    *mono = coarse_ns(CLOCK_MONOTONIC_COARSE);
+    *wall = coarse_ns(CLOCK_REALTIME_COARSE);
+#else
+    *mono = monotonic_ns();
+    *wall = realtime_ns();
+#endif
+  }
+}
+
+uint64_t nanotime_at(enum nanotime_precision p){
+  switch(p){
+  case NANOTIME_CACHED: return cached_nanotime();
+#ifdef CLOCK_MONOTONIC_COARSE
+  case NANOTIME_COARSE: return coarse_ns(CLOCK_MONOTONIC_COARSE);
+#endif
+  default:              return nanotime();
+  }
 }
 
 void current_utc_time(struct timespec *ts) {
@@ -47,8 +396,11 @@ static void demo(int argc, char **argv) {
 
   printf("s:  %lu\n", ts.tv_sec);
   printf("ns: %lu\n", ts.tv_nsec);
-  
-  printf("nanotime:%ll",nanotime());
+
+  uint64_t t = nanotime();
+  printf("nanotime: %llu (%s, %.0f Hz)\n", (unsigned long long)t,
+         nanotime_uses_tsc() ? "tsc" : "clock_gettime", nanotime_tsc_hz());
+  printf("walltime: %llu\n", (unsigned long long)nanotime_to_walltime(t));
 
 
 }
@@ -1,4 +1,49 @@
 #ifndef UTIL_P_TIME
+#define UTIL_P_TIME
+#include <stdint.h>
+#include <time.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Monotonic, linear 64 bit nanosecond count. Two values can be subtracted directly.
+// Uses the invariant TSC when the cpu has one (calibrated against CLOCK_MONOTONIC on
+// first use and drift corrected about once a second), otherwise clock_gettime.
 uint64_t nanotime();
+
+// Wall clock time, same as before
 void current_utc_time(struct timespec *ts);
-#define UTIL_P_TIME
+
+// Calibrate now rather than on the first nanotime() call, which blocks for ~10ms.
+// Set NANOTIME_NO_TSC in the environment to force the clock_gettime fallback.
+void nanotime_calibrate();
+
+// Nonzero if nanotime() is running off the TSC
+int nanotime_uses_tsc();
+
+// Converts a nanotime() value into wall clock nanoseconds since the epoch
+uint64_t nanotime_to_walltime(uint64_t t);
+
+// Raw TSC ticks (0 if there is no usable TSC), and the calibrated frequency to go with them
+uint64_t nanotime_ticks();
+double nanotime_tsc_hz();
+
+// Cached clock, for call sites that only need about a millisecond of accuracy (log lines,
+// request stamps). nanotime_cache_start() runs a ticker thread that publishes nanotime() and
+// the wall time every tick_us (0 means 1000), then cached_nanotime() is a single load.
+// Without the ticker the cached readers fall back to CLOCK_*_COARSE, which is still a lot
+// cheaper than a full clock_gettime but is only as good as the kernel tick (1-4ms).
+int nanotime_cache_start(unsigned int tick_us);
+void nanotime_cache_stop();
+uint64_t cached_nanotime();
+uint64_t cached_walltime();
+void cached_time(uint64_t *mono, uint64_t *wall);  // consistent pair of the two above
+
+// Lets each call site pick how much precision it pays for
+enum nanotime_precision { NANOTIME_EXACT = 0, NANOTIME_COARSE, NANOTIME_CACHED };
+uint64_t nanotime_at(enum nanotime_precision p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //UTIL_P_TIME
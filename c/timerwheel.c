@@ -0,0 +1,239 @@
+// Hierarchical timing wheel, see timerwheel.h
+// Author: Paul Foster
+// Public domain
+//
+// compile with: gcc -c timerwheel.c
+//
+// Level L has 64 slots of 64^L ticks each. A timer goes in the lowest level whose span covers its
+// distance from now, and each time the level below wraps around, the next slot of the level above
+// is emptied and its timers re-filed lower down (the cascade). Each level keeps a bitmap of its
+// non-empty slots so advancing over idle stretches doesn't have to visit every tick.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "timerwheel.h"
+
+#define MASK (TIMERWHEEL_SLOTS - 1)
+#define BATCH_BUCKET (-1)
+
+enum { TIMER_IDLE = 0, TIMER_ARMED, TIMER_INBOX };
+
+static inline void list_init(struct timer_node* head)
+{
+  head->next = head->prev = head;
+}
+
+static inline void list_push(struct timer_node* head, struct timer_node* t)
+{
+  t->prev = head->prev;
+  t->next = head;
+  head->prev->next = t;
+  head->prev = t;
+}
+
+static inline void unlink_node(struct timerwheel* w, struct timer_node* t)
+{
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  if(t->bucket != BATCH_BUCKET){
+    int level = t->bucket / TIMERWHEEL_SLOTS, slot = t->bucket & MASK;
+    struct timer_node* head = &w->slots[level][slot];
+    if(head->next == head)
+      w->occupied[level] &= ~(1ull << slot);
+  }
+  t->next = t->prev = NULL;
+}
+
+static void place(struct timerwheel* w, struct timer_node* t)
+{
+  uint64_t e = t->expires < w->current ? w->current : t->expires;
+  uint64_t delta = e - w->current;
+  int level = 0;
+
+  while(level < TIMERWHEEL_LEVELS - 1 && delta >= (1ull << (TIMERWHEEL_BITS * (level + 1))))
+    level++;
+  if(level == TIMERWHEEL_LEVELS - 1 && delta >= (1ull << (TIMERWHEEL_BITS * TIMERWHEEL_LEVELS)))
+    e = w->current + (1ull << (TIMERWHEEL_BITS * TIMERWHEEL_LEVELS)) - 1;  //re-filed when it cascades
+
+  int slot = (int)((e >> (TIMERWHEEL_BITS * level)) & MASK);
+  t->bucket = level * TIMERWHEEL_SLOTS + slot;
+  list_push(&w->slots[level][slot], t);
+  w->occupied[level] |= 1ull << slot;
+}
+
+static uint64_t to_ticks(const struct timerwheel* w, uint64_t ns)
+{
+  if(ns <= w->origin_ns)
+    return 0;
+  return (ns - w->origin_ns + w->tick_ns - 1) / w->tick_ns;
+}
+
+void timer_init(struct timer_node* t, timer_fn fn)
+{
+  memset(t, 0, sizeof(*t));
+  t->fn = fn;
+}
+
+int timer_pending(const struct timer_node* t)
+{
+  return __atomic_load_n(&t->state, __ATOMIC_ACQUIRE) != TIMER_IDLE;
+}
+
+void timerwheel_init(struct timerwheel* w, uint64_t tick_ns, uint64_t now_ns)
+{
+  int l, s;
+  memset(w, 0, sizeof(*w));
+  w->tick_ns = tick_ns ? tick_ns : 1;
+  w->origin_ns = now_ns;
+  for(l = 0; l < TIMERWHEEL_LEVELS; l++)
+    for(s = 0; s < TIMERWHEEL_SLOTS; s++)
+      list_init(&w->slots[l][s]);
+}
+
+static void drain_inbox(struct timerwheel* w)
+{
+  struct timer_node* t;
+  if(!__atomic_load_n(&w->inbox, __ATOMIC_RELAXED))
+    return;
+
+  t = __atomic_exchange_n(&w->inbox, NULL, __ATOMIC_ACQUIRE);
+  while(t){
+    struct timer_node* next = t->inbox_next;
+    t->state = TIMER_ARMED;
+    place(w, t);
+    w->count++;
+    t = next;
+  }
+}
+
+void timerwheel_add(struct timerwheel* w, struct timer_node* t, uint64_t deadline_ns)
+{
+  if(t->state != TIMER_IDLE)
+    timerwheel_cancel(w, t);
+  t->expires = to_ticks(w, deadline_ns);
+  t->state = TIMER_ARMED;
+  place(w, t);
+  w->count++;
+}
+
+void timerwheel_add_concurrent(struct timerwheel* w, struct timer_node* t, uint64_t deadline_ns)
+{
+  t->expires = to_ticks(w, deadline_ns);
+  __atomic_store_n(&t->state, TIMER_INBOX, __ATOMIC_RELAXED);
+  t->inbox_next = __atomic_load_n(&w->inbox, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&w->inbox, &t->inbox_next, t, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+void timerwheel_cancel(struct timerwheel* w, struct timer_node* t)
+{
+  if(t->state == TIMER_INBOX)
+    drain_inbox(w);
+  if(t->state != TIMER_ARMED)
+    return;
+  unlink_node(w, t);
+  t->state = TIMER_IDLE;
+  w->count--;
+}
+
+void timerwheel_reschedule(struct timerwheel* w, struct timer_node* t, uint64_t deadline_ns)
+{
+  timerwheel_cancel(w, t);
+  timerwheel_add(w, t, deadline_ns);
+}
+
+// Re-files everything in one slot of a higher level, returns that slot's index
+static int cascade(struct timerwheel* w, int level)
+{
+  int slot = (int)((w->current >> (TIMERWHEEL_BITS * level)) & MASK);
+  struct timer_node* head = &w->slots[level][slot];
+  struct timer_node* t = head->next;
+
+  list_init(head);
+  w->occupied[level] &= ~(1ull << slot);
+  while(t != head){
+    struct timer_node* next = t->next;
+    place(w, t);
+    t = next;
+  }
+  return slot;
+}
+
+uint64_t timerwheel_advance(struct timerwheel* w, uint64_t now_ns)
+{
+  struct timer_node batch;
+  uint64_t fired = 0;
+  uint64_t target;
+
+  drain_inbox(w);
+  if(now_ns < w->origin_ns)
+    return 0;
+  target = (now_ns - w->origin_ns) / w->tick_ns;   //last tick that is due
+  list_init(&batch);
+
+  while(w->current <= target){
+    if(w->count == 0){
+      w->current = target + 1;
+      break;
+    }
+
+    int idx = (int)(w->current & MASK);
+    if(idx == 0){
+      int level;
+      for(level = 1; level < TIMERWHEEL_LEVELS && cascade(w, level) == 0; level++)
+        ;
+    }
+
+    // skip straight to the next occupied slot in this rotation, or the end of it
+    uint64_t m = w->occupied[0] >> idx;
+    if(!(m & 1)){
+      uint64_t step = m ? (uint64_t)__builtin_ctzll(m) : (uint64_t)(TIMERWHEEL_SLOTS - idx);
+      w->current = w->current + step > target + 1 ? target + 1 : w->current + step;
+      continue;
+    }
+
+    // move the whole slot onto the batch list
+    struct timer_node* head = &w->slots[0][idx];
+    struct timer_node* t;
+    for(t = head->next; t != head; t = t->next)
+      t->bucket = BATCH_BUCKET;
+    head->next->prev = batch.prev;
+    batch.prev->next = head->next;
+    head->prev->next = &batch;
+    batch.prev = head->prev;
+    list_init(head);
+    w->occupied[0] &= ~(1ull << idx);
+    w->current++;
+  }
+
+  // Callbacks run after the wheel has moved on, so anything they re-arm at or before now waits
+  // for the next advance instead of looping here. Cancelling a timer still in the batch is fine.
+  while(batch.next != &batch){
+    struct timer_node* t = batch.next;
+    unlink_node(w, t);
+    t->state = TIMER_IDLE;
+    w->count--;
+    fired++;
+    t->fn(t);
+  }
+  return fired;
+}
+
+uint64_t timerwheel_next_ns(struct timerwheel* w, uint64_t now_ns)
+{
+  drain_inbox(w);
+  if(w->count == 0)
+    return UINT64_MAX;
+
+  int idx = (int)(w->current & MASK);
+  uint64_t m = w->occupied[0] >> idx;
+  uint64_t tick;
+  if(m)
+    tick = w->current + __builtin_ctzll(m);
+  else
+    tick = (w->current | MASK) + 1;  //whatever is next lives higher up, wake for the cascade
+
+  uint64_t at = w->origin_ns + tick * w->tick_ns;
+  return at > now_ns ? at - now_ns : 0;
+}
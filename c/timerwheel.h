@@ -0,0 +1,86 @@
+// Hierarchical timing wheel for very large numbers of deadlines, driven by nanotime()
+// Author: Paul Foster
+// Public domain
+//
+// Usage:
+//   struct conn { int fd; struct timer_node timeout; };
+//   static void on_timeout(struct timer_node* t){
+//     struct conn* c = timer_entry(t, struct conn, timeout);
+//     ...
+//   }
+//   timerwheel_init(&w, 1000000, nanotime());              //1ms ticks
+//   timer_init(&c->timeout, on_timeout);
+//   timerwheel_add(&w, &c->timeout, nanotime() + 5000000000ull);
+//   ...
+//   timerwheel_advance(&w, nanotime());                    //in the event loop, runs expired callbacks
+//
+// Insert, cancel and reschedule are O(1) and the nodes live inside your own structs, so arming a
+// timer never allocates. The wheel belongs to one thread. Other threads can arm timers with
+// timerwheel_add_concurrent(), which pushes onto a lock-free inbox the owner drains on its next
+// call, but only the owner may cancel or reschedule.
+//
+// Deadlines are rounded up to the tick, and a timer fires at the first advance at or after it.
+
+#ifndef P_TIMERWHEEL_H
+#define P_TIMERWHEEL_H
+#include <stdint.h>
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMERWHEEL_BITS   6
+#define TIMERWHEEL_SLOTS  (1 << TIMERWHEEL_BITS)
+#define TIMERWHEEL_LEVELS 6     //64^6 ticks, about 2 years with 1ms ticks. Later deadlines get clamped and re-filed.
+
+struct timer_node;
+typedef void (*timer_fn)(struct timer_node* t);
+
+struct timer_node
+{
+  struct timer_node* next;
+  struct timer_node* prev;
+  struct timer_node* inbox_next;
+  uint64_t           expires;     //in ticks
+  timer_fn           fn;
+  int                state;
+  int                bucket;      //level*TIMERWHEEL_SLOTS + slot while armed
+};
+
+#define timer_entry(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+
+struct timerwheel
+{
+  uint64_t          tick_ns;
+  uint64_t          origin_ns;
+  uint64_t          current;      //next tick to process
+  uint64_t          count;        //armed timers
+  uint64_t          occupied[TIMERWHEEL_LEVELS];
+  struct timer_node slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];   //list sentinels
+  struct timer_node* inbox;
+};
+
+void timer_init(struct timer_node* t, timer_fn fn);
+int  timer_pending(const struct timer_node* t);
+
+void timerwheel_init(struct timerwheel* w, uint64_t tick_ns, uint64_t now_ns);
+
+// Owner thread only
+void timerwheel_add(struct timerwheel* w, struct timer_node* t, uint64_t deadline_ns);
+void timerwheel_cancel(struct timerwheel* w, struct timer_node* t);
+void timerwheel_reschedule(struct timerwheel* w, struct timer_node* t, uint64_t deadline_ns);
+
+// Any thread. The timer must not already be armed.
+void timerwheel_add_concurrent(struct timerwheel* w, struct timer_node* t, uint64_t deadline_ns);
+
+// Runs every timer due by now_ns and returns how many fired. Callbacks may re-arm or cancel timers.
+uint64_t timerwheel_advance(struct timerwheel* w, uint64_t now_ns);
+
+// How long the owner can sleep before it needs to call timerwheel_advance() again.
+// Exact for deadlines within the next 64 ticks, a safe lower bound otherwise. UINT64_MAX if idle.
+uint64_t timerwheel_next_ns(struct timerwheel* w, uint64_t now_ns);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_TIMERWHEEL_H
@@ -0,0 +1,239 @@
+// Scoped trace zones with per thread lock-free ring buffers, written out as chrome trace-event JSON
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c trace.c time.c -lpthread
+//
+// Each thread owns one buffer and is the only writer of its head, the dump/flusher is the only
+// writer of the tail. Buffers are allocated once per thread and never freed, when a thread exits
+// its buffer is handed to the next new thread, so the flusher can always walk the list safely.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_MASK (TRACE_BUFFER_EVENTS-1)
+#if (TRACE_BUFFER_EVENTS & TRACE_MASK) != 0
+#error TRACE_BUFFER_EVENTS must be a power of two
+#endif
+
+struct trace_event
+{
+  const char* name;
+  uint64_t    begin;
+  uint64_t    end;
+  uint32_t    tid;
+};
+
+struct trace_buf
+{
+  struct trace_buf* next;
+  int               in_use;
+  uint32_t          tid;
+  uint64_t          head __attribute__((aligned(64)));  //only the owning thread writes this
+  uint64_t          tail __attribute__((aligned(64)));  //only the flusher writes this
+  struct trace_event ev[TRACE_BUFFER_EVENTS] __attribute__((aligned(64)));
+};
+
+static struct trace_buf* trace_bufs = NULL;
+static __thread struct trace_buf* tls_buf = NULL;
+static uint64_t trace_dropped_events = 0;
+static uint64_t trace_epoch;
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+// Serializes readers. Writers never touch it.
+static pthread_mutex_t trace_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+  pthread_t thread;
+  int       running;
+  FILE*     out;
+  int       first;
+  unsigned int interval_ms;
+} flusher;
+
+static void thread_exit(void* p)
+{
+  struct trace_buf* b = (struct trace_buf*)p;
+  __atomic_store_n(&b->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void trace_init()
+{
+  trace_epoch = nanotime();
+  pthread_key_create(&trace_key, thread_exit);
+}
+
+static struct trace_buf* thread_buf()
+{
+  pthread_once(&trace_once, trace_init);
+
+  // reuse the buffer of a thread that has gone away if we can
+  struct trace_buf* b;
+  for(b = __atomic_load_n(&trace_bufs, __ATOMIC_ACQUIRE); b; b = b->next){
+    int expected = 0;
+    if(__atomic_compare_exchange_n(&b->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      break;
+  }
+
+  if(!b){
+    if(posix_memalign((void**)&b, 64, sizeof(struct trace_buf)))
+      return NULL;
+    memset(b, 0, sizeof(struct trace_buf));
+    b->in_use = 1;
+    b->next = __atomic_load_n(&trace_bufs, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&trace_bufs, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+
+  b->tid = (uint32_t)syscall(SYS_gettid);
+  pthread_setspecific(trace_key, b);
+  tls_buf = b;
+  return b;
+}
+
+void trace_thread_init()
+{
+  if(!tls_buf)
+    thread_buf();
+}
+
+void trace_record(const char* name, uint64_t begin)
+{
+  uint64_t end = nanotime();
+  struct trace_buf* b = tls_buf;
+  if(__builtin_expect(!b, 0) && !(b = thread_buf()))
+    return;
+
+  uint64_t head = b->head;
+  if(head - __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE) >= TRACE_BUFFER_EVENTS){
+    __atomic_fetch_add(&trace_dropped_events, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  struct trace_event* e = &b->ev[head & TRACE_MASK];
+  e->name  = name;
+  e->begin = begin;
+  e->end   = end;
+  e->tid   = b->tid;
+  __atomic_store_n(&b->head, head+1, __ATOMIC_RELEASE);
+}
+
+uint64_t trace_dropped()
+{
+  return __atomic_load_n(&trace_dropped_events, __ATOMIC_RELAXED);
+}
+
+static void write_name(FILE* out, const char* name)
+{
+  for(; *name; name++){
+    if(*name == '"' || *name == '\\')
+      fputc('\\', out);
+    if((unsigned char)*name >= ' ')
+      fputc(*name, out);
+  }
+}
+
+// Writes out and releases every event recorded so far. Call with trace_flush_lock held.
+static void drain(FILE* out, int* first)
+{
+  struct trace_buf* b;
+  int pid = getpid();
+
+  for(b = __atomic_load_n(&trace_bufs, __ATOMIC_ACQUIRE); b; b = b->next){
+    uint64_t head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = b->tail;
+
+    for(; tail != head; tail++){
+      const struct trace_event* e = &b->ev[tail & TRACE_MASK];
+      fprintf(out, "%s{\"name\":\"", *first ? "" : ",\n");
+      write_name(out, e->name);
+      fprintf(out, "\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+              pid, e->tid, (int64_t)(e->begin - trace_epoch) / 1000.0, (e->end - e->begin) / 1000.0);
+      *first = 0;
+    }
+    __atomic_store_n(&b->tail, tail, __ATOMIC_RELEASE);
+  }
+}
+
+int trace_dump(const char* path)
+{
+  FILE* out = fopen(path, "w");
+  if(!out)
+    return -1;
+
+  pthread_once(&trace_once, trace_init);
+  pthread_mutex_lock(&trace_flush_lock);
+  int first = 1;
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  drain(out, &first);
+  fprintf(out, "\n]}\n");
+  pthread_mutex_unlock(&trace_flush_lock);
+
+  return fclose(out);
+}
+
+static void* flusher_main(void* arg)
+{
+  struct timespec ts;
+  (void)arg;
+  ts.tv_sec  = flusher.interval_ms / 1000;
+  ts.tv_nsec = (flusher.interval_ms % 1000) * 1000000l;
+
+  while(__atomic_load_n(&flusher.running, __ATOMIC_ACQUIRE)){
+    nanosleep(&ts, NULL);
+    pthread_mutex_lock(&trace_flush_lock);
+    drain(flusher.out, &flusher.first);
+    fflush(flusher.out);
+    pthread_mutex_unlock(&trace_flush_lock);
+  }
+  return NULL;
+}
+
+// Uses the JSON array form of the format, which the viewers accept even if the process dies
+// before the closing bracket is written
+int trace_start_flusher(const char* path, unsigned int interval_ms)
+{
+  if(flusher.running)
+    return -1;
+
+  pthread_once(&trace_once, trace_init);
+  flusher.out = fopen(path, "w");
+  if(!flusher.out)
+    return -1;
+  fprintf(flusher.out, "[\n");
+  flusher.first = 1;
+  flusher.interval_ms = interval_ms ? interval_ms : 1;
+  flusher.running = 1;
+
+  if(pthread_create(&flusher.thread, NULL, flusher_main, NULL)){
+    flusher.running = 0;
+    fclose(flusher.out);
+    return -1;
+  }
+  return 0;
+}
+
+void trace_stop_flusher()
+{
+  if(!flusher.running)
+    return;
+
+  __atomic_store_n(&flusher.running, 0, __ATOMIC_RELEASE);
+  pthread_join(flusher.thread, NULL);
+
+  pthread_mutex_lock(&trace_flush_lock);
+  drain(flusher.out, &flusher.first);
+  fprintf(flusher.out, "\n]\n");
+  fclose(flusher.out);
+  flusher.out = NULL;
+  pthread_mutex_unlock(&trace_flush_lock);
+}
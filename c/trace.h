@@ -0,0 +1,87 @@
+// Scoped trace zones that can be viewed on a timeline in chrome://tracing or ui.perfetto.dev
+// Each thread records into its own preallocated ring buffer, so recording a zone is two
+// nanotime() calls and a few stores: no locks, no allocation.
+//
+// Usage:
+//   void work(){
+//     TRACE_SCOPE("work");          // C (gcc/clang) or C++, ends when the scope does
+//     ...
+//     TRACE_BEGIN(decode);          // or mark a region by hand
+//     ...
+//     TRACE_END(decode, "decode");
+//   }
+//   trace_dump("trace.json");       // or trace_start_flusher("trace.json", 100) at startup
+//
+// Zone names must be string literals (or otherwise live forever), only the pointer is stored.
+// Define NO_TRACE to compile all of it out.
+// Link with time.c and -lpthread
+
+#ifndef P_TRACE_H
+#define P_TRACE_H
+#include <stdint.h>
+#include <stdio.h>
+#include "time.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Events each thread can hold before it has to be flushed. Must be a power of two.
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS (1<<16)
+#endif
+
+// Records a finished zone that started at begin (a nanotime() value)
+void trace_record(const char* name, uint64_t begin);
+
+// Allocates this thread's buffer now instead of on its first event
+void trace_thread_init();
+
+// Writes everything buffered so far as a complete trace file, and empties the buffers
+int trace_dump(const char* path);
+
+// Starts/stops a background thread that appends to path every interval_ms
+int trace_start_flusher(const char* path, unsigned int interval_ms);
+void trace_stop_flusher();
+
+// Number of events thrown away because a buffer was full
+uint64_t trace_dropped();
+
+struct trace_zone_ { uint64_t begin; const char* name; };
+static inline void trace_scope_end_(struct trace_zone_* z) { trace_record(z->name, z->begin); }
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef NO_TRACE
+#define TRACE_CONCAT_(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT_(a,b)
+#define TRACE_BEGIN(var) uint64_t TRACE_CONCAT(trace_begin_,var) = nanotime()
+#define TRACE_END(var, name) trace_record(name, TRACE_CONCAT(trace_begin_,var))
+
+#ifdef __cplusplus
+class TraceZone
+{
+public:
+   TraceZone( const char* name ) : mName( name ), mBegin( nanotime() ) {}
+   ~TraceZone() { trace_record( mName, mBegin ); }
+private:
+   TraceZone( const TraceZone& );
+   TraceZone& operator=( const TraceZone& );
+   const char* mName;
+   uint64_t    mBegin;
+};
+#define TRACE_SCOPE(name) TraceZone TRACE_CONCAT(trace_zone_,__LINE__)( name )
+#else
+#define TRACE_SCOPE(name) \
+   struct trace_zone_ TRACE_CONCAT(trace_zone_,__LINE__) __attribute__((cleanup(trace_scope_end_))) = \
+      { nanotime(), name }
+#endif
+
+#else //NO_TRACE
+#define TRACE_BEGIN(var)
+#define TRACE_END(var, name)
+#define TRACE_SCOPE(name)
+#endif
+
+#endif //P_TRACE_H
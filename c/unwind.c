@@ -0,0 +1,888 @@
+// Frame pointer and cached CFI unwinders, see unwind.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c unwind.c
+//
+// The CFI side keeps three things. The module list is an array of the executable segments with
+// their .eh_frame_hdr tables, replaced as a whole by unwind_refresh() and never freed, so a
+// signal handler can be walking the old one. The rules are a direct mapped cache from pc to how
+// to find the CFA, the return address and the saved rbp, each entry behind its own sequence
+// count. And the address of the signal trampoline, to step into the interrupted context.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <link.h>
+#include <ucontext.h>
+#include <fcntl.h>
+
+#include "unwind.h"
+
+#define PAGE_MASK_ (~(uintptr_t)4095)
+
+#ifndef SA_RESTORER
+#define SA_RESTORER 0x04000000  //the kernel's, glibc doesn't export it
+#endif
+
+// --- memory checks ---
+
+static __thread uintptr_t stack_lo __attribute__((tls_model("initial-exec")));
+static __thread uintptr_t stack_hi __attribute__((tls_model("initial-exec")));
+
+struct bounds
+{
+  uintptr_t lo, hi;
+  uintptr_t ok_page;  //last page found readable
+};
+
+static void init_bounds(struct bounds* b)
+{
+  b->lo = stack_lo;
+  b->hi = stack_hi;
+  b->ok_page = 0;
+}
+
+// write() copies from the address and fails with EFAULT instead of faulting if it can't be read.
+// msync() only says whether a page is mapped, and is happy with PROT_NONE guard pages.
+static int probe_pipe[2] = { -1, -1 };
+
+// Off the thread's stack: alternate signal stacks, and threads nobody called unwind_thread_init() on
+__attribute__((noinline)) static int mapped(struct bounds* b, uintptr_t addr)
+{
+  uintptr_t page = addr & PAGE_MASK_, word;
+  if(!addr)
+    return 0;
+  if(page == b->ok_page)
+    return 1;
+  if(write(probe_pipe[1], (const void*)addr, sizeof(word)) != sizeof(word))
+    return 0;
+  // every probe reads back as much as it wrote, so the pipe never fills and this never waits
+  if(read(probe_pipe[0], &word, sizeof(word)) < 0)
+    return 0;
+  b->ok_page = page;
+  return 1;
+}
+
+// Loads a word if it is on the thread's stack, or on some other mapped page
+static inline int load(struct bounds* b, uintptr_t addr, uintptr_t* out)
+{
+  if(addr & (sizeof(uintptr_t) - 1))
+    return 0;
+  if((addr < b->lo || addr >= b->hi) && !mapped(b, addr))
+    return 0;
+  *out = *(const uintptr_t*)addr;
+  return 1;
+}
+
+void unwind_thread_init()
+{
+  pthread_attr_t attr;
+  void* addr;
+  size_t size;
+  if(stack_hi || pthread_getattr_np(pthread_self(), &attr))
+    return;
+  if(!pthread_attr_getstack(&attr, &addr, &size)){
+    stack_lo = (uintptr_t)addr;
+    stack_hi = (uintptr_t)addr + size;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+// --- signal frames ---
+
+// Where a signal handler returns to. glibc hands the same __restore_rt to the kernel for every
+// handler and sigaction() reports it back, so setting any signal to what it already is shows it.
+static uintptr_t restorer;
+
+static void find_restorer()
+{
+#if defined(__x86_64__)
+  struct sigaction sa;
+  if(sigaction(SIGURG, NULL, &sa) || sigaction(SIGURG, &sa, NULL) || sigaction(SIGURG, NULL, &sa))
+    return;
+  if(sa.sa_flags & SA_RESTORER)
+    restorer = (uintptr_t)sa.sa_restorer;
+#endif
+}
+
+struct regs
+{
+  uintptr_t pc, sp, fp;
+};
+
+static void regs_from_context(const void* ucontext, struct regs* r)
+{
+  const ucontext_t* uc = (const ucontext_t*)ucontext;
+#if defined(__x86_64__)
+  r->pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+  r->sp = (uintptr_t)uc->uc_mcontext.gregs[REG_RSP];
+  r->fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+  r->pc = (uintptr_t)uc->uc_mcontext.pc;
+  r->sp = (uintptr_t)uc->uc_mcontext.sp;
+  r->fp = (uintptr_t)uc->uc_mcontext.regs[29];
+#else
+  (void)uc;
+  memset(r, 0, sizeof(*r));
+#endif
+}
+
+// The trampoline's stack pointer points at the ucontext the kernel pushed
+static int step_signal(struct bounds* b, uintptr_t uc, struct regs* r)
+{
+#if defined(__x86_64__)
+  uintptr_t base = uc + offsetof(ucontext_t, uc_mcontext.gregs);
+  return load(b, base + REG_RIP * sizeof(greg_t), &r->pc)
+    && load(b, base + REG_RSP * sizeof(greg_t), &r->sp)
+    && load(b, base + REG_RBP * sizeof(greg_t), &r->fp);
+#else
+  (void)b;
+  (void)uc;
+  (void)r;
+  return 0;
+#endif
+}
+
+// --- frame pointers ---
+
+// Frame records are { caller's fp, return address } on both x86_64 and aarch64
+static int walk_fp(struct regs* r, int first_done, void** addrs, int max_frames)
+{
+  struct bounds b;
+  uintptr_t fp = r->fp, next, ra;
+  int n = first_done;
+  init_bounds(&b);
+  while(n < max_frames){
+    if(!load(&b, fp, &next) || !load(&b, fp + sizeof(uintptr_t), &ra) || !ra)
+      break;
+    addrs[n++] = (void*)ra;
+    if(ra == restorer && restorer){
+      // the handler's frame record sits right below the ucontext
+      if(!step_signal(&b, fp + 2 * sizeof(uintptr_t), r) || n == max_frames)
+        break;
+      addrs[n++] = (void*)r->pc;
+      fp = r->fp;
+      continue;
+    }
+    if(next <= fp)
+      break;  //the stack grows down, anything else is the end or garbage
+    fp = next;
+  }
+  return n;
+}
+
+__attribute__((noinline)) int unwind_fp(void** addrs, int max_frames)
+{
+  struct regs r;
+  if(max_frames <= 0)
+    return 0;
+  unwind_thread_init();
+  r.fp = (uintptr_t)__builtin_frame_address(0);
+  return walk_fp(&r, 0, addrs, max_frames);
+}
+
+int unwind_fp_context(const void* ucontext, void** addrs, int max_frames)
+{
+  struct regs r;
+  if(max_frames <= 0)
+    return 0;
+  regs_from_context(ucontext, &r);
+  addrs[0] = (void*)r.pc;
+  return walk_fp(&r, 1, addrs, max_frames);
+}
+
+#if defined(__x86_64__)
+
+// --- modules ---
+
+struct cfi_module
+{
+  uintptr_t      start, end;  //an executable segment
+  const uint8_t* hdr;         //.eh_frame_hdr, which the table entries are relative to
+  const int32_t* table;       //pairs of initial location, FDE address, sorted
+  uint32_t       count;
+};
+
+struct module_list
+{
+  size_t            n;
+  struct cfi_module m[];
+};
+
+static struct module_list* modules;
+static pthread_mutex_t refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long loaded_adds = ~0ULL, loaded_subs = ~0ULL;
+
+static int read_counts(struct dl_phdr_info* info, size_t size, void* data)
+{
+  unsigned long long* counts = (unsigned long long*)data;
+  if(size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)){
+    counts[0] = info->dlpi_adds;
+    counts[1] = info->dlpi_subs;
+  }
+  return 1;
+}
+
+static int add_module(struct dl_phdr_info* info, size_t size, void* data)
+{
+  struct module_list** list = (struct module_list**)data;
+  const uint8_t* hdr = NULL;
+  int i;
+  (void)size;
+  for(i = 0; i < info->dlpi_phnum; i++)
+    if(info->dlpi_phdr[i].p_type == PT_GNU_EH_FRAME)
+      hdr = (const uint8_t*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+  // only the encoding every toolchain emits: udata4 count, table of datarel sdata4 pairs
+  if(!hdr || hdr[0] != 1 || hdr[2] != 0x03 || hdr[3] != 0x3b)
+    return 0;
+  for(i = 0; i < info->dlpi_phnum; i++){
+    const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+    struct cfi_module* m;
+    if(ph->p_type != PT_LOAD || !(ph->p_flags & PF_X))
+      continue;
+    *list = (struct module_list*)realloc(*list, sizeof(struct module_list) + ((*list)->n + 1) * sizeof(struct cfi_module));
+    m = &(*list)->m[(*list)->n++];
+    m->start = info->dlpi_addr + ph->p_vaddr;
+    m->end = m->start + ph->p_memsz;
+    m->hdr = hdr;
+    m->count = *(const uint32_t*)(hdr + 8);
+    m->table = (const int32_t*)(hdr + 12);
+  }
+  return 0;
+}
+
+static int compare_modules(const void* a, const void* b)
+{
+  uintptr_t x = ((const struct cfi_module*)a)->start, y = ((const struct cfi_module*)b)->start;
+  return x < y ? -1 : x > y;
+}
+
+// --- rule cache ---
+
+enum { RULE_NONE, RULE_CFA_SP, RULE_CFA_FP, RULE_END };
+
+#define RULE_CACHE_SIZE 4096
+#define FP_UNCHANGED 0
+#define FP_LOST (-2048)
+
+// A rule packs the CFA offset in the low 32 bits, then the return address and saved rbp
+// offsets from the CFA in words, 12 bits each, then the kind
+struct rule_entry
+{
+  uint32_t  seq;
+  uintptr_t pc;
+  uint64_t  rule;
+};
+
+static struct rule_entry rule_cache[RULE_CACHE_SIZE];
+
+static uint64_t pack_rule(int kind, int32_t cfa_off, int ra_words, int fp_words)
+{
+  return (uint32_t)cfa_off | (uint64_t)(ra_words & 0xfff) << 32 | (uint64_t)(fp_words & 0xfff) << 44 | (uint64_t)kind << 56;
+}
+
+static int rule_kind(uint64_t rule) { return (int)(rule >> 56); }
+static int32_t rule_cfa_off(uint64_t rule) { return (int32_t)(uint32_t)rule; }
+static int rule_ra_words(uint64_t rule) { return (int)((int64_t)(rule << 20) >> 52); }
+static int rule_fp_words(uint64_t rule) { return (int)((int64_t)(rule << 8) >> 52); }
+
+static size_t rule_slot(uintptr_t pc)
+{
+  return (size_t)((pc * 0x9e3779b97f4a7c15ull) >> 52);
+}
+
+static int cached_rule(uintptr_t pc, uint64_t* rule)
+{
+  struct rule_entry* e = &rule_cache[rule_slot(pc)];
+  uint32_t s = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+  uintptr_t key;
+  if(s & 1)
+    return 0;
+  key = __atomic_load_n(&e->pc, __ATOMIC_RELAXED);
+  *rule = __atomic_load_n(&e->rule, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return key == pc && __atomic_load_n(&e->seq, __ATOMIC_RELAXED) == s;
+}
+
+// Whoever gets the entry's sequence count to odd first writes it, anyone else just doesn't cache
+static void cache_rule(uintptr_t pc, uint64_t rule)
+{
+  struct rule_entry* e = &rule_cache[rule_slot(pc)];
+  uint32_t s = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+  if((s & 1) || !__atomic_compare_exchange_n(&e->seq, &s, s + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&e->pc, pc, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->rule, rule, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->seq, s + 2, __ATOMIC_RELEASE);
+}
+
+static void clear_rules()
+{
+  size_t i;
+  for(i = 0; i < RULE_CACHE_SIZE; i++){
+    struct rule_entry* e = &rule_cache[i];
+    uint32_t s = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    while((s & 1) || !__atomic_compare_exchange_n(&e->seq, &s, s + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      s = __atomic_load_n(&e->seq, __ATOMIC_RELAXED) & ~1u;
+    __atomic_store_n(&e->pc, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->seq, s + 2, __ATOMIC_RELEASE);
+  }
+}
+
+void unwind_refresh()
+{
+  unsigned long long counts[2] = { ~0ULL, ~0ULL };
+  struct module_list* list;
+
+  pthread_mutex_lock(&refresh_lock);
+  dl_iterate_phdr(read_counts, counts);
+  if(modules && counts[0] != ~0ULL && counts[0] == loaded_adds && counts[1] == loaded_subs){
+    pthread_mutex_unlock(&refresh_lock);
+    return;
+  }
+  list = (struct module_list*)calloc(1, sizeof(struct module_list));
+  dl_iterate_phdr(add_module, &list);
+  qsort(list->m, list->n, sizeof(struct cfi_module), compare_modules);
+  // the old list is leaked on purpose, a signal handler could be searching it right now
+  __atomic_store_n(&modules, list, __ATOMIC_RELEASE);
+  if(loaded_subs != ~0ULL && counts[1] != loaded_subs)
+    clear_rules();  //something was unloaded, and something else can be loaded at its addresses
+  loaded_adds = counts[0];
+  loaded_subs = counts[1];
+  pthread_mutex_unlock(&refresh_lock);
+}
+
+static const struct cfi_module* find_module(uintptr_t pc)
+{
+  const struct module_list* list = __atomic_load_n(&modules, __ATOMIC_ACQUIRE);
+  size_t lo = 0, hi;
+  if(!list)
+    return NULL;
+  hi = list->n;
+  while(lo < hi){
+    size_t mid = (lo + hi) / 2;
+    if(list->m[mid].start <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo && pc < list->m[lo-1].end ? &list->m[lo-1] : NULL;
+}
+
+// --- CFI ---
+
+static uint64_t read_uleb(const uint8_t** p, const uint8_t* end)
+{
+  uint64_t v = 0;
+  int shift = 0;
+  while(*p < end){
+    uint8_t c = *(*p)++;
+    if(shift < 64)
+      v |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+    if(!(c & 0x80))
+      break;
+  }
+  return v;
+}
+
+static int64_t read_sleb(const uint8_t** p, const uint8_t* end)
+{
+  int64_t v = 0;
+  int shift = 0;
+  uint8_t c = 0;
+  while(*p < end){
+    c = *(*p)++;
+    if(shift < 64)
+      v |= (int64_t)(c & 0x7f) << shift;
+    shift += 7;
+    if(!(c & 0x80))
+      break;
+  }
+  if(shift < 64 && (c & 0x40))
+    v |= -((int64_t)1 << shift);
+  return v;
+}
+
+// A DW_EH_PE encoded pointer. Only what .eh_frame uses: absolute or pc relative, no indirection.
+static int read_encoded(const uint8_t** p, const uint8_t* end, uint8_t enc, uintptr_t* out)
+{
+  const uint8_t* start = *p;
+  uintptr_t v;
+  if(enc == 0xff){
+    *out = 0;
+    return 1;
+  }
+  switch(enc & 0x0f){
+  case 0x00: if(end - *p < 8) return 0; v = *(const uint64_t*)*p; *p += 8; break;
+  case 0x01: v = (uintptr_t)read_uleb(p, end); break;
+  case 0x02: if(end - *p < 2) return 0; v = *(const uint16_t*)*p; *p += 2; break;
+  case 0x03: if(end - *p < 4) return 0; v = *(const uint32_t*)*p; *p += 4; break;
+  case 0x04: if(end - *p < 8) return 0; v = *(const uint64_t*)*p; *p += 8; break;
+  case 0x09: v = (uintptr_t)read_sleb(p, end); break;
+  case 0x0a: if(end - *p < 2) return 0; v = (uintptr_t)(intptr_t)*(const int16_t*)*p; *p += 2; break;
+  case 0x0b: if(end - *p < 4) return 0; v = (uintptr_t)(intptr_t)*(const int32_t*)*p; *p += 4; break;
+  case 0x0c: if(end - *p < 8) return 0; v = *(const uint64_t*)*p; *p += 8; break;
+  default: return 0;
+  }
+  switch(enc & 0x70){
+  case 0x00: break;
+  case 0x10: v += (uintptr_t)start; break;
+  default: return 0;
+  }
+  if(enc & 0x80)
+    return 0;
+  *out = v;
+  return 1;
+}
+
+// x86_64 DWARF register numbers
+#define DW_RBP 6
+#define DW_RSP 7
+#define DW_RA  16
+
+enum { REG_SAME, REG_UNDEF, REG_OFFSET, REG_OTHER };
+
+struct cfa_state
+{
+  int     cfa_reg;  //-1 for an expression
+  int64_t cfa_off;
+  int     fp_how, ra_how;
+  int64_t fp_off, ra_off;
+};
+
+struct cie_info
+{
+  uint64_t       code_align;
+  int64_t        data_align;
+  uint64_t       ra_reg;
+  uint8_t        fde_enc;
+  int            has_aug_data;
+  const uint8_t* insns;
+  const uint8_t* end;
+};
+
+static void set_reg(struct cfa_state* s, uint64_t reg, int how, int64_t off)
+{
+  if(reg == DW_RBP){
+    s->fp_how = how;
+    s->fp_off = off;
+  }
+  else if(reg == DW_RA){
+    s->ra_how = how;
+    s->ra_off = off;
+  }
+}
+
+// CFA expressions that come down to rsp plus something that depends only on the pc, which is what
+// the PLT has: rsp + 8, + 8 more past the push. Each stack value is a multiple of rsp plus a constant.
+static int eval_cfa_expression(const uint8_t* p, const uint8_t* end, uintptr_t pc, int64_t* off)
+{
+  int64_t k[8], c[8];  //value = k*rsp + c
+  int n = 0;
+  while(p < end){
+    uint8_t op = *p++;
+    if(n == 8)
+      return 0;
+    if(op >= 0x30 && op <= 0x4f){  //lit0-31
+      k[n] = 0;
+      c[n++] = op - 0x30;
+    }
+    else if(op == 0x77 || op == 0x80){  //breg7 (rsp), breg16 (rip)
+      k[n] = op == 0x77;
+      c[n++] = read_sleb(&p, end) + (op == 0x77 ? 0 : (int64_t)pc);
+    }
+    else if(op == 0x08){  //const1u
+      if(p >= end)
+        return 0;
+      k[n] = 0;
+      c[n++] = *p++;
+    }
+    else if(op == 0x23){  //plus_uconst
+      if(!n)
+        return 0;
+      c[n-1] += (int64_t)read_uleb(&p, end);
+    }
+    else{
+      if(n < 2)
+        return 0;
+      n--;
+      if(op == 0x22){  //plus
+        k[n-1] += k[n];
+        c[n-1] += c[n];
+        continue;
+      }
+      if(k[n] || k[n-1])
+        return 0;  //the rest only work on constants
+      switch(op){
+      case 0x1a: c[n-1] &= c[n]; break;
+      case 0x1c: c[n-1] -= c[n]; break;
+      case 0x1e: c[n-1] *= c[n]; break;
+      case 0x24: c[n-1] = (int64_t)((uint64_t)c[n-1] << c[n]); break;
+      case 0x2a: c[n-1] = c[n-1] >= c[n]; break;
+      default: return 0;
+      }
+    }
+  }
+  if(n != 1 || k[0] != 1)
+    return 0;
+  *off = c[0];
+  return 1;
+}
+
+// Runs instructions until the location passes pc. Returns 0 on anything it doesn't understand.
+static int run_cfa(const uint8_t* p, const uint8_t* end, const struct cie_info* cie, const struct cfa_state* initial,
+                   uintptr_t loc, uintptr_t pc, struct cfa_state* s)
+{
+  struct cfa_state stack[8];
+  int depth = 0;
+  while(p < end){
+    uint8_t op = *p++;
+    uint64_t reg, delta;
+    switch(op >> 6){
+    case 1:
+      delta = (op & 0x3f) * cie->code_align;
+      goto advance;
+    case 2:
+      set_reg(s, op & 0x3f, REG_OFFSET, (int64_t)read_uleb(&p, end) * cie->data_align);
+      continue;
+    case 3:
+      reg = op & 0x3f;
+      goto restore;
+    }
+    switch(op){
+    case 0x00: break;  //nop
+    case 0x01: if(!read_encoded(&p, end, cie->fde_enc, &loc)) return 0; if(loc > pc) return 1; break;
+    case 0x02: if(p + 1 > end) return 0; delta = *p * cie->code_align; p += 1; goto advance;
+    case 0x03: if(p + 2 > end) return 0; delta = *(const uint16_t*)p * cie->code_align; p += 2; goto advance;
+    case 0x04: if(p + 4 > end) return 0; delta = *(const uint32_t*)p * cie->code_align; p += 4; goto advance;
+    case 0x05:  //offset_extended
+      reg = read_uleb(&p, end);
+      set_reg(s, reg, REG_OFFSET, (int64_t)read_uleb(&p, end) * cie->data_align);
+      break;
+    case 0x06:  //restore_extended
+      reg = read_uleb(&p, end);
+      goto restore;
+    case 0x07: set_reg(s, read_uleb(&p, end), REG_UNDEF, 0); break;
+    case 0x08: set_reg(s, read_uleb(&p, end), REG_SAME, 0); break;
+    case 0x09:  //register
+      reg = read_uleb(&p, end);
+      read_uleb(&p, end);
+      set_reg(s, reg, REG_OTHER, 0);
+      break;
+    case 0x0a:
+      if(depth == 8)
+        return 0;
+      stack[depth++] = *s;
+      break;
+    case 0x0b:
+      if(!depth)
+        return 0;
+      *s = stack[--depth];  //the CFA too, epilogues in the middle of a function rely on it
+      break;
+    case 0x0c:
+      s->cfa_reg = (int)read_uleb(&p, end);
+      s->cfa_off = (int64_t)read_uleb(&p, end);
+      break;
+    case 0x0d: s->cfa_reg = (int)read_uleb(&p, end); break;
+    case 0x0e: s->cfa_off = (int64_t)read_uleb(&p, end); break;
+    case 0x0f:  //def_cfa_expression
+      delta = read_uleb(&p, end);
+      s->cfa_reg = eval_cfa_expression(p, p + delta, pc, &s->cfa_off) ? DW_RSP : -1;
+      p += delta;
+      break;
+    case 0x10:  //expression
+    case 0x16:  //val_expression
+      reg = read_uleb(&p, end);
+      delta = read_uleb(&p, end);
+      p += delta;
+      set_reg(s, reg, REG_OTHER, 0);
+      break;
+    case 0x11:  //offset_extended_sf
+      reg = read_uleb(&p, end);
+      set_reg(s, reg, REG_OFFSET, read_sleb(&p, end) * cie->data_align);
+      break;
+    case 0x12:  //def_cfa_sf
+      s->cfa_reg = (int)read_uleb(&p, end);
+      s->cfa_off = read_sleb(&p, end) * cie->data_align;
+      break;
+    case 0x13: s->cfa_off = read_sleb(&p, end) * cie->data_align; break;
+    case 0x14:  //val_offset
+      reg = read_uleb(&p, end);
+      read_uleb(&p, end);
+      set_reg(s, reg, REG_OTHER, 0);
+      break;
+    case 0x15:  //val_offset_sf
+      reg = read_uleb(&p, end);
+      read_sleb(&p, end);
+      set_reg(s, reg, REG_OTHER, 0);
+      break;
+    case 0x2e: read_uleb(&p, end); break;  //GNU_args_size
+    case 0x2f:  //GNU_negative_offset_extended
+      reg = read_uleb(&p, end);
+      set_reg(s, reg, REG_OFFSET, -(int64_t)read_uleb(&p, end) * cie->data_align);
+      break;
+    default:
+      return 0;
+    }
+    continue;
+
+  advance:
+    loc += delta;
+    if(loc > pc)
+      return 1;
+    continue;
+
+  restore:
+    if(!initial)
+      return 0;  //restore in a CIE makes no sense
+    if(reg == DW_RBP){
+      s->fp_how = initial->fp_how;
+      s->fp_off = initial->fp_off;
+    }
+    else if(reg == DW_RA){
+      s->ra_how = initial->ra_how;
+      s->ra_off = initial->ra_off;
+    }
+  }
+  return 1;
+}
+
+// Reads the CIE a FDE points to
+static int parse_cie(const uint8_t* p, struct cie_info* cie)
+{
+  uint64_t len = *(const uint32_t*)p;
+  const uint8_t* aug;
+  uint8_t version;
+  p += 4;
+  if(len == 0xffffffff){
+    len = *(const uint64_t*)p;
+    p += 8;
+  }
+  cie->end = p + len;
+  if(*(const uint32_t*)p != 0)
+    return 0;
+  p += 4;
+  version = *p++;
+  aug = p;
+  p += strlen((const char*)aug) + 1;
+  cie->code_align = read_uleb(&p, cie->end);
+  cie->data_align = read_sleb(&p, cie->end);
+  cie->ra_reg = version == 1 ? *p++ : read_uleb(&p, cie->end);
+  cie->fde_enc = 0;
+  cie->has_aug_data = aug[0] == 'z';
+  if(cie->has_aug_data){
+    uint64_t aug_len = read_uleb(&p, cie->end);
+    const uint8_t* q = p;
+    for(aug++; *aug; aug++){
+      uintptr_t ignored;
+      switch(*aug){
+      case 'R': cie->fde_enc = *q++; break;
+      case 'L': q++; break;
+      case 'P': { uint8_t enc = *q++; if(!read_encoded(&q, p + aug_len, enc & 0x7f, &ignored)) return 0; } break;
+      case 'S': case 'B': break;
+      default: return 0;
+      }
+    }
+    p += aug_len;
+  }
+  else if(aug[0])
+    return 0;
+  cie->insns = p;
+  return cie->ra_reg == DW_RA;
+}
+
+static uint64_t compute_rule(const struct cfi_module* m, uintptr_t pc)
+{
+  uint32_t lo = 0, hi = m->count;
+  uintptr_t rel = pc - (uintptr_t)m->hdr, pc_begin, pc_range;
+  const uint8_t *fde, *p, *end;
+  struct cie_info cie;
+  struct cfa_state s, initial;
+  uint64_t len;
+  int64_t ra_words, fp_words;
+
+  // the last entry at or below pc
+  while(lo < hi){
+    uint32_t mid = (lo + hi) / 2;
+    if((intptr_t)m->table[2*mid] <= (intptr_t)rel)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(!lo)
+    return pack_rule(RULE_NONE, 0, 0, 0);
+  fde = m->hdr + m->table[2*(lo-1) + 1];
+
+  p = fde;
+  len = *(const uint32_t*)p;
+  p += 4;
+  if(len == 0xffffffff){
+    len = *(const uint64_t*)p;
+    p += 8;
+  }
+  end = p + len;
+  if(!parse_cie(p - *(const uint32_t*)p, &cie))
+    return pack_rule(RULE_NONE, 0, 0, 0);
+  p += 4;
+  if(!read_encoded(&p, end, cie.fde_enc, &pc_begin) || !read_encoded(&p, end, cie.fde_enc & 0x0f, &pc_range))
+    return pack_rule(RULE_NONE, 0, 0, 0);
+  if(pc < pc_begin || pc >= pc_begin + pc_range)
+    return pack_rule(RULE_NONE, 0, 0, 0);
+  if(cie.has_aug_data){
+    len = read_uleb(&p, end);
+    p += len;
+  }
+
+  memset(&s, 0, sizeof(s));
+  s.cfa_reg = DW_RSP;
+  s.ra_how = REG_UNDEF;
+  if(!run_cfa(cie.insns, cie.end, &cie, NULL, pc_begin, ~(uintptr_t)0, &s))
+    return pack_rule(RULE_NONE, 0, 0, 0);
+  initial = s;
+  if(!run_cfa(p, end, &cie, &initial, pc_begin, pc, &s))
+    return pack_rule(RULE_NONE, 0, 0, 0);
+
+  if(s.ra_how == REG_UNDEF)
+    return pack_rule(RULE_END, 0, 0, 0);  //the outermost frame, _start or a thread's start
+  if((s.cfa_reg != DW_RSP && s.cfa_reg != DW_RBP) || s.ra_how != REG_OFFSET || s.cfa_off != (int32_t)s.cfa_off)
+    return pack_rule(RULE_NONE, 0, 0, 0);
+  ra_words = s.ra_off / 8;
+  fp_words = s.fp_how == REG_SAME ? FP_UNCHANGED : s.fp_how == REG_OFFSET ? s.fp_off / 8 : FP_LOST;
+  if(ra_words <= -2048 || ra_words > 2047 || (s.fp_how == REG_OFFSET && (fp_words <= -2048 || fp_words > 2047 || !fp_words)))
+    return pack_rule(RULE_NONE, 0, 0, 0);
+  return pack_rule(s.cfa_reg == DW_RSP ? RULE_CFA_SP : RULE_CFA_FP, (int32_t)s.cfa_off, (int)ra_words, (int)fp_words);
+}
+
+static int walk_cfi(struct regs* r, int exact_pc, int may_refresh, void** addrs, int max_frames)
+{
+  struct bounds b;
+  uintptr_t pc = r->pc, sp = r->sp, fp = r->fp;
+  int n = 1;
+  init_bounds(&b);
+  while(n < max_frames){
+    // a return address is just past the call, which can be the last instruction of a function
+    uintptr_t key = exact_pc ? pc : pc - 1, cfa, ra, next_fp = fp;
+    uint64_t rule;
+
+    if(pc == restorer && restorer){
+      if(!step_signal(&b, sp, r))
+        break;
+      pc = r->pc;
+      sp = r->sp;
+      fp = r->fp;
+      addrs[n++] = (void*)pc;
+      exact_pc = 1;
+      continue;
+    }
+    if(!cached_rule(key, &rule)){
+      const struct cfi_module* m = find_module(key);
+      if(!m && may_refresh){
+        unwind_refresh();
+        may_refresh = 0;
+        m = find_module(key);
+      }
+      rule = m ? compute_rule(m, key) : pack_rule(RULE_NONE, 0, 0, 0);
+      if(m)
+        cache_rule(key, rule);
+    }
+
+    switch(rule_kind(rule)){
+    case RULE_END:
+      return n;
+    case RULE_CFA_SP:
+    case RULE_CFA_FP:
+      cfa = (rule_kind(rule) == RULE_CFA_SP ? sp : fp) + rule_cfa_off(rule);
+      if(!load(&b, cfa + rule_ra_words(rule) * 8, &ra))
+        return n;
+      if(rule_fp_words(rule) == FP_LOST)
+        next_fp = 0;
+      else if(rule_fp_words(rule) != FP_UNCHANGED && !load(&b, cfa + rule_fp_words(rule) * 8, &next_fp))
+        return n;
+      break;
+    default:
+      // no CFI for this pc, hope it keeps a frame pointer
+      if(!load(&b, fp + 8, &ra) || !load(&b, fp, &next_fp))
+        return n;
+      cfa = fp + 16;
+      break;
+    }
+    if(!ra || cfa <= sp)
+      break;
+    pc = ra;
+    sp = cfa;
+    fp = next_fp;
+    exact_pc = 0;
+    addrs[n++] = (void*)ra;
+  }
+  return n;
+}
+
+__attribute__((noinline)) int unwind_cfi(void** addrs, int max_frames)
+{
+  struct regs r;
+  uintptr_t* frame = (uintptr_t*)__builtin_frame_address(0);
+  if(max_frames <= 0)
+    return 0;
+  unwind_thread_init();
+  unwind_refresh();
+  // the caller's registers as they will be when this returns
+  r.pc = (uintptr_t)__builtin_return_address(0);
+  r.sp = (uintptr_t)(frame + 2);
+  r.fp = frame[0];
+  addrs[0] = (void*)r.pc;
+  return walk_cfi(&r, 0, 1, addrs, max_frames);
+}
+
+int unwind_cfi_context(const void* ucontext, void** addrs, int max_frames)
+{
+  struct regs r;
+  if(max_frames <= 0)
+    return 0;
+  regs_from_context(ucontext, &r);
+  addrs[0] = (void*)r.pc;
+  return walk_cfi(&r, 1, 0, addrs, max_frames);
+}
+
+#else
+
+void unwind_refresh()
+{
+}
+
+__attribute__((noinline)) int unwind_cfi(void** addrs, int max_frames)
+{
+  struct regs r;
+  if(max_frames <= 0)
+    return 0;
+  unwind_thread_init();
+  r.fp = (uintptr_t)__builtin_frame_address(0);
+  return walk_fp(&r, 0, addrs, max_frames);
+}
+
+int unwind_cfi_context(const void* ucontext, void** addrs, int max_frames)
+{
+  return unwind_fp_context(ucontext, addrs, max_frames);
+}
+
+#endif
+
+__attribute__((constructor)) static void unwind_init()
+{
+  // the main thread's bounds come from /proc/self/maps, which isn't something to read later
+  unwind_thread_init();
+  if(pipe2(probe_pipe, O_CLOEXEC | O_NONBLOCK))
+    probe_pipe[0] = probe_pipe[1] = -1;  //then only the stack is trusted
+  find_restorer();
+  unwind_refresh();
+}
@@ -0,0 +1,52 @@
+// Stack unwinders that are cheap enough for sampling, as alternatives to glibc backtrace()
+// Author: Paul Foster
+// Public domain
+//
+// backtrace() goes through libgcc's generic unwinder, which searches and decodes .eh_frame for
+// every frame of every call. There are two replacements with the same signature:
+//
+//   unwind_fp()   follows the frame pointer chain. A few loads per frame, but every function on
+//                 the stack has to keep its frame pointer (-fno-omit-frame-pointer, and libc
+//                 usually doesn't), or its caller is skipped.
+//   unwind_cfi()  runs the .eh_frame CFI like backtrace() does, so it works on normal -O2 code.
+//                 Each module's .eh_frame_hdr search table is found once and kept, and the rule
+//                 for each pc is cached, so a frame seen before is a hash lookup and two loads.
+//                 x86_64 only, elsewhere it is unwind_fp().
+//
+//   stack_dump_set_unwinder(unwind_cfi);   //for the assert handler and lockprof
+//
+// Both check every load against the thread's stack before making it, and on x86_64 both step
+// through signal frames, so the interrupted pc shows up when they run in a signal handler. The
+// _context versions start from the ucontext a SA_SIGINFO handler gets instead, with the
+// interrupted pc first, and neither allocate nor take a lock, so they are the ones for sampling.
+// The others look the modules up again when a pc isn't in a known one. The _context versions
+// can't (dl_iterate_phdr isn't async-signal-safe), so call unwind_refresh() after a dlopen or
+// dlclose if you unwind from signal handlers.
+//
+// linux, compile with: gcc -c unwind.c (bench_unwind.c compares them)
+
+#ifndef P_UNWIND_H
+#define P_UNWIND_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same as backtrace(): return addresses, the first one in the caller's own function
+int unwind_fp(void** addrs, int max_frames);
+int unwind_cfi(void** addrs, int max_frames);
+
+// From a signal handler's ucontext_t. The first address is the interrupted pc.
+int unwind_fp_context(const void* ucontext, void** addrs, int max_frames);
+int unwind_cfi_context(const void* ucontext, void** addrs, int max_frames);
+
+// Records the calling thread's stack bounds so the checks don't need a syscall per new page.
+// Done automatically for the main thread and by the non-context functions.
+void unwind_thread_init();
+
+// Reloads the module list, and drops cached rules
+void unwind_refresh();
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_UNWIND_H
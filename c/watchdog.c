@@ -0,0 +1,256 @@
+// Stall watchdog, see watchdog.h
+// Author: Paul Foster
+// Public domain
+//
+// linux, compile with: gcc -c watchdog.c
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "watchdog.h"
+#include "stack_dump_on_assert.h"
+#include "time.h"
+
+#define MAX_FRAMES 64
+#define CAPTURE_TIMEOUT_MS 100
+#define DEDUP_SLOTS 64
+#define MINUTE_NS 60000000000ull
+
+// Stacks logged recently, so the same stall every few seconds doesn't flood the log
+struct seen_stack
+{
+  uint64_t hash;
+  uint64_t last_full;  //nanotime() of the last full report
+  uint64_t since;      //reports suppressed since then
+};
+
+static struct {
+  pthread_t               thread;
+  int                     running;
+  uint64_t                interval_ns;
+  FILE*                   out;
+  struct watchdog_worker* workers;
+  struct seen_stack       seen[DEDUP_SLOTS];
+  uint64_t                window_start;    //the rate limit's current minute
+  unsigned int            window_reports;
+  uint64_t                reports, suppressed;
+} wd;
+static pthread_mutex_t wd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct watchdog_worker* watchdog_register(const char* name, uint64_t deadline_ns)
+{
+  struct watchdog_worker* w;
+  if(posix_memalign((void**)&w, 64, sizeof(*w)))
+    return NULL;
+  memset(w, 0, sizeof(*w));
+  w->name = name;
+  w->tid = (int)syscall(SYS_gettid);
+  w->deadline_ns = deadline_ns;
+  w->last_change = nanotime();
+
+  pthread_mutex_lock(&wd_lock);
+  w->next = wd.workers;
+  wd.workers = w;
+  pthread_mutex_unlock(&wd_lock);
+  return w;
+}
+
+void watchdog_unregister(struct watchdog_worker* w)
+{
+  struct watchdog_worker** p;
+  if(!w)
+    return;
+  pthread_mutex_lock(&wd_lock);
+  for(p = &wd.workers; *p; p = &(*p)->next){
+    if(*p == w){
+      *p = w->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&wd_lock);
+  free(w);
+}
+
+static uint64_t hash_stack(void* const* frames, int n)
+{
+  uint64_t h = 14695981039346656037ull;
+  int i;
+  for(i = 0; i < n; i++)
+    h = (h ^ (uintptr_t)frames[i]) * 1099511628211ull;
+  return h;
+}
+
+enum { REPORT_FULL, REPORT_SAME, REPORT_CAPPED };
+
+// Whether this stack gets a full report, or why not. Called with wd_lock held.
+static int should_report(uint64_t hash, uint64_t now, uint64_t* suppressed_before)
+{
+  struct seen_stack* s = NULL;
+  int i;
+
+  for(i = 0; i < DEDUP_SLOTS && !s; i++)
+    if(wd.seen[i].hash == hash && wd.seen[i].last_full)
+      s = &wd.seen[i];
+  if(s && now - s->last_full < MINUTE_NS){
+    s->since++;
+    return REPORT_SAME;
+  }
+  if(now - wd.window_start >= MINUTE_NS){
+    wd.window_start = now;
+    wd.window_reports = 0;
+  }
+  if(wd.window_reports >= WATCHDOG_REPORTS_PER_MINUTE)
+    return REPORT_CAPPED;
+  wd.window_reports++;
+
+  if(!s){
+    // replace whichever was reported longest ago
+    s = &wd.seen[0];
+    for(i = 1; i < DEDUP_SLOTS; i++)
+      if(wd.seen[i].last_full < s->last_full)
+        s = &wd.seen[i];
+    s->hash = hash;
+    s->since = 0;
+  }
+  *suppressed_before = s->since;
+  s->last_full = now;
+  s->since = 0;
+  return REPORT_FULL;
+}
+
+// What check() found, copied out so the capture and the printing happen without wd_lock
+struct stall_event
+{
+  int      moving;       //recovered rather than stalled
+  int      tid;
+  char     name[32];
+  double   ms;
+  uint64_t deadline_ns;
+};
+
+static void report_stall(const struct stall_event* e, uint64_t now)
+{
+  void* frames[MAX_FRAMES];
+  uint64_t hash, suppressed_before = 0;
+  int n = stack_dump_thread(e->tid, frames, MAX_FRAMES, CAPTURE_TIMEOUT_MS), verdict;
+
+  // a thread that didn't answer is deduplicated by its tid, as if that was its stack
+  hash = n > 0 ? hash_stack(frames, n) : ~(uint64_t)e->tid;
+  pthread_mutex_lock(&wd_lock);
+  verdict = should_report(hash, now, &suppressed_before);
+  if(verdict == REPORT_FULL)
+    wd.reports++;
+  else
+    wd.suppressed++;
+  pthread_mutex_unlock(&wd_lock);
+
+  fprintf(wd.out, "watchdog: thread %d (%s) stalled for %.1f ms", e->tid, e->name, e->ms);
+  if(verdict == REPORT_SAME){
+    fprintf(wd.out, n > 0 ? ", same stack as reported before\n" : ", no stack again\n");
+    return;
+  }
+  if(verdict == REPORT_CAPPED){
+    fprintf(wd.out, ", %s not shown, over %d reports this minute\n", n > 0 ? "stack" : "report", WATCHDOG_REPORTS_PER_MINUTE);
+    return;
+  }
+  if(n <= 0)
+    fprintf(wd.out, ", no stack (it didn't answer the signal)");
+  else
+    fprintf(wd.out, ", deadline %.1f ms", e->deadline_ns / 1e6);
+  if(suppressed_before)
+    fprintf(wd.out, " (%llu more times since this %s last shown)", (unsigned long long)suppressed_before,
+            n > 0 ? "stack was" : "was");
+  fprintf(wd.out, "\n");
+  if(n > 0)
+    stack_dump_print(wd.out, frames, n);
+}
+
+#define MAX_EVENTS 32   //per check, the workers past them are looked at in the next one
+
+static void check(uint64_t now)
+{
+  struct watchdog_worker* w;
+  struct stall_event events[MAX_EVENTS];
+  int n = 0, i;
+
+  pthread_mutex_lock(&wd_lock);
+  for(w = wd.workers; w && n < MAX_EVENTS; w = w->next){
+    uint64_t beats = __atomic_load_n(&w->beats, __ATOMIC_RELAXED);
+    int moving = beats != w->seen_beats || (beats & 1);
+    if(moving ? w->stalled && beats != w->seen_beats : !w->stalled && now - w->last_change > w->deadline_ns){
+      events[n].moving = moving;
+      events[n].tid = w->tid;
+      snprintf(events[n].name, sizeof(events[n].name), "%s", w->name);
+      events[n].ms = (now - w->last_change) / 1e6;
+      events[n].deadline_ns = w->deadline_ns;
+      n++;
+    }
+    if(moving){
+      w->seen_beats = beats;
+      w->last_change = now;
+      w->stalled = 0;
+    } else if(now - w->last_change > w->deadline_ns)
+      w->stalled = 1;
+  }
+  pthread_mutex_unlock(&wd_lock);
+
+  // a worker may unregister meanwhile, then its capture just times out
+  for(i = 0; i < n; i++){
+    if(events[i].moving)
+      fprintf(wd.out, "watchdog: thread %d (%s) moving again after %.1f ms\n", events[i].tid, events[i].name, events[i].ms);
+    else
+      report_stall(&events[i], now);
+  }
+  fflush(wd.out);
+}
+
+static void* monitor_main(void* arg)
+{
+  (void)arg;
+  while(__atomic_load_n(&wd.running, __ATOMIC_ACQUIRE)){
+    struct timespec ts = { (time_t)(wd.interval_ns / 1000000000u), (long)(wd.interval_ns % 1000000000u) };
+    nanosleep(&ts, NULL);
+    check(nanotime());
+  }
+  return NULL;
+}
+
+int watchdog_start(uint64_t interval_ns, FILE* out)
+{
+  if(__atomic_load_n(&wd.running, __ATOMIC_ACQUIRE))
+    return -1;
+  wd.interval_ns = interval_ns;
+  wd.out = out ? out : stderr;
+  wd.window_start = nanotime();
+  __atomic_store_n(&wd.running, 1, __ATOMIC_RELEASE);
+  if(pthread_create(&wd.thread, NULL, monitor_main, NULL)){
+    wd.running = 0;
+    return -1;
+  }
+  return 0;
+}
+
+void watchdog_stop()
+{
+  if(!__atomic_load_n(&wd.running, __ATOMIC_ACQUIRE))
+    return;
+  __atomic_store_n(&wd.running, 0, __ATOMIC_RELEASE);
+  pthread_join(wd.thread, NULL);
+}
+
+uint64_t watchdog_reports()
+{
+  return wd.reports;
+}
+
+uint64_t watchdog_suppressed()
+{
+  return wd.suppressed;
+}
@@ -0,0 +1,85 @@
+// Stall watchdog: logs the stack of any worker thread that stops making progress
+// Author: Paul Foster
+// Public domain
+//
+// Usage:
+//   watchdog_start(10000000, stderr);       //check every 10ms
+//
+//   void* worker(void* arg){
+//     struct watchdog_worker* w = watchdog_register("decoder", 50000000);   //50ms deadline
+//     while(running){
+//       watchdog_beat(w);                    //once per loop iteration
+//       ...
+//     }
+//     watchdog_unregister(w);
+//   }
+//
+// A beat is one relaxed store to a cache line only that worker writes, no clock read, no
+// fence. The monitor thread notices when each count last changed, so a stall is measured on its
+// side, to within one check interval. When a worker has been silent for longer than its deadline
+// its stack is captured through stack_dump_thread() and logged with how long it has been stuck,
+// and again with the total when it recovers. The same stall stack is only logged in full once
+// a minute, and at most WATCHDOG_REPORTS_PER_MINUTE full reports go out in total; the rest are
+// counted and reported as one line each, which says which of the two it was. A worker that
+// doesn't answer the signal is limited the same way, as if it had a stack of its own. The stacks
+// are captured and printed without the monitor's lock, so registering isn't held up by them.
+//
+// Call watchdog_pause(w) before a worker legitimately waits (for work, say) and watchdog_beat()
+// resumes it.
+// Link with stack_dump_on_assert.c elfsym.c unwind.c time.c and -lpthread
+
+#ifndef P_WATCHDOG_H
+#define P_WATCHDOG_H
+#include <stdint.h>
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef WATCHDOG_REPORTS_PER_MINUTE
+#define WATCHDOG_REPORTS_PER_MINUTE 10
+#endif
+
+struct watchdog_worker
+{
+  // written only by the worker, the low bit is set while paused
+  uint64_t beats __attribute__((aligned(64)));
+
+  // the monitor's, under its lock
+  struct watchdog_worker* next __attribute__((aligned(64)));
+  const char* name;
+  int         tid;
+  uint64_t    deadline_ns;
+  uint64_t    seen_beats;
+  uint64_t    last_change;     //nanotime() the monitor saw beats move
+  int         stalled;
+};
+
+// Registers the calling thread, which must beat at least every deadline_ns. The name must live
+// as long as the registration.
+struct watchdog_worker* watchdog_register(const char* name, uint64_t deadline_ns);
+void watchdog_unregister(struct watchdog_worker* w);
+
+static inline void watchdog_beat(struct watchdog_worker* w)
+{
+  __atomic_store_n(&w->beats, (__atomic_load_n(&w->beats, __ATOMIC_RELAXED) | 1) + 1, __ATOMIC_RELAXED);
+}
+
+// Until the next beat this worker is not expected to make progress
+static inline void watchdog_pause(struct watchdog_worker* w)
+{
+  __atomic_store_n(&w->beats, __atomic_load_n(&w->beats, __ATOMIC_RELAXED) | 1, __ATOMIC_RELAXED);
+}
+
+// Starts the monitor thread, which checks every interval_ns and writes reports to out
+int  watchdog_start(uint64_t interval_ns, FILE* out);
+void watchdog_stop();
+
+// Full reports written, and reports cut down to one line by the dedup or the rate limit
+uint64_t watchdog_reports();
+uint64_t watchdog_suppressed();
+
+#ifdef __cplusplus
+}
+#endif
+#endif //P_WATCHDOG_H